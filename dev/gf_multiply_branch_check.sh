@@ -9,7 +9,16 @@ fi
 
 g++ -std=c++17 -O2 -mpclmul -mssse3 -I./include -DGF_MUL_VERIFY -c ./src/aes.cpp -o /tmp/aes.o
 # Fail if any branch instructions appear in GF_Multiply
-if objdump -d /tmp/aes.o | sed -n '/GF_Multiply/,/GHASH/p' | grep -E '[[:space:]]j'; then
+# (the function body runs from its symbol line to the next blank line)
+if objdump -d /tmp/aes.o | sed -n '/<[^>]*GF_Multiply[^>]*>:$/,/^$/p' | grep -E '[[:space:]]j'; then
   echo "Error: branch instructions detected in GF_Multiply"
   exit 1
 fi
+
+# The portable ctmul64 path must be branch-free as well. Build it without
+# inlining or tail calls so each helper keeps its own symbol.
+g++ -std=c++17 -O2 -fno-inline -fno-optimize-sibling-calls -I./include -c ./src/aes.cpp -o /tmp/aes_ct64.o
+if objdump -d /tmp/aes_ct64.o | sed -n '/<[^>]*\(ghash_mul_ct64\|ghash_mul_acc_ct64\|ghash_reduce_ct64\|ghash_fold\|ghash_bmul64\|ghash_rev64\|ghash_factor\)[^>]*>:$/,/^$/p' | grep -E '[[:space:]]j'; then
+  echo "Error: branch instructions detected in the ctmul64 GHASH"
+  exit 1
+fi
@@ -2,9 +2,11 @@
 #define __AESCPP_AES_HPP_
 
 #include <array>
+#include <atomic>
 #include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <memory>
 #if __cplusplus >= 201703L
@@ -20,6 +22,9 @@ using AESCPP_SHARED_LOCK = std::unique_lock<M>;
 #endif
 #include <stdexcept>
 #include <string>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
 #include <vector>
 
 #if __cplusplus >= 201703L
@@ -50,6 +55,187 @@ void secure_zero(void *p, size_t n);
 /// \brief Supported AES key lengths.
 enum class AESKeyLength { AES_128, AES_192, AES_256 };
 
+/// \brief Block cipher and GHASH implementations.
+enum class Backend {
+  Auto,      ///< Fastest implementation the CPU supports.
+  Software,  ///< Portable constant-time bitsliced AES and software GHASH.
+  AESNI,     ///< AES-NI, with PCLMULQDQ for GHASH when the CPU has it.
+  ARMv8      ///< ARMv8 Crypto Extensions, with PMULL for GHASH when present.
+};
+
+/// \brief Select the implementation used by all AES objects, e.g. to
+/// benchmark the software path on a CPU with AES-NI.
+///
+/// The choice is made once per process from CPUID, or from the
+/// `AESCPP_BACKEND=software` environment variable, and can be changed at any
+/// time with this function. Keys expanded under one backend remain valid
+/// under the other.
+/// \param backend Implementation to use; Backend::Auto restores the default.
+/// \throws std::invalid_argument If the CPU or build lacks the backend.
+void set_backend(Backend backend);
+
+/// \brief Implementation currently in use; never Backend::Auto.
+Backend active_backend();
+
+/// \brief Writable view of contiguous bytes owned by the caller.
+///
+/// Output counterpart of ByteSpan.
+class MutableByteSpan {
+ public:
+  /// \brief Empty view.
+  MutableByteSpan() noexcept = default;
+
+  /// \brief View \p size bytes starting at \p data.
+  MutableByteSpan(unsigned char *data, size_t size) noexcept
+      : ptr(data), len(size) {}
+
+  /// \brief View the contents of \p v.
+  MutableByteSpan(std::vector<unsigned char> &v) noexcept
+      : ptr(v.data()), len(v.size()) {}
+
+  /// \brief View the contents of \p a.
+  template <size_t N>
+  MutableByteSpan(std::array<unsigned char, N> &a) noexcept
+      : ptr(a.data()), len(N) {}
+
+  /// \brief View the array \p a.
+  template <size_t N>
+  MutableByteSpan(unsigned char (&a)[N]) noexcept : ptr(a), len(N) {}
+
+  unsigned char *data() const noexcept { return ptr; }
+  size_t size() const noexcept { return len; }
+  bool empty() const noexcept { return len == 0; }
+
+ private:
+  unsigned char *ptr = nullptr;
+  size_t len = 0;
+};
+
+/// \brief Read-only view of contiguous bytes, a C++11 stand-in for
+/// `std::span<const unsigned char>`.
+///
+/// It converts implicitly from a pointer and length, `std::vector`,
+/// `std::array`, byte arrays, `std::string` and, in C++17, `std::string_view`,
+/// so buffers are passed without first being copied into a vector. The view
+/// does not own the bytes and must not outlive them.
+class ByteSpan {
+ public:
+  /// \brief Empty view.
+  ByteSpan() noexcept = default;
+
+  /// \brief View \p size bytes starting at \p data.
+  ByteSpan(const unsigned char *data, size_t size) noexcept
+      : ptr(data), len(size) {}
+
+  /// \brief View \p size characters starting at \p data as bytes.
+  ByteSpan(const char *data, size_t size) noexcept
+      : ptr(reinterpret_cast<const unsigned char *>(data)), len(size) {}
+
+  /// \brief View the contents of \p v.
+  ByteSpan(const std::vector<unsigned char> &v) noexcept
+      : ptr(v.data()), len(v.size()) {}
+
+  /// \brief View the contents of \p a.
+  template <size_t N>
+  ByteSpan(const std::array<unsigned char, N> &a) noexcept
+      : ptr(a.data()), len(N) {}
+
+  /// \brief View the array \p a.
+  template <size_t N>
+  ByteSpan(const unsigned char (&a)[N]) noexcept : ptr(a), len(N) {}
+
+  /// \brief View the characters of \p s as bytes.
+  ByteSpan(const std::string &s) noexcept : ByteSpan(s.data(), s.size()) {}
+
+#if __cplusplus >= 201703L
+  /// \brief View the characters of \p s as bytes.
+  ByteSpan(std::string_view s) noexcept : ByteSpan(s.data(), s.size()) {}
+#endif
+
+  /// \brief Read-only view of \p s.
+  ByteSpan(MutableByteSpan s) noexcept : ptr(s.data()), len(s.size()) {}
+
+  const unsigned char *data() const noexcept { return ptr; }
+  size_t size() const noexcept { return len; }
+  bool empty() const noexcept { return len == 0; }
+
+ private:
+  const unsigned char *ptr = nullptr;
+  size_t len = 0;
+};
+
+class AesKey;
+class GcmKey;
+class XtsKey;
+namespace detail {
+class GcmStream;
+class ModeStream;
+}  // namespace detail
+namespace utils {
+class CtrDrbg;
+}  // namespace utils
+
+/// \brief Worker threads shared by the parallel mode overloads.
+///
+/// A parallel call splits its buffer into ranges, runs the first on the
+/// calling thread, queues the others to the pool and waits for them. While it
+/// waits the caller runs queued ranges itself, so one pool can serve several
+/// threads at once, including calls made from inside a worker.
+class ThreadPool {
+ public:
+  /// \brief Start \p threads worker threads.
+  /// \throws std::system_error If a thread cannot be started.
+  explicit ThreadPool(size_t threads);
+
+  /// \brief Finish the queued work and join the workers.
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /// \brief Number of worker threads, not counting callers.
+  size_t size() const noexcept;
+
+ private:
+  friend class AES;
+
+  // Call task(0) .. task(count - 1), task(0) on the calling thread, and return
+  // once all of them have finished. If tasks throw, the first exception is
+  // rethrown after the others have finished.
+  void Run(size_t count, const std::function<void(size_t)> &task);
+
+  struct State;
+  std::unique_ptr<State> state;
+};
+
+/// \brief How a parallel mode call spreads its buffer over threads.
+///
+/// \code
+/// aes_cpp::ThreadPool pool(15);
+/// aes.EncryptCTR(in, inLen, key, iv, out, aes_cpp::Parallelism(pool));
+/// aes.EncryptCTR(in, inLen, key, iv, out, aes_cpp::Parallelism(8));
+/// \endcode
+struct Parallelism {
+  /// \brief Default for minBytesPerThread.
+  static constexpr size_t defaultMinBytesPerThread = 256 * 1024;
+
+  /// \brief Start threads for the call itself.
+  /// \param threads Threads to use, including the caller; 0 picks
+  /// std::thread::hardware_concurrency().
+  explicit Parallelism(size_t threads = 0) : threads(threads) {}
+
+  /// \brief Run on the workers of \p pool plus the calling thread.
+  explicit Parallelism(ThreadPool &pool) : pool(&pool) {}
+
+  /// \brief Threads to use, including the caller; 0 means all available.
+  size_t threads = 0;
+  /// \brief Pool to run on instead of starting threads; may be nullptr.
+  ThreadPool *pool = nullptr;
+  /// \brief Smallest range worth a thread of its own. Shorter buffers use
+  /// fewer threads and run on the caller alone below twice this size.
+  size_t minBytesPerThread = defaultMinBytesPerThread;
+};
+
 /// \brief AES cipher implementation with multiple block modes.
 ///
 /// Example usage:
@@ -59,18 +245,39 @@ enum class AESKeyLength { AES_128, AES_192, AES_256 };
 /// \endcode
 class AES {
  public:
+  /// \brief Default number of expanded key schedules kept per object.
+  static constexpr size_t defaultCacheCapacity = 16;
+
+  /// \brief Key schedule cache counters, see cache_stats().
+  struct CacheStats {
+    uint64_t hits;       ///< Lookups served from the cache.
+    uint64_t misses;     ///< Lookups that expanded the key.
+    uint64_t evictions;  ///< Schedules zeroized to make room for another key.
+    size_t size;         ///< Schedules currently cached.
+    size_t capacity;     ///< Maximum number of cached schedules.
+  };
+
   /// \brief Construct an AES object.
   /// \param keyLength Desired key length variant.
   explicit AES(const AESKeyLength keyLength = AESKeyLength::AES_256);
 
+  /// \brief Construct an AES object with a custom key cache size.
+  /// \param keyLength Desired key length variant.
+  /// \param cacheCapacity Number of expanded key schedules to keep; 0
+  /// disables the cache so every raw-key call expands its key.
+  AES(const AESKeyLength keyLength, size_t cacheCapacity);
+
   /// \brief Destroy the AES object and securely clear cached keys.
   ~AES();
 
   /// \brief Securely erase cached key material.
   /// \note Call after sensitive operations to remove residual keys. The
-  ///       destructor invokes this automatically.
+  ///       destructor invokes this automatically. Counters are kept.
   void clear_cache();
 
+  /// \brief Snapshot of the key schedule cache counters.
+  CacheStats cache_stats() const;
+
   /// \brief Encrypt data using ECB mode.
   /// \warning ECB mode leaks plaintext patterns and should not be used for new
   ///          code. Prefer an authenticated mode like GCM.
@@ -455,6 +662,684 @@ class AES {
                   const unsigned char aad[], size_t aadLen,
                   const unsigned char tag[], unsigned char out[]);
 
+  /// \brief Encrypt data using CBC mode with an expanded key.
+  /// \param in Input buffer.
+  /// \param inLen Length of input in bytes; must be divisible by 16.
+  /// \param key Expanded key; its length must match this object.
+  /// \param iv Initialization vector (16 bytes).
+  /// \param out Output buffer with space for \p inLen bytes of ciphertext.
+  void EncryptCBC(const unsigned char in[], size_t inLen, const AesKey &key,
+                  const unsigned char *iv, unsigned char out[]);
+  /// \brief Decrypt data encrypted with CBC mode using an expanded key.
+  /// \param in Ciphertext buffer.
+  /// \param inLen Length of ciphertext in bytes; must be divisible by 16.
+  /// \param key Expanded key; its length must match this object.
+  /// \param iv Initialization vector used during encryption (16 bytes).
+  /// \param out Output buffer with space for \p inLen bytes of plaintext.
+  void DecryptCBC(const unsigned char in[], size_t inLen, const AesKey &key,
+                  const unsigned char *iv, unsigned char out[]);
+  /// \brief Encrypt data using CFB mode with an expanded key.
+  /// \param in Input buffer.
+  /// \param inLen Length of input in bytes; may be any value.
+  /// \param key Expanded key; its length must match this object.
+  /// \param iv Initialization vector (16 bytes).
+  /// \param out Output buffer with space for \p inLen bytes of ciphertext.
+  void EncryptCFB(const unsigned char in[], size_t inLen, const AesKey &key,
+                  const unsigned char *iv, unsigned char out[]);
+  /// \brief Decrypt data encrypted with CFB mode using an expanded key.
+  /// \param in Ciphertext buffer.
+  /// \param inLen Length of ciphertext in bytes; may be any value.
+  /// \param key Expanded key; its length must match this object.
+  /// \param iv Initialization vector used during encryption (16 bytes).
+  /// \param out Output buffer with space for \p inLen bytes of plaintext.
+  void DecryptCFB(const unsigned char in[], size_t inLen, const AesKey &key,
+                  const unsigned char *iv, unsigned char out[]);
+  /// \brief Encrypt data using CTR mode with an expanded key.
+  /// \param in Input buffer.
+  /// \param inLen Length of input in bytes; may be any value.
+  /// \param key Expanded key; its length must match this object.
+  /// \param iv Initialization vector (16 bytes).
+  /// \param out Output buffer with space for \p inLen bytes of ciphertext.
+  void EncryptCTR(const unsigned char in[], size_t inLen, const AesKey &key,
+                  const unsigned char iv[], unsigned char out[]);
+  /// \brief Decrypt data encrypted with CTR mode using an expanded key.
+  /// \param in Ciphertext buffer.
+  /// \param inLen Length of ciphertext in bytes; may be any value.
+  /// \param key Expanded key; its length must match this object.
+  /// \param iv Initialization vector used during encryption (16 bytes).
+  /// \param out Output buffer with space for \p inLen bytes of plaintext.
+  void DecryptCTR(const unsigned char in[], size_t inLen, const AesKey &key,
+                  const unsigned char iv[], unsigned char out[]);
+  /// \brief Encrypt data using CTR mode, splitting large buffers over
+  /// threads.
+  ///
+  /// Each thread takes a contiguous range of blocks and starts from the
+  /// counter for its first block, carried through all 128 bits, so the output
+  /// is identical to the single-threaded overload.
+  /// \param in Input buffer.
+  /// \param inLen Length of input in bytes; may be any value.
+  /// \param key Expanded key; its length must match this object.
+  /// \param iv Initialization vector (16 bytes).
+  /// \param out Output buffer with space for \p inLen bytes of ciphertext.
+  /// \param parallel Thread count or pool and splitting threshold.
+  /// \throws std::length_error If the counter would wrap around; the blocks
+  /// before the wrap are still produced.
+  void EncryptCTR(const unsigned char in[], size_t inLen, const AesKey &key,
+                  const unsigned char iv[], unsigned char out[],
+                  const Parallelism &parallel);
+  /// \brief Decrypt data encrypted with CTR mode, splitting large buffers
+  /// over threads.
+  /// \param in Ciphertext buffer.
+  /// \param inLen Length of ciphertext in bytes; may be any value.
+  /// \param key Expanded key; its length must match this object.
+  /// \param iv Initialization vector used during encryption (16 bytes).
+  /// \param out Output buffer with space for \p inLen bytes of plaintext.
+  /// \param parallel Thread count or pool and splitting threshold.
+  void DecryptCTR(const unsigned char in[], size_t inLen, const AesKey &key,
+                  const unsigned char iv[], unsigned char out[],
+                  const Parallelism &parallel);
+  /// \brief Encrypt data using GCM mode with an expanded key.
+  /// \param in Input buffer.
+  /// \param inLen Length of input in bytes.
+  /// \param key Expanded key with precomputed GHASH key; its length must match
+  /// this object.
+  /// \param iv 12-byte initialization vector.
+  /// \param aad Additional authenticated data; may be nullptr when \p aadLen is
+  /// 0.
+  /// \param aadLen Length of \p aad in bytes.
+  /// \param tag Output buffer for the 16-byte authentication tag.
+  /// \param out Output buffer with space for \p inLen bytes of ciphertext.
+  /// \throws std::length_error On the same limits as the raw-key overload.
+  void EncryptGCM(const unsigned char in[], size_t inLen, const GcmKey &key,
+                  const unsigned char iv[], const unsigned char aad[],
+                  size_t aadLen, unsigned char tag[], unsigned char out[]);
+  /// \brief Decrypt data encrypted with GCM mode using an expanded key.
+  /// \param in Ciphertext buffer.
+  /// \param inLen Length of ciphertext in bytes.
+  /// \param key Expanded key with precomputed GHASH key; its length must match
+  /// this object.
+  /// \param iv 12-byte initialization vector used during encryption.
+  /// \param aad Additional authenticated data; may be nullptr when \p aadLen is
+  /// 0.
+  /// \param aadLen Length of \p aad in bytes.
+  /// \param tag Expected 16-byte authentication tag.
+  /// \param out Output buffer with space for \p inLen bytes of plaintext.
+  /// \throws std::runtime_error If authentication fails.
+  /// \throws std::length_error On the same limits as the raw-key overload.
+  void DecryptGCM(const unsigned char in[], size_t inLen, const GcmKey &key,
+                  const unsigned char iv[], const unsigned char aad[],
+                  size_t aadLen, const unsigned char tag[],
+                  unsigned char out[]);
+  /// \brief Encrypt data using GCM mode, splitting large buffers over
+  /// threads.
+  ///
+  /// Each thread encrypts a contiguous range and hashes it on its own; the
+  /// partial GHASH values are shifted into place by multiplying with the
+  /// matching power of H and combined, so the tag is the standard GCM tag.
+  /// \param in Input buffer.
+  /// \param inLen Length of input in bytes.
+  /// \param key Expanded key with precomputed GHASH key; its length must match
+  /// this object.
+  /// \param iv 12-byte initialization vector.
+  /// \param aad Additional authenticated data; may be nullptr when \p aadLen is
+  /// 0.
+  /// \param aadLen Length of \p aad in bytes.
+  /// \param tag Output buffer for the 16-byte authentication tag.
+  /// \param out Output buffer with space for \p inLen bytes of ciphertext.
+  /// \param parallel Thread count or pool and splitting threshold.
+  /// \throws std::length_error On the same limits as the raw-key overload.
+  void EncryptGCM(const unsigned char in[], size_t inLen, const GcmKey &key,
+                  const unsigned char iv[], const unsigned char aad[],
+                  size_t aadLen, unsigned char tag[], unsigned char out[],
+                  const Parallelism &parallel);
+  /// \brief Decrypt data encrypted with GCM mode, splitting large buffers
+  /// over threads.
+  /// \param in Ciphertext buffer.
+  /// \param inLen Length of ciphertext in bytes.
+  /// \param key Expanded key with precomputed GHASH key; its length must match
+  /// this object.
+  /// \param iv 12-byte initialization vector used during encryption.
+  /// \param aad Additional authenticated data; may be nullptr when \p aadLen is
+  /// 0.
+  /// \param aadLen Length of \p aad in bytes.
+  /// \param tag Expected 16-byte authentication tag.
+  /// \param out Output buffer with space for \p inLen bytes of plaintext;
+  /// zeroized if authentication fails.
+  /// \param parallel Thread count or pool and splitting threshold.
+  /// \throws std::runtime_error If authentication fails.
+  /// \throws std::length_error On the same limits as the raw-key overload.
+  void DecryptGCM(const unsigned char in[], size_t inLen, const GcmKey &key,
+                  const unsigned char iv[], const unsigned char aad[],
+                  size_t aadLen, const unsigned char tag[],
+                  unsigned char out[], const Parallelism &parallel);
+
+  /// \brief Encrypt data in ECB mode, splitting large buffers over threads.
+  /// \param in Input buffer.
+  /// \param inLen Length of input in bytes; must be divisible by 16.
+  /// \param key Expanded key; its length must match this object.
+  /// \param out Output buffer with space for \p inLen bytes; may be \p in.
+  /// \param parallel Thread count or pool and splitting threshold.
+  AESCPP_DEPRECATED(
+      "ECB mode leaks plaintext patterns; use an authenticated mode like "
+      "GCM") void EncryptECB(const unsigned char in[], size_t inLen,
+                             const AesKey &key, unsigned char out[],
+                             const Parallelism &parallel);
+  /// \brief Decrypt data encrypted with ECB mode, splitting large buffers
+  /// over threads.
+  /// \param in Ciphertext buffer.
+  /// \param inLen Length of ciphertext in bytes; must be divisible by 16.
+  /// \param key Expanded key; its length must match this object.
+  /// \param out Output buffer with space for \p inLen bytes; may be \p in.
+  /// \param parallel Thread count or pool and splitting threshold.
+  AESCPP_DEPRECATED(
+      "ECB mode leaks plaintext patterns; use an authenticated mode like "
+      "GCM") void DecryptECB(const unsigned char in[], size_t inLen,
+                             const AesKey &key, unsigned char out[],
+                             const Parallelism &parallel);
+  /// \brief Decrypt data encrypted with CBC mode, splitting large buffers
+  /// over threads.
+  ///
+  /// CBC decryption has no chain: block i only needs ciphertext blocks i - 1
+  /// and i. Each thread takes a range and starts from the ciphertext block
+  /// in front of it, which is copied beforehand so \p out may alias \p in.
+  /// \param in Ciphertext buffer.
+  /// \param inLen Length of ciphertext in bytes; must be divisible by 16.
+  /// \param key Expanded key; its length must match this object.
+  /// \param iv Initialization vector used during encryption (16 bytes).
+  /// \param out Output buffer with space for \p inLen bytes of plaintext.
+  /// \param parallel Thread count or pool and splitting threshold.
+  void DecryptCBC(const unsigned char in[], size_t inLen, const AesKey &key,
+                  const unsigned char *iv, unsigned char out[],
+                  const Parallelism &parallel);
+  /// \brief Decrypt data encrypted with CFB mode, splitting large buffers
+  /// over threads, in the same way as DecryptCBC.
+  /// \param in Ciphertext buffer.
+  /// \param inLen Length of ciphertext in bytes; may be any value.
+  /// \param key Expanded key; its length must match this object.
+  /// \param iv Initialization vector used during encryption (16 bytes).
+  /// \param out Output buffer with space for \p inLen bytes of plaintext.
+  /// \param parallel Thread count or pool and splitting threshold.
+  void DecryptCFB(const unsigned char in[], size_t inLen, const AesKey &key,
+                  const unsigned char *iv, unsigned char out[],
+                  const Parallelism &parallel);
+
+  /// \brief Encrypt one data unit, e.g. a disk sector, with XTS-AES
+  /// (IEEE 1619, NIST SP 800-38E).
+  ///
+  /// Blocks are independent, so they run through an interleaved multi-block
+  /// kernel like CTR. A partial last block is handled with ciphertext
+  /// stealing, so the ciphertext is exactly as long as the plaintext.
+  /// \param in Input buffer.
+  /// \param inLen Length of the data unit in bytes; at least 16 and at most
+  /// 2^24.
+  /// \param key XTS key pair; its length must match this object.
+  /// \param sector Data unit sequence number, encrypted into the initial
+  /// tweak.
+  /// \param out Output buffer with space for \p inLen bytes of ciphertext;
+  /// may be \p in.
+  /// \throws std::length_error If \p inLen is out of range.
+  void EncryptXTS(const unsigned char in[], size_t inLen, const XtsKey &key,
+                  uint64_t sector, unsigned char out[]);
+  /// \brief Decrypt one data unit encrypted with XTS-AES.
+  /// \param in Ciphertext buffer.
+  /// \param inLen Length of the data unit in bytes; at least 16 and at most
+  /// 2^24.
+  /// \param key XTS key pair; its length must match this object.
+  /// \param sector Data unit sequence number used during encryption.
+  /// \param out Output buffer with space for \p inLen bytes of plaintext; may
+  /// be \p in.
+  /// \throws std::length_error If \p inLen is out of range.
+  void DecryptXTS(const unsigned char in[], size_t inLen, const XtsKey &key,
+                  uint64_t sector, unsigned char out[]);
+  /// \brief Encrypt consecutive data units of \p sectorSize bytes in one
+  /// call, numbered from \p firstSector.
+  ///
+  /// The tweaks of a batch of sectors are encrypted together, so small
+  /// sectors do not pay for a single-block tweak encryption each. The output
+  /// equals EncryptXTS applied to every sector in turn.
+  /// \param in Input buffer.
+  /// \param inLen Length of input in bytes; a multiple of \p sectorSize.
+  /// \param key XTS key pair; its length must match this object.
+  /// \param sectorSize Bytes per data unit, e.g. 512 or 4096; at least 16
+  /// and at most 2^24.
+  /// \param firstSector Sequence number of the first data unit.
+  /// \param out Output buffer with space for \p inLen bytes of ciphertext;
+  /// may be \p in.
+  /// \throws std::length_error If the sizes are invalid or the sector number
+  /// would pass 2^64 - 1.
+  void EncryptXTSSectors(const unsigned char in[], size_t inLen,
+                         const XtsKey &key, size_t sectorSize,
+                         uint64_t firstSector, unsigned char out[]);
+  /// \brief Decrypt consecutive data units encrypted with EncryptXTSSectors.
+  /// \param in Ciphertext buffer.
+  /// \param inLen Length of ciphertext in bytes; a multiple of \p sectorSize.
+  /// \param key XTS key pair; its length must match this object.
+  /// \param sectorSize Bytes per data unit; at least 16 and at most 2^24.
+  /// \param firstSector Sequence number of the first data unit.
+  /// \param out Output buffer with space for \p inLen bytes of plaintext; may
+  /// be \p in.
+  /// \throws std::length_error If the sizes are invalid or the sector number
+  /// would pass 2^64 - 1.
+  void DecryptXTSSectors(const unsigned char in[], size_t inLen,
+                         const XtsKey &key, size_t sectorSize,
+                         uint64_t firstSector, unsigned char out[]);
+  /// \brief Encrypt consecutive data units, splitting the sectors over
+  /// threads.
+  /// \param in Input buffer.
+  /// \param inLen Length of input in bytes; a multiple of \p sectorSize.
+  /// \param key XTS key pair; its length must match this object.
+  /// \param sectorSize Bytes per data unit; at least 16 and at most 2^24.
+  /// \param firstSector Sequence number of the first data unit.
+  /// \param out Output buffer with space for \p inLen bytes of ciphertext;
+  /// may be \p in.
+  /// \param parallel Thread count or pool and splitting threshold.
+  void EncryptXTSSectors(const unsigned char in[], size_t inLen,
+                         const XtsKey &key, size_t sectorSize,
+                         uint64_t firstSector, unsigned char out[],
+                         const Parallelism &parallel);
+  /// \brief Decrypt consecutive data units, splitting the sectors over
+  /// threads.
+  /// \param in Ciphertext buffer.
+  /// \param inLen Length of ciphertext in bytes; a multiple of \p sectorSize.
+  /// \param key XTS key pair; its length must match this object.
+  /// \param sectorSize Bytes per data unit; at least 16 and at most 2^24.
+  /// \param firstSector Sequence number of the first data unit.
+  /// \param out Output buffer with space for \p inLen bytes of plaintext; may
+  /// be \p in.
+  /// \param parallel Thread count or pool and splitting threshold.
+  void DecryptXTSSectors(const unsigned char in[], size_t inLen,
+                         const XtsKey &key, size_t sectorSize,
+                         uint64_t firstSector, unsigned char out[],
+                         const Parallelism &parallel);
+
+  /// \brief Encrypt and authenticate data with CCM mode (NIST SP 800-38C,
+  /// RFC 3610).
+  ///
+  /// The CBC-MAC over the plaintext and the CTR keystream run in one loop,
+  /// with each keystream block computed while the MAC block ahead of it is
+  /// still in flight, so a message costs about as much as its CBC-MAC.
+  /// \param in Input buffer.
+  /// \param inLen Length of input in bytes; below 2^(8 * (15 - \p nonceLen)).
+  /// \param key Expanded key; its length must match this object.
+  /// \param nonce Nonce of \p nonceLen bytes; never reuse one with a key.
+  /// \param nonceLen Nonce length, 7 to 13 bytes.
+  /// \param aad Additional authenticated data; may be nullptr when \p aadLen is
+  /// 0.
+  /// \param aadLen Length of \p aad in bytes.
+  /// \param tag Output buffer for the authentication tag.
+  /// \param tagLen Tag length: 4, 6, 8, 10, 12, 14 or 16 bytes.
+  /// \param out Output buffer with space for \p inLen bytes of ciphertext;
+  /// may be \p in.
+  /// \throws std::invalid_argument If a pointer is null or a length is not
+  /// allowed.
+  /// \throws std::length_error If \p inLen does not fit the length field left
+  /// by the nonce.
+  void EncryptCCM(const unsigned char in[], size_t inLen, const AesKey &key,
+                  const unsigned char nonce[], size_t nonceLen,
+                  const unsigned char aad[], size_t aadLen, unsigned char tag[],
+                  size_t tagLen, unsigned char out[]);
+  /// \brief Decrypt and verify data encrypted with CCM mode.
+  /// \param in Ciphertext buffer.
+  /// \param inLen Length of ciphertext in bytes, without the tag.
+  /// \param key Expanded key; its length must match this object.
+  /// \param nonce Nonce of \p nonceLen bytes used during encryption.
+  /// \param nonceLen Nonce length, 7 to 13 bytes.
+  /// \param aad Additional authenticated data; may be nullptr when \p aadLen is
+  /// 0.
+  /// \param aadLen Length of \p aad in bytes.
+  /// \param tag Expected authentication tag.
+  /// \param tagLen Tag length: 4, 6, 8, 10, 12, 14 or 16 bytes.
+  /// \param out Output buffer with space for \p inLen bytes of plaintext; may
+  /// be \p in.
+  /// \throws std::runtime_error If authentication fails; \p out is zeroed.
+  /// \throws std::invalid_argument If a pointer is null or a length is not
+  /// allowed.
+  /// \throws std::length_error If \p inLen does not fit the length field left
+  /// by the nonce.
+  void DecryptCCM(const unsigned char in[], size_t inLen, const AesKey &key,
+                  const unsigned char nonce[], size_t nonceLen,
+                  const unsigned char aad[], size_t aadLen,
+                  const unsigned char tag[], size_t tagLen,
+                  unsigned char out[]);
+
+  /// \brief Apply the forward block cipher to independent 16-byte blocks.
+  ///
+  /// Raw primitive for building other constructions (tweakable modes, PRFs);
+  /// no mode is applied. Blocks go through the same interleaved multi-block
+  /// kernel as CTR, eight at a time on AES-NI.
+  /// \param in Input blocks.
+  /// \param blocks Number of 16-byte blocks in \p in.
+  /// \param key Expanded key; its length must match this object.
+  /// \param out Output buffer with space for \p blocks * 16 bytes; may be
+  /// \p in, but must not partially overlap it.
+  void EncryptBlocks(const unsigned char in[], size_t blocks, const AesKey &key,
+                     unsigned char out[]);
+  /// \brief Apply the inverse block cipher to independent 16-byte blocks.
+  /// \param in Input blocks.
+  /// \param blocks Number of 16-byte blocks in \p in.
+  /// \param key Expanded key; its length must match this object.
+  /// \param out Output buffer with space for \p blocks * 16 bytes; may be
+  /// \p in, but must not partially overlap it.
+  void DecryptBlocks(const unsigned char in[], size_t blocks, const AesKey &key,
+                     unsigned char out[]);
+
+  /// \brief Apply the forward block cipher to independent 16-byte blocks.
+  /// \param in Input blocks; length must be divisible by 16.
+  /// \param key Expanded key; its length must match this object.
+  /// \return Output blocks of the same length as \p in.
+  AESCPP_NODISCARD std::vector<unsigned char> EncryptBlocks(
+      const std::vector<unsigned char> &in, const AesKey &key);
+
+  /// \brief Apply the inverse block cipher to independent 16-byte blocks.
+  /// \param in Input blocks; length must be divisible by 16.
+  /// \param key Expanded key; its length must match this object.
+  /// \return Output blocks of the same length as \p in.
+  AESCPP_NODISCARD std::vector<unsigned char> DecryptBlocks(
+      const std::vector<unsigned char> &in, const AesKey &key);
+
+  /// \brief Encrypt data in ECB mode with an expanded key.
+  /// \param in Input vector.
+  /// \param key Expanded key; its length must match this object.
+  /// \return Ciphertext of the same length as \p in.
+  AESCPP_NODISCARD AESCPP_DEPRECATED(
+      "ECB mode leaks plaintext patterns; use an authenticated mode like "
+      "GCM") std::vector<unsigned char> EncryptECB(const std::vector<unsigned
+                                                                   char> &in,
+                                                   const AesKey &key);
+
+  /// \brief Decrypt data encrypted with ECB mode using an expanded key.
+  /// \param in Ciphertext vector.
+  /// \param key Expanded key; its length must match this object.
+  /// \return Plaintext of the same length as \p in.
+  AESCPP_NODISCARD AESCPP_DEPRECATED(
+      "ECB mode leaks plaintext patterns; use an authenticated mode like "
+      "GCM") std::vector<unsigned char> DecryptECB(const std::vector<unsigned
+                                                                   char> &in,
+                                                   const AesKey &key);
+
+  /// \brief Encrypt data using CBC mode with an expanded key.
+  /// \param in Input vector.
+  /// \param key Expanded key; its length must match this object.
+  /// \param iv Initialization vector (16 bytes).
+  /// \return Ciphertext of the same length as \p in.
+  AESCPP_NODISCARD std::vector<unsigned char> EncryptCBC(
+      const std::vector<unsigned char> &in, const AesKey &key,
+      const std::vector<unsigned char> &iv);
+
+  /// \brief Decrypt data encrypted with CBC mode using an expanded key.
+  /// \param in Ciphertext vector.
+  /// \param key Expanded key; its length must match this object.
+  /// \param iv Initialization vector used for encryption (16 bytes).
+  /// \return Plaintext of the same length as \p in.
+  AESCPP_NODISCARD std::vector<unsigned char> DecryptCBC(
+      const std::vector<unsigned char> &in, const AesKey &key,
+      const std::vector<unsigned char> &iv);
+
+  /// \brief Encrypt data using CFB mode with an expanded key.
+  /// \param in Input vector.
+  /// \param key Expanded key; its length must match this object.
+  /// \param iv Initialization vector (16 bytes).
+  /// \return Ciphertext of the same length as \p in.
+  AESCPP_NODISCARD std::vector<unsigned char> EncryptCFB(
+      const std::vector<unsigned char> &in, const AesKey &key,
+      const std::vector<unsigned char> &iv);
+
+  /// \brief Decrypt data encrypted with CFB mode using an expanded key.
+  /// \param in Ciphertext vector.
+  /// \param key Expanded key; its length must match this object.
+  /// \param iv Initialization vector used for encryption (16 bytes).
+  /// \return Plaintext of the same length as \p in.
+  AESCPP_NODISCARD std::vector<unsigned char> DecryptCFB(
+      const std::vector<unsigned char> &in, const AesKey &key,
+      const std::vector<unsigned char> &iv);
+
+  /// \brief Encrypt data using CTR mode with an expanded key.
+  /// \param in Input vector.
+  /// \param key Expanded key; its length must match this object.
+  /// \param iv Initialization vector (16 bytes).
+  /// \return Ciphertext of the same length as \p in.
+  AESCPP_NODISCARD std::vector<unsigned char> EncryptCTR(
+      const std::vector<unsigned char> &in, const AesKey &key,
+      const std::vector<unsigned char> &iv);
+
+  /// \brief Decrypt data encrypted with CTR mode using an expanded key.
+  /// \param in Ciphertext vector.
+  /// \param key Expanded key; its length must match this object.
+  /// \param iv Initialization vector used for encryption (16 bytes).
+  /// \return Plaintext of the same length as \p in.
+  AESCPP_NODISCARD std::vector<unsigned char> DecryptCTR(
+      const std::vector<unsigned char> &in, const AesKey &key,
+      const std::vector<unsigned char> &iv);
+
+  /// \brief Encrypt data using GCM mode with an expanded key.
+  /// \param in Input vector.
+  /// \param key Expanded key with precomputed GHASH key.
+  /// \param iv 12-byte initialization vector.
+  /// \param aad Additional authenticated data.
+  /// \param tag Output tag resized to 16 bytes.
+  /// \return Ciphertext of the same length as \p in.
+  AESCPP_NODISCARD std::vector<unsigned char> EncryptGCM(
+      const std::vector<unsigned char> &in, const GcmKey &key,
+      const std::vector<unsigned char> &iv,
+      const std::vector<unsigned char> &aad, std::vector<unsigned char> &tag);
+
+  /// \brief Decrypt data encrypted with GCM mode using an expanded key.
+  /// \param in Ciphertext vector.
+  /// \param key Expanded key with precomputed GHASH key.
+  /// \param iv 12-byte initialization vector used for encryption.
+  /// \param aad Additional authenticated data.
+  /// \param tag Authentication tag to verify.
+  /// \return Plaintext of the same length as \p in.
+  /// \throws std::runtime_error If authentication fails.
+  AESCPP_NODISCARD std::vector<unsigned char> DecryptGCM(
+      const std::vector<unsigned char> &in, const GcmKey &key,
+      const std::vector<unsigned char> &iv,
+      const std::vector<unsigned char> &aad,
+      const std::vector<unsigned char> &tag);
+
+  /// \brief Encrypt \p in into \p out using ECB mode.
+  /// \param in Plaintext; its length must be a multiple of 16.
+  /// \param key Raw key of the length this object was created for.
+  /// \param out Output buffer at least as long as \p in; may alias \p in.
+  /// \throws std::invalid_argument If \p key has the wrong size.
+  /// \throws std::length_error If \p out is too small or \p in is not a
+  /// multiple of 16 bytes.
+  AESCPP_DEPRECATED(
+      "ECB mode leaks plaintext patterns; use an authenticated mode like "
+      "GCM") void EncryptECB(ByteSpan in, ByteSpan key, MutableByteSpan out);
+
+  /// \brief Decrypt \p in into \p out using ECB mode.
+  /// \copydetails EncryptECB(ByteSpan, ByteSpan, MutableByteSpan)
+  AESCPP_DEPRECATED(
+      "ECB mode leaks plaintext patterns; use an authenticated mode like "
+      "GCM") void DecryptECB(ByteSpan in, ByteSpan key, MutableByteSpan out);
+
+  /// \brief Encrypt \p in into \p out using CBC mode.
+  /// \param in Plaintext; its length must be a multiple of 16.
+  /// \param key Raw key of the length this object was created for.
+  /// \param iv 16-byte initialization vector.
+  /// \param out Output buffer at least as long as \p in; may alias \p in.
+  /// \throws std::invalid_argument If \p key or \p iv has the wrong size.
+  /// \throws std::length_error If \p out is too small or \p in is not a
+  /// multiple of 16 bytes.
+  void EncryptCBC(ByteSpan in, ByteSpan key, ByteSpan iv, MutableByteSpan out);
+
+  /// \brief Decrypt \p in into \p out using CBC mode.
+  /// \copydetails EncryptCBC(ByteSpan, ByteSpan, ByteSpan, MutableByteSpan)
+  void DecryptCBC(ByteSpan in, ByteSpan key, ByteSpan iv, MutableByteSpan out);
+
+  /// \brief Encrypt \p in into \p out using CFB mode.
+  /// \param in Plaintext of any length.
+  /// \param key Raw key of the length this object was created for.
+  /// \param iv 16-byte initialization vector.
+  /// \param out Output buffer at least as long as \p in; may alias \p in.
+  /// \throws std::invalid_argument If \p key or \p iv has the wrong size.
+  /// \throws std::length_error If \p out is too small.
+  void EncryptCFB(ByteSpan in, ByteSpan key, ByteSpan iv, MutableByteSpan out);
+
+  /// \brief Decrypt \p in into \p out using CFB mode.
+  /// \copydetails EncryptCFB(ByteSpan, ByteSpan, ByteSpan, MutableByteSpan)
+  void DecryptCFB(ByteSpan in, ByteSpan key, ByteSpan iv, MutableByteSpan out);
+
+  /// \brief Encrypt \p in into \p out using CTR mode.
+  /// \param in Plaintext of any length.
+  /// \param key Raw key of the length this object was created for.
+  /// \param iv 16-byte initial counter block.
+  /// \param out Output buffer at least as long as \p in; may alias \p in.
+  /// \throws std::invalid_argument If \p key or \p iv has the wrong size.
+  /// \throws std::length_error If \p out is too small or the counter would
+  /// wrap around.
+  void EncryptCTR(ByteSpan in, ByteSpan key, ByteSpan iv, MutableByteSpan out);
+
+  /// \brief Decrypt \p in into \p out using CTR mode.
+  /// \copydetails EncryptCTR(ByteSpan, ByteSpan, ByteSpan, MutableByteSpan)
+  void DecryptCTR(ByteSpan in, ByteSpan key, ByteSpan iv, MutableByteSpan out);
+
+  /// \brief Encrypt \p in into \p out using GCM mode.
+  /// \param in Plaintext of any length.
+  /// \param key Raw key of the length this object was created for.
+  /// \param iv 12-byte initialization vector.
+  /// \param aad Additional authenticated data; may be empty.
+  /// \param tag Output buffer for the 16-byte authentication tag.
+  /// \param out Output buffer at least as long as \p in; may alias \p in.
+  /// \throws std::invalid_argument If \p key, \p iv or \p tag has the wrong
+  /// size.
+  /// \throws std::length_error If \p out is too small or the GCM length limits
+  /// are exceeded.
+  void EncryptGCM(ByteSpan in, ByteSpan key, ByteSpan iv, ByteSpan aad,
+                  MutableByteSpan tag, MutableByteSpan out);
+
+  /// \brief Decrypt \p in into \p out using GCM mode and check its tag.
+  /// \param in Ciphertext of any length.
+  /// \param key Raw key of the length this object was created for.
+  /// \param iv 12-byte initialization vector used during encryption.
+  /// \param aad Additional authenticated data used during encryption.
+  /// \param tag Expected 16-byte authentication tag.
+  /// \param out Output buffer at least as long as \p in; may alias \p in.
+  /// \throws std::runtime_error If authentication fails; \p out is zeroed.
+  /// \throws std::invalid_argument If \p key, \p iv or \p tag has the wrong
+  /// size.
+  /// \throws std::length_error If \p out is too small or the GCM length limits
+  /// are exceeded.
+  void DecryptGCM(ByteSpan in, ByteSpan key, ByteSpan iv, ByteSpan aad,
+                  ByteSpan tag, MutableByteSpan out);
+
+  /// \brief Encrypt \p in into \p out using ECB mode with an expanded key.
+  /// \throws std::length_error If \p out is too small or \p in is not a
+  /// multiple of 16 bytes.
+  AESCPP_DEPRECATED(
+      "ECB mode leaks plaintext patterns; use an authenticated mode like "
+      "GCM") void EncryptECB(ByteSpan in, const AesKey &key,
+                             MutableByteSpan out);
+
+  /// \brief Decrypt \p in into \p out using ECB mode with an expanded key.
+  /// \throws std::length_error If \p out is too small or \p in is not a
+  /// multiple of 16 bytes.
+  AESCPP_DEPRECATED(
+      "ECB mode leaks plaintext patterns; use an authenticated mode like "
+      "GCM") void DecryptECB(ByteSpan in, const AesKey &key,
+                             MutableByteSpan out);
+
+  /// \brief Encrypt \p in into \p out using CBC mode with an expanded key.
+  /// \throws std::invalid_argument If \p iv is not 16 bytes.
+  /// \throws std::length_error If \p out is too small or \p in is not a
+  /// multiple of 16 bytes.
+  void EncryptCBC(ByteSpan in, const AesKey &key, ByteSpan iv,
+                  MutableByteSpan out);
+
+  /// \brief Decrypt \p in into \p out using CBC mode with an expanded key.
+  /// \throws std::invalid_argument If \p iv is not 16 bytes.
+  /// \throws std::length_error If \p out is too small or \p in is not a
+  /// multiple of 16 bytes.
+  void DecryptCBC(ByteSpan in, const AesKey &key, ByteSpan iv,
+                  MutableByteSpan out);
+
+  /// \brief Encrypt \p in into \p out using CFB mode with an expanded key.
+  /// \throws std::invalid_argument If \p iv is not 16 bytes.
+  /// \throws std::length_error If \p out is too small.
+  void EncryptCFB(ByteSpan in, const AesKey &key, ByteSpan iv,
+                  MutableByteSpan out);
+
+  /// \brief Decrypt \p in into \p out using CFB mode with an expanded key.
+  /// \throws std::invalid_argument If \p iv is not 16 bytes.
+  /// \throws std::length_error If \p out is too small.
+  void DecryptCFB(ByteSpan in, const AesKey &key, ByteSpan iv,
+                  MutableByteSpan out);
+
+  /// \brief Encrypt \p in into \p out using CTR mode with an expanded key.
+  /// \throws std::invalid_argument If \p iv is not 16 bytes.
+  /// \throws std::length_error If \p out is too small or the counter would
+  /// wrap around.
+  void EncryptCTR(ByteSpan in, const AesKey &key, ByteSpan iv,
+                  MutableByteSpan out);
+
+  /// \brief Decrypt \p in into \p out using CTR mode with an expanded key.
+  /// \throws std::invalid_argument If \p iv is not 16 bytes.
+  /// \throws std::length_error If \p out is too small or the counter would
+  /// wrap around.
+  void DecryptCTR(ByteSpan in, const AesKey &key, ByteSpan iv,
+                  MutableByteSpan out);
+
+  /// \brief Encrypt \p in into \p out using GCM mode with an expanded key.
+  /// \throws std::invalid_argument If \p iv is not 12 bytes or \p tag is not
+  /// 16 bytes.
+  /// \throws std::length_error If \p out is too small or the GCM length limits
+  /// are exceeded.
+  void EncryptGCM(ByteSpan in, const GcmKey &key, ByteSpan iv, ByteSpan aad,
+                  MutableByteSpan tag, MutableByteSpan out);
+
+  /// \brief Decrypt \p in into \p out using GCM mode with an expanded key.
+  /// \throws std::runtime_error If authentication fails; \p out is zeroed.
+  /// \throws std::invalid_argument If \p iv is not 12 bytes or \p tag is not
+  /// 16 bytes.
+  /// \throws std::length_error If \p out is too small or the GCM length limits
+  /// are exceeded.
+  void DecryptGCM(ByteSpan in, const GcmKey &key, ByteSpan iv, ByteSpan aad,
+                  ByteSpan tag, MutableByteSpan out);
+
+  /// \brief Encrypt one data unit \p in into \p out with XTS-AES.
+  /// \throws std::length_error If \p in is shorter than 16 or longer than
+  /// 2^24 bytes, or \p out is too small.
+  void EncryptXTS(ByteSpan in, const XtsKey &key, uint64_t sector,
+                  MutableByteSpan out);
+
+  /// \brief Decrypt one data unit \p in into \p out with XTS-AES.
+  /// \throws std::length_error If \p in is shorter than 16 or longer than
+  /// 2^24 bytes, or \p out is too small.
+  void DecryptXTS(ByteSpan in, const XtsKey &key, uint64_t sector,
+                  MutableByteSpan out);
+
+  /// \brief Encrypt consecutive data units of \p sectorSize bytes.
+  /// \throws std::length_error If the sizes are invalid, \p out is too small
+  /// or the sector number would pass 2^64 - 1.
+  void EncryptXTSSectors(ByteSpan in, const XtsKey &key, size_t sectorSize,
+                         uint64_t firstSector, MutableByteSpan out);
+
+  /// \brief Decrypt consecutive data units of \p sectorSize bytes.
+  /// \throws std::length_error If the sizes are invalid, \p out is too small
+  /// or the sector number would pass 2^64 - 1.
+  void DecryptXTSSectors(ByteSpan in, const XtsKey &key, size_t sectorSize,
+                         uint64_t firstSector, MutableByteSpan out);
+
+  /// \brief Encrypt \p in into \p out using CCM mode. The tag length is
+  /// \p tag.size().
+  /// \throws std::invalid_argument If \p nonce or \p tag has a size CCM does
+  /// not allow.
+  /// \throws std::length_error If \p out is too small or \p in is too long
+  /// for the nonce length.
+  void EncryptCCM(ByteSpan in, const AesKey &key, ByteSpan nonce, ByteSpan aad,
+                  MutableByteSpan tag, MutableByteSpan out);
+
+  /// \brief Decrypt and verify \p in into \p out using CCM mode. The tag
+  /// length is \p tag.size().
+  /// \throws std::runtime_error If authentication fails; \p out is zeroed.
+  /// \throws std::invalid_argument If \p nonce or \p tag has a size CCM does
+  /// not allow.
+  /// \throws std::length_error If \p out is too small or \p in is too long
+  /// for the nonce length.
+  void DecryptCCM(ByteSpan in, const AesKey &key, ByteSpan nonce, ByteSpan aad,
+                  ByteSpan tag, MutableByteSpan out);
+
 #ifdef AESCPP_DEBUG
   /// \brief Print byte array as hexadecimal values.
   /// \param a Array to print.
@@ -473,8 +1358,24 @@ class AES {
 #endif
 
  private:
+  friend class AesKey;
+  friend class GcmKey;
+  friend class detail::GcmStream;
+  friend class detail::ModeStream;
+  friend class utils::CtrDrbg;
+
   static constexpr unsigned int Nb = 4;
   static constexpr unsigned int blockBytesLen = 4 * Nb * sizeof(unsigned char);
+  /// \brief Number of blocks handed to the multi-block kernels at once.
+  static constexpr unsigned int batchBlocks = 8;
+  /// \brief Size of the bitsliced AES-256 schedule, the largest one.
+  static constexpr unsigned int bitslicedKeysMaxLen = 64 * 15;
+  /// \brief Granularity of the ranges handed to threads by the parallel ECB,
+  /// CBC and CFB overloads. Range boundaries are multiples of it from the
+  /// start of the buffer, so each range covers whole eight-block batches; only
+  /// a page-aligned output buffer keeps threads off each other's cache lines
+  /// and pages.
+  static constexpr size_t parallelTileBytes = 4096;
 
   unsigned int Nk;
   unsigned int Nr;
@@ -514,15 +1415,113 @@ class AES {
 
   void CheckLength(size_t len);
 
+  void CheckGCMArgs(size_t inLen, const unsigned char iv[],
+                    const unsigned char aad[], size_t aadLen,
+                    const unsigned char tag[]);
+
+  // Mode bodies shared by the raw-key and expanded-key entry points. Arguments
+  // are already validated.
+  void CBCEncrypt(const unsigned char in[], size_t inLen,
+                  const unsigned char *iv, unsigned char out[],
+                  const unsigned char *roundKeys);
+  void CBCDecrypt(const unsigned char in[], size_t inLen,
+                  const unsigned char *iv, unsigned char out[],
+                  const unsigned char *roundKeys);
+  void CFBEncrypt(const unsigned char in[], size_t inLen,
+                  const unsigned char *iv, unsigned char out[],
+                  const unsigned char *roundKeys);
+  void CFBDecrypt(const unsigned char in[], size_t inLen,
+                  const unsigned char *iv, unsigned char out[],
+                  const unsigned char *roundKeys);
+  void CTRCrypt(const unsigned char in[], size_t inLen,
+                const unsigned char iv[], unsigned char out[],
+                const unsigned char *roundKeys,
+                const Parallelism *parallel = nullptr);
+
+  // CBC (or, with `cfb`, CFB) decryption over ranges run on several threads.
+  // Each range is chained from the ciphertext block in front of it, copied
+  // up front so that `out` may alias `in`.
+  void ChainedDecryptParallel(const unsigned char in[], size_t inLen,
+                              const unsigned char *iv, unsigned char out[],
+                              const unsigned char *roundKeys, bool cfb,
+                              const Parallelism &parallel);
+
+  // Boundaries of `len` bytes split into one range per thread chosen by
+  // `parallel`: 0, then multiples of `align`, then `len`.
+  static std::vector<size_t> ParallelSplit(size_t len, size_t align,
+                                           const Parallelism &parallel);
+
+  // Call task(bounds[i], bounds[i + 1]) for every range, each on its own
+  // thread, and return once all are done. If `task` throws, the first
+  // exception is rethrown after every range has finished.
+  static void RunParallel(const std::vector<size_t> &bounds,
+                          const Parallelism &parallel,
+                          const std::function<void(size_t, size_t)> &task);
+
+  // RunParallel over ParallelSplit(len, align, parallel).
+  static void RunParallel(size_t len, size_t align,
+                          const Parallelism &parallel,
+                          const std::function<void(size_t, size_t)> &task);
+
   void KeyExpansion(const unsigned char key[], unsigned char w[]);
 
+  /// \brief Derive the equivalent inverse cipher schedule.
+  /// \param w Encryption schedule produced by KeyExpansion.
+  /// \param dw Receives 4 * Nb * (Nr + 1) bytes of decryption round keys in
+  /// the order they are applied.
+  void InvKeyExpansion(const unsigned char w[], unsigned char dw[]);
+
+  // Return the cached schedule for `key`: the encryption round keys followed
+  // by the equivalent inverse cipher round keys, 4 * Nb * (Nr + 1) bytes each,
+  // then the bitsliced round keys of the software engine (64 bytes per round)
+  // and a std::atomic<unsigned char> recording whether those were built.
+  //
+  // While the key stays cached, repeated calls are served from this thread's
+  // snapshot of the entry: no shard lock, and the returned handle counts its
+  // references privately, so threads sharing a key do not contend on one
+  // reference count. With a cache capacity of 0 every call expands the key.
   std::shared_ptr<const std::vector<unsigned char>> prepare_round_keys(
       const unsigned char *key);
 
+  // Shard lookup behind prepare_round_keys. Expands and caches the key on a
+  // miss, evicting another key if the shard is full. Reports the entry and
+  // the entry version it was read under.
+  std::shared_ptr<const std::vector<unsigned char>> LookupSchedule(
+      const unsigned char *key, size_t shardIndex, size_t &entryIndex,
+      uint64_t &version);
+
+  // Build a new zeroize-on-release schedule for `key` in the layout returned
+  // by prepare_round_keys.
+  std::shared_ptr<std::vector<unsigned char>> ExpandSchedule(
+      const unsigned char *key);
+
+  // Bitsliced round keys of a schedule from ExpandSchedule. Schedules built
+  // while a hardware backend was active lack them; the first call builds them
+  // into the schedule, so later calls with it reuse them. A call racing with
+  // that build derives them into `scratch` (bitslicedKeysMaxLen bytes), which
+  // the caller must zeroize when it is the returned pointer.
+  const unsigned char *BitslicedKeys(const unsigned char *roundKeys,
+                                     unsigned char scratch[]) const;
+
+  // States of the byte after the bitsliced keys, accessed atomically.
+  static constexpr unsigned char bitslicedAbsent = 0;
+  static constexpr unsigned char bitslicedReady = 1;
+  static constexpr unsigned char bitslicedBuilding = 2;
+
+  // Round keys of `key`; throws if it is empty or of another key length.
+  const unsigned char *CheckedSchedule(const AesKey &key) const;
+
+  // Bytes of a raw key passed as a span; throws if its size does not match.
+  const unsigned char *CheckedKey(ByteSpan key) const;
+
   void EncryptECB(const unsigned char in[], size_t inLen,
                   const unsigned char key[], unsigned char out[]);
   void DecryptECB(const unsigned char in[], size_t inLen,
                   const unsigned char key[], unsigned char out[]);
+  void EncryptECB(const unsigned char in[], size_t inLen, const AesKey &key,
+                  unsigned char out[]);
+  void DecryptECB(const unsigned char in[], size_t inLen, const AesKey &key,
+                  unsigned char out[]);
 
   void EncryptBlock(const unsigned char in[], unsigned char out[],
                     const unsigned char *roundKeys);
@@ -530,6 +1529,68 @@ class AES {
   void DecryptBlock(const unsigned char in[], unsigned char out[],
                     const unsigned char *roundKeys);
 
+  // Encrypt `blocks` independent 16-byte blocks. `in` and `out` may be the same
+  // buffer but must not otherwise overlap.
+  void EncryptBlocks(const unsigned char in[], unsigned char out[],
+                     size_t blocks, const unsigned char *roundKeys);
+
+  // Decrypt `blocks` independent 16-byte blocks. `in` and `out` may be the same
+  // buffer but must not otherwise overlap.
+  void DecryptBlocks(const unsigned char in[], unsigned char out[],
+                     size_t blocks, const unsigned char *roundKeys);
+
+  // XOR `len` bytes of CTR keystream starting at `counter` into `out`.
+  // `counter` is advanced by the number of blocks consumed; the caller must
+  // ensure it does not wrap around.
+  void CtrXor(const unsigned char in[], unsigned char out[], size_t len,
+              const unsigned char *roundKeys, unsigned char counter[16]);
+
+  // XTS over `blocks` whole blocks: out = E(in ^ T) ^ T, with `tweak`
+  // multiplied by x after every block. `roundKeys` is a full schedule;
+  // `decrypt` runs the inverse cipher.
+  void XTSBlocks(const unsigned char in[], unsigned char out[], size_t blocks,
+                 const unsigned char *roundKeys, unsigned char tweak[16],
+                 bool decrypt);
+
+  // One data unit of at least 16 bytes from its encrypted tweak, with
+  // ciphertext stealing for a partial last block.
+  void XTSUnit(const unsigned char in[], size_t len, unsigned char out[],
+               const unsigned char *roundKeys, unsigned char tweak[16],
+               bool decrypt);
+
+  // `count` data units of `unitLen` bytes numbered from `first`.
+  void XTSSectors(const unsigned char in[], size_t unitLen, size_t count,
+                  const XtsKey &key, uint64_t first, unsigned char out[],
+                  bool decrypt);
+
+  // Validate the sizes, then run XTSSectors, on several threads if
+  // `parallel` is given.
+  void XTSCrypt(const unsigned char in[], size_t inLen, const XtsKey &key,
+                size_t sectorSize, uint64_t firstSector, unsigned char out[],
+                bool decrypt, const Parallelism *parallel = nullptr);
+
+  void CheckCCMArgs(size_t inLen, const unsigned char nonce[], size_t nonceLen,
+                    const unsigned char aad[], size_t aadLen,
+                    const unsigned char tag[], size_t tagLen);
+
+  // CBC-MAC of `blocks` whole blocks of `data`, chained into `mac`.
+  void CBCMACBlocks(const unsigned char data[], size_t blocks,
+                    const unsigned char *roundKeys, unsigned char mac[16]);
+
+  // CCM over `blocks` whole blocks: CTR from `counter` and CBC-MAC of the
+  // plaintext into `mac`, both advanced.
+  void CCMBlocks(const unsigned char in[], unsigned char out[], size_t blocks,
+                 const unsigned char *roundKeys, unsigned char counter[16],
+                 unsigned char mac[16], bool decrypt);
+
+  // Encrypt or decrypt `in` and compute the full 16-byte CCM tag; callers
+  // truncate it. Arguments must have passed CheckCCMArgs.
+  void CCMCrypt(const unsigned char in[], size_t inLen,
+                const unsigned char *roundKeys, const unsigned char nonce[],
+                size_t nonceLen, const unsigned char aad[], size_t aadLen,
+                size_t tagLen, unsigned char tag[16], unsigned char out[],
+                bool decrypt);
+
   void XorBlocks(const unsigned char *a, const unsigned char *b,
                  unsigned char *c, size_t len) noexcept;
 
@@ -541,12 +1602,564 @@ class AES {
   void GHASH(const unsigned char *H, const unsigned char *X, size_t len,
              unsigned char *tag);
 
-  // Convert raw array to a std::vector.
-  std::vector<unsigned char> ArrayToVector(unsigned char *a, size_t len);
+  // Hash subkey H together with H^1..H^8 in the byte-reflected form used by
+  // the PCLMUL backend. `karatsuba` holds the XOR of the two 64-bit halves of
+  // each power and `reversed` their bit reversals for the portable backend.
+  // Both backends fill every table, so a key works under either.
+  struct GhashKey {
+    alignas(16) unsigned char H[16];
+    alignas(16) unsigned char powers[8][16];
+    alignas(16) unsigned char karatsuba[8][16];
+    uint64_t reversed[8][2];
+  };
+
+  // Derive the GHASH key for the cipher key behind `roundKeys`.
+  void GHASHInit(const unsigned char *roundKeys, GhashKey &hashKey);
+
+  // Update GHASH state in `tag` with `len` bytes from `X`. A trailing partial
+  // block is padded with zeros.
+  void GHASHBlocks(const GhashKey &hashKey, const unsigned char *X, size_t len,
+                   unsigned char tag[16]);
+
+  // GCM payload processing: CTR keystream starting at `counter` combined with
+  // GHASH over the ciphertext, accumulated into `tag`. `counter` is advanced
+  // past the last block consumed. `in` and `out` may be the same buffer.
+  void GCMCrypt(const unsigned char in[], unsigned char out[], size_t len,
+                const unsigned char *roundKeys, const GhashKey &hashKey,
+                unsigned char counter[16], unsigned char tag[16],
+                bool decrypt);
+
+  // GCMCrypt over ranges run on several threads. Each range is hashed from
+  // zero and multiplied by H to the number of blocks that follow it; `tag` is
+  // multiplied by H to the total block count, and the results are XORed.
+  void GCMCryptParallel(const unsigned char in[], unsigned char out[],
+                        size_t len, const unsigned char *roundKeys,
+                        const GhashKey &hashKey,
+                        const unsigned char counter[16], unsigned char tag[16],
+                        bool decrypt, const Parallelism &parallel);
+
+  // Multiply `tag` by H^n, as if n zero blocks were hashed.
+  void GHASHShift(const GhashKey &hashKey, uint64_t n, unsigned char tag[16]);
+
+  void GCMSeal(const unsigned char in[], size_t inLen,
+               const unsigned char *roundKeys, const GhashKey &hashKey,
+               const unsigned char iv[], const unsigned char aad[],
+               size_t aadLen, unsigned char tag[], unsigned char out[],
+               const Parallelism *parallel = nullptr);
+
+  // Returns false, with `out` zeroized, if the tag does not verify.
+  bool GCMOpen(const unsigned char in[], size_t inLen,
+               const unsigned char *roundKeys, const GhashKey &hashKey,
+               const unsigned char iv[], const unsigned char aad[],
+               size_t aadLen, const unsigned char tag[], unsigned char out[],
+               const Parallelism *parallel = nullptr);
+
+  // One cached schedule. `referenced` is the CLOCK bit: set on every hit,
+  // cleared as the eviction hand passes over the entry. `version` changes
+  // whenever the entry is replaced, which invalidates the thread snapshots
+  // taken from it and no others.
+  struct CacheEntry {
+    std::vector<unsigned char> key;
+    std::shared_ptr<std::vector<unsigned char>> roundKeys;
+    std::atomic<bool> referenced{false};
+    std::atomic<uint64_t> version{0};
+  };
+
+  // Keys are spread over shards by a hash of the key bytes, so threads using
+  // different keys rarely contend on the same lock.
+  struct CacheShard {
+    AESCPP_SHARED_MUTEX mutex;
+    std::unique_ptr<CacheEntry[]> entries;
+    size_t capacity = 0;
+    size_t hand = 0;
+  };
+
+  // Per-thread references to recently used cache entries, see
+  // prepare_round_keys. They hold no copy of the key.
+  struct ScheduleSnapshot;
+  struct SnapshotTable;
+  static SnapshotTable &ThreadSnapshots();
+
+  // Drop the snapshots of this object in every thread, so cleared schedules
+  // are zeroized now rather than when each thread next calls in.
+  void ReleaseSnapshots();
+
+  static constexpr size_t maxCacheShards = 8;
+
+  size_t ShardIndex(const unsigned char *key) const;
+
+  // Process-unique id; snapshots are tagged with it rather than with `this`,
+  // so a new object at a reused address never matches stale snapshots.
+  uint64_t instanceId = 0;
+  // Advanced by clear_cache(); snapshots taken under an older epoch are
+  // dropped instead of served.
+  std::atomic<uint64_t> cacheEpoch{0};
+  // Set the first time a thread snapshot is taken for this object, so that
+  // objects which never took one skip the walk in ReleaseSnapshots().
+  std::atomic<bool> snapshotsTaken{false};
+  size_t cacheCapacity = 0;
+  size_t cacheShardCount = 0;
+  std::unique_ptr<CacheShard[]> cacheShards;
+  std::atomic<uint64_t> cacheHits{0};
+  std::atomic<uint64_t> cacheMisses{0};
+  std::atomic<uint64_t> cacheEvictions{0};
+  // Hits served from thread snapshots. Each snapshot holds a reference and
+  // publishes into it when its slot is reused, even after this object is
+  // gone, so no hits are lost to another object taking the slot.
+  std::shared_ptr<std::atomic<uint64_t>> snapshotHits;
+};
+
+/// \brief Expanded AES key schedule, built once and reused across calls.
+///
+/// The AES mode overloads taking an AesKey use its round keys directly and
+/// skip the per-call key cache lookup: no locking, key comparison or
+/// reference counting. Copies share one immutable schedule, which is zeroized
+/// when the last copy is destroyed, so an AesKey may be used from several
+/// threads at once.
+///
+/// \code
+/// aes_cpp::AesKey key(aes_cpp::AESKeyLength::AES_256, rawKey);
+/// aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_256);
+/// aes.EncryptCTR(in, inLen, key, iv, out);
+/// \endcode
+class AesKey {
+ public:
+  /// \brief Expand \p key.
+  /// \param keyLength Key length variant.
+  /// \param key Raw key of 16, 24 or 32 bytes according to \p keyLength.
+  /// \throws std::invalid_argument If \p key is null.
+  AesKey(AESKeyLength keyLength, const unsigned char key[]);
+
+  /// \overload
+  /// \throws std::invalid_argument If \p key has the wrong size.
+  AesKey(AESKeyLength keyLength, const std::vector<unsigned char> &key);
+
+  /// \brief Key length this schedule was expanded for.
+  AESKeyLength key_length() const noexcept;
+
+ private:
+  friend class AES;
+  friend class GcmKey;
+
+  AESKeyLength keyLength;
+  unsigned int rounds = 0;
+  std::shared_ptr<const std::vector<unsigned char>> schedule;
+};
+
+/// \brief Expanded key for GCM: the AES schedule plus the GHASH key H and its
+/// precomputed powers.
+///
+/// Like AesKey it is immutable, cheap to copy and zeroized with its last copy.
+class GcmKey {
+ public:
+  /// \brief Expand \p key and derive the GHASH key.
+  /// \param keyLength Key length variant.
+  /// \param key Raw key of 16, 24 or 32 bytes according to \p keyLength.
+  /// \throws std::invalid_argument If \p key is null.
+  GcmKey(AESKeyLength keyLength, const unsigned char key[]);
+
+  /// \overload
+  /// \throws std::invalid_argument If \p key has the wrong size.
+  GcmKey(AESKeyLength keyLength, const std::vector<unsigned char> &key);
+
+  /// \brief Underlying block cipher key.
+  const AesKey &aes_key() const noexcept { return key; }
+
+ private:
+  friend class AES;
+  friend class detail::GcmStream;
+
+  AesKey key;
+  std::shared_ptr<const AES::GhashKey> hashKey;
+};
+
+/// \brief Key pair for XTS-AES: the data key and the tweak key, each expanded
+/// once.
+///
+/// Like AesKey it is immutable, cheap to copy and zeroized with its last copy.
+class XtsKey {
+ public:
+  /// \brief Split and expand a double-length XTS key.
+  /// \param keyLength AES_128 or AES_256, the length of each half.
+  /// \param key 32 or 64 bytes according to \p keyLength: the data key
+  /// followed by the tweak key.
+  /// \throws std::invalid_argument If \p key is null, \p keyLength is AES_192
+  /// or the two halves are equal.
+  XtsKey(AESKeyLength keyLength, const unsigned char key[]);
+
+  /// \overload
+  /// \throws std::invalid_argument If \p key has the wrong size.
+  XtsKey(AESKeyLength keyLength, const std::vector<unsigned char> &key);
+
+  /// \brief Length of each half of the key pair.
+  AESKeyLength key_length() const noexcept { return dataKey.key_length(); }
+
+ private:
+  friend class AES;
+
+  AesKey dataKey;
+  AesKey tweakKey;
+};
+
+namespace detail {
+// State shared by GcmEncryptor and GcmDecryptor: the counter, the GHASH
+// accumulator and the partial block carried between calls. Full blocks go
+// through the same stitched kernels as the one-shot GCM calls.
+class GcmStream {
+ public:
+  GcmStream(const GcmKey &key, const unsigned char iv[], bool decrypt);
+  ~GcmStream();
+
+  GcmStream(const GcmStream &) = delete;
+  GcmStream &operator=(const GcmStream &) = delete;
+
+  void init(const unsigned char iv[]);
+  void aad(const unsigned char aad[], size_t len);
+  void update(const unsigned char in[], size_t len, unsigned char out[]);
+  // Tag of the message so far; the stream needs init() before further use.
+  void finish(unsigned char tag[16]);
+
+ private:
+  enum class Phase { Aad, Payload, Finished };
+
+  // XOR `len` bytes with the current keystream block, which must have that
+  // many bytes left, and buffer the ciphertext for GHASH.
+  void Carry(const unsigned char in[], size_t len, unsigned char out[]);
+
+  GcmKey key;
+  AES cipher;
+  bool decrypt;
+  Phase phase = Phase::Aad;
+  uint64_t aadLen = 0;
+  uint64_t payloadLen = 0;
+  size_t aadPending = 0;  // bytes of AAD waiting in `block`
+  unsigned char J0[16];
+  unsigned char counter[16];
+  unsigned char hash[16];
+  unsigned char keystream[16];
+  unsigned char block[16];
+};
+}  // namespace detail
+
+/// \brief Incremental GCM encryption: AAD and payload may arrive in pieces of
+/// any size, with partial blocks carried between calls.
+///
+/// The result is the same as one EncryptGCM call over the concatenated AAD
+/// and payload. No memory is allocated after construction; init() starts the
+/// next message under the same key.
+///
+/// \code
+/// aes_cpp::GcmEncryptor enc(key, iv);
+/// enc.aad(header, headerLen);
+/// for (auto &chunk : chunks) enc.update(chunk.data(), chunk.size(), out);
+/// enc.finish(tag);
+/// \endcode
+class GcmEncryptor {
+ public:
+  /// \brief Start a message.
+  /// \param key Expanded GCM key; the encryptor keeps a reference-counted
+  /// copy.
+  /// \param iv 12-byte initialization vector.
+  /// \throws std::invalid_argument If \p iv is null.
+  GcmEncryptor(const GcmKey &key, const unsigned char iv[]);
+
+  /// \brief Discard the current state and start a new message.
+  /// \param iv 12-byte initialization vector.
+  /// \throws std::invalid_argument If \p iv is null.
+  void init(const unsigned char iv[]);
+
+  /// \brief Add additional authenticated data.
+  /// \param aad AAD bytes; may be nullptr when \p len is 0.
+  /// \param len Length of \p aad in bytes.
+  /// \throws std::logic_error If payload was already passed to update().
+  /// \throws std::length_error If the total AAD exceeds the GCM limit.
+  void aad(const unsigned char aad[], size_t len);
+
+  /// \brief Encrypt the next \p len bytes of payload.
+  /// \param in Plaintext bytes.
+  /// \param len Length of \p in in bytes.
+  /// \param out Output buffer with space for \p len bytes; may be \p in.
+  /// \throws std::logic_error After finish(), until init() is called.
+  /// \throws std::length_error If the total length exceeds the GCM limits.
+  void update(const unsigned char in[], size_t len, unsigned char out[]);
+
+  /// \brief Complete the message.
+  /// \param tag Output buffer for the 16-byte authentication tag.
+  /// \throws std::logic_error If the message was already finished.
+  void finish(unsigned char tag[]);
+
+ private:
+  detail::GcmStream stream;
+};
+
+/// \brief Incremental GCM decryption, the counterpart of GcmEncryptor.
+///
+/// \warning Plaintext is returned by update() before the tag can be checked.
+/// Do not act on it, or release it further, until finish() has returned.
+class GcmDecryptor {
+ public:
+  /// \brief Start a message.
+  /// \param key Expanded GCM key; the decryptor keeps a reference-counted
+  /// copy.
+  /// \param iv 12-byte initialization vector used during encryption.
+  /// \throws std::invalid_argument If \p iv is null.
+  GcmDecryptor(const GcmKey &key, const unsigned char iv[]);
+
+  /// \brief Discard the current state and start a new message.
+  /// \param iv 12-byte initialization vector used during encryption.
+  /// \throws std::invalid_argument If \p iv is null.
+  void init(const unsigned char iv[]);
+
+  /// \brief Add additional authenticated data.
+  /// \param aad AAD bytes; may be nullptr when \p len is 0.
+  /// \param len Length of \p aad in bytes.
+  /// \throws std::logic_error If payload was already passed to update().
+  /// \throws std::length_error If the total AAD exceeds the GCM limit.
+  void aad(const unsigned char aad[], size_t len);
+
+  /// \brief Decrypt the next \p len bytes of ciphertext.
+  /// \param in Ciphertext bytes.
+  /// \param len Length of \p in in bytes.
+  /// \param out Output buffer with space for \p len bytes; may be \p in.
+  /// \throws std::logic_error After finish(), until init() is called.
+  /// \throws std::length_error If the total length exceeds the GCM limits.
+  void update(const unsigned char in[], size_t len, unsigned char out[]);
+
+  /// \brief Complete the message and check its tag.
+  /// \param tag Expected 16-byte authentication tag.
+  /// \throws std::runtime_error If authentication fails.
+  /// \throws std::logic_error If the message was already finished.
+  void finish(const unsigned char tag[]);
+
+ private:
+  detail::GcmStream stream;
+};
+
+namespace detail {
+// State shared by the CTR, CBC and CFB stream classes. `chain` is the next
+// counter block (CTR), the previous ciphertext block (CBC) or the shift
+// register (CFB). `buffer` holds the current keystream block for CTR and CFB,
+// and the partial input block for CBC.
+class ModeStream {
+ public:
+  enum class Mode { CTR, CBCEncrypt, CBCDecrypt, CFBEncrypt, CFBDecrypt };
+
+  ModeStream(const AesKey &key, const unsigned char iv[], Mode mode);
+  ~ModeStream();
+
+  ModeStream(const ModeStream &) = delete;
+  ModeStream &operator=(const ModeStream &) = delete;
+
+  void init(const unsigned char iv[]);
+  // Returns the number of bytes written; only CBC writes fewer than `len`.
+  size_t update(const unsigned char in[], size_t len, unsigned char out[]);
+  // Fails if a partial CBC block is pending; the stream needs init() before
+  // further use.
+  void finish();
+
+ private:
+  void CtrUpdate(const unsigned char in[], size_t len, unsigned char out[],
+                 const unsigned char *roundKeys);
+  size_t CbcUpdate(const unsigned char in[], size_t len, unsigned char out[],
+                   const unsigned char *roundKeys);
+  void CfbUpdate(const unsigned char in[], size_t len, unsigned char out[],
+                 const unsigned char *roundKeys);
+  // Run whole CBC blocks and move `chain` to the last ciphertext block.
+  void CbcBlocks(const unsigned char in[], size_t len, unsigned char out[],
+                 const unsigned char *roundKeys);
+  // XOR `len` bytes with the unused part of the CFB keystream block and feed
+  // the ciphertext into `chain`.
+  void CfbCarry(const unsigned char in[], size_t len, unsigned char out[]);
+
+  AesKey key;
+  AES cipher;
+  Mode mode;
+  bool finished = false;
+  bool exhausted = false;  // CTR counter wrapped around 2^128
+  size_t used = 0;         // keystream bytes consumed, or CBC bytes pending
+  unsigned char chain[16];
+  unsigned char buffer[16];
+};
+}  // namespace detail
+
+/// \brief Incremental CTR encryption: the payload may arrive in pieces of any
+/// size, with the unused keystream carried between calls.
+///
+/// The result is the same as one EncryptCTR call over the concatenated input.
+/// No memory is allocated after construction; init() starts the next message
+/// under the same key.
+class CtrEncryptor {
+ public:
+  /// \brief Start a message.
+  /// \param key Expanded key; the encryptor keeps a reference-counted copy.
+  /// \param iv 16-byte initial counter block.
+  /// \throws std::invalid_argument If \p iv is null.
+  CtrEncryptor(const AesKey &key, const unsigned char iv[]);
+
+  /// \brief Discard the current state and start a new message.
+  /// \param iv 16-byte initial counter block.
+  /// \throws std::invalid_argument If \p iv is null.
+  void init(const unsigned char iv[]);
+
+  /// \brief Encrypt the next \p len bytes.
+  /// \param in Plaintext bytes.
+  /// \param len Length of \p in in bytes.
+  /// \param out Output buffer with space for \p len bytes; may be \p in.
+  /// \throws std::length_error If the counter would wrap around 2^128; nothing
+  /// is written in that case.
+  void update(const unsigned char in[], size_t len, unsigned char out[]);
 
-  std::vector<unsigned char> cachedKey;
-  std::shared_ptr<std::vector<unsigned char>> cachedRoundKeys;
-  AESCPP_SHARED_MUTEX cacheMutex;
+ private:
+  detail::ModeStream stream;
+};
+
+/// \brief Incremental CTR decryption, the counterpart of CtrEncryptor.
+class CtrDecryptor {
+ public:
+  /// \brief Start a message.
+  /// \param key Expanded key; the decryptor keeps a reference-counted copy.
+  /// \param iv 16-byte initial counter block used during encryption.
+  /// \throws std::invalid_argument If \p iv is null.
+  CtrDecryptor(const AesKey &key, const unsigned char iv[]);
+
+  /// \brief Discard the current state and start a new message.
+  /// \param iv 16-byte initial counter block used during encryption.
+  /// \throws std::invalid_argument If \p iv is null.
+  void init(const unsigned char iv[]);
+
+  /// \brief Decrypt the next \p len bytes.
+  /// \param in Ciphertext bytes.
+  /// \param len Length of \p in in bytes.
+  /// \param out Output buffer with space for \p len bytes; may be \p in.
+  /// \throws std::length_error If the counter would wrap around 2^128; nothing
+  /// is written in that case.
+  void update(const unsigned char in[], size_t len, unsigned char out[]);
+
+ private:
+  detail::ModeStream stream;
+};
+
+/// \brief Incremental CBC encryption of input that arrives in pieces of any
+/// size.
+///
+/// Input is buffered until a whole block is available, so update() may write
+/// fewer bytes than it was given. The concatenated output equals one
+/// EncryptCBC call over the concatenated input, which must be a multiple of
+/// 16 bytes by the time finish() is called. Padding is left to the caller, as
+/// with EncryptCBC. No memory is allocated after construction.
+class CbcEncryptor {
+ public:
+  /// \brief Start a message.
+  /// \param key Expanded key; the encryptor keeps a reference-counted copy.
+  /// \param iv 16-byte initialization vector.
+  /// \throws std::invalid_argument If \p iv is null.
+  CbcEncryptor(const AesKey &key, const unsigned char iv[]);
+
+  /// \brief Discard the current state and start a new message.
+  /// \param iv 16-byte initialization vector.
+  /// \throws std::invalid_argument If \p iv is null.
+  void init(const unsigned char iv[]);
+
+  /// \brief Encrypt every whole block completed by the next \p len bytes.
+  /// \param in Plaintext bytes.
+  /// \param len Length of \p in in bytes.
+  /// \param out Output buffer with space for \p len + 15 bytes. It may be
+  /// \p in only while every call so far has passed a multiple of 16 bytes.
+  /// \return Number of bytes written to \p out, a multiple of 16.
+  /// \throws std::logic_error After finish(), until init() is called.
+  size_t update(const unsigned char in[], size_t len, unsigned char out[]);
+
+  /// \brief Complete the message.
+  /// \throws std::length_error If a partial block is still buffered.
+  /// \throws std::logic_error If the message was already finished.
+  void finish();
+
+ private:
+  detail::ModeStream stream;
+};
+
+/// \brief Incremental CBC decryption, the counterpart of CbcEncryptor.
+class CbcDecryptor {
+ public:
+  /// \brief Start a message.
+  /// \param key Expanded key; the decryptor keeps a reference-counted copy.
+  /// \param iv 16-byte initialization vector used during encryption.
+  /// \throws std::invalid_argument If \p iv is null.
+  CbcDecryptor(const AesKey &key, const unsigned char iv[]);
+
+  /// \brief Discard the current state and start a new message.
+  /// \param iv 16-byte initialization vector used during encryption.
+  /// \throws std::invalid_argument If \p iv is null.
+  void init(const unsigned char iv[]);
+
+  /// \brief Decrypt every whole block completed by the next \p len bytes.
+  /// \param in Ciphertext bytes.
+  /// \param len Length of \p in in bytes.
+  /// \param out Output buffer with space for \p len + 15 bytes. It may be
+  /// \p in only while every call so far has passed a multiple of 16 bytes.
+  /// \return Number of bytes written to \p out, a multiple of 16.
+  /// \throws std::logic_error After finish(), until init() is called.
+  size_t update(const unsigned char in[], size_t len, unsigned char out[]);
+
+  /// \brief Complete the message.
+  /// \throws std::length_error If a partial block is still buffered.
+  /// \throws std::logic_error If the message was already finished.
+  void finish();
+
+ private:
+  detail::ModeStream stream;
+};
+
+/// \brief Incremental CFB-128 encryption: the payload may arrive in pieces of
+/// any size, with the partial keystream block carried between calls.
+///
+/// The result is the same as one EncryptCFB call over the concatenated input.
+/// No memory is allocated after construction.
+class CfbEncryptor {
+ public:
+  /// \brief Start a message.
+  /// \param key Expanded key; the encryptor keeps a reference-counted copy.
+  /// \param iv 16-byte initialization vector.
+  /// \throws std::invalid_argument If \p iv is null.
+  CfbEncryptor(const AesKey &key, const unsigned char iv[]);
+
+  /// \brief Discard the current state and start a new message.
+  /// \param iv 16-byte initialization vector.
+  /// \throws std::invalid_argument If \p iv is null.
+  void init(const unsigned char iv[]);
+
+  /// \brief Encrypt the next \p len bytes.
+  /// \param in Plaintext bytes.
+  /// \param len Length of \p in in bytes.
+  /// \param out Output buffer with space for \p len bytes; may be \p in.
+  void update(const unsigned char in[], size_t len, unsigned char out[]);
+
+ private:
+  detail::ModeStream stream;
+};
+
+/// \brief Incremental CFB-128 decryption, the counterpart of CfbEncryptor.
+class CfbDecryptor {
+ public:
+  /// \brief Start a message.
+  /// \param key Expanded key; the decryptor keeps a reference-counted copy.
+  /// \param iv 16-byte initialization vector used during encryption.
+  /// \throws std::invalid_argument If \p iv is null.
+  CfbDecryptor(const AesKey &key, const unsigned char iv[]);
+
+  /// \brief Discard the current state and start a new message.
+  /// \param iv 16-byte initialization vector used during encryption.
+  /// \throws std::invalid_argument If \p iv is null.
+  void init(const unsigned char iv[]);
+
+  /// \brief Decrypt the next \p len bytes.
+  /// \param in Ciphertext bytes.
+  /// \param len Length of \p in in bytes.
+  /// \param out Output buffer with space for \p len bytes; may be \p in.
+  void update(const unsigned char in[], size_t len, unsigned char out[]);
+
+ private:
+  detail::ModeStream stream;
 };
 
 constexpr std::array<uint8_t, 256> sbox = {
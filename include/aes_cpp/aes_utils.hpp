@@ -3,10 +3,12 @@
 
 #include <aes_cpp/aes.hpp>
 #include <array>
+#include <atomic>
 #include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -26,6 +28,11 @@ bool fill_os_random(void *data, size_t len) noexcept;
 }  // namespace detail
 
 /// \brief Generate a random 12-byte IV.
+///
+/// IVs are drawn from a per-thread buffer that is refilled from the operating
+/// system a few kilobytes at a time. Bytes are wiped from the buffer as they
+/// are handed out, and a child process discards its parent's buffer after
+/// fork(). Define AESUTILS_DISABLE_RANDOM_POOL to read every IV from the OS.
 /// \return Array containing the IV.
 std::array<uint8_t, 12> generate_iv_12();
 
@@ -33,6 +40,18 @@ std::array<uint8_t, 12> generate_iv_12();
 /// \return Array containing the IV.
 std::array<uint8_t, 16> generate_iv_16();
 
+/// \brief Generate \p count random 12-byte IVs in one call.
+/// \param count Number of IVs.
+/// \return Vector of \p count IVs.
+/// \throws std::length_error If \p count * 12 overflows.
+std::vector<std::array<uint8_t, 12>> generate_iv_12(std::size_t count);
+
+/// \brief Generate \p count random 16-byte IVs in one call.
+/// \param count Number of IVs.
+/// \return Vector of \p count IVs.
+/// \throws std::length_error If \p count * 16 overflows.
+std::vector<std::array<uint8_t, 16>> generate_iv_16(std::size_t count);
+
 /// \brief Add PKCS#7 padding to data.
 /// \param data Input data.
 /// \return Padded data.
@@ -122,6 +141,17 @@ template <class T>
 EncryptedData encrypt(const std::string &plain_text, const T &key, AesMode mode,
                       const MacFn &mac_fn = {});
 
+/// \brief Encrypt bytes viewed by a span, e.g. a `std::string_view` or a
+/// buffer owned by the caller, without copying them first.
+/// \tparam T Container type holding the key.
+/// \param plain Plaintext bytes.
+/// \param key Key material.
+/// \param mode Block mode to use.
+/// \return Encrypted data with IV and timestamp.
+template <class T>
+EncryptedData encrypt(ByteSpan plain, const T &key, AesMode mode,
+                      const MacFn &mac_fn = {});
+
 /// \brief Decrypt previously encrypted data.
 /// \tparam T Container type holding the key.
 /// \param data Encrypted container.
@@ -142,6 +172,21 @@ template <class T>
 std::string decrypt_to_string(const EncryptedData &data, const T &key,
                               AesMode mode, const MacFn &mac_fn = {});
 
+/// \brief Decrypt previously encrypted data into a caller-provided buffer.
+/// \tparam T Container type holding the key.
+/// \param data Encrypted container.
+/// \param key Key material.
+/// \param mode Block mode used during encryption.
+/// \param out Output buffer at least as long as `data.ciphertext`. Bytes past
+/// the returned length are zeroed.
+/// \return Length of the plaintext written to \p out.
+/// \throws std::length_error If \p out is too small.
+/// \throws std::runtime_error If the ciphertext or its padding is invalid;
+/// \p out is zeroed.
+template <class T>
+std::size_t decrypt_into(const EncryptedData &data, const T &key, AesMode mode,
+                         MutableByteSpan out, const MacFn &mac_fn = {});
+
 /// \brief Encrypt data using AES-GCM.
 /// \tparam T Container type holding the key.
 /// \param plain Plaintext bytes.
@@ -162,6 +207,16 @@ template <class T>
 GcmEncryptedData encrypt_gcm(const std::string &plain_text, const T &key,
                              const std::vector<uint8_t> &aad = {});
 
+/// \brief Encrypt bytes viewed by a span using AES-GCM, without copying them
+/// first.
+/// \tparam T Container type holding the key.
+/// \param plain Plaintext bytes.
+/// \param key Key material.
+/// \param aad Additional authenticated data; may be empty.
+/// \return Encrypted data with IV, ciphertext and tag.
+template <class T>
+GcmEncryptedData encrypt_gcm(ByteSpan plain, const T &key, ByteSpan aad = {});
+
 /// \brief Decrypt AES-GCM encrypted data.
 /// \tparam T Container type holding the key.
 /// \param data Encrypted container.
@@ -184,6 +239,162 @@ template <class T>
 std::string decrypt_gcm_to_string(const GcmEncryptedData &data, const T &key,
                                   const std::vector<uint8_t> &aad = {});
 
+/// \brief Decrypt AES-GCM encrypted data into a caller-provided buffer.
+/// \tparam T Container type holding the key.
+/// \param data Encrypted container.
+/// \param key Key material.
+/// \param out Output buffer at least as long as `data.ciphertext`.
+/// \param aad Additional authenticated data used during encryption.
+/// \return Length of the plaintext written to \p out.
+/// \throws std::length_error If \p out is too small.
+/// \throws std::runtime_error If authentication fails; \p out is zeroed.
+template <class T>
+std::size_t decrypt_gcm_into(const GcmEncryptedData &data, const T &key,
+                             MutableByteSpan out, ByteSpan aad = {});
+
+/// \brief Deterministic 96-bit GCM nonces for one key (NIST SP 800-38D,
+/// section 8.2.1).
+///
+/// Each nonce is a 4-byte fixed field followed by a 64-bit big-endian
+/// counter. Threads reserve blocks of counter values from a shared atomic and
+/// then hand them out locally, so most calls touch no shared state. Nonces
+/// are therefore unique but not issued in order across threads, and values
+/// left in a block when a thread exits are skipped.
+///
+/// Use one sequence per key, with a fixed field that no other writer of the
+/// same key uses; a sequence cannot be copied, since a copy would repeat its
+/// nonces.
+class GcmNonceSequence {
+ public:
+  /// \brief Bind a sequence to \p key.
+  /// \param key Expanded key the nonces are used with.
+  /// \param fixed Fixed field, e.g. a device or process identifier.
+  /// \param limit Maximum number of nonces to issue.
+  /// \param block_size Counter values each thread reserves at a time.
+  /// \throws std::invalid_argument If \p block_size is 0.
+  /// \throws std::runtime_error If fork() cannot be detected.
+  GcmNonceSequence(const GcmKey &key, uint32_t fixed,
+                   uint64_t limit = UINT64_MAX, uint32_t block_size = 1024);
+
+  GcmNonceSequence(const GcmNonceSequence &) = delete;
+  GcmNonceSequence &operator=(const GcmNonceSequence &) = delete;
+
+  /// \brief Next unused nonce.
+  /// \throws std::length_error Once \p limit nonces have been reserved.
+  /// \throws std::logic_error In a process forked after construction, which
+  ///         would otherwise repeat the parent's nonces.
+  std::array<uint8_t, 12> next();
+
+  /// \brief Encrypt \p plain under the bound key with the next nonce.
+  /// \param plain Plaintext bytes.
+  /// \param aad Additional authenticated data; may be empty.
+  /// \return Encrypted data with the nonce used, ciphertext and tag.
+  /// \throws std::length_error If the sequence is exhausted.
+  /// \throws std::logic_error In a process forked after construction.
+  GcmEncryptedData encrypt(ByteSpan plain, ByteSpan aad = {});
+
+  /// \brief Key this sequence is bound to.
+  const GcmKey &gcm_key() const noexcept { return key; }
+
+ private:
+  GcmKey key;
+  uint32_t fixed;
+  uint64_t limit;
+  uint32_t blockSize;
+  uint64_t id;                     // tags this sequence's per-thread blocks
+  std::atomic<uint64_t> reserved;  // counter values handed out to threads
+  unsigned forkGeneration = 0;     // fork_generation() at construction
+};
+
+/// \brief Deterministic random bit generator: NIST SP 800-90A CTR_DRBG with
+/// AES-256 and no derivation function.
+///
+/// Output is produced by the library's CTR kernels, so bulk generation runs
+/// at CTR encryption speed instead of at the speed of the OS generator. The
+/// generator reseeds from the OS after \p reseed_interval requests of up to
+/// max_request_bytes each, and in a child process after fork(). An object
+/// must not be used by several threads at once; random_bytes() keeps one per
+/// thread.
+class CtrDrbg {
+ public:
+  /// \brief Bytes of entropy input, and the maximum length of the
+  /// personalization string and additional input.
+  static constexpr std::size_t seed_length = 48;
+  /// \brief Output of one SP 800-90A generate request (2^19 bits). Longer
+  /// calls to generate() are split into several requests.
+  static constexpr std::size_t max_request_bytes = 1 << 16;
+  /// \brief Requests between reseeds unless the caller asks for another
+  /// interval.
+  static constexpr uint64_t default_reseed_interval = 1ull << 20;
+
+  /// \brief Instantiate from OS entropy.
+  /// \param personalization Up to 48 bytes mixed into the initial state.
+  /// \param reseed_interval Generate requests between reseeds, 1 to 2^48.
+  /// \throws std::runtime_error If the OS generator fails.
+  /// \throws std::invalid_argument If an argument is out of range.
+  explicit CtrDrbg(ByteSpan personalization = {},
+                   uint64_t reseed_interval = default_reseed_interval);
+
+  /// \brief Instantiate from caller-supplied entropy, e.g. to reproduce
+  /// known-answer tests. Later reseeds still draw from the OS.
+  /// \param entropy Exactly 48 bytes of full-entropy input.
+  /// \param personalization Up to 48 bytes mixed into the initial state.
+  /// \param reseed_interval Generate requests between reseeds, 1 to 2^48.
+  /// \throws std::invalid_argument If an argument is out of range.
+  CtrDrbg(ByteSpan entropy, ByteSpan personalization,
+          uint64_t reseed_interval);
+
+  /// \brief Wipe the internal state.
+  ~CtrDrbg();
+
+  CtrDrbg(const CtrDrbg &) = delete;
+  CtrDrbg &operator=(const CtrDrbg &) = delete;
+
+  /// \brief Fill \p out with random bytes.
+  /// \param out Output buffer of any length.
+  /// \param additional Up to 48 bytes of additional input for the first
+  /// request.
+  /// \throws std::runtime_error If a due reseed cannot read the OS generator.
+  /// \throws std::invalid_argument If \p additional is too long.
+  void generate(MutableByteSpan out, ByteSpan additional = {});
+
+  /// \brief Reseed from OS entropy now, e.g. after restoring a VM snapshot.
+  /// \param additional Up to 48 bytes of additional input.
+  /// \throws std::runtime_error If the OS generator fails.
+  /// \throws std::invalid_argument If \p additional is too long.
+  void reseed(ByteSpan additional = {});
+
+  /// \brief Reseed from caller-supplied entropy.
+  /// \param entropy Exactly 48 bytes of full-entropy input.
+  /// \param additional Up to 48 bytes of additional input.
+  /// \throws std::invalid_argument If an argument has the wrong size.
+  void reseed(ByteSpan entropy, ByteSpan additional);
+
+ private:
+  // Start from the all-zero key and V, then seed.
+  void Instantiate(ByteSpan entropy, ByteSpan personalization,
+                   uint64_t reseed_interval);
+  // CTR_DRBG_Update: derive a new key and V from `provided` (48 bytes).
+  void Update(const uint8_t provided[seed_length]);
+  // Reseed or instantiate from `entropy` and `additional`.
+  void Seed(ByteSpan entropy, ByteSpan additional);
+  // One generate request of at most max_request_bytes.
+  void Request(uint8_t *out, std::size_t len, ByteSpan additional);
+
+  AES cipher;
+  std::shared_ptr<std::vector<unsigned char>> schedule;
+  uint8_t v[16];
+  uint64_t reseedCounter = 0;
+  uint64_t reseedInterval = default_reseed_interval;
+  unsigned forkGeneration = 0;
+};
+
+/// \brief Fill \p out from this thread's CtrDrbg, for bulk random data such as
+/// test inputs or ephemeral keys. The generator is seeded from the OS on first
+/// use in each thread.
+/// \throws std::runtime_error If the OS generator fails.
+void random_bytes(MutableByteSpan out);
+
 }  // namespace utils
 
 }  // namespace aes_cpp
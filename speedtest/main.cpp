@@ -15,9 +15,11 @@ unsigned long getMicroseconds() {
 // Generate plaintext filled with cryptographically secure random bytes.
 unsigned char *getRandomPlain(unsigned int length) {
   unsigned char *plain = new unsigned char[length];
-  if (!aes_cpp::utils::detail::fill_os_random(plain, length)) {
+  try {
+    aes_cpp::utils::random_bytes(aes_cpp::MutableByteSpan(plain, length));
+  } catch (...) {
     delete[] plain;
-    throw std::runtime_error("Failed to generate random bytes");
+    throw;
   }
   return plain;
 }
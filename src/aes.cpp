@@ -2,12 +2,20 @@
 
 #include <aes_cpp/aes.hpp>
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdlib>
 #include <cstdint>
 #include <cstring>
+#include <deque>
+#include <exception>
 #include <memory>
 #include <mutex>
+#include <new>
 #include <stdexcept>
+#include <system_error>
+#include <thread>
 
 #if defined(__has_include)
 #if __has_include(<strings.h>)
@@ -18,25 +26,66 @@
 #if defined(_WIN32)
 #include <windows.h>
 #endif
-#if ((defined(__PCLMUL__) || defined(__AES__)) &&                  \
-     (defined(__x86_64__) || defined(_M_X64) || defined(__i386) || \
-      defined(_M_IX86))) ||                                        \
-    (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
-#include <wmmintrin.h>
+// x86 kernels are compiled with per-function target attributes, so a generic
+// build still contains them and CPUID picks them at runtime. Define
+// AESCPP_DISABLE_AESNI to leave them out.
+#if !defined(AESCPP_DISABLE_AESNI) &&                             \
+    (defined(__x86_64__) || defined(_M_X64) || defined(__i386) || \
+     defined(_M_IX86)) &&                                         \
+    (defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER))
+#define AESCPP_X86_KERNELS 1
+#endif
+
+// ARMv8 Crypto Extension kernels (AESE/AESD/PMULL) need either a build for a
+// CPU that has them or a compiler whose <arm_neon.h> exposes them to functions
+// with a target attribute (AESCPP_ARM_ISA). Define AESCPP_DISABLE_ARM_CRYPTO
+// to leave them out.
+#if !defined(AESCPP_DISABLE_ARM_CRYPTO) && defined(__aarch64__) && \
+    defined(__AARCH64EL__) && (defined(__GNUC__) || defined(__clang__))
+#if defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO)
+#define AESCPP_ARM_KERNELS 1
+#elif defined(__clang__) && __clang_major__ >= 16
+#define AESCPP_ARM_KERNELS 1
+#define AESCPP_ARM_ISA "aes"
+#elif !defined(__clang__) && __GNUC__ >= 8
+#define AESCPP_ARM_KERNELS 1
+#define AESCPP_ARM_ISA "+crypto"
+#endif
 #endif
-#if defined(__SSSE3__)
-#include <tmmintrin.h>
+
+#if (defined(AESCPP_X86_KERNELS) || defined(AESCPP_ARM_ISA)) && \
+    (defined(__GNUC__) || defined(__clang__))
+#define AESCPP_TARGET(isa) __attribute__((target(isa)))
+#else
+#define AESCPP_TARGET(isa)
+#endif
+
+// Full unrolling of the round loops in kernels whose round count is a
+// template argument; MSVC unrolls such short constant loops on its own.
+#if defined(__clang__)
+#define AESCPP_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__) && __GNUC__ >= 8
+#define AESCPP_UNROLL _Pragma("GCC unroll 64")
+#else
+#define AESCPP_UNROLL
 #endif
+
 #if defined(__SSE2__)
 #include <emmintrin.h>
 #endif
-#if defined(_MSC_VER)
+#if defined(AESCPP_X86_KERNELS) || defined(GF_MUL_VERIFY)
 #include <immintrin.h>
+#endif
+#if defined(AESCPP_ARM_KERNELS)
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#endif
+#if defined(AESCPP_X86_KERNELS) && defined(_MSC_VER)
 #include <intrin.h>
-#elif defined(__has_include)
-#if (defined(__x86_64__) || defined(_M_X64) || defined(__i386) || \
-     defined(_M_IX86)) &&                                         \
-    __has_include(<cpuid.h>)
+#elif defined(AESCPP_X86_KERNELS) && defined(__has_include)
+#if __has_include(<cpuid.h>)
 #include <cpuid.h>
 #endif
 #endif
@@ -68,74 +117,121 @@ bool constant_time_eq(const unsigned char *a, const unsigned char *b,
   return diff == 0;
 }
 
-#if ((defined(__AES__) && (defined(__x86_64__) || defined(_M_X64) || \
-                           defined(__i386) || defined(_M_IX86))) ||  \
-     (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))))
-static bool has_aesni() {
+#if defined(AESCPP_X86_KERNELS)
+namespace {
+struct CpuFeatures {
+  bool aes = false;
+  bool pclmul = false;
+  bool ssse3 = false;
+};
+
+CpuFeatures detect_cpu() {
+  CpuFeatures cpu;
+  unsigned int ecx = 0;
 #if defined(_MSC_VER)
   int info[4];
   __cpuid(info, 1);
-  return (info[2] & (1 << 25)) != 0;
-#elif defined(__GNUC__) || defined(__clang__)
-#ifdef __get_cpuid
-  unsigned int eax, ebx, ecx, edx;
-  if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
-    return (ecx & bit_AES) != 0;
-  }
-  return false;
+  ecx = static_cast<unsigned int>(info[2]);
+#elif defined(__get_cpuid)
+  unsigned int eax, ebx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) ecx = 0;
 #else
-  unsigned int eax, ebx, ecx, edx;
+  unsigned int eax, ebx, edx;
   __asm__ volatile("cpuid"
                    : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
-                   : "a"(1));
-  return (ecx & (1u << 25)) != 0;
-#endif
-#else
-  return false;
+                   : "a"(1), "c"(0));
 #endif
+  cpu.pclmul = (ecx & (1u << 1)) != 0;
+  cpu.ssse3 = (ecx & (1u << 9)) != 0;
+  cpu.aes = (ecx & (1u << 25)) != 0;
+  return cpu;
 }
+}  // namespace
 #endif
 
-#if (((defined(__PCLMUL__) && (defined(__x86_64__) || defined(_M_X64) || \
-                               defined(__i386) || defined(_M_IX86))) ||  \
-      (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))))
-static bool has_pclmul() {
-#if defined(_MSC_VER)
-  static const bool result = []() {
-    int info[4];
-    __cpuid(info, 1);
-    return (info[2] & (1 << 1)) != 0;
-  }();
-  return result;
-#elif defined(__GNUC__) || defined(__clang__)
-#ifdef __get_cpuid
-  static const bool result = []() {
-    unsigned int eax, ebx, ecx, edx;
-    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
-      return (ecx & bit_PCLMUL) != 0;
-    }
-    return false;
-  }();
-  return result;
-#else
-  static const bool result = []() {
-    unsigned int eax, ebx, ecx, edx;
-    __asm__ volatile("cpuid"
-                     : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
-                     : "a"(1));
-    return (ecx & (1u << 1)) != 0;
-  }();
-  return result;
-#endif
-#else
-  return false;
+#if defined(AESCPP_ARM_KERNELS)
+namespace {
+struct CpuFeatures {
+  bool aes = false;
+  bool pmull = false;
+};
+
+// Linux reports the extensions in AT_HWCAP; every Apple arm64 CPU has them;
+// elsewhere rely on what the build targets.
+CpuFeatures detect_cpu() {
+  CpuFeatures cpu;
+#if defined(__linux__)
+  const unsigned long hwcap = getauxval(AT_HWCAP);
+  cpu.aes = (hwcap & (1ul << 3)) != 0;    // HWCAP_AES
+  cpu.pmull = (hwcap & (1ul << 4)) != 0;  // HWCAP_PMULL
+#elif defined(__APPLE__) || defined(__ARM_FEATURE_AES) || \
+    defined(__ARM_FEATURE_CRYPTO)
+  cpu.aes = true;
+  cpu.pmull = true;
 #endif
+  return cpu;
 }
+}  // namespace
 #endif
 
-static constexpr unsigned char R[16] = {
-    0, 0, 0, 0, 0, 0, 0, 0,
-    0, 0, 0, 0, 0, 0, 0, 0x87};  // Polynomial: x^128 + x^7 + x^2 + x + 1
+namespace {
+// Block cipher kernels for one key size. The round count is a template
+// argument of the implementations, so their round loops are fully unrolled.
+struct CipherKernels {
+  void (*encryptBlock)(const unsigned char in[], unsigned char out[],
+                       const unsigned char *roundKeys);
+  void (*decryptBlock)(const unsigned char in[], unsigned char out[],
+                       const unsigned char *decKeys);
+  void (*encryptBlocks)(const unsigned char in[], unsigned char out[],
+                        size_t blocks, const unsigned char *roundKeys);
+  void (*decryptBlocks)(const unsigned char in[], unsigned char out[],
+                        size_t blocks, const unsigned char *decKeys);
+  void (*keyExpansion)(const unsigned char key[], unsigned char w[]);
+  void (*invKeyExpansion)(const unsigned char w[], unsigned char dw[]);
+  void (*ctrXor)(const unsigned char in[], unsigned char out[], size_t len,
+                 const unsigned char *roundKeys, unsigned char counter[16]);
+  void (*xtsEncrypt)(const unsigned char in[], unsigned char out[],
+                     size_t blocks, const unsigned char *roundKeys,
+                     unsigned char tweak[16]);
+  void (*xtsDecrypt)(const unsigned char in[], unsigned char out[],
+                     size_t blocks, const unsigned char *decKeys,
+                     unsigned char tweak[16]);
+  void (*ccmEncrypt)(const unsigned char in[], unsigned char out[],
+                     size_t blocks, const unsigned char *roundKeys,
+                     unsigned char counter[16], unsigned char mac[16]);
+  void (*ccmDecrypt)(const unsigned char in[], unsigned char out[],
+                     size_t blocks, const unsigned char *roundKeys,
+                     unsigned char counter[16], unsigned char mac[16]);
+  size_t (*gcmCrypt)(const unsigned char in[], unsigned char out[], size_t len,
+                     const unsigned char *roundKeys,
+                     const unsigned char powers[8][16],
+                     const unsigned char karatsuba[8][16],
+                     unsigned char counter[16], unsigned char tag[16],
+                     bool decrypt);
+};
+
+// CPU-specific kernels, picked once per process. A null entry means the
+// portable implementation in the corresponding AES member function.
+struct Kernels {
+  Backend backend;
+  // AES-128, AES-192 and AES-256, in that order.
+  CipherKernels cipher[3];
+  void (*gfMultiply)(const unsigned char *X, const unsigned char *Y,
+                     unsigned char *Z);
+  void (*ghashPowers)(const unsigned char H[16], unsigned char powers[8][16],
+                      unsigned char karatsuba[8][16]);
+  void (*ghashBlocks)(const unsigned char powers[8][16],
+                      const unsigned char karatsuba[8][16],
+                      const unsigned char *X, size_t len,
+                      unsigned char tag[16]);
+
+  const CipherKernels &rounds(unsigned int Nr) const {
+    return cipher[(Nr - 10) / 2];
+  }
+};
+
+const Kernels &kernels();
+}  // namespace
 
 static constexpr uint8_t RCON_TABLE[] = {0x01, 0x02, 0x04, 0x08, 0x10,
                                          0x20, 0x40, 0x80, 0x1B, 0x36,
@@ -215,639 +311,3909 @@ inline unsigned char mul14(unsigned char x) {
   unsigned char x8 = gf_xtime(x4);
   return x8 ^ x4 ^ x2;
 }
-}  // namespace
-
-AES::AES(const AESKeyLength keyLength) {
-  switch (keyLength) {
-    case AESKeyLength::AES_128:
-      this->Nk = 4;
-      this->Nr = 10;
-      break;
 
-    case AESKeyLength::AES_192:
-      this->Nk = 6;
-      this->Nr = 12;
-      break;
+inline uint64_t load_be64(const unsigned char *p) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; ++i) v = (v << 8) | p[i];
+  return v;
+}
 
-    case AESKeyLength::AES_256:
-      this->Nk = 8;
-      this->Nr = 14;
-      break;
+inline void store_be64(unsigned char *p, uint64_t v) {
+  for (int i = 7; i >= 0; --i) {
+    p[i] = static_cast<unsigned char>(v);
+    v >>= 8;
   }
 }
 
-AES::~AES() { clear_cache(); }
-
-void AES::clear_cache() {
-  std::unique_lock<AESCPP_SHARED_MUTEX> lock(cacheMutex);
-  cachedRoundKeys.reset();
-  secure_zero(cachedKey.data(), cachedKey.size());
-  cachedKey.clear();
+// Validate that `key` holds exactly the bytes `keyLength` requires.
+const unsigned char *checked_key_data(AESKeyLength keyLength, ByteSpan key) {
+  size_t expected = 32;
+  if (keyLength == AESKeyLength::AES_128) expected = 16;
+  if (keyLength == AESKeyLength::AES_192) expected = 24;
+  if (key.size() != expected) throw std::invalid_argument("Invalid key size");
+  return key.data();
 }
 
-std::shared_ptr<const std::vector<unsigned char>> AES::prepare_round_keys(
-    const unsigned char *key) {
-  const size_t keyLen = 4 * Nk;
-  {
-    AESCPP_SHARED_LOCK<AESCPP_SHARED_MUTEX> lock(cacheMutex);
-    if (cachedKey.size() == keyLen &&
-        constant_time_eq(cachedKey.data(), key, keyLen)) {
-      return cachedRoundKeys;
-    }
-  }
-  std::unique_lock<AESCPP_SHARED_MUTEX> lock(cacheMutex);
-  if (cachedKey.size() != keyLen ||
-      !constant_time_eq(cachedKey.data(), key, keyLen)) {
-    secure_zero(cachedKey.data(), cachedKey.size());
-    cachedKey.assign(key, key + keyLen);
-    auto newRoundKeys = std::shared_ptr<std::vector<unsigned char>>(
-        new std::vector<unsigned char>(4 * Nb * (Nr + 1)),
-        [](std::vector<unsigned char> *p) {
-          secure_zero(p->data(), p->size());
-          delete p;
-        });  // zeroize on last reference
-    KeyExpansion(key, newRoundKeys->data());
-    cachedRoundKeys = newRoundKeys;
+// Bytes in each half of a double-length XTS key. IEEE 1619 defines XTS only
+// for AES-128 and AES-256.
+size_t xts_half_length(AESKeyLength keyLength) {
+  if (keyLength == AESKeyLength::AES_192) {
+    throw std::invalid_argument("XTS requires AES-128 or AES-256");
   }
-  return cachedRoundKeys;
+  return keyLength == AESKeyLength::AES_128 ? 16 : 32;
 }
 
-void AES::EncryptECB(const unsigned char in[], size_t inLen,
-                     const unsigned char key[], unsigned char out[]) {
+// Validate a double-length XTS key. Equal halves are rejected as in
+// SP 800-38E; they make the tweak encryption reveal data key outputs.
+const unsigned char *checked_xts_key(AESKeyLength keyLength,
+                                     const unsigned char key[]) {
+  const size_t half = xts_half_length(keyLength);
   if (!key) throw std::invalid_argument("Null key");
-  CheckLength(inLen);
-  auto roundKeys = prepare_round_keys(key);
-  for (size_t i = 0; i < inLen; i += blockBytesLen) {
-    EncryptBlock(in + i, out + i, roundKeys->data());
+  if (constant_time_eq(key, key + half, half)) {
+    throw std::invalid_argument("XTS key halves must differ");
   }
+  return key;
 }
 
-AESCPP_NODISCARD unsigned char *AES::EncryptECB(const unsigned char in[],
-                                                size_t inLen,
-                                                const unsigned char key[]) {
-  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
-  EncryptECB(in, inLen, key, out.get());
-  return out.release();
+// Validate that `key` holds both halves of an XTS key.
+const unsigned char *checked_xts_key_data(AESKeyLength keyLength,
+                                          ByteSpan key) {
+  if (key.size() != 2 * xts_half_length(keyLength)) {
+    throw std::invalid_argument("Invalid key size");
+  }
+  return key.data();
 }
 
-void AES::DecryptECB(const unsigned char in[], size_t inLen,
-                     const unsigned char key[], unsigned char out[]) {
-  if (!key) throw std::invalid_argument("Null key");
-  CheckLength(inLen);
-  auto roundKeys = prepare_round_keys(key);
-  for (size_t i = 0; i < inLen; i += blockBytesLen) {
-    DecryptBlock(in + i, out + i, roundKeys->data());
+// Size checks shared by the span overloads; `key` is checked separately.
+void check_span_args(ByteSpan in, ByteSpan iv, size_t ivLen,
+                     MutableByteSpan out) {
+  if (iv.size() != ivLen) {
+    throw std::invalid_argument("IV size must be " + std::to_string(ivLen) +
+                                " bytes");
+  }
+  if (out.size() < in.size()) {
+    throw std::length_error("Output buffer too small");
   }
 }
 
-AESCPP_NODISCARD unsigned char *AES::DecryptECB(const unsigned char in[],
-                                                size_t inLen,
-                                                const unsigned char key[]) {
-  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
-  DecryptECB(in, inLen, key, out.get());
-  return out.release();
+// Add `n` to the 128-bit big-endian counter. Wrap-around is the caller's
+// responsibility.
+inline void ctr_add(unsigned char counter[16], uint64_t n) {
+  uint64_t hi = load_be64(counter);
+  uint64_t lo = load_be64(counter + 8);
+  lo += n;
+  hi += lo < n;
+  store_be64(counter, hi);
+  store_be64(counter + 8, lo);
 }
 
-void AES::EncryptCBC(const unsigned char in[], size_t inLen,
-                     const unsigned char key[], const unsigned char *iv,
-                     unsigned char out[]) {
-  if (!key) throw std::invalid_argument("Null key");
-  if (!iv) throw std::invalid_argument("Null IV");
-  CheckLength(inLen);
-  auto roundKeys = prepare_round_keys(key);
-  unsigned char block[blockBytesLen];
-  memcpy(block, iv, blockBytesLen);
+// Constant-time bitsliced AES for hosts without AES-NI, after BearSSL's
+// "ct64" implementation. Four blocks are processed together in eight 64-bit
+// words: word i holds bit i of every state byte, so SubBytes becomes a fixed
+// Boolean circuit and no table lookup or secret-dependent branch remains.
+inline uint32_t load_le32(const unsigned char *p) {
+  return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+         (static_cast<uint32_t>(p[2]) << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
 
-  for (size_t i = 0; i < inLen; i += blockBytesLen) {
-    XorBlocks(block, in + i, block, blockBytesLen);
-    EncryptBlock(block, out + i, roundKeys->data());
-    memcpy(block, out + i, blockBytesLen);
+inline void store_le32(unsigned char *p, uint32_t v) {
+  p[0] = static_cast<unsigned char>(v);
+  p[1] = static_cast<unsigned char>(v >> 8);
+  p[2] = static_cast<unsigned char>(v >> 16);
+  p[3] = static_cast<unsigned char>(v >> 24);
+}
+
+// Boyar-Peralta S-box circuit (113 gates) applied to all 32 bytes at once.
+void bs_sbox(uint64_t q[8]) {
+  const uint64_t x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4];
+  const uint64_t x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0];
+
+  // Top linear transformation
+  const uint64_t y14 = x3 ^ x5;
+  const uint64_t y13 = x0 ^ x6;
+  const uint64_t y9 = x0 ^ x3;
+  const uint64_t y8 = x0 ^ x5;
+  const uint64_t t0 = x1 ^ x2;
+  const uint64_t y1 = t0 ^ x7;
+  const uint64_t y4 = y1 ^ x3;
+  const uint64_t y12 = y13 ^ y14;
+  const uint64_t y2 = y1 ^ x0;
+  const uint64_t y5 = y1 ^ x6;
+  const uint64_t y3 = y5 ^ y8;
+  const uint64_t t1 = x4 ^ y12;
+  const uint64_t y15 = t1 ^ x5;
+  const uint64_t y20 = t1 ^ x1;
+  const uint64_t y6 = y15 ^ x7;
+  const uint64_t y10 = y15 ^ t0;
+  const uint64_t y11 = y20 ^ y9;
+  const uint64_t y7 = x7 ^ y11;
+  const uint64_t y17 = y10 ^ y11;
+  const uint64_t y19 = y10 ^ y8;
+  const uint64_t y16 = t0 ^ y11;
+  const uint64_t y21 = y13 ^ y16;
+  const uint64_t y18 = x0 ^ y16;
+
+  // Non-linear section: inversion in GF(2^8) via GF(2^4)
+  const uint64_t t2 = y12 & y15;
+  const uint64_t t3 = y3 & y6;
+  const uint64_t t4 = t3 ^ t2;
+  const uint64_t t5 = y4 & x7;
+  const uint64_t t6 = t5 ^ t2;
+  const uint64_t t7 = y13 & y16;
+  const uint64_t t8 = y5 & y1;
+  const uint64_t t9 = t8 ^ t7;
+  const uint64_t t10 = y2 & y7;
+  const uint64_t t11 = t10 ^ t7;
+  const uint64_t t12 = y9 & y11;
+  const uint64_t t13 = y14 & y17;
+  const uint64_t t14 = t13 ^ t12;
+  const uint64_t t15 = y8 & y10;
+  const uint64_t t16 = t15 ^ t12;
+  const uint64_t t17 = t4 ^ t14;
+  const uint64_t t18 = t6 ^ t16;
+  const uint64_t t19 = t9 ^ t14;
+  const uint64_t t20 = t11 ^ t16;
+  const uint64_t t21 = t17 ^ y20;
+  const uint64_t t22 = t18 ^ y19;
+  const uint64_t t23 = t19 ^ y21;
+  const uint64_t t24 = t20 ^ y18;
+
+  const uint64_t t25 = t21 ^ t22;
+  const uint64_t t26 = t21 & t23;
+  const uint64_t t27 = t24 ^ t26;
+  const uint64_t t28 = t25 & t27;
+  const uint64_t t29 = t28 ^ t22;
+  const uint64_t t30 = t23 ^ t24;
+  const uint64_t t31 = t22 ^ t26;
+  const uint64_t t32 = t31 & t30;
+  const uint64_t t33 = t32 ^ t24;
+  const uint64_t t34 = t23 ^ t33;
+  const uint64_t t35 = t27 ^ t33;
+  const uint64_t t36 = t24 & t35;
+  const uint64_t t37 = t36 ^ t34;
+  const uint64_t t38 = t27 ^ t36;
+  const uint64_t t39 = t29 & t38;
+  const uint64_t t40 = t25 ^ t39;
+
+  const uint64_t t41 = t40 ^ t37;
+  const uint64_t t42 = t29 ^ t33;
+  const uint64_t t43 = t29 ^ t40;
+  const uint64_t t44 = t33 ^ t37;
+  const uint64_t t45 = t42 ^ t41;
+  const uint64_t z0 = t44 & y15;
+  const uint64_t z1 = t37 & y6;
+  const uint64_t z2 = t33 & x7;
+  const uint64_t z3 = t43 & y16;
+  const uint64_t z4 = t40 & y1;
+  const uint64_t z5 = t29 & y7;
+  const uint64_t z6 = t42 & y11;
+  const uint64_t z7 = t45 & y17;
+  const uint64_t z8 = t41 & y10;
+  const uint64_t z9 = t44 & y12;
+  const uint64_t z10 = t37 & y3;
+  const uint64_t z11 = t33 & y4;
+  const uint64_t z12 = t43 & y13;
+  const uint64_t z13 = t40 & y5;
+  const uint64_t z14 = t29 & y2;
+  const uint64_t z15 = t42 & y9;
+  const uint64_t z16 = t45 & y14;
+  const uint64_t z17 = t41 & y8;
+
+  // Bottom linear transformation
+  const uint64_t t46 = z15 ^ z16;
+  const uint64_t t47 = z10 ^ z11;
+  const uint64_t t48 = z5 ^ z13;
+  const uint64_t t49 = z9 ^ z10;
+  const uint64_t t50 = z2 ^ z12;
+  const uint64_t t51 = z2 ^ z5;
+  const uint64_t t52 = z7 ^ z8;
+  const uint64_t t53 = z0 ^ z3;
+  const uint64_t t54 = z6 ^ z7;
+  const uint64_t t55 = z16 ^ z17;
+  const uint64_t t56 = z12 ^ t48;
+  const uint64_t t57 = t50 ^ t53;
+  const uint64_t t58 = z4 ^ t46;
+  const uint64_t t59 = z3 ^ t54;
+  const uint64_t t60 = t46 ^ t57;
+  const uint64_t t61 = z14 ^ t57;
+  const uint64_t t62 = t52 ^ t58;
+  const uint64_t t63 = t49 ^ t58;
+  const uint64_t t64 = z4 ^ t59;
+  const uint64_t t65 = t61 ^ t62;
+  const uint64_t t66 = z1 ^ t63;
+  const uint64_t s0 = t59 ^ t63;
+  const uint64_t s6 = t56 ^ ~t62;
+  const uint64_t s7 = t48 ^ ~t60;
+  const uint64_t t67 = t64 ^ t65;
+  const uint64_t s3 = t53 ^ t66;
+  const uint64_t s4 = t51 ^ t66;
+  const uint64_t s5 = t47 ^ t65;
+  const uint64_t s1 = t64 ^ ~s3;
+  const uint64_t s2 = t55 ^ ~t67;
+
+  q[7] = s0;
+  q[6] = s1;
+  q[5] = s2;
+  q[4] = s3;
+  q[3] = s4;
+  q[2] = s5;
+  q[1] = s6;
+  q[0] = s7;
+}
+
+// Inverse of the S-box affine map: bit i of the result is
+// x[i+7] ^ x[i+5] ^ x[i+2] (indices mod 8) ^ bit i of 0x05.
+inline void bs_inv_affine(uint64_t q[8]) {
+  uint64_t x[8];
+  for (int i = 0; i < 8; ++i) x[i] = q[i];
+  for (int i = 0; i < 8; ++i) {
+    q[i] = x[(i + 7) & 7] ^ x[(i + 5) & 7] ^ x[(i + 2) & 7];
   }
+  q[0] = ~q[0];
+  q[2] = ~q[2];
+}
 
-  secure_zero(block, sizeof(block));
+// InvSubBytes(x) = A^-1(S(A^-1(x))) with A^-1 the inverse affine map, which
+// reuses the forward circuit.
+void bs_inv_sbox(uint64_t q[8]) {
+  bs_inv_affine(q);
+  bs_sbox(q);
+  bs_inv_affine(q);
 }
 
-AESCPP_NODISCARD unsigned char *AES::EncryptCBC(const unsigned char in[],
-                                                size_t inLen,
-                                                const unsigned char key[],
-                                                const unsigned char *iv) {
-  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
-  EncryptCBC(in, inLen, key, iv, out.get());
-  return out.release();
+// Transpose between the interleaved byte layout and bit planes.
+void bs_ortho(uint64_t q[8]) {
+  const uint64_t c[3][2] = {{0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL},
+                            {0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL},
+                            {0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL}};
+  for (int k = 0; k < 3; ++k) {
+    const int s = 1 << k;
+    for (int i = 0; i < 8; ++i) {
+      if (i & s) continue;
+      const uint64_t a = q[i];
+      const uint64_t b = q[i + s];
+      q[i] = (a & c[k][0]) | ((b & c[k][0]) << s);
+      q[i + s] = ((a & c[k][1]) >> s) | (b & c[k][1]);
+    }
+  }
 }
 
-void AES::DecryptCBC(const unsigned char in[], size_t inLen,
-                     const unsigned char key[], const unsigned char *iv,
-                     unsigned char out[]) {
-  if (!key) throw std::invalid_argument("Null key");
-  if (!iv) throw std::invalid_argument("Null IV");
-  CheckLength(inLen);
-  auto roundKeys = prepare_round_keys(key);
-  unsigned char block[blockBytesLen];
-  unsigned char temp[blockBytesLen];
-  memcpy(block, iv, blockBytesLen);
+// Spread the four little-endian words of a block over two 64-bit words.
+void bs_interleave_in(uint64_t &q0, uint64_t &q1, const uint32_t w[4]) {
+  uint64_t x[4];
+  for (int i = 0; i < 4; ++i) {
+    x[i] = w[i];
+    x[i] |= x[i] << 16;
+    x[i] &= 0x0000FFFF0000FFFFULL;
+    x[i] |= x[i] << 8;
+    x[i] &= 0x00FF00FF00FF00FFULL;
+  }
+  q0 = x[0] | (x[2] << 8);
+  q1 = x[1] | (x[3] << 8);
+}
 
-  for (size_t i = 0; i < inLen; i += blockBytesLen) {
-    memcpy(temp, in + i, blockBytesLen);
-    DecryptBlock(in + i, out + i, roundKeys->data());
-    XorBlocks(block, out + i, out + i, blockBytesLen);
-    memcpy(block, temp, blockBytesLen);
+void bs_interleave_out(uint32_t w[4], uint64_t q0, uint64_t q1) {
+  uint64_t x[4];
+  x[0] = q0 & 0x00FF00FF00FF00FFULL;
+  x[1] = q1 & 0x00FF00FF00FF00FFULL;
+  x[2] = (q0 >> 8) & 0x00FF00FF00FF00FFULL;
+  x[3] = (q1 >> 8) & 0x00FF00FF00FF00FFULL;
+  for (int i = 0; i < 4; ++i) {
+    x[i] |= x[i] >> 8;
+    x[i] &= 0x0000FFFF0000FFFFULL;
+    w[i] = static_cast<uint32_t>(x[i]) | static_cast<uint32_t>(x[i] >> 16);
   }
+}
 
-  secure_zero(block, sizeof(block));
-  secure_zero(temp, sizeof(temp));
+// Load up to four blocks into bitsliced form; missing blocks are zero.
+void bs_load(const unsigned char *in, size_t blocks, uint64_t q[8]) {
+  uint32_t w[4];
+  for (size_t i = 0; i < 4; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      w[j] = i < blocks ? load_le32(in + 16 * i + 4 * j) : 0;
+    }
+    bs_interleave_in(q[i], q[i + 4], w);
+  }
+  bs_ortho(q);
 }
 
-AESCPP_NODISCARD unsigned char *AES::DecryptCBC(const unsigned char in[],
-                                                size_t inLen,
-                                                const unsigned char key[],
-                                                const unsigned char *iv) {
-  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
-  DecryptCBC(in, inLen, key, iv, out.get());
-  return out.release();
+void bs_store(uint64_t q[8], size_t blocks, unsigned char *out) {
+  uint32_t w[4];
+  bs_ortho(q);
+  for (size_t i = 0; i < blocks; ++i) {
+    bs_interleave_out(w, q[i], q[i + 4]);
+    for (int j = 0; j < 4; ++j) store_le32(out + 16 * i + 4 * j, w[j]);
+  }
 }
 
-void AES::EncryptCFB(const unsigned char in[], size_t inLen,
-                     const unsigned char key[], const unsigned char *iv,
-                     unsigned char out[]) {
-  if (!key) throw std::invalid_argument("Null key");
-  if (!iv) throw std::invalid_argument("Null IV");
-  auto roundKeys = prepare_round_keys(key);
-  unsigned char block[blockBytesLen];
-  unsigned char encryptedBlock[blockBytesLen];
-  memcpy(block, iv, blockBytesLen);
+// Round keys are stored bitsliced, 64 bytes per round, in native byte order.
+inline void bs_add_round_key(uint64_t q[8], const unsigned char *sk) {
+  for (int i = 0; i < 8; ++i) {
+    uint64_t k;
+    memcpy(&k, sk + 8 * i, sizeof(k));
+    q[i] ^= k;
+  }
+}
 
-  for (size_t i = 0; i < inLen; i += blockBytesLen) {
-    EncryptBlock(block, encryptedBlock, roundKeys->data());
-    size_t blockLen = std::min<size_t>(blockBytesLen, inLen - i);
-    XorBlocks(in + i, encryptedBlock, out + i, blockLen);
-    memcpy(block, out + i, blockLen);
+void bs_shift_rows(uint64_t q[8]) {
+  for (int i = 0; i < 8; ++i) {
+    const uint64_t x = q[i];
+    q[i] = (x & 0x000000000000FFFFULL) | ((x & 0x00000000FFF00000ULL) >> 4) |
+           ((x & 0x00000000000F0000ULL) << 12) |
+           ((x & 0x0000FF0000000000ULL) >> 8) |
+           ((x & 0x000000FF00000000ULL) << 8) |
+           ((x & 0xF000000000000000ULL) >> 12) |
+           ((x & 0x0FFF000000000000ULL) << 4);
   }
+}
 
-  secure_zero(block, sizeof(block));
-  secure_zero(encryptedBlock, sizeof(encryptedBlock));
+void bs_inv_shift_rows(uint64_t q[8]) {
+  for (int i = 0; i < 8; ++i) {
+    const uint64_t x = q[i];
+    q[i] = (x & 0x000000000000FFFFULL) | ((x & 0x000000000FFF0000ULL) << 4) |
+           ((x & 0x00000000F0000000ULL) >> 12) |
+           ((x & 0x000000FF00000000ULL) << 8) |
+           ((x & 0x0000FF0000000000ULL) >> 8) |
+           ((x & 0x000F000000000000ULL) << 12) |
+           ((x & 0xFFF0000000000000ULL) >> 4);
+  }
 }
 
-AESCPP_NODISCARD unsigned char *AES::EncryptCFB(const unsigned char in[],
-                                                size_t inLen,
-                                                const unsigned char key[],
-                                                const unsigned char *iv) {
-  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
-  EncryptCFB(in, inLen, key, iv, out.get());
-  return out.release();
+// Rotating a plane by 16 bits moves every byte one row up its column.
+inline uint64_t bs_rotr16(uint64_t x) { return (x << 48) | (x >> 16); }
+inline uint64_t bs_rotr32(uint64_t x) { return (x << 32) | (x >> 32); }
+
+void bs_mix_columns(uint64_t q[8]) {
+  uint64_t r[8];
+  for (int i = 0; i < 8; ++i) r[i] = bs_rotr16(q[i]);
+  const uint64_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+  const uint64_t q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+  q[0] = q7 ^ r[7] ^ r[0] ^ bs_rotr32(q0 ^ r[0]);
+  q[1] = q0 ^ r[0] ^ q7 ^ r[7] ^ r[1] ^ bs_rotr32(q1 ^ r[1]);
+  q[2] = q1 ^ r[1] ^ r[2] ^ bs_rotr32(q2 ^ r[2]);
+  q[3] = q2 ^ r[2] ^ q7 ^ r[7] ^ r[3] ^ bs_rotr32(q3 ^ r[3]);
+  q[4] = q3 ^ r[3] ^ q7 ^ r[7] ^ r[4] ^ bs_rotr32(q4 ^ r[4]);
+  q[5] = q4 ^ r[4] ^ r[5] ^ bs_rotr32(q5 ^ r[5]);
+  q[6] = q5 ^ r[5] ^ r[6] ^ bs_rotr32(q6 ^ r[6]);
+  q[7] = q6 ^ r[6] ^ r[7] ^ bs_rotr32(q7 ^ r[7]);
 }
 
-void AES::DecryptCFB(const unsigned char in[], size_t inLen,
-                     const unsigned char key[], const unsigned char *iv,
-                     unsigned char out[]) {
-  if (!key) throw std::invalid_argument("Null key");
-  if (!iv) throw std::invalid_argument("Null IV");
-  auto roundKeys = prepare_round_keys(key);
-  unsigned char block[blockBytesLen];
-  unsigned char encryptedBlock[blockBytesLen];
-  unsigned char temp[blockBytesLen];
-  memcpy(block, iv, blockBytesLen);
+// InvMixColumns = MixColumns after multiplying each column by
+// {05} + {04}x^2, i.e. s[i] ^= {04} * (s[i] ^ s[i + 2]).
+void bs_inv_mix_columns(uint64_t q[8]) {
+  uint64_t t[8];
+  for (int i = 0; i < 8; ++i) t[i] = q[i] ^ bs_rotr32(q[i]);
+  for (int k = 0; k < 2; ++k) {  // t = {02} * t, twice
+    const uint64_t hi = t[7];
+    for (int i = 7; i > 0; --i) t[i] = t[i - 1];
+    t[0] = hi;
+    t[1] ^= hi;
+    t[3] ^= hi;
+    t[4] ^= hi;
+  }
+  for (int i = 0; i < 8; ++i) q[i] ^= t[i];
+  bs_mix_columns(q);
+}
 
-  for (size_t i = 0; i < inLen; i += blockBytesLen) {
-    EncryptBlock(block, encryptedBlock, roundKeys->data());
-    size_t blockLen = std::min<size_t>(blockBytesLen, inLen - i);
-    memcpy(temp, in + i, blockLen);
-    XorBlocks(temp, encryptedBlock, out + i, blockLen);
-    memcpy(block, temp, blockLen);
+// Convert an expanded key schedule of Nr + 1 round keys to bitsliced form.
+void bs_key_schedule(const unsigned char *w, unsigned int Nr,
+                     unsigned char *sk) {
+  for (unsigned int r = 0; r <= Nr; ++r) {
+    uint32_t k[4];
+    for (int j = 0; j < 4; ++j) k[j] = load_le32(w + 16 * r + 4 * j);
+    uint64_t q[8];
+    bs_interleave_in(q[0], q[4], k);
+    q[1] = q[2] = q[3] = q[0];
+    q[5] = q[6] = q[7] = q[4];
+    bs_ortho(q);
+    memcpy(sk + 64 * r, q, sizeof(q));
+    secure_zero(q, sizeof(q));
+    secure_zero(k, sizeof(k));
   }
+}
 
-  secure_zero(block, sizeof(block));
-  secure_zero(encryptedBlock, sizeof(encryptedBlock));
-  secure_zero(temp, sizeof(temp));
+void bs_encrypt(unsigned int Nr, const unsigned char *sk, uint64_t q[8]) {
+  bs_add_round_key(q, sk);
+  for (unsigned int r = 1; r < Nr; ++r) {
+    bs_sbox(q);
+    bs_shift_rows(q);
+    bs_mix_columns(q);
+    bs_add_round_key(q, sk + 64 * r);
+  }
+  bs_sbox(q);
+  bs_shift_rows(q);
+  bs_add_round_key(q, sk + 64 * Nr);
 }
 
-AESCPP_NODISCARD unsigned char *AES::DecryptCFB(const unsigned char in[],
-                                                size_t inLen,
-                                                const unsigned char key[],
-                                                const unsigned char *iv) {
-  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
-  DecryptCFB(in, inLen, key, iv, out.get());
-  return out.release();
+void bs_decrypt(unsigned int Nr, const unsigned char *sk, uint64_t q[8]) {
+  bs_add_round_key(q, sk + 64 * Nr);
+  for (unsigned int r = Nr - 1; r > 0; --r) {
+    bs_inv_shift_rows(q);
+    bs_inv_sbox(q);
+    bs_add_round_key(q, sk + 64 * r);
+    bs_inv_mix_columns(q);
+  }
+  bs_inv_shift_rows(q);
+  bs_inv_sbox(q);
+  bs_add_round_key(q, sk);
 }
 
-void AES::EncryptCTR(const unsigned char in[], size_t inLen,
-                     const unsigned char key[], const unsigned char iv[],
-                     unsigned char out[]) {
-  if (!key) throw std::invalid_argument("Null key");
-  if (!iv) throw std::invalid_argument("Null IV");
-  auto roundKeys = prepare_round_keys(key);
-  unsigned char counter[blockBytesLen];
-  unsigned char encryptedCounter[blockBytesLen];
-  memcpy(counter, iv, blockBytesLen);
+// Constant-time GHASH for hosts without PCLMULQDQ, after BearSSL's "ctmul64".
+// A field element is held as two 64-bit words: y1 is the first eight bytes in
+// GCM order and y0 the last eight. Carry-less products come from ordinary
+// integer multiplies on operands thinned to every fourth bit, so carries never
+// reach a bit that is kept, and the high half of each 64x64 product comes from
+// the same multiply on bit-reversed operands.
+inline uint64_t load_le64(const unsigned char *p) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+  return v;
+}
 
-  for (size_t i = 0; i < inLen; i += blockBytesLen) {
-    EncryptBlock(counter, encryptedCounter, roundKeys->data());
+inline void store_le64(unsigned char *p, uint64_t v) {
+  for (int i = 0; i < 8; ++i) {
+    p[i] = static_cast<unsigned char>(v);
+    v >>= 8;
+  }
+}
 
-    size_t blockLen = std::min<size_t>(blockBytesLen, inLen - i);
-    XorBlocks(in + i, encryptedCounter, out + i, blockLen);
+// Multiply an XTS tweak by x in GF(2^128). Tweaks are little-endian, so the
+// carry out of bit 127 folds back into byte 0 as 0x87.
+inline void xts_double(unsigned char t[16]) {
+  const uint64_t lo = load_le64(t);
+  const uint64_t hi = load_le64(t + 8);
+  store_le64(t + 8, (hi << 1) | (lo >> 63));
+  store_le64(t, (lo << 1) ^ (0x87 & (0 - (hi >> 63))));
+}
 
-    bool overflow = true;  // detect counter wrap-around
-    for (int j = blockBytesLen - 1; j >= 0; --j) {
-      if (++counter[j] != 0) {
-        overflow = false;
-        break;
-      }
-    }
-    if (overflow) {
-      throw std::length_error("CTR counter overflow");
-    }
-  }
+// Low 64 bits of the carry-less product x * y.
+inline uint64_t ghash_bmul64(uint64_t x, uint64_t y) {
+  const uint64_t m0 = 0x1111111111111111, m1 = 0x2222222222222222;
+  const uint64_t m2 = 0x4444444444444444, m3 = 0x8888888888888888;
+  const uint64_t x0 = x & m0, x1 = x & m1, x2 = x & m2, x3 = x & m3;
+  const uint64_t y0 = y & m0, y1 = y & m1, y2 = y & m2, y3 = y & m3;
+  const uint64_t z0 = (x0 * y0) ^ (x1 * y3) ^ (x2 * y2) ^ (x3 * y1);
+  const uint64_t z1 = (x0 * y1) ^ (x1 * y0) ^ (x2 * y3) ^ (x3 * y2);
+  const uint64_t z2 = (x0 * y2) ^ (x1 * y1) ^ (x2 * y0) ^ (x3 * y3);
+  const uint64_t z3 = (x0 * y3) ^ (x1 * y2) ^ (x2 * y1) ^ (x3 * y0);
+  return (z0 & m0) | (z1 & m1) | (z2 & m2) | (z3 & m3);
+}
 
-  secure_zero(counter, sizeof(counter));
-  secure_zero(encryptedCounter, sizeof(encryptedCounter));
+inline uint64_t ghash_rev64(uint64_t x) {
+  x = ((x & 0x5555555555555555) << 1) | ((x >> 1) & 0x5555555555555555);
+  x = ((x & 0x3333333333333333) << 2) | ((x >> 2) & 0x3333333333333333);
+  x = ((x & 0x0f0f0f0f0f0f0f0f) << 4) | ((x >> 4) & 0x0f0f0f0f0f0f0f0f);
+  x = ((x & 0x00ff00ff00ff00ff) << 8) | ((x >> 8) & 0x00ff00ff00ff00ff);
+  x = ((x & 0x0000ffff0000ffff) << 16) | ((x >> 16) & 0x0000ffff0000ffff);
+  return (x << 32) | (x >> 32);
 }
 
-AESCPP_NODISCARD unsigned char *AES::EncryptCTR(const unsigned char in[],
-                                                size_t inLen,
-                                                const unsigned char key[],
-                                                const unsigned char iv[]) {
-  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
-  EncryptCTR(in, inLen, key, iv, out.get());
-  return out.release();
+// A multiplier: both halves and their bit reversals.
+struct GhashFactor {
+  uint64_t h0, h1, h0r, h1r;
+};
+
+// Unreduced Karatsuba terms of a sum of products, for the direct and the
+// bit-reversed multiplies. Sums of products share one reduction.
+struct GhashAcc {
+  uint64_t z0, z1, z2, z0h, z1h, z2h;
+};
+
+inline GhashFactor ghash_factor(uint64_t h0, uint64_t h1) {
+  return GhashFactor{h0, h1, ghash_rev64(h0), ghash_rev64(h1)};
 }
 
-void AES::DecryptCTR(const unsigned char in[], size_t inLen,
-                     const unsigned char key[], const unsigned char iv[],
-                     unsigned char out[]) {
-  EncryptCTR(in, inLen, key, iv, out);
+// acc += y * h with six 64-bit carry-less multiplies.
+inline void ghash_mul_acc_ct64(uint64_t y0, uint64_t y1, const GhashFactor &h,
+                               GhashAcc &acc) {
+  const uint64_t y0r = ghash_rev64(y0);
+  const uint64_t y1r = ghash_rev64(y1);
+  acc.z0 ^= ghash_bmul64(y0, h.h0);
+  acc.z1 ^= ghash_bmul64(y1, h.h1);
+  acc.z2 ^= ghash_bmul64(y0 ^ y1, h.h0 ^ h.h1);
+  acc.z0h ^= ghash_bmul64(y0r, h.h0r);
+  acc.z1h ^= ghash_bmul64(y1r, h.h1r);
+  acc.z2h ^= ghash_bmul64(y0r ^ y1r, h.h0r ^ h.h1r);
 }
 
-AESCPP_NODISCARD unsigned char *AES::DecryptCTR(const unsigned char in[],
-                                                size_t inLen,
-                                                const unsigned char key[],
-                                                const unsigned char iv[]) {
-  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
-  DecryptCTR(in, inLen, key, iv, out.get());
-  return out.release();
+// Shift the 256-bit carry-less product <v3:v2:v1:v0> left by one for the
+// reflected bit order and reduce it modulo x^128 + x^7 + x^2 + x + 1 into
+// <y1:y0>. Shared with the PMULL backend.
+inline void ghash_fold(uint64_t v0, uint64_t v1, uint64_t v2, uint64_t v3,
+                       uint64_t &y0, uint64_t &y1) {
+  v3 = (v3 << 1) | (v2 >> 63);
+  v2 = (v2 << 1) | (v1 >> 63);
+  v1 = (v1 << 1) | (v0 >> 63);
+  v0 <<= 1;
+  v2 ^= v0 ^ (v0 >> 1) ^ (v0 >> 2) ^ (v0 >> 7);
+  v1 ^= (v0 << 63) ^ (v0 << 62) ^ (v0 << 57);
+  v3 ^= v1 ^ (v1 >> 1) ^ (v1 >> 2) ^ (v1 >> 7);
+  v2 ^= (v1 << 63) ^ (v1 << 62) ^ (v1 << 57);
+  y0 = v2;
+  y1 = v3;
 }
 
-void AES::EncryptGCM(const unsigned char in[], size_t inLen,
-                     const unsigned char key[], const unsigned char iv[],
-                     const unsigned char aad[], size_t aadLen,
-                     unsigned char tag[], unsigned char out[]) {
-  if (!key) throw std::invalid_argument("Null key");
-  if (!iv || (!aad && aadLen > 0) || !tag)
-    throw std::invalid_argument("Null IV, AAD or tag");
-  if (inLen > (1ULL << 32) * 16) throw std::length_error("Input too long");
-  const uint64_t gcmByteLimit = ((1ULL << 39) - 256) / 8;
-  if (aadLen > gcmByteLimit) throw std::length_error("AAD too long");
-  if (aadLen + inLen > gcmByteLimit)
-    throw std::length_error("AAD + input too long");
-  auto roundKeys = prepare_round_keys(key);
+// Recombine the Karatsuba terms into the 256-bit product and reduce it.
+inline void ghash_reduce_ct64(const GhashAcc &acc, uint64_t &y0,
+                              uint64_t &y1) {
+  const uint64_t z2 = acc.z2 ^ acc.z0 ^ acc.z1;
+  const uint64_t z0h = ghash_rev64(acc.z0h) >> 1;
+  const uint64_t z1h = ghash_rev64(acc.z1h) >> 1;
+  const uint64_t z2h = ghash_rev64(acc.z2h ^ acc.z0h ^ acc.z1h) >> 1;
+  ghash_fold(acc.z0, z0h ^ z2, acc.z1 ^ z2h, z1h, y0, y1);
+}
 
-  // Compute hash subkey H
-  unsigned char H[16] = {0};
-  unsigned char zeroBlock[16] = {0};
-  EncryptBlock(zeroBlock, H, roundKeys->data());
+// Single GF(2^128) product in GCM byte order, Z = X * Y. Z may alias X or Y.
+void ghash_mul_ct64(const unsigned char *X, const unsigned char *Y,
+                    unsigned char *Z) {
+  uint64_t y1 = load_be64(X);
+  uint64_t y0 = load_be64(X + 8);
+  GhashFactor h = ghash_factor(load_be64(Y + 8), load_be64(Y));
+  GhashAcc acc = {0, 0, 0, 0, 0, 0};
+  ghash_mul_acc_ct64(y0, y1, h, acc);
+  ghash_reduce_ct64(acc, y0, y1);
+  store_be64(Z, y1);
+  store_be64(Z + 8, y0);
+  secure_zero(&h, sizeof(h));
+  secure_zero(&acc, sizeof(acc));
+}
 
-  // Encrypt data in CTR mode
-  unsigned char ctr[16] = {0};
-  memcpy(ctr, iv, 12);  // IV is 12 bytes
-  ctr[15] = 1;          // Set initial counter value
-  unsigned char encryptedCtr[16] = {0};
+// Fill H^1..H^8 and their Karatsuba halves in the layout of
+// GhashPowersPCLMUL: each power as a little-endian 128-bit integer.
+void ghash_powers_ct64(const unsigned char H[16], unsigned char powers[8][16],
+                       unsigned char karatsuba[8][16]) {
+  uint64_t p0 = load_be64(H + 8);
+  uint64_t p1 = load_be64(H);
+  GhashFactor h = ghash_factor(p0, p1);
+  for (int k = 0; k < 8; ++k) {
+    store_le64(powers[k], p0);
+    store_le64(powers[k] + 8, p1);
+    store_le64(karatsuba[k], p0 ^ p1);
+    store_le64(karatsuba[k] + 8, p0 ^ p1);
+    GhashAcc acc = {0, 0, 0, 0, 0, 0};
+    ghash_mul_acc_ct64(p0, p1, h, acc);
+    ghash_reduce_ct64(acc, p0, p1);
+  }
+  secure_zero(&h, sizeof(h));
+  secure_zero(&p0, sizeof(p0));
+  secure_zero(&p1, sizeof(p1));
+}
 
-  // GHASH for AAD without intermediate buffers
-  memset(tag, 0, 16);
-  for (size_t i = 0; i < aadLen; i += 16) {
-    GHASH(H, aad + i, std::min<size_t>(16, aadLen - i), tag);
+// Bit-reversed halves of each power, so ghash_blocks_ct64 does not redo them
+// on every call.
+void ghash_reversed_ct64(const unsigned char powers[8][16],
+                         uint64_t reversed[8][2]) {
+  for (int k = 0; k < 8; ++k) {
+    reversed[k][0] = ghash_rev64(load_le64(powers[k]));
+    reversed[k][1] = ghash_rev64(load_le64(powers[k] + 8));
   }
+}
+
+// GHASH over `len` bytes. Eight blocks are folded per iteration as
+// Y = (Y ^ X0) * H^8 ^ X1 * H^7 ^ ... ^ X7 * H with a single reduction; a
+// trailing partial block is padded with zeros.
+void ghash_blocks_ct64(const unsigned char powers[8][16],
+                       const uint64_t reversed[8][2], const unsigned char *X,
+                       size_t len, unsigned char tag[16]) {
+  GhashFactor h[8];
+  for (int k = 0; k < 8; ++k) {
+    h[k] = GhashFactor{load_le64(powers[k]), load_le64(powers[k] + 8),
+                       reversed[k][0], reversed[k][1]};
+  }
+  uint64_t y1 = load_be64(tag);
+  uint64_t y0 = load_be64(tag + 8);
 
-  for (size_t i = 0; i < inLen; i += 16) {
-    // Increment counter - GCM requires incrementing J0 before processing data
-    for (int j = 15; j >= 0; --j) {
-      if (++ctr[j]) break;
+  size_t i = 0;
+  for (; i + 8 * 16 <= len; i += 8 * 16) {
+    GhashAcc acc = {0, 0, 0, 0, 0, 0};
+    for (int j = 0; j < 8; ++j) {
+      uint64_t x1 = load_be64(X + i + j * 16);
+      uint64_t x0 = load_be64(X + i + j * 16 + 8);
+      if (j == 0) {
+        x0 ^= y0;
+        x1 ^= y1;
+      }
+      ghash_mul_acc_ct64(x0, x1, h[7 - j], acc);
     }
-    EncryptBlock(ctr, encryptedCtr, roundKeys->data());
+    ghash_reduce_ct64(acc, y0, y1);
+  }
 
-    size_t blockLen = std::min<size_t>(16, inLen - i);
-    XorBlocks(in + i, encryptedCtr, out + i, blockLen);
-    GHASH(H, out + i, blockLen, tag);
+  for (; i < len; i += 16) {
+    unsigned char block[16] = {0};
+    memcpy(block, X + i, std::min<size_t>(16, len - i));
+    y1 ^= load_be64(block);
+    y0 ^= load_be64(block + 8);
+    GhashAcc acc = {0, 0, 0, 0, 0, 0};
+    ghash_mul_acc_ct64(y0, y1, h[0], acc);
+    ghash_reduce_ct64(acc, y0, y1);
+    secure_zero(block, sizeof(block));
   }
 
-  unsigned char lenBlock[16] = {0};
-  uint64_t aadBits = static_cast<uint64_t>(aadLen) * 8;
-  uint64_t lenBits = static_cast<uint64_t>(inLen) * 8;
-  for (int i = 0; i < 8; i++)
-    lenBlock[i] = static_cast<unsigned char>(aadBits >> (56 - 8 * i));
-  for (int i = 0; i < 8; i++)
-    lenBlock[8 + i] = static_cast<unsigned char>(lenBits >> (56 - 8 * i));
-  GHASH(H, lenBlock, 16, tag);
+  store_be64(tag, y1);
+  store_be64(tag + 8, y0);
+  secure_zero(h, sizeof(h));
+}
+}  // namespace
 
-  unsigned char J0[16] = {0};
-  memcpy(J0, iv, 12);
-  J0[15] = 1;
-  unsigned char S[16] = {0};
-  EncryptBlock(J0, S, roundKeys->data());
-  for (int i = 0; i < 16; i++) {
-    tag[i] ^= S[i];
+constexpr size_t AES::defaultCacheCapacity;
+constexpr size_t AES::maxCacheShards;
+
+AES::AES(const AESKeyLength keyLength) : AES(keyLength, defaultCacheCapacity) {}
+
+namespace {
+std::atomic<uint64_t> nextInstanceId{0};
+}  // namespace
+
+AES::AES(const AESKeyLength keyLength, size_t cacheCapacity)
+    : instanceId(nextInstanceId.fetch_add(1, std::memory_order_relaxed) + 1),
+      cacheCapacity(cacheCapacity) {
+  switch (keyLength) {
+    case AESKeyLength::AES_128:
+      this->Nk = 4;
+      this->Nr = 10;
+      break;
+
+    case AESKeyLength::AES_192:
+      this->Nk = 6;
+      this->Nr = 12;
+      break;
+
+    case AESKeyLength::AES_256:
+      this->Nk = 8;
+      this->Nr = 14;
+      break;
   }
 
-  secure_zero(lenBlock, sizeof(lenBlock));
-  secure_zero(H, sizeof(H));
-  secure_zero(zeroBlock, sizeof(zeroBlock));
-  secure_zero(ctr, sizeof(ctr));
-  secure_zero(encryptedCtr, sizeof(encryptedCtr));
-  secure_zero(J0, sizeof(J0));
-  secure_zero(S, sizeof(S));
+  cacheShardCount = std::min(cacheCapacity, maxCacheShards);
+  if (cacheShardCount == 0) return;
+  cacheShards.reset(new CacheShard[cacheShardCount]);
+  for (size_t i = 0; i < cacheShardCount; ++i) {
+    CacheShard &shard = cacheShards[i];
+    shard.capacity = cacheCapacity / cacheShardCount +
+                     (i < cacheCapacity % cacheShardCount ? 1 : 0);
+    shard.entries.reset(new CacheEntry[shard.capacity]);
+  }
+  snapshotHits = std::make_shared<std::atomic<uint64_t>>(0);
 }
 
-AESCPP_NODISCARD unsigned char *AES::EncryptGCM(
-    const unsigned char in[], size_t inLen, const unsigned char key[],
-    const unsigned char iv[], const unsigned char aad[], size_t aadLen,
-    unsigned char tag[]) {
-  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
-  EncryptGCM(in, inLen, key, iv, aad, aadLen, tag, out.get());
-  return out.release();
+// Hits taken from a snapshot are published to snapshotHits in batches of this
+// size, so the fast path does not write the shared counter on every call.
+static constexpr uint64_t snapshotHitBatch = 256;
+
+namespace {
+// Deleter of a snapshot's handle: the handle has its own reference count and
+// holds one reference to the cached schedule until its last copy is gone.
+struct ScheduleRef {
+  std::shared_ptr<const std::vector<unsigned char>> schedule;
+  void operator()(const std::vector<unsigned char> *) { schedule.reset(); }
+};
+}  // namespace
+
+struct AES::ScheduleSnapshot {
+  uint64_t owner = 0;
+  uint64_t epoch = 0;
+  size_t shard = 0;
+  size_t entry = 0;
+  uint64_t version = 0;
+  uint64_t pendingHits = 0;
+  std::shared_ptr<std::atomic<uint64_t>> hits;  // owner's snapshotHits
+  std::shared_ptr<const std::vector<unsigned char>> roundKeys;
+
+  void Publish() {
+    if (pendingHits == 0) return;
+    hits->fetch_add(pendingHits, std::memory_order_relaxed);
+    pendingHits = 0;
+  }
+
+  void Reset() {
+    Publish();
+    hits.reset();
+    roundKeys.reset();
+    owner = 0;
+  }
+};
+
+// A few slots let a thread alternate between keys or AES objects without
+// falling back to the shared cache. Every table is registered so that
+// clear_cache() can release the snapshots of threads that are not calling in;
+// `mutex` is only contended while that happens.
+struct AES::SnapshotTable {
+  static constexpr size_t slotCount = 4;
+  std::mutex mutex;
+  ScheduleSnapshot slots[slotCount];
+  size_t next = 0;
+
+  SnapshotTable();
+  ~SnapshotTable();
+};
+
+constexpr size_t AES::SnapshotTable::slotCount;
+
+namespace {
+struct SnapshotRegistry {
+  std::mutex mutex;
+  std::vector<void *> tables;
+  std::atomic<uint64_t> locks{0};
+};
+
+// Never destroyed, so thread exit during static destruction can still
+// unregister.
+SnapshotRegistry &snapshot_registry() {
+  static SnapshotRegistry *registry = new SnapshotRegistry;
+  return *registry;
 }
 
-void AES::DecryptGCM(const unsigned char in[], size_t inLen,
-                     const unsigned char key[], const unsigned char iv[],
-                     const unsigned char aad[], size_t aadLen,
-                     const unsigned char tag[], unsigned char out[]) {
-  if (!key) throw std::invalid_argument("Null key");
-  if (!iv || (!aad && aadLen > 0) || !tag)
-    throw std::invalid_argument("Null IV, AAD or tag");
-  if (inLen > (1ULL << 32) * 16) throw std::length_error("Input too long");
-  const uint64_t gcmByteLimit = ((1ULL << 39) - 256) / 8;
-  if (aadLen > gcmByteLimit) throw std::length_error("AAD too long");
-  if (aadLen + inLen > gcmByteLimit)
-    throw std::length_error("AAD + input too long");
-  auto roundKeys = prepare_round_keys(key);
+std::unique_lock<std::mutex> lock_snapshot_registry() {
+  SnapshotRegistry &registry = snapshot_registry();
+  registry.locks.fetch_add(1, std::memory_order_relaxed);
+  return std::unique_lock<std::mutex>(registry.mutex);
+}
+}  // namespace
+
+// Number of times the snapshot registry has been locked; used by the tests.
+uint64_t snapshot_registry_lock_count() {
+  return snapshot_registry().locks.load(std::memory_order_relaxed);
+}
 
-  // Compute hash subkey H
-  unsigned char H[16] = {0};
-  unsigned char zeroBlock[16] = {0};
-  EncryptBlock(zeroBlock, H, roundKeys->data());
+AES::SnapshotTable::SnapshotTable() {
+  std::unique_lock<std::mutex> lock = lock_snapshot_registry();
+  snapshot_registry().tables.push_back(this);
+}
 
-  // Decrypt data in CTR mode
-  unsigned char ctr[16] = {0};
-  memcpy(ctr, iv, 12);
-  ctr[15] = 1;  // Set initial counter value
-  unsigned char encryptedCtr[16] = {0};
+AES::SnapshotTable::~SnapshotTable() {
+  std::unique_lock<std::mutex> lock = lock_snapshot_registry();
+  SnapshotRegistry &registry = snapshot_registry();
+  registry.tables.erase(
+      std::find(registry.tables.begin(), registry.tables.end(), this));
+}
 
-  unsigned char calculatedTag[16] = {0};
-  // GHASH for AAD without forming a concatenated buffer
-  for (size_t i = 0; i < aadLen; i += 16) {
-    GHASH(H, aad + i, std::min<size_t>(16, aadLen - i), calculatedTag);
+AES::SnapshotTable &AES::ThreadSnapshots() {
+  static thread_local SnapshotTable table;
+  return table;
+}
+
+AES::~AES() { clear_cache(); }
+
+void AES::clear_cache() {
+  cacheEpoch.fetch_add(1, std::memory_order_relaxed);
+  for (size_t i = 0; i < cacheShardCount; ++i) {
+    CacheShard &shard = cacheShards[i];
+    std::unique_lock<AESCPP_SHARED_MUTEX> lock(shard.mutex);
+    for (size_t j = 0; j < shard.capacity; ++j) {
+      CacheEntry &entry = shard.entries[j];
+      entry.roundKeys.reset();
+      secure_zero(entry.key.data(), entry.key.size());
+      entry.key.clear();
+      entry.referenced.store(false, std::memory_order_relaxed);
+    }
+    shard.hand = 0;
   }
+  ReleaseSnapshots();
+}
 
-  for (size_t i = 0; i < inLen; i += 16) {
-    // Increment counter - GCM requires incrementing J0 before processing data
-    for (int j = 15; j >= 0; --j) {
-      if (++ctr[j]) break;
+void AES::ReleaseSnapshots() {
+  // Pairs with the store in prepare_round_keys: a snapshot taken after this
+  // load was taken after the shards were cleared.
+  if (!snapshotsTaken.load()) return;
+  std::unique_lock<std::mutex> registryLock = lock_snapshot_registry();
+  for (void *p : snapshot_registry().tables) {
+    SnapshotTable &table = *static_cast<SnapshotTable *>(p);
+    std::lock_guard<std::mutex> lock(table.mutex);
+    for (ScheduleSnapshot &slot : table.slots) {
+      if (slot.owner == instanceId) slot.Reset();
     }
-    EncryptBlock(ctr, encryptedCtr, roundKeys->data());
+  }
+}
 
-    size_t blockLen = std::min<size_t>(16, inLen - i);
-    // GHASH must run on the ciphertext before it may be overwritten by
-    // XorBlocks when operating in-place.
-    GHASH(H, in + i, blockLen, calculatedTag);
-    XorBlocks(in + i, encryptedCtr, out + i, blockLen);
+AES::CacheStats AES::cache_stats() const {
+  CacheStats stats;
+  stats.hits = cacheHits.load(std::memory_order_relaxed);
+  stats.misses = cacheMisses.load(std::memory_order_relaxed);
+  stats.evictions = cacheEvictions.load(std::memory_order_relaxed);
+  stats.size = 0;
+  stats.capacity = cacheCapacity;
+  if (cacheShardCount == 0) return stats;
+  stats.hits += snapshotHits->load(std::memory_order_relaxed);
+  // Other threads publish their snapshot hits in batches; this thread's
+  // unpublished hits are added here so its own view is exact.
+  {
+    SnapshotTable &table = ThreadSnapshots();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    for (const ScheduleSnapshot &slot : table.slots) {
+      if (slot.owner == instanceId) stats.hits += slot.pendingHits;
+    }
+  }
+  for (size_t i = 0; i < cacheShardCount; ++i) {
+    CacheShard &shard = cacheShards[i];
+    AESCPP_SHARED_LOCK<AESCPP_SHARED_MUTEX> lock(shard.mutex);
+    for (size_t j = 0; j < shard.capacity; ++j) {
+      if (!shard.entries[j].key.empty()) ++stats.size;
+    }
   }
+  return stats;
+}
 
-  unsigned char lenBlock[16] = {0};
-  uint64_t aadBits = static_cast<uint64_t>(aadLen) * 8;
-  uint64_t lenBits = static_cast<uint64_t>(inLen) * 8;
-  for (int i = 0; i < 8; i++)
-    lenBlock[i] = static_cast<unsigned char>(aadBits >> (56 - 8 * i));
-  for (int i = 0; i < 8; i++)
-    lenBlock[8 + i] = static_cast<unsigned char>(lenBits >> (56 - 8 * i));
-  GHASH(H, lenBlock, 16, calculatedTag);
+size_t AES::ShardIndex(const unsigned char *key) const {
+  // FNV-1a; only picks a lock, so it needs to spread keys, not hide them.
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < 4 * Nk; ++i) {
+    h = (h ^ key[i]) * 0x100000001b3ULL;
+  }
+  return static_cast<size_t>(h >> 32) % cacheShardCount;
+}
 
-  unsigned char J0[16] = {0};
+std::shared_ptr<const std::vector<unsigned char>> AES::prepare_round_keys(
+    const unsigned char *key) {
+  if (cacheShardCount == 0) {
+    cacheMisses.fetch_add(1, std::memory_order_relaxed);
+    return ExpandSchedule(key);
+  }
+  const size_t keyLen = 4 * Nk;
+  const uint64_t epoch = cacheEpoch.load(std::memory_order_relaxed);
+  SnapshotTable &table = ThreadSnapshots();
+  std::lock_guard<std::mutex> lock(table.mutex);
+  // The first round key is the key itself, so snapshots are matched against
+  // their schedule and need no copy of the key.
+  ScheduleSnapshot *match = nullptr;
+  for (ScheduleSnapshot &slot : table.slots) {
+    if (slot.owner == instanceId &&
+        constant_time_eq(slot.roundKeys->data(), key, keyLen)) {
+      match = &slot;
+      break;
+    }
+  }
+  if (match != nullptr) {
+    ScheduleSnapshot &snapshot = *match;
+    CacheEntry &entry = cacheShards[snapshot.shard].entries[snapshot.entry];
+    if (snapshot.epoch == epoch &&
+        entry.version.load(std::memory_order_acquire) == snapshot.version) {
+      // Only write the CLOCK bit after the hand has cleared it, so a hot key
+      // keeps its cache line shared between readers.
+      if (!entry.referenced.load(std::memory_order_relaxed)) {
+        entry.referenced.store(true, std::memory_order_relaxed);
+      }
+      if (++snapshot.pendingHits == snapshotHitBatch) snapshot.Publish();
+      return snapshot.roundKeys;
+    }
+  } else {
+    match = &table.slots[table.next];
+    table.next = (table.next + 1) % SnapshotTable::slotCount;
+  }
+
+  // Slow path. Resetting the slot publishes its pending hits to the object
+  // that took it, whether or not that is this object.
+  if (!snapshotsTaken.load(std::memory_order_relaxed)) {
+    snapshotsTaken.store(true);
+  }
+  ScheduleSnapshot &snapshot = *match;
+  snapshot.Reset();
+  snapshot.shard = ShardIndex(key);
+  std::shared_ptr<const std::vector<unsigned char>> schedule =
+      LookupSchedule(key, snapshot.shard, snapshot.entry, snapshot.version);
+  const std::vector<unsigned char> *data = schedule.get();
+  snapshot.roundKeys = std::shared_ptr<const std::vector<unsigned char>>(
+      data, ScheduleRef{std::move(schedule)});
+  snapshot.owner = instanceId;
+  snapshot.hits = snapshotHits;
+  snapshot.epoch = epoch;
+  return snapshot.roundKeys;
+}
+
+std::shared_ptr<const std::vector<unsigned char>> AES::LookupSchedule(
+    const unsigned char *key, size_t shardIndex, size_t &entryIndex,
+    uint64_t &version) {
+  const size_t keyLen = 4 * Nk;
+  CacheShard &shard = cacheShards[shardIndex];
+  {
+    AESCPP_SHARED_LOCK<AESCPP_SHARED_MUTEX> lock(shard.mutex);
+    for (size_t i = 0; i < shard.capacity; ++i) {
+      CacheEntry &entry = shard.entries[i];
+      if (entry.key.size() == keyLen &&
+          constant_time_eq(entry.key.data(), key, keyLen)) {
+        entry.referenced.store(true, std::memory_order_relaxed);
+        cacheHits.fetch_add(1, std::memory_order_relaxed);
+        entryIndex = i;
+        version = entry.version.load(std::memory_order_relaxed);
+        return entry.roundKeys;
+      }
+    }
+  }
+  std::unique_lock<AESCPP_SHARED_MUTEX> lock(shard.mutex);
+  size_t victim = shard.capacity;
+  for (size_t i = 0; i < shard.capacity; ++i) {
+    CacheEntry &entry = shard.entries[i];
+    if (entry.key.empty()) {
+      if (victim == shard.capacity) victim = i;
+    } else if (constant_time_eq(entry.key.data(), key, keyLen)) {
+      // Another thread inserted the key after we dropped the shared lock.
+      entry.referenced.store(true, std::memory_order_relaxed);
+      cacheHits.fetch_add(1, std::memory_order_relaxed);
+      entryIndex = i;
+      version = entry.version.load(std::memory_order_relaxed);
+      return entry.roundKeys;
+    }
+  }
+  cacheMisses.fetch_add(1, std::memory_order_relaxed);
+  if (victim == shard.capacity) {
+    // CLOCK: give recently used entries a second chance, evict the first one
+    // that has not been hit since the hand last passed it. Snapshot hits set
+    // the bit without the shard lock, so readers could keep every bit set;
+    // after two sweeps the entry under the hand is evicted regardless.
+    for (size_t step = 0; step < 2 * shard.capacity; ++step) {
+      if (!shard.entries[shard.hand].referenced.exchange(
+              false, std::memory_order_relaxed)) {
+        break;
+      }
+      shard.hand = (shard.hand + 1) % shard.capacity;
+    }
+    victim = shard.hand;
+    shard.hand = (shard.hand + 1) % shard.capacity;
+    cacheEvictions.fetch_add(1, std::memory_order_relaxed);
+  }
+  CacheEntry &entry = shard.entries[victim];
+  // Callers and thread snapshots still holding the old schedule keep it
+  // alive; its deleter zeroizes it once they are done.
+  entry.roundKeys.reset();
+  secure_zero(entry.key.data(), entry.key.size());
+  entry.roundKeys = ExpandSchedule(key);
+  entry.key.assign(key, key + keyLen);
+  entry.referenced.store(false, std::memory_order_relaxed);
+  entryIndex = victim;
+  version = entry.version.fetch_add(1, std::memory_order_release) + 1;
+  return entry.roundKeys;
+}
+
+std::shared_ptr<std::vector<unsigned char>> AES::ExpandSchedule(
+    const unsigned char *key) {
+  const size_t scheduleLen = 4 * Nb * (Nr + 1);
+  auto roundKeys = std::shared_ptr<std::vector<unsigned char>>(
+      new std::vector<unsigned char>(2 * scheduleLen + 64 * (Nr + 1) + 1),
+      [](std::vector<unsigned char> *p) {
+        secure_zero(p->data(), p->size());
+        delete p;
+      });  // zeroize on last reference
+  // Encryption schedule, the equivalent inverse cipher schedule and the
+  // bitsliced copy used by the software engine.
+  KeyExpansion(key, roundKeys->data());
+  InvKeyExpansion(roundKeys->data(), roundKeys->data() + scheduleLen);
+  // The bitsliced keys would cost more than the rest of key setup, so they
+  // are only built here while the software engine is selected. Otherwise
+  // BitslicedKeys builds them into the schedule the first time it needs them.
+  const bool bitsliced = kernels().backend == Backend::Software;
+  if (bitsliced) {
+    bs_key_schedule(roundKeys->data(), Nr,
+                    roundKeys->data() + 2 * scheduleLen);
+  }
+  new (roundKeys->data() + 2 * scheduleLen + 64 * (Nr + 1))
+      std::atomic<unsigned char>(bitsliced ? bitslicedReady : bitslicedAbsent);
+  return roundKeys;
+}
+
+const unsigned char *AES::BitslicedKeys(const unsigned char *roundKeys,
+                                        unsigned char scratch[]) const {
+  // Schedules come from ExpandSchedule, which leaves them writable, so the
+  // keys can be filled in after a switch to the software backend. One thread
+  // builds them in place; others that arrive meanwhile use `scratch`.
+  unsigned char *sk =
+      const_cast<unsigned char *>(roundKeys) + 8 * Nb * (Nr + 1);
+  std::atomic<unsigned char> &state =
+      *reinterpret_cast<std::atomic<unsigned char> *>(sk + 64 * (Nr + 1));
+  unsigned char current = state.load(std::memory_order_acquire);
+  if (current == bitslicedReady) return sk;
+  if (current == bitslicedAbsent &&
+      state.compare_exchange_strong(current, bitslicedBuilding,
+                                    std::memory_order_relaxed)) {
+    bs_key_schedule(roundKeys, Nr, sk);
+    state.store(bitslicedReady, std::memory_order_release);
+    return sk;
+  }
+  bs_key_schedule(roundKeys, Nr, scratch);
+  return scratch;
+}
+
+AesKey::AesKey(AESKeyLength keyLength, const unsigned char key[])
+    : keyLength(keyLength) {
+  if (!key) throw std::invalid_argument("Null key");
+  AES aes(keyLength, 0);
+  rounds = aes.Nr;
+  schedule = aes.ExpandSchedule(key);
+}
+
+AesKey::AesKey(AESKeyLength keyLength, const std::vector<unsigned char> &key)
+    : AesKey(keyLength, checked_key_data(keyLength, key)) {}
+
+AESKeyLength AesKey::key_length() const noexcept { return keyLength; }
+
+GcmKey::GcmKey(AESKeyLength keyLength, const unsigned char key[])
+    : key(keyLength, key) {
+  AES aes(keyLength, 0);
+  auto newHashKey = std::shared_ptr<AES::GhashKey>(
+      new AES::GhashKey(), [](AES::GhashKey *p) {
+        secure_zero(p, sizeof(*p));
+        delete p;
+      });  // zeroize on last reference
+  aes.GHASHInit(this->key.schedule->data(), *newHashKey);
+  hashKey = newHashKey;
+}
+
+GcmKey::GcmKey(AESKeyLength keyLength, const std::vector<unsigned char> &key)
+    : GcmKey(keyLength, checked_key_data(keyLength, key)) {}
+
+XtsKey::XtsKey(AESKeyLength keyLength, const unsigned char key[])
+    : dataKey(keyLength, checked_xts_key(keyLength, key)),
+      tweakKey(keyLength, key + xts_half_length(keyLength)) {}
+
+XtsKey::XtsKey(AESKeyLength keyLength, const std::vector<unsigned char> &key)
+    : XtsKey(keyLength, checked_xts_key_data(keyLength, key)) {}
+
+namespace detail {
+GcmStream::GcmStream(const GcmKey &key, const unsigned char iv[], bool decrypt)
+    : key(key), cipher(key.aes_key().key_length(), 0), decrypt(decrypt) {
+  init(iv);
+}
+
+GcmStream::~GcmStream() {
+  secure_zero(J0, sizeof(J0));
+  secure_zero(counter, sizeof(counter));
+  secure_zero(hash, sizeof(hash));
+  secure_zero(keystream, sizeof(keystream));
+  secure_zero(block, sizeof(block));
+}
+
+void GcmStream::init(const unsigned char iv[]) {
+  if (!iv) throw std::invalid_argument("Null IV");
+  memset(J0, 0, sizeof(J0));
   memcpy(J0, iv, 12);
   J0[15] = 1;
-  unsigned char S[16] = {0};
-  EncryptBlock(J0, S, roundKeys->data());
-  for (int i = 0; i < 16; i++) {
-    calculatedTag[i] ^= S[i];
+  memcpy(counter, J0, sizeof(counter));
+  counter[15] = 2;
+  memset(hash, 0, sizeof(hash));
+  secure_zero(keystream, sizeof(keystream));
+  secure_zero(block, sizeof(block));
+  phase = Phase::Aad;
+  aadLen = 0;
+  payloadLen = 0;
+  aadPending = 0;
+}
+
+void GcmStream::aad(const unsigned char aad[], size_t len) {
+  if (phase != Phase::Aad) {
+    throw std::logic_error("AAD must precede the payload");
   }
-  bool tagMatch = constant_time_eq(tag, calculatedTag, 16);
+  if (!aad && len > 0) throw std::invalid_argument("Null AAD");
+  const uint64_t gcmByteLimit = ((1ULL << 39) - 256) / 8;
+  if (len > gcmByteLimit - aadLen) throw std::length_error("AAD too long");
+  if (len == 0) return;
+  aadLen += len;
+
+  if (aadPending != 0) {
+    const size_t n = std::min<size_t>(16 - aadPending, len);
+    memcpy(block + aadPending, aad, n);
+    aadPending += n;
+    aad += n;
+    len -= n;
+    if (aadPending < 16) return;
+    cipher.GHASHBlocks(*key.hashKey, block, 16, hash);
+    aadPending = 0;
+  }
+  const size_t full = len - len % 16;
+  cipher.GHASHBlocks(*key.hashKey, aad, full, hash);
+  aadPending = len - full;
+  memcpy(block, aad + full, aadPending);
+}
 
-  secure_zero(lenBlock, sizeof(lenBlock));
-  secure_zero(H, sizeof(H));
-  secure_zero(zeroBlock, sizeof(zeroBlock));
-  secure_zero(ctr, sizeof(ctr));
-  secure_zero(encryptedCtr, sizeof(encryptedCtr));
-  secure_zero(calculatedTag, sizeof(calculatedTag));
-  secure_zero(J0, sizeof(J0));
+void GcmStream::update(const unsigned char in[], size_t len,
+                       unsigned char out[]) {
+  if (phase == Phase::Finished) {
+    throw std::logic_error("GCM message already finished");
+  }
+  if (len == 0) return;
+  if (!in || !out) throw std::invalid_argument("Null input or output");
+  if (len > (1ULL << 32) * 16 - payloadLen) {
+    throw std::length_error("Input too long");
+  }
+  const uint64_t gcmByteLimit = ((1ULL << 39) - 256) / 8;
+  if (aadLen + payloadLen + len > gcmByteLimit) {
+    throw std::length_error("AAD + input too long");
+  }
+  if (phase == Phase::Aad) {
+    // A trailing partial AAD block is padded with zeros.
+    cipher.GHASHBlocks(*key.hashKey, block, aadPending, hash);
+    aadPending = 0;
+    phase = Phase::Payload;
+  }
+
+  // Rest of the keystream block started by the previous call.
+  const size_t offset = payloadLen % 16;
+  if (offset != 0) {
+    const size_t n = std::min<size_t>(16 - offset, len);
+    Carry(in, n, out);
+    in += n;
+    out += n;
+    len -= n;
+  }
+
+  const unsigned char *roundKeys = cipher.CheckedSchedule(key.aes_key());
+  const size_t full = len - len % 16;
+  if (full != 0) {
+    cipher.GCMCrypt(in, out, full, roundKeys, *key.hashKey, counter, hash,
+                    decrypt);
+    payloadLen += full;
+  }
+  if (full != len) {
+    cipher.EncryptBlock(counter, keystream, roundKeys);
+    ctr_add(counter, 1);
+    Carry(in + full, len - full, out + full);
+  }
+}
+
+void GcmStream::Carry(const unsigned char in[], size_t len,
+                      unsigned char out[]) {
+  const size_t offset = payloadLen % 16;
+  for (size_t i = 0; i < len; ++i) {
+    const unsigned char c = in[i];
+    out[i] = static_cast<unsigned char>(c ^ keystream[offset + i]);
+    block[offset + i] = decrypt ? c : out[i];
+  }
+  payloadLen += len;
+  if (payloadLen % 16 == 0) {
+    cipher.GHASHBlocks(*key.hashKey, block, 16, hash);
+  }
+}
+
+void GcmStream::finish(unsigned char tag[16]) {
+  if (phase == Phase::Finished) {
+    throw std::logic_error("GCM message already finished");
+  }
+  if (phase == Phase::Aad) {
+    cipher.GHASHBlocks(*key.hashKey, block, aadPending, hash);
+  } else {
+    cipher.GHASHBlocks(*key.hashKey, block, payloadLen % 16, hash);
+  }
+
+  unsigned char lenBlock[16];
+  store_be64(lenBlock, aadLen * 8);
+  store_be64(lenBlock + 8, payloadLen * 8);
+  cipher.GHASHBlocks(*key.hashKey, lenBlock, 16, hash);
+
+  unsigned char S[16];
+  cipher.EncryptBlock(J0, S, cipher.CheckedSchedule(key.aes_key()));
+  for (int i = 0; i < 16; i++) tag[i] = hash[i] ^ S[i];
+
+  phase = Phase::Finished;
   secure_zero(S, sizeof(S));
+  secure_zero(hash, sizeof(hash));
+  secure_zero(keystream, sizeof(keystream));
+  secure_zero(block, sizeof(block));
+}
+}  // namespace detail
+
+GcmEncryptor::GcmEncryptor(const GcmKey &key, const unsigned char iv[])
+    : stream(key, iv, false) {}
+
+void GcmEncryptor::init(const unsigned char iv[]) { stream.init(iv); }
+
+void GcmEncryptor::aad(const unsigned char aad[], size_t len) {
+  stream.aad(aad, len);
+}
+
+void GcmEncryptor::update(const unsigned char in[], size_t len,
+                          unsigned char out[]) {
+  stream.update(in, len, out);
+}
+
+void GcmEncryptor::finish(unsigned char tag[]) {
+  if (!tag) throw std::invalid_argument("Null tag");
+  stream.finish(tag);
+}
+
+GcmDecryptor::GcmDecryptor(const GcmKey &key, const unsigned char iv[])
+    : stream(key, iv, true) {}
+
+void GcmDecryptor::init(const unsigned char iv[]) { stream.init(iv); }
+
+void GcmDecryptor::aad(const unsigned char aad[], size_t len) {
+  stream.aad(aad, len);
+}
+
+void GcmDecryptor::update(const unsigned char in[], size_t len,
+                          unsigned char out[]) {
+  stream.update(in, len, out);
+}
+
+void GcmDecryptor::finish(const unsigned char tag[]) {
+  if (!tag) throw std::invalid_argument("Null tag");
+  unsigned char calculatedTag[16];
+  stream.finish(calculatedTag);
+  const bool tagMatch = constant_time_eq(tag, calculatedTag, 16);
+  secure_zero(calculatedTag, sizeof(calculatedTag));
+  if (!tagMatch) throw std::runtime_error("Authentication failed");
+}
+
+namespace detail {
+namespace {
+const char *ModeName(ModeStream::Mode mode) {
+  switch (mode) {
+    case ModeStream::Mode::CTR:
+      return "CTR";
+    case ModeStream::Mode::CBCEncrypt:
+    case ModeStream::Mode::CBCDecrypt:
+      return "CBC";
+    case ModeStream::Mode::CFBEncrypt:
+    case ModeStream::Mode::CFBDecrypt:
+      return "CFB";
+  }
+  return "Stream";
+}
+
+bool IsCbc(ModeStream::Mode mode) {
+  return mode == ModeStream::Mode::CBCEncrypt ||
+         mode == ModeStream::Mode::CBCDecrypt;
+}
+}  // namespace
+
+ModeStream::ModeStream(const AesKey &key, const unsigned char iv[], Mode mode)
+    : key(key), cipher(key.key_length(), 0), mode(mode) {
+  init(iv);
+}
+
+ModeStream::~ModeStream() {
+  secure_zero(chain, sizeof(chain));
+  secure_zero(buffer, sizeof(buffer));
+}
+
+void ModeStream::init(const unsigned char iv[]) {
+  if (!iv) throw std::invalid_argument("Null IV");
+  memcpy(chain, iv, sizeof(chain));
+  secure_zero(buffer, sizeof(buffer));
+  used = IsCbc(mode) ? 0 : sizeof(buffer);
+  finished = false;
+  exhausted = false;
+}
+
+size_t ModeStream::update(const unsigned char in[], size_t len,
+                          unsigned char out[]) {
+  if (finished) {
+    throw std::logic_error(std::string(ModeName(mode)) +
+                           " message already finished");
+  }
+  if (len == 0) return 0;
+  if (!in || !out) throw std::invalid_argument("Null input or output");
+  const unsigned char *roundKeys = cipher.CheckedSchedule(key);
+  switch (mode) {
+    case Mode::CTR:
+      CtrUpdate(in, len, out, roundKeys);
+      return len;
+    case Mode::CBCEncrypt:
+    case Mode::CBCDecrypt:
+      return CbcUpdate(in, len, out, roundKeys);
+    case Mode::CFBEncrypt:
+    case Mode::CFBDecrypt:
+      CfbUpdate(in, len, out, roundKeys);
+      return len;
+  }
+  return 0;
+}
+
+void ModeStream::finish() {
+  if (finished) {
+    throw std::logic_error(std::string(ModeName(mode)) +
+                           " message already finished");
+  }
+  if (IsCbc(mode)) cipher.CheckLength(used);
+  finished = true;
+  secure_zero(chain, sizeof(chain));
+}
+
+void ModeStream::CtrUpdate(const unsigned char in[], size_t len,
+                           unsigned char out[],
+                           const unsigned char *roundKeys) {
+  // Refuse the whole call if it needs a counter past 2^128 - 1, so that no
+  // keystream is ever reused.
+  const size_t carried = std::min<size_t>(sizeof(buffer) - used, len);
+  const uint64_t blocks =
+      (static_cast<uint64_t>(len - carried) + sizeof(buffer) - 1) /
+      sizeof(buffer);
+  if (blocks != 0 &&
+      (exhausted || (load_be64(chain) == UINT64_MAX &&
+                     blocks - 1 > UINT64_MAX - load_be64(chain + 8)))) {
+    throw std::length_error("CTR counter overflow");
+  }
+
+  for (size_t i = 0; i < carried; ++i) {
+    out[i] = static_cast<unsigned char>(in[i] ^ buffer[used + i]);
+  }
+  used += carried;
+  in += carried;
+  out += carried;
+  len -= carried;
+  if (len == 0) return;
+
+  const size_t full = len - len % sizeof(buffer);
+  cipher.CtrXor(in, out, full, roundKeys, chain);
+  if (full != len) {
+    cipher.EncryptBlock(chain, buffer, roundKeys);
+    ctr_add(chain, 1);
+    used = len - full;
+    for (size_t i = 0; i < used; ++i) {
+      out[full + i] = static_cast<unsigned char>(in[full + i] ^ buffer[i]);
+    }
+  }
+  exhausted = load_be64(chain) == 0 && load_be64(chain + 8) == 0;
+}
+
+size_t ModeStream::CbcUpdate(const unsigned char in[], size_t len,
+                             unsigned char out[],
+                             const unsigned char *roundKeys) {
+  size_t written = 0;
+  if (used != 0) {
+    const size_t n = std::min<size_t>(sizeof(buffer) - used, len);
+    memcpy(buffer + used, in, n);
+    used += n;
+    in += n;
+    len -= n;
+    if (used < sizeof(buffer)) return 0;
+    CbcBlocks(buffer, sizeof(buffer), out, roundKeys);
+    written = sizeof(buffer);
+    used = 0;
+  }
+
+  const size_t full = len - len % sizeof(buffer);
+  if (full != 0) CbcBlocks(in, full, out + written, roundKeys);
+  written += full;
+  used = len - full;
+  memcpy(buffer, in + full, used);
+  return written;
+}
+
+void ModeStream::CbcBlocks(const unsigned char in[], size_t len,
+                           unsigned char out[],
+                           const unsigned char *roundKeys) {
+  if (mode == Mode::CBCEncrypt) {
+    cipher.CBCEncrypt(in, len, chain, out, roundKeys);
+    memcpy(chain, out + len - sizeof(chain), sizeof(chain));
+    return;
+  }
+  // `out` may alias `in`, so keep the last ciphertext block first.
+  unsigned char last[16];
+  memcpy(last, in + len - sizeof(last), sizeof(last));
+  cipher.CBCDecrypt(in, len, chain, out, roundKeys);
+  memcpy(chain, last, sizeof(chain));
+  secure_zero(last, sizeof(last));
+}
+
+void ModeStream::CfbUpdate(const unsigned char in[], size_t len,
+                           unsigned char out[],
+                           const unsigned char *roundKeys) {
+  const size_t carried = std::min<size_t>(sizeof(buffer) - used, len);
+  CfbCarry(in, carried, out);
+  in += carried;
+  out += carried;
+  len -= carried;
+  if (len == 0) return;
+
+  const size_t full = len - len % sizeof(buffer);
+  if (full != 0) {
+    if (mode == Mode::CFBEncrypt) {
+      cipher.CFBEncrypt(in, full, chain, out, roundKeys);
+      memcpy(chain, out + full - sizeof(chain), sizeof(chain));
+    } else {
+      unsigned char last[16];
+      memcpy(last, in + full - sizeof(last), sizeof(last));
+      cipher.CFBDecrypt(in, full, chain, out, roundKeys);
+      memcpy(chain, last, sizeof(chain));
+      secure_zero(last, sizeof(last));
+    }
+  }
+  if (full != len) {
+    cipher.EncryptBlock(chain, buffer, roundKeys);
+    used = 0;
+    CfbCarry(in + full, len - full, out + full);
+  }
+}
+
+void ModeStream::CfbCarry(const unsigned char in[], size_t len,
+                          unsigned char out[]) {
+  // The keystream block was taken from `chain`, which now collects the
+  // ciphertext that feeds the next one.
+  for (size_t i = 0; i < len; ++i) {
+    const unsigned char c = in[i];
+    out[i] = static_cast<unsigned char>(c ^ buffer[used + i]);
+    chain[used + i] = mode == Mode::CFBDecrypt ? c : out[i];
+  }
+  used += len;
+}
+}  // namespace detail
+
+CtrEncryptor::CtrEncryptor(const AesKey &key, const unsigned char iv[])
+    : stream(key, iv, detail::ModeStream::Mode::CTR) {}
+
+void CtrEncryptor::init(const unsigned char iv[]) { stream.init(iv); }
+
+void CtrEncryptor::update(const unsigned char in[], size_t len,
+                          unsigned char out[]) {
+  stream.update(in, len, out);
+}
+
+CtrDecryptor::CtrDecryptor(const AesKey &key, const unsigned char iv[])
+    : stream(key, iv, detail::ModeStream::Mode::CTR) {}
+
+void CtrDecryptor::init(const unsigned char iv[]) { stream.init(iv); }
+
+void CtrDecryptor::update(const unsigned char in[], size_t len,
+                          unsigned char out[]) {
+  stream.update(in, len, out);
+}
+
+CbcEncryptor::CbcEncryptor(const AesKey &key, const unsigned char iv[])
+    : stream(key, iv, detail::ModeStream::Mode::CBCEncrypt) {}
+
+void CbcEncryptor::init(const unsigned char iv[]) { stream.init(iv); }
+
+size_t CbcEncryptor::update(const unsigned char in[], size_t len,
+                            unsigned char out[]) {
+  return stream.update(in, len, out);
+}
+
+void CbcEncryptor::finish() { stream.finish(); }
+
+CbcDecryptor::CbcDecryptor(const AesKey &key, const unsigned char iv[])
+    : stream(key, iv, detail::ModeStream::Mode::CBCDecrypt) {}
+
+void CbcDecryptor::init(const unsigned char iv[]) { stream.init(iv); }
+
+size_t CbcDecryptor::update(const unsigned char in[], size_t len,
+                            unsigned char out[]) {
+  return stream.update(in, len, out);
+}
+
+void CbcDecryptor::finish() { stream.finish(); }
+
+CfbEncryptor::CfbEncryptor(const AesKey &key, const unsigned char iv[])
+    : stream(key, iv, detail::ModeStream::Mode::CFBEncrypt) {}
+
+void CfbEncryptor::init(const unsigned char iv[]) { stream.init(iv); }
+
+void CfbEncryptor::update(const unsigned char in[], size_t len,
+                          unsigned char out[]) {
+  stream.update(in, len, out);
+}
+
+CfbDecryptor::CfbDecryptor(const AesKey &key, const unsigned char iv[])
+    : stream(key, iv, detail::ModeStream::Mode::CFBDecrypt) {}
+
+void CfbDecryptor::init(const unsigned char iv[]) { stream.init(iv); }
+
+void CfbDecryptor::update(const unsigned char in[], size_t len,
+                          unsigned char out[]) {
+  stream.update(in, len, out);
+}
+
+constexpr size_t Parallelism::defaultMinBytesPerThread;
+constexpr size_t AES::parallelTileBytes;
+constexpr unsigned char AES::bitslicedAbsent;
+constexpr unsigned char AES::bitslicedReady;
+constexpr unsigned char AES::bitslicedBuilding;
+
+struct ThreadPool::State {
+  std::mutex mutex;
+  std::condition_variable wake;      // work queued or pool stopping
+  std::condition_variable finished;  // a Run batch completed, or work queued
+  std::deque<std::function<void()>> queue;
+  std::vector<std::thread> workers;
+  bool stopping = false;
+};
+
+ThreadPool::ThreadPool(size_t threads) : state(new State()) {
+  State &st = *state;
+  auto worker = [&st]() {
+    std::unique_lock<std::mutex> lock(st.mutex);
+    for (;;) {
+      st.wake.wait(lock, [&st]() { return st.stopping || !st.queue.empty(); });
+      if (st.queue.empty()) return;
+      std::function<void()> job = std::move(st.queue.front());
+      st.queue.pop_front();
+      lock.unlock();
+      job();
+      lock.lock();
+    }
+  };
+  try {
+    for (size_t i = 0; i < threads; ++i) st.workers.emplace_back(worker);
+  } catch (...) {
+    {
+      std::lock_guard<std::mutex> lock(st.mutex);
+      st.stopping = true;
+    }
+    st.wake.notify_all();
+    for (std::thread &t : st.workers) t.join();
+    throw;
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->stopping = true;
+  }
+  state->wake.notify_all();
+  for (std::thread &t : state->workers) t.join();
+}
+
+size_t ThreadPool::size() const noexcept { return state->workers.size(); }
+
+void ThreadPool::Run(size_t count, const std::function<void(size_t)> &task) {
+  if (count == 0) return;
+  State &st = *state;
+  size_t remaining = count - 1;  // guarded by st.mutex
+  std::exception_ptr error;      // first exception thrown, likewise
+  // Queued jobs refer to this frame, so exceptions are caught and rethrown
+  // only once every job has finished.
+  if (remaining != 0) {
+    {
+      std::lock_guard<std::mutex> lock(st.mutex);
+      for (size_t i = 1; i < count; ++i) {
+        st.queue.emplace_back([&st, &task, &remaining, &error, i]() {
+          std::exception_ptr thrown;
+          try {
+            task(i);
+          } catch (...) {
+            thrown = std::current_exception();
+          }
+          std::lock_guard<std::mutex> lock(st.mutex);
+          if (thrown && !error) error = thrown;
+          if (--remaining == 0) st.finished.notify_all();
+        });
+      }
+    }
+    st.wake.notify_all();
+    st.finished.notify_all();
+  }
+  std::exception_ptr thrown;
+  try {
+    task(0);
+  } catch (...) {
+    thrown = std::current_exception();
+  }
+
+  // Help with queued work, ours or another caller's, rather than sleeping
+  // while workers may be busy elsewhere.
+  std::unique_lock<std::mutex> lock(st.mutex);
+  for (;;) {
+    st.finished.wait(lock, [&st, &remaining]() {
+      return remaining == 0 || !st.queue.empty();
+    });
+    if (remaining == 0) break;
+    std::function<void()> job = std::move(st.queue.front());
+    st.queue.pop_front();
+    lock.unlock();
+    job();
+    lock.lock();
+  }
+  if (!thrown) thrown = error;
+  lock.unlock();
+  if (thrown) std::rethrow_exception(thrown);
+}
+
+std::vector<size_t> AES::ParallelSplit(size_t len, size_t align,
+                                       const Parallelism &parallel) {
+  size_t threads = parallel.threads;
+  if (parallel.pool) {
+    const size_t available = parallel.pool->size() + 1;
+    threads = threads == 0 ? available : std::min(threads, available);
+  } else if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  const size_t units = (len + align - 1) / align;
+  threads = std::min(
+      threads, len / std::max<size_t>(parallel.minBytesPerThread, 1));
+  threads = std::min(threads, units);
+
+  // Spread the aligned units evenly; the first `extra` ranges get one more.
+  std::vector<size_t> bounds(1, 0);
+  if (threads < 2) {
+    bounds.push_back(len);
+    return bounds;
+  }
+  const size_t per = units / threads;
+  const size_t extra = units % threads;
+  for (size_t i = 1; i <= threads; ++i) {
+    bounds.push_back(std::min(len, (i * per + std::min(i, extra)) * align));
+  }
+  return bounds;
+}
+
+void AES::RunParallel(const std::vector<size_t> &bounds,
+                      const Parallelism &parallel,
+                      const std::function<void(size_t, size_t)> &task) {
+  const size_t count = bounds.size() - 1;
+  if (count < 2) {
+    task(bounds.front(), bounds.back());
+    return;
+  }
+  const std::function<void(size_t)> range = [&](size_t i) {
+    task(bounds[i], bounds[i + 1]);
+  };
+  if (parallel.pool) {
+    parallel.pool->Run(count, range);
+    return;
+  }
+
+  // Exceptions are kept per range and the first is rethrown once every
+  // thread has been joined.
+  std::vector<std::exception_ptr> errors(count);
+  auto guarded = [&range, &errors](size_t i) {
+    try {
+      range(i);
+    } catch (...) {
+      errors[i] = std::current_exception();
+    }
+  };
+  // Ranges whose thread cannot be started run on the caller instead.
+  std::vector<std::thread> workers;
+  workers.reserve(count - 1);
+  size_t started = 1;
+  try {
+    for (; started < count; ++started) workers.emplace_back(guarded, started);
+  } catch (const std::system_error &) {
+  }
+  guarded(0);
+  for (size_t i = started; i < count; ++i) guarded(i);
+  for (std::thread &t : workers) t.join();
+  for (const std::exception_ptr &e : errors) {
+    if (e) std::rethrow_exception(e);
+  }
+}
+
+void AES::RunParallel(size_t len, size_t align, const Parallelism &parallel,
+                      const std::function<void(size_t, size_t)> &task) {
+  RunParallel(ParallelSplit(len, align, parallel), parallel, task);
+}
+
+void AES::EncryptECB(const unsigned char in[], size_t inLen,
+                     const unsigned char key[], unsigned char out[]) {
+  if (!key) throw std::invalid_argument("Null key");
+  CheckLength(inLen);
+  const auto &roundKeys = prepare_round_keys(key);
+  EncryptBlocks(in, out, inLen / blockBytesLen, roundKeys->data());
+}
+
+void AES::EncryptECB(const unsigned char in[], size_t inLen,
+                     const AesKey &key, unsigned char out[]) {
+  const unsigned char *roundKeys = CheckedSchedule(key);
+  CheckLength(inLen);
+  EncryptBlocks(in, out, inLen / blockBytesLen, roundKeys);
+}
+
+AESCPP_NODISCARD unsigned char *AES::EncryptECB(const unsigned char in[],
+                                                size_t inLen,
+                                                const unsigned char key[]) {
+  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
+  EncryptECB(in, inLen, key, out.get());
+  return out.release();
+}
+
+void AES::DecryptECB(const unsigned char in[], size_t inLen,
+                     const unsigned char key[], unsigned char out[]) {
+  if (!key) throw std::invalid_argument("Null key");
+  CheckLength(inLen);
+  const auto &roundKeys = prepare_round_keys(key);
+  DecryptBlocks(in, out, inLen / blockBytesLen, roundKeys->data());
+}
+
+void AES::DecryptECB(const unsigned char in[], size_t inLen,
+                     const AesKey &key, unsigned char out[]) {
+  const unsigned char *roundKeys = CheckedSchedule(key);
+  CheckLength(inLen);
+  DecryptBlocks(in, out, inLen / blockBytesLen, roundKeys);
+}
+
+void AES::EncryptECB(const unsigned char in[], size_t inLen,
+                     const AesKey &key, unsigned char out[],
+                     const Parallelism &parallel) {
+  const unsigned char *roundKeys = CheckedSchedule(key);
+  CheckLength(inLen);
+  RunParallel(inLen, parallelTileBytes, parallel,
+              [&](size_t begin, size_t end) {
+                EncryptBlocks(in + begin, out + begin,
+                              (end - begin) / blockBytesLen, roundKeys);
+              });
+}
+
+void AES::DecryptECB(const unsigned char in[], size_t inLen,
+                     const AesKey &key, unsigned char out[],
+                     const Parallelism &parallel) {
+  const unsigned char *roundKeys = CheckedSchedule(key);
+  CheckLength(inLen);
+  RunParallel(inLen, parallelTileBytes, parallel,
+              [&](size_t begin, size_t end) {
+                DecryptBlocks(in + begin, out + begin,
+                              (end - begin) / blockBytesLen, roundKeys);
+              });
+}
+
+void AES::EncryptBlocks(const unsigned char in[], size_t blocks,
+                        const AesKey &key, unsigned char out[]) {
+  EncryptBlocks(in, out, blocks, CheckedSchedule(key));
+}
+
+void AES::DecryptBlocks(const unsigned char in[], size_t blocks,
+                        const AesKey &key, unsigned char out[]) {
+  DecryptBlocks(in, out, blocks, CheckedSchedule(key));
+}
+
+AESCPP_NODISCARD unsigned char *AES::DecryptECB(const unsigned char in[],
+                                                size_t inLen,
+                                                const unsigned char key[]) {
+  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
+  DecryptECB(in, inLen, key, out.get());
+  return out.release();
+}
+
+void AES::EncryptCBC(const unsigned char in[], size_t inLen,
+                     const unsigned char key[], const unsigned char *iv,
+                     unsigned char out[]) {
+  if (!key) throw std::invalid_argument("Null key");
+  if (!iv) throw std::invalid_argument("Null IV");
+  CheckLength(inLen);
+  const auto &roundKeys = prepare_round_keys(key);
+  CBCEncrypt(in, inLen, iv, out, roundKeys->data());
+}
+
+void AES::EncryptCBC(const unsigned char in[], size_t inLen,
+                     const AesKey &key, const unsigned char *iv,
+                     unsigned char out[]) {
+  const unsigned char *roundKeys = CheckedSchedule(key);
+  if (!iv) throw std::invalid_argument("Null IV");
+  CheckLength(inLen);
+  CBCEncrypt(in, inLen, iv, out, roundKeys);
+}
+
+void AES::CBCEncrypt(const unsigned char in[], size_t inLen,
+                     const unsigned char *iv, unsigned char out[],
+                     const unsigned char *roundKeys) {
+  unsigned char block[blockBytesLen];
+  memcpy(block, iv, blockBytesLen);
+
+  for (size_t i = 0; i < inLen; i += blockBytesLen) {
+    XorBlocks(block, in + i, block, blockBytesLen);
+    EncryptBlock(block, out + i, roundKeys);
+    memcpy(block, out + i, blockBytesLen);
+  }
+
+  secure_zero(block, sizeof(block));
+}
+
+AESCPP_NODISCARD unsigned char *AES::EncryptCBC(const unsigned char in[],
+                                                size_t inLen,
+                                                const unsigned char key[],
+                                                const unsigned char *iv) {
+  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
+  EncryptCBC(in, inLen, key, iv, out.get());
+  return out.release();
+}
+
+void AES::DecryptCBC(const unsigned char in[], size_t inLen,
+                     const unsigned char key[], const unsigned char *iv,
+                     unsigned char out[]) {
+  if (!key) throw std::invalid_argument("Null key");
+  if (!iv) throw std::invalid_argument("Null IV");
+  CheckLength(inLen);
+  const auto &roundKeys = prepare_round_keys(key);
+  CBCDecrypt(in, inLen, iv, out, roundKeys->data());
+}
+
+void AES::DecryptCBC(const unsigned char in[], size_t inLen,
+                     const AesKey &key, const unsigned char *iv,
+                     unsigned char out[]) {
+  const unsigned char *roundKeys = CheckedSchedule(key);
+  if (!iv) throw std::invalid_argument("Null IV");
+  CheckLength(inLen);
+  CBCDecrypt(in, inLen, iv, out, roundKeys);
+}
+
+void AES::DecryptCBC(const unsigned char in[], size_t inLen,
+                     const AesKey &key, const unsigned char *iv,
+                     unsigned char out[], const Parallelism &parallel) {
+  const unsigned char *roundKeys = CheckedSchedule(key);
+  if (!iv) throw std::invalid_argument("Null IV");
+  CheckLength(inLen);
+  ChainedDecryptParallel(in, inLen, iv, out, roundKeys, false, parallel);
+}
+
+void AES::ChainedDecryptParallel(const unsigned char in[], size_t inLen,
+                                 const unsigned char *iv, unsigned char out[],
+                                 const unsigned char *roundKeys, bool cfb,
+                                 const Parallelism &parallel) {
+  const std::vector<size_t> bounds =
+      ParallelSplit(inLen, parallelTileBytes, parallel);
+  std::vector<unsigned char> chains((bounds.size() - 1) * blockBytesLen);
+  for (size_t i = 0; i + 1 < bounds.size(); ++i) {
+    memcpy(chains.data() + i * blockBytesLen,
+           i == 0 ? iv : in + bounds[i] - blockBytesLen, blockBytesLen);
+  }
+  RunParallel(bounds, parallel, [&](size_t begin, size_t end) {
+    const size_t i =
+        std::lower_bound(bounds.begin(), bounds.end(), begin) - bounds.begin();
+    const unsigned char *chain = chains.data() + i * blockBytesLen;
+    if (cfb) {
+      CFBDecrypt(in + begin, end - begin, chain, out + begin, roundKeys);
+    } else {
+      CBCDecrypt(in + begin, end - begin, chain, out + begin, roundKeys);
+    }
+  });
+  secure_zero(chains.data(), chains.size());
+}
+
+void AES::CBCDecrypt(const unsigned char in[], size_t inLen,
+                     const unsigned char *iv, unsigned char out[],
+                     const unsigned char *roundKeys) {
+  // chain holds the previous ciphertext block followed by the current batch,
+  // so `out` may alias `in`.
+  unsigned char chain[(batchBlocks + 1) * blockBytesLen];
+  memcpy(chain, iv, blockBytesLen);
+
+  for (size_t i = 0; i < inLen; i += batchBlocks * blockBytesLen) {
+    const size_t batchLen =
+        std::min<size_t>(batchBlocks * blockBytesLen, inLen - i);
+    memcpy(chain + blockBytesLen, in + i, batchLen);
+    DecryptBlocks(chain + blockBytesLen, out + i, batchLen / blockBytesLen,
+                  roundKeys);
+    XorBlocks(chain, out + i, out + i, batchLen);
+    memcpy(chain, chain + batchLen, blockBytesLen);
+  }
+
+  secure_zero(chain, sizeof(chain));
+}
+
+AESCPP_NODISCARD unsigned char *AES::DecryptCBC(const unsigned char in[],
+                                                size_t inLen,
+                                                const unsigned char key[],
+                                                const unsigned char *iv) {
+  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
+  DecryptCBC(in, inLen, key, iv, out.get());
+  return out.release();
+}
+
+void AES::EncryptCFB(const unsigned char in[], size_t inLen,
+                     const unsigned char key[], const unsigned char *iv,
+                     unsigned char out[]) {
+  if (!key) throw std::invalid_argument("Null key");
+  if (!iv) throw std::invalid_argument("Null IV");
+  const auto &roundKeys = prepare_round_keys(key);
+  CFBEncrypt(in, inLen, iv, out, roundKeys->data());
+}
+
+void AES::EncryptCFB(const unsigned char in[], size_t inLen,
+                     const AesKey &key, const unsigned char *iv,
+                     unsigned char out[]) {
+  const unsigned char *roundKeys = CheckedSchedule(key);
+  if (!iv) throw std::invalid_argument("Null IV");
+  CFBEncrypt(in, inLen, iv, out, roundKeys);
+}
+
+void AES::CFBEncrypt(const unsigned char in[], size_t inLen,
+                     const unsigned char *iv, unsigned char out[],
+                     const unsigned char *roundKeys) {
+  unsigned char block[blockBytesLen];
+  unsigned char encryptedBlock[blockBytesLen];
+  memcpy(block, iv, blockBytesLen);
+
+  for (size_t i = 0; i < inLen; i += blockBytesLen) {
+    EncryptBlock(block, encryptedBlock, roundKeys);
+    size_t blockLen = std::min<size_t>(blockBytesLen, inLen - i);
+    XorBlocks(in + i, encryptedBlock, out + i, blockLen);
+    memcpy(block, out + i, blockLen);
+  }
+
+  secure_zero(block, sizeof(block));
+  secure_zero(encryptedBlock, sizeof(encryptedBlock));
+}
+
+AESCPP_NODISCARD unsigned char *AES::EncryptCFB(const unsigned char in[],
+                                                size_t inLen,
+                                                const unsigned char key[],
+                                                const unsigned char *iv) {
+  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
+  EncryptCFB(in, inLen, key, iv, out.get());
+  return out.release();
+}
+
+void AES::DecryptCFB(const unsigned char in[], size_t inLen,
+                     const unsigned char key[], const unsigned char *iv,
+                     unsigned char out[]) {
+  if (!key) throw std::invalid_argument("Null key");
+  if (!iv) throw std::invalid_argument("Null IV");
+  const auto &roundKeys = prepare_round_keys(key);
+  CFBDecrypt(in, inLen, iv, out, roundKeys->data());
+}
+
+void AES::DecryptCFB(const unsigned char in[], size_t inLen,
+                     const AesKey &key, const unsigned char *iv,
+                     unsigned char out[]) {
+  const unsigned char *roundKeys = CheckedSchedule(key);
+  if (!iv) throw std::invalid_argument("Null IV");
+  CFBDecrypt(in, inLen, iv, out, roundKeys);
+}
+
+void AES::DecryptCFB(const unsigned char in[], size_t inLen,
+                     const AesKey &key, const unsigned char *iv,
+                     unsigned char out[], const Parallelism &parallel) {
+  const unsigned char *roundKeys = CheckedSchedule(key);
+  if (!iv) throw std::invalid_argument("Null IV");
+  ChainedDecryptParallel(in, inLen, iv, out, roundKeys, true, parallel);
+}
+
+void AES::CFBDecrypt(const unsigned char in[], size_t inLen,
+                     const unsigned char *iv, unsigned char out[],
+                     const unsigned char *roundKeys) {
+  // Keystream block i is E(C[i-1]); all of them are known up front, so a whole
+  // batch is encrypted at once. chain keeps the previous ciphertext block in
+  // front of the batch so that `out` may alias `in`.
+  unsigned char chain[(batchBlocks + 1) * blockBytesLen];
+  unsigned char keystream[batchBlocks * blockBytesLen];
+  memcpy(chain, iv, blockBytesLen);
+
+  for (size_t i = 0; i < inLen; i += batchBlocks * blockBytesLen) {
+    const size_t batchLen =
+        std::min<size_t>(batchBlocks * blockBytesLen, inLen - i);
+    const size_t blocks = (batchLen + blockBytesLen - 1) / blockBytesLen;
+    memcpy(chain + blockBytesLen, in + i, batchLen);
+    EncryptBlocks(chain, keystream, blocks, roundKeys);
+    XorBlocks(chain + blockBytesLen, keystream, out + i, batchLen);
+    memcpy(chain, chain + batchLen, blockBytesLen);
+  }
+
+  secure_zero(chain, sizeof(chain));
+  secure_zero(keystream, sizeof(keystream));
+}
+
+AESCPP_NODISCARD unsigned char *AES::DecryptCFB(const unsigned char in[],
+                                                size_t inLen,
+                                                const unsigned char key[],
+                                                const unsigned char *iv) {
+  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
+  DecryptCFB(in, inLen, key, iv, out.get());
+  return out.release();
+}
+
+void AES::EncryptCTR(const unsigned char in[], size_t inLen,
+                     const unsigned char key[], const unsigned char iv[],
+                     unsigned char out[]) {
+  if (!key) throw std::invalid_argument("Null key");
+  if (!iv) throw std::invalid_argument("Null IV");
+  const auto &roundKeys = prepare_round_keys(key);
+  CTRCrypt(in, inLen, iv, out, roundKeys->data());
+}
+
+void AES::EncryptCTR(const unsigned char in[], size_t inLen,
+                     const AesKey &key, const unsigned char iv[],
+                     unsigned char out[]) {
+  const unsigned char *roundKeys = CheckedSchedule(key);
+  if (!iv) throw std::invalid_argument("Null IV");
+  CTRCrypt(in, inLen, iv, out, roundKeys);
+}
+
+void AES::EncryptCTR(const unsigned char in[], size_t inLen,
+                     const AesKey &key, const unsigned char iv[],
+                     unsigned char out[], const Parallelism &parallel) {
+  const unsigned char *roundKeys = CheckedSchedule(key);
+  if (!iv) throw std::invalid_argument("Null IV");
+  CTRCrypt(in, inLen, iv, out, roundKeys, &parallel);
+}
+
+void AES::CTRCrypt(const unsigned char in[], size_t inLen,
+                   const unsigned char iv[], unsigned char out[],
+                   const unsigned char *roundKeys,
+                   const Parallelism *parallel) {
+  unsigned char counter[blockBytesLen];
+  memcpy(counter, iv, blockBytesLen);
+
+  // Every processed block increments the counter once, so the call fails as
+  // soon as iv + blocks reaches 2^128. Blocks that precede the wrap-around are
+  // still produced, exactly as with a block-by-block loop.
+  const uint64_t blocks = (static_cast<uint64_t>(inLen) + blockBytesLen - 1) /
+                          blockBytesLen;
+  const uint64_t counterHi = load_be64(counter);
+  const uint64_t counterLo = load_be64(counter + 8);
+  const bool overflow =
+      counterHi == UINT64_MAX && blocks > UINT64_MAX - counterLo;
+  size_t len = inLen;
+  if (overflow) {
+    const uint64_t allowed = UINT64_MAX - counterLo + 1;
+    len = std::min<size_t>(inLen, static_cast<size_t>(allowed) * blockBytesLen);
+  }
+
+  if (parallel) {
+    // Each range starts at the counter of its first block.
+    RunParallel(len, blockBytesLen, *parallel, [&](size_t begin, size_t end) {
+      unsigned char start[blockBytesLen];
+      memcpy(start, counter, blockBytesLen);
+      ctr_add(start, begin / blockBytesLen);
+      CtrXor(in + begin, out + begin, end - begin, roundKeys, start);
+      secure_zero(start, sizeof(start));
+    });
+  } else {
+    CtrXor(in, out, len, roundKeys, counter);
+  }
+  secure_zero(counter, sizeof(counter));
+  if (overflow) {
+    throw std::length_error("CTR counter overflow");
+  }
+}
+
+AESCPP_NODISCARD unsigned char *AES::EncryptCTR(const unsigned char in[],
+                                                size_t inLen,
+                                                const unsigned char key[],
+                                                const unsigned char iv[]) {
+  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
+  EncryptCTR(in, inLen, key, iv, out.get());
+  return out.release();
+}
+
+void AES::DecryptCTR(const unsigned char in[], size_t inLen,
+                     const unsigned char key[], const unsigned char iv[],
+                     unsigned char out[]) {
+  EncryptCTR(in, inLen, key, iv, out);
+}
+
+void AES::DecryptCTR(const unsigned char in[], size_t inLen,
+                     const AesKey &key, const unsigned char iv[],
+                     unsigned char out[]) {
+  EncryptCTR(in, inLen, key, iv, out);
+}
+
+void AES::DecryptCTR(const unsigned char in[], size_t inLen,
+                     const AesKey &key, const unsigned char iv[],
+                     unsigned char out[], const Parallelism &parallel) {
+  EncryptCTR(in, inLen, key, iv, out, parallel);
+}
+
+AESCPP_NODISCARD unsigned char *AES::DecryptCTR(const unsigned char in[],
+                                                size_t inLen,
+                                                const unsigned char key[],
+                                                const unsigned char iv[]) {
+  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
+  DecryptCTR(in, inLen, key, iv, out.get());
+  return out.release();
+}
+
+void AES::EncryptXTS(const unsigned char in[], size_t inLen,
+                     const XtsKey &key, uint64_t sector, unsigned char out[]) {
+  XTSCrypt(in, inLen, key, inLen, sector, out, false);
+}
+
+void AES::DecryptXTS(const unsigned char in[], size_t inLen,
+                     const XtsKey &key, uint64_t sector, unsigned char out[]) {
+  XTSCrypt(in, inLen, key, inLen, sector, out, true);
+}
+
+void AES::EncryptXTSSectors(const unsigned char in[], size_t inLen,
+                            const XtsKey &key, size_t sectorSize,
+                            uint64_t firstSector, unsigned char out[]) {
+  XTSCrypt(in, inLen, key, sectorSize, firstSector, out, false);
+}
+
+void AES::DecryptXTSSectors(const unsigned char in[], size_t inLen,
+                            const XtsKey &key, size_t sectorSize,
+                            uint64_t firstSector, unsigned char out[]) {
+  XTSCrypt(in, inLen, key, sectorSize, firstSector, out, true);
+}
+
+void AES::EncryptXTSSectors(const unsigned char in[], size_t inLen,
+                            const XtsKey &key, size_t sectorSize,
+                            uint64_t firstSector, unsigned char out[],
+                            const Parallelism &parallel) {
+  XTSCrypt(in, inLen, key, sectorSize, firstSector, out, false, &parallel);
+}
+
+void AES::DecryptXTSSectors(const unsigned char in[], size_t inLen,
+                            const XtsKey &key, size_t sectorSize,
+                            uint64_t firstSector, unsigned char out[],
+                            const Parallelism &parallel) {
+  XTSCrypt(in, inLen, key, sectorSize, firstSector, out, true, &parallel);
+}
+
+void AES::XTSCrypt(const unsigned char in[], size_t inLen, const XtsKey &key,
+                   size_t sectorSize, uint64_t firstSector,
+                   unsigned char out[], bool decrypt,
+                   const Parallelism *parallel) {
+  CheckedSchedule(key.dataKey);
+  // IEEE 1619 allows at most 2^20 blocks per data unit.
+  if (sectorSize < blockBytesLen || sectorSize > (size_t(1) << 24)) {
+    throw std::length_error("XTS data unit must be 16 to 2^24 bytes");
+  }
+  if (inLen % sectorSize != 0) {
+    throw std::length_error("Input length must be a multiple of sectorSize");
+  }
+  const size_t count = inLen / sectorSize;
+  if (count == 0) return;
+  if (static_cast<uint64_t>(count - 1) > UINT64_MAX - firstSector) {
+    throw std::length_error("XTS sector number overflow");
+  }
+
+  if (parallel) {
+    // Ranges hold whole sectors, each numbered from its own first one.
+    RunParallel(inLen, sectorSize, *parallel, [&](size_t begin, size_t end) {
+      XTSSectors(in + begin, sectorSize, (end - begin) / sectorSize, key,
+                 firstSector + begin / sectorSize, out + begin, decrypt);
+    });
+  } else {
+    XTSSectors(in, sectorSize, count, key, firstSector, out, decrypt);
+  }
+}
+
+void AES::XTSSectors(const unsigned char in[], size_t unitLen, size_t count,
+                     const XtsKey &key, uint64_t first, unsigned char out[],
+                     bool decrypt) {
+  const unsigned char *dataKeys = key.dataKey.schedule->data();
+  const unsigned char *tweakKeys = key.tweakKey.schedule->data();
+  // Initial tweaks of a batch of sectors go through the multi-block kernel
+  // together, instead of one single-block call per sector.
+  const size_t batch = 4 * batchBlocks;
+  unsigned char tweaks[4 * batchBlocks * blockBytesLen];
+  for (size_t i = 0; i < count; i += batch) {
+    const size_t n = std::min(batch, count - i);
+    memset(tweaks, 0, n * blockBytesLen);
+    for (size_t j = 0; j < n; ++j) {
+      store_le64(tweaks + j * blockBytesLen, first + i + j);
+    }
+    EncryptBlocks(tweaks, tweaks, n, tweakKeys);
+    for (size_t j = 0; j < n; ++j) {
+      const size_t offset = (i + j) * unitLen;
+      XTSUnit(in + offset, unitLen, out + offset, dataKeys,
+              tweaks + j * blockBytesLen, decrypt);
+    }
+  }
+  secure_zero(tweaks, sizeof(tweaks));
+}
+
+void AES::XTSUnit(const unsigned char in[], size_t len, unsigned char out[],
+                  const unsigned char *roundKeys, unsigned char tweak[16],
+                  bool decrypt) {
+  const size_t tail = len % blockBytesLen;
+  const size_t blocks = len / blockBytesLen - (tail ? 1 : 0);
+  XTSBlocks(in, out, blocks, roundKeys, tweak, decrypt);
+  if (tail == 0) return;
+
+  // Ciphertext stealing (IEEE 1619, 5.3.2): the last full block borrows the
+  // tail of its neighbour's output and the two swap places. Decryption
+  // undoes them in reverse tweak order. Both inputs are read before either
+  // output is written, so `out` may alias `in`.
+  const unsigned char *lastIn = in + blocks * blockBytesLen;
+  unsigned char *lastOut = out + blocks * blockBytesLen;
+  unsigned char stolen[blockBytesLen];
+  unsigned char merged[blockBytesLen];
+  if (!decrypt) {
+    XTSBlocks(lastIn, stolen, 1, roundKeys, tweak, false);
+    memcpy(merged, lastIn + blockBytesLen, tail);
+  } else {
+    unsigned char next[blockBytesLen];
+    memcpy(next, tweak, blockBytesLen);
+    xts_double(next);
+    XTSBlocks(lastIn, stolen, 1, roundKeys, next, true);
+    memcpy(merged, lastIn + blockBytesLen, tail);
+    secure_zero(next, sizeof(next));
+  }
+  memcpy(merged + tail, stolen + tail, blockBytesLen - tail);
+  memcpy(lastOut + blockBytesLen, stolen, tail);
+  XTSBlocks(merged, lastOut, 1, roundKeys, tweak, decrypt);
+  secure_zero(stolen, sizeof(stolen));
+  secure_zero(merged, sizeof(merged));
+}
+
+void AES::EncryptCCM(const unsigned char in[], size_t inLen,
+                     const AesKey &key, const unsigned char nonce[],
+                     size_t nonceLen, const unsigned char aad[], size_t aadLen,
+                     unsigned char tag[], size_t tagLen, unsigned char out[]) {
+  const unsigned char *roundKeys = CheckedSchedule(key);
+  CheckCCMArgs(inLen, nonce, nonceLen, aad, aadLen, tag, tagLen);
+  unsigned char fullTag[16];
+  CCMCrypt(in, inLen, roundKeys, nonce, nonceLen, aad, aadLen, tagLen,
+           fullTag, out, false);
+  memcpy(tag, fullTag, tagLen);
+  secure_zero(fullTag, sizeof(fullTag));
+}
+
+void AES::DecryptCCM(const unsigned char in[], size_t inLen,
+                     const AesKey &key, const unsigned char nonce[],
+                     size_t nonceLen, const unsigned char aad[], size_t aadLen,
+                     const unsigned char tag[], size_t tagLen,
+                     unsigned char out[]) {
+  const unsigned char *roundKeys = CheckedSchedule(key);
+  CheckCCMArgs(inLen, nonce, nonceLen, aad, aadLen, tag, tagLen);
+  unsigned char fullTag[16];
+  CCMCrypt(in, inLen, roundKeys, nonce, nonceLen, aad, aadLen, tagLen,
+           fullTag, out, true);
+  const bool tagMatch = constant_time_eq(tag, fullTag, tagLen);
+  secure_zero(fullTag, sizeof(fullTag));
+  if (!tagMatch) {
+    secure_zero(out, inLen);
+    throw std::runtime_error("Authentication failed");
+  }
+}
+
+void AES::CCMCrypt(const unsigned char in[], size_t inLen,
+                   const unsigned char *roundKeys, const unsigned char nonce[],
+                   size_t nonceLen, const unsigned char aad[], size_t aadLen,
+                   size_t tagLen, unsigned char tag[16], unsigned char out[],
+                   bool decrypt) {
+  const size_t lengthBytes = 15 - nonceLen;
+
+  // B0: flags, nonce and message length.
+  unsigned char block[blockBytesLen];
+  block[0] = static_cast<unsigned char>((aadLen > 0 ? 0x40 : 0) |
+                                        ((tagLen - 2) / 2) << 3 |
+                                        (lengthBytes - 1));
+  memcpy(block + 1, nonce, nonceLen);
+  uint64_t remaining = inLen;
+  for (size_t i = blockBytesLen - 1; i > nonceLen; --i) {
+    block[i] = static_cast<unsigned char>(remaining);
+    remaining >>= 8;
+  }
+  unsigned char mac[blockBytesLen] = {0};
+  CBCMACBlocks(block, 1, roundKeys, mac);
+
+  if (aadLen > 0) {
+    // The AAD follows its encoded length and is zero-padded to a block.
+    const uint64_t len = aadLen;
+    size_t prefix = 0;
+    memset(block, 0, sizeof(block));
+    if (len < 0xff00) {
+      prefix = 2;
+    } else if (len >> 32 == 0) {
+      block[0] = 0xff;
+      block[1] = 0xfe;
+      prefix = 6;
+    } else {
+      block[0] = 0xff;
+      block[1] = 0xff;
+      prefix = 10;
+    }
+    const size_t lengthField = prefix == 2 ? 2 : prefix - 2;
+    for (size_t i = 0; i < lengthField; ++i) {
+      block[prefix - 1 - i] = static_cast<unsigned char>(len >> (8 * i));
+    }
+    const size_t head = std::min<size_t>(blockBytesLen - prefix, aadLen);
+    memcpy(block + prefix, aad, head);
+    CBCMACBlocks(block, 1, roundKeys, mac);
+    const size_t fullBlocks = (aadLen - head) / blockBytesLen;
+    CBCMACBlocks(aad + head, fullBlocks, roundKeys, mac);
+    const size_t rest = aadLen - head - fullBlocks * blockBytesLen;
+    if (rest > 0) {
+      memset(block, 0, sizeof(block));
+      memcpy(block, aad + aadLen - rest, rest);
+      CBCMACBlocks(block, 1, roundKeys, mac);
+    }
+  }
+
+  // Counter block A0 encrypts the tag; the payload starts at A1.
+  unsigned char counter[blockBytesLen] = {0};
+  counter[0] = static_cast<unsigned char>(lengthBytes - 1);
+  memcpy(counter + 1, nonce, nonceLen);
+  unsigned char s0[blockBytesLen];
+  EncryptBlock(counter, s0, roundKeys);
+  counter[blockBytesLen - 1] = 1;
+
+  const size_t fullBlocks = inLen / blockBytesLen;
+  CCMBlocks(in, out, fullBlocks, roundKeys, counter, mac, decrypt);
+  const size_t tail = inLen % blockBytesLen;
+  if (tail > 0) {
+    unsigned char keystream[blockBytesLen];
+    EncryptBlock(counter, keystream, roundKeys);
+    const unsigned char *src = in + fullBlocks * blockBytesLen;
+    unsigned char *dst = out + fullBlocks * blockBytesLen;
+    memset(block, 0, sizeof(block));
+    for (size_t i = 0; i < tail; ++i) {
+      const unsigned char o = src[i] ^ keystream[i];
+      block[i] = decrypt ? o : src[i];
+      dst[i] = o;
+    }
+    CBCMACBlocks(block, 1, roundKeys, mac);
+    secure_zero(keystream, sizeof(keystream));
+  }
+
+  XorBlocks(mac, s0, tag, blockBytesLen);
+  secure_zero(block, sizeof(block));
+  secure_zero(mac, sizeof(mac));
+  secure_zero(counter, sizeof(counter));
+  secure_zero(s0, sizeof(s0));
+}
+
+void AES::EncryptGCM(const unsigned char in[], size_t inLen,
+                     const unsigned char key[], const unsigned char iv[],
+                     const unsigned char aad[], size_t aadLen,
+                     unsigned char tag[], unsigned char out[]) {
+  if (!key) throw std::invalid_argument("Null key");
+  CheckGCMArgs(inLen, iv, aad, aadLen, tag);
+  const auto &roundKeys = prepare_round_keys(key);
+
+  // Compute hash subkey H and its powers
+  GhashKey hashKey = {};
+  GHASHInit(roundKeys->data(), hashKey);
+  GCMSeal(in, inLen, roundKeys->data(), hashKey, iv, aad, aadLen, tag, out);
+  secure_zero(&hashKey, sizeof(hashKey));
+}
+
+void AES::EncryptGCM(const unsigned char in[], size_t inLen,
+                     const GcmKey &key, const unsigned char iv[],
+                     const unsigned char aad[], size_t aadLen,
+                     unsigned char tag[], unsigned char out[]) {
+  const unsigned char *roundKeys = CheckedSchedule(key.key);
+  CheckGCMArgs(inLen, iv, aad, aadLen, tag);
+  GCMSeal(in, inLen, roundKeys, *key.hashKey, iv, aad, aadLen, tag, out);
+}
+
+void AES::EncryptGCM(const unsigned char in[], size_t inLen,
+                     const GcmKey &key, const unsigned char iv[],
+                     const unsigned char aad[], size_t aadLen,
+                     unsigned char tag[], unsigned char out[],
+                     const Parallelism &parallel) {
+  const unsigned char *roundKeys = CheckedSchedule(key.key);
+  CheckGCMArgs(inLen, iv, aad, aadLen, tag);
+  GCMSeal(in, inLen, roundKeys, *key.hashKey, iv, aad, aadLen, tag, out,
+          &parallel);
+}
+
+void AES::GCMSeal(const unsigned char in[], size_t inLen,
+                  const unsigned char *roundKeys, const GhashKey &hashKey,
+                  const unsigned char iv[], const unsigned char aad[],
+                  size_t aadLen, unsigned char tag[], unsigned char out[],
+                  const Parallelism *parallel) {
+  // GHASH for AAD without intermediate buffers
+  memset(tag, 0, 16);
+  GHASHBlocks(hashKey, aad, aadLen, tag);
+
+  // Encrypt data in CTR mode starting from inc32(J0)
+  unsigned char ctr[16] = {0};
+  memcpy(ctr, iv, 12);  // IV is 12 bytes
+  ctr[15] = 2;
+  if (parallel) {
+    GCMCryptParallel(in, out, inLen, roundKeys, hashKey, ctr, tag, false,
+                     *parallel);
+  } else {
+    GCMCrypt(in, out, inLen, roundKeys, hashKey, ctr, tag, false);
+  }
+
+  unsigned char lenBlock[16] = {0};
+  uint64_t aadBits = static_cast<uint64_t>(aadLen) * 8;
+  uint64_t lenBits = static_cast<uint64_t>(inLen) * 8;
+  for (int i = 0; i < 8; i++)
+    lenBlock[i] = static_cast<unsigned char>(aadBits >> (56 - 8 * i));
+  for (int i = 0; i < 8; i++)
+    lenBlock[8 + i] = static_cast<unsigned char>(lenBits >> (56 - 8 * i));
+  GHASHBlocks(hashKey, lenBlock, 16, tag);
+
+  unsigned char J0[16] = {0};
+  memcpy(J0, iv, 12);
+  J0[15] = 1;
+  unsigned char S[16] = {0};
+  EncryptBlock(J0, S, roundKeys);
+  for (int i = 0; i < 16; i++) {
+    tag[i] ^= S[i];
+  }
+
+  secure_zero(lenBlock, sizeof(lenBlock));
+  secure_zero(ctr, sizeof(ctr));
+  secure_zero(J0, sizeof(J0));
+  secure_zero(S, sizeof(S));
+}
+
+AESCPP_NODISCARD unsigned char *AES::EncryptGCM(
+    const unsigned char in[], size_t inLen, const unsigned char key[],
+    const unsigned char iv[], const unsigned char aad[], size_t aadLen,
+    unsigned char tag[]) {
+  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
+  EncryptGCM(in, inLen, key, iv, aad, aadLen, tag, out.get());
+  return out.release();
+}
+
+void AES::DecryptGCM(const unsigned char in[], size_t inLen,
+                     const unsigned char key[], const unsigned char iv[],
+                     const unsigned char aad[], size_t aadLen,
+                     const unsigned char tag[], unsigned char out[]) {
+  if (!key) throw std::invalid_argument("Null key");
+  CheckGCMArgs(inLen, iv, aad, aadLen, tag);
+  const auto &roundKeys = prepare_round_keys(key);
+
+  // Compute hash subkey H and its powers
+  GhashKey hashKey = {};
+  GHASHInit(roundKeys->data(), hashKey);
+  const bool tagMatch = GCMOpen(in, inLen, roundKeys->data(), hashKey, iv, aad,
+                                aadLen, tag, out);
+  secure_zero(&hashKey, sizeof(hashKey));
+  if (!tagMatch) throw std::runtime_error("Authentication failed");
+}
+
+void AES::DecryptGCM(const unsigned char in[], size_t inLen,
+                     const GcmKey &key, const unsigned char iv[],
+                     const unsigned char aad[], size_t aadLen,
+                     const unsigned char tag[], unsigned char out[]) {
+  const unsigned char *roundKeys = CheckedSchedule(key.key);
+  CheckGCMArgs(inLen, iv, aad, aadLen, tag);
+  if (!GCMOpen(in, inLen, roundKeys, *key.hashKey, iv, aad, aadLen, tag, out))
+    throw std::runtime_error("Authentication failed");
+}
+
+void AES::DecryptGCM(const unsigned char in[], size_t inLen,
+                     const GcmKey &key, const unsigned char iv[],
+                     const unsigned char aad[], size_t aadLen,
+                     const unsigned char tag[], unsigned char out[],
+                     const Parallelism &parallel) {
+  const unsigned char *roundKeys = CheckedSchedule(key.key);
+  CheckGCMArgs(inLen, iv, aad, aadLen, tag);
+  if (!GCMOpen(in, inLen, roundKeys, *key.hashKey, iv, aad, aadLen, tag, out,
+               &parallel))
+    throw std::runtime_error("Authentication failed");
+}
+
+bool AES::GCMOpen(const unsigned char in[], size_t inLen,
+                  const unsigned char *roundKeys, const GhashKey &hashKey,
+                  const unsigned char iv[], const unsigned char aad[],
+                  size_t aadLen, const unsigned char tag[],
+                  unsigned char out[], const Parallelism *parallel) {
+  unsigned char calculatedTag[16] = {0};
+  // GHASH for AAD without forming a concatenated buffer
+  GHASHBlocks(hashKey, aad, aadLen, calculatedTag);
+
+  // Decrypt data in CTR mode starting from inc32(J0). GCMCrypt hashes the
+  // ciphertext before it may be overwritten when operating in-place.
+  unsigned char ctr[16] = {0};
+  memcpy(ctr, iv, 12);
+  ctr[15] = 2;
+  if (parallel) {
+    GCMCryptParallel(in, out, inLen, roundKeys, hashKey, ctr, calculatedTag,
+                     true, *parallel);
+  } else {
+    GCMCrypt(in, out, inLen, roundKeys, hashKey, ctr, calculatedTag, true);
+  }
+
+  unsigned char lenBlock[16] = {0};
+  uint64_t aadBits = static_cast<uint64_t>(aadLen) * 8;
+  uint64_t lenBits = static_cast<uint64_t>(inLen) * 8;
+  for (int i = 0; i < 8; i++)
+    lenBlock[i] = static_cast<unsigned char>(aadBits >> (56 - 8 * i));
+  for (int i = 0; i < 8; i++)
+    lenBlock[8 + i] = static_cast<unsigned char>(lenBits >> (56 - 8 * i));
+  GHASHBlocks(hashKey, lenBlock, 16, calculatedTag);
+
+  unsigned char J0[16] = {0};
+  memcpy(J0, iv, 12);
+  J0[15] = 1;
+  unsigned char S[16] = {0};
+  EncryptBlock(J0, S, roundKeys);
+  for (int i = 0; i < 16; i++) {
+    calculatedTag[i] ^= S[i];
+  }
+  bool tagMatch = constant_time_eq(tag, calculatedTag, 16);
+
+  secure_zero(lenBlock, sizeof(lenBlock));
+  secure_zero(ctr, sizeof(ctr));
+  secure_zero(calculatedTag, sizeof(calculatedTag));
+  secure_zero(J0, sizeof(J0));
+  secure_zero(S, sizeof(S));
+
+  if (!tagMatch) secure_zero(out, inLen);
+  return tagMatch;
+}
+
+AESCPP_NODISCARD unsigned char *AES::DecryptGCM(
+    const unsigned char in[], size_t inLen, const unsigned char key[],
+    const unsigned char iv[], const unsigned char aad[], size_t aadLen,
+    const unsigned char tag[]) {
+  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
+  DecryptGCM(in, inLen, key, iv, aad, aadLen, tag, out.get());
+  return out.release();
+}
+
+void AES::CheckLength(size_t len) {
+  // ensure input length is a multiple of the block size
+  if (len % blockBytesLen != 0) {
+    throw std::length_error("Plaintext length must be divisible by " +
+                            std::to_string(blockBytesLen));
+  }
+}
+
+void AES::CheckGCMArgs(size_t inLen, const unsigned char iv[],
+                       const unsigned char aad[], size_t aadLen,
+                       const unsigned char tag[]) {
+  if (!iv || (!aad && aadLen > 0) || !tag)
+    throw std::invalid_argument("Null IV, AAD or tag");
+  if (inLen > (1ULL << 32) * 16) throw std::length_error("Input too long");
+  const uint64_t gcmByteLimit = ((1ULL << 39) - 256) / 8;
+  if (aadLen > gcmByteLimit) throw std::length_error("AAD too long");
+  if (aadLen + inLen > gcmByteLimit)
+    throw std::length_error("AAD + input too long");
+}
+
+void AES::CheckCCMArgs(size_t inLen, const unsigned char nonce[],
+                       size_t nonceLen, const unsigned char aad[],
+                       size_t aadLen, const unsigned char tag[],
+                       size_t tagLen) {
+  if (!nonce || (!aad && aadLen > 0) || !tag)
+    throw std::invalid_argument("Null nonce, AAD or tag");
+  if (nonceLen < 7 || nonceLen > 13)
+    throw std::invalid_argument("CCM nonce must be 7 to 13 bytes");
+  if (tagLen < 4 || tagLen > 16 || tagLen % 2 != 0)
+    throw std::invalid_argument("CCM tag must be 4, 6, ..., 16 bytes");
+  // The message length is stored in the 15 - nonceLen bytes left by B0.
+  const size_t lengthBytes = 15 - nonceLen;
+  if (lengthBytes < 8 && static_cast<uint64_t>(inLen) >> (8 * lengthBytes))
+    throw std::length_error("Input too long for the CCM nonce length");
+}
+
+const unsigned char *AES::CheckedSchedule(const AesKey &key) const {
+  if (!key.schedule) throw std::invalid_argument("Empty key");
+  if (key.rounds != Nr) throw std::invalid_argument("Key length mismatch");
+  return key.schedule->data();
+}
+
+const unsigned char *AES::CheckedKey(ByteSpan key) const {
+  if (key.size() != 4 * Nk) throw std::invalid_argument("Invalid key size");
+  return key.data();
+}
+
+#if defined(AESCPP_X86_KERNELS)
+template <unsigned int Nr>
+AESCPP_TARGET("aes,sse2")
+static void EncryptBlockAESNI(const unsigned char in[], unsigned char out[],
+                              const unsigned char *roundKeys) {
+  __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+  m = _mm_xor_si128(
+      m, _mm_loadu_si128(reinterpret_cast<const __m128i *>(roundKeys)));
+  AESCPP_UNROLL
+  for (unsigned int i = 1; i < Nr; ++i) {
+    m = _mm_aesenc_si128(
+        m,
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(roundKeys + i * 16)));
+  }
+  m = _mm_aesenclast_si128(
+      m,
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(roundKeys + Nr * 16)));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(out), m);
+}
+
+// `decKeys` is the equivalent inverse cipher schedule built by
+// InvKeyExpansion, so no `aesimc` is needed per block.
+template <unsigned int Nr>
+AESCPP_TARGET("aes,sse2")
+static void DecryptBlockAESNI(const unsigned char in[], unsigned char out[],
+                              const unsigned char *decKeys) {
+  __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+  m = _mm_xor_si128(
+      m, _mm_loadu_si128(reinterpret_cast<const __m128i *>(decKeys)));
+  AESCPP_UNROLL
+  for (unsigned int i = 1; i < Nr; ++i) {
+    m = _mm_aesdec_si128(
+        m,
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(decKeys + i * 16)));
+  }
+  m = _mm_aesdeclast_si128(
+      m,
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(decKeys + Nr * 16)));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(out), m);
+}
+
+// Encrypt `blocks` independent blocks, eight per iteration with interleaved
+// `aesenc` chains.
+template <unsigned int Nr>
+AESCPP_TARGET("aes,sse2")
+static void EncryptBlocksAESNI(const unsigned char in[], unsigned char out[],
+                               size_t blocks, const unsigned char *roundKeys) {
+  __m128i rk[Nr + 1];
+  AESCPP_UNROLL
+  for (unsigned int r = 0; r <= Nr; ++r) {
+    rk[r] =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(roundKeys + r * 16));
+  }
+  size_t i = 0;
+  for (; i + 8 <= blocks; i += 8) {
+    __m128i b[8];
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) {
+      b[j] = _mm_xor_si128(
+          _mm_loadu_si128(
+              reinterpret_cast<const __m128i *>(in + (i + j) * 16)),
+          rk[0]);
+    }
+    AESCPP_UNROLL
+    for (unsigned int r = 1; r < Nr; ++r) {
+      AESCPP_UNROLL
+      for (int j = 0; j < 8; ++j) b[j] = _mm_aesenc_si128(b[j], rk[r]);
+    }
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) {
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + (i + j) * 16),
+                       _mm_aesenclast_si128(b[j], rk[Nr]));
+    }
+  }
+  for (; i < blocks; ++i) {
+    __m128i b = _mm_xor_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 16)),
+        rk[0]);
+    AESCPP_UNROLL
+    for (unsigned int r = 1; r < Nr; ++r) b = _mm_aesenc_si128(b, rk[r]);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 16),
+                     _mm_aesenclast_si128(b, rk[Nr]));
+  }
+}
+
+// Decrypt `blocks` independent blocks with the equivalent inverse cipher
+// schedule, eight per iteration with interleaved `aesdec` chains.
+template <unsigned int Nr>
+AESCPP_TARGET("aes,sse2")
+static void DecryptBlocksAESNI(const unsigned char in[], unsigned char out[],
+                               size_t blocks, const unsigned char *decKeys) {
+  __m128i rk[Nr + 1];
+  AESCPP_UNROLL
+  for (unsigned int r = 0; r <= Nr; ++r) {
+    rk[r] =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(decKeys + r * 16));
+  }
+  size_t i = 0;
+  for (; i + 8 <= blocks; i += 8) {
+    __m128i b[8];
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) {
+      b[j] = _mm_xor_si128(
+          _mm_loadu_si128(
+              reinterpret_cast<const __m128i *>(in + (i + j) * 16)),
+          rk[0]);
+    }
+    AESCPP_UNROLL
+    for (unsigned int r = 1; r < Nr; ++r) {
+      AESCPP_UNROLL
+      for (int j = 0; j < 8; ++j) b[j] = _mm_aesdec_si128(b[j], rk[r]);
+    }
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) {
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + (i + j) * 16),
+                       _mm_aesdeclast_si128(b[j], rk[Nr]));
+    }
+  }
+  for (; i < blocks; ++i) {
+    __m128i b = _mm_xor_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 16)),
+        rk[0]);
+    AESCPP_UNROLL
+    for (unsigned int r = 1; r < Nr; ++r) b = _mm_aesdec_si128(b, rk[r]);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 16),
+                     _mm_aesdeclast_si128(b, rk[Nr]));
+  }
+}
+
+// FIPS-197 key expansion with SubWord and RotWord done by `aeskeygenassist`,
+// which also makes key setup constant time. The source word is placed in
+// dword 1, so dword 0 of the result is SubWord(temp) and dword 1 is
+// RotWord(SubWord(temp)); Rcon is applied here since the instruction only
+// takes an immediate. The loop is unrolled per key size, so the word index
+// tests are resolved at compile time.
+template <unsigned int Nk, unsigned int Nr>
+AESCPP_TARGET("aes,sse2")
+static void KeyExpansionAESNI(const unsigned char key[], unsigned char w[]) {
+  std::memcpy(w, key, 4 * Nk);
+  AESCPP_UNROLL
+  for (unsigned int i = Nk; i < 4 * (Nr + 1); ++i) {
+    uint32_t temp;
+    std::memcpy(&temp, w + 4 * (i - 1), 4);
+    if (i % Nk == 0 || (Nk > 6 && i % Nk == 4)) {
+      const __m128i t = _mm_aeskeygenassist_si128(
+          _mm_set_epi32(0, 0, static_cast<int>(temp), 0), 0);
+      if (i % Nk == 0) {
+        temp = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_srli_si128(t, 4))) ^
+               RCON_TABLE[i / Nk - 1];
+      } else {
+        temp = static_cast<uint32_t>(_mm_cvtsi128_si32(t));
+      }
+    }
+    uint32_t prev;
+    std::memcpy(&prev, w + 4 * (i - Nk), 4);
+    temp ^= prev;
+    std::memcpy(w + 4 * i, &temp, 4);
+  }
+}
+
+// Equivalent inverse cipher schedule: the encryption round keys in reverse
+// order with `aesimc` applied to all but the first and last.
+template <unsigned int Nr>
+AESCPP_TARGET("aes,sse2")
+static void InvKeyExpansionAESNI(const unsigned char w[], unsigned char dw[]) {
+  std::memcpy(dw, w + Nr * 16, 16);
+  AESCPP_UNROLL
+  for (unsigned int round = 1; round < Nr; ++round) {
+    const __m128i rk = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(w + (Nr - round) * 16));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dw + round * 16),
+                     _mm_aesimc_si128(rk));
+  }
+  std::memcpy(dw + Nr * 16, w, 16);
+}
+#endif
+
+#if defined(AESCPP_X86_KERNELS)
+// CTR keystream XOR over `len` bytes, eight counter blocks per iteration.
+// Round keys stay in registers and the eight `aesenc` chains are interleaved
+// so the AES unit is never waiting on a single block. Counters are kept as a
+// little-endian 128-bit value and built with 64-bit SIMD adds whenever the low
+// half cannot carry inside the batch. `counter` is advanced past the last
+// block consumed; the caller guarantees it does not wrap.
+template <unsigned int Nr>
+AESCPP_TARGET("aes,ssse3")
+static void CtrXorAESNI(const unsigned char in[], unsigned char out[],
+                        size_t len, const unsigned char *roundKeys,
+                        unsigned char counter[16]) {
+  __m128i rk[Nr + 1];
+  AESCPP_UNROLL
+  for (unsigned int r = 0; r <= Nr; ++r) {
+    rk[r] =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(roundKeys + r * 16));
+  }
+  const __m128i bswap =
+      _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  uint64_t hi = load_be64(counter);
+  uint64_t lo = load_be64(counter + 8);
+
+  size_t i = 0;
+  for (; i + 8 * 16 <= len; i += 8 * 16) {
+    __m128i b[8];
+    if (lo <= UINT64_MAX - 7) {
+      const __m128i c = _mm_set_epi64x(static_cast<long long>(hi),
+                                       static_cast<long long>(lo));
+      AESCPP_UNROLL
+      for (int j = 0; j < 8; ++j) {
+        b[j] = _mm_shuffle_epi8(_mm_add_epi64(c, _mm_set_epi64x(0, j)), bswap);
+      }
+    } else {
+      AESCPP_UNROLL
+      for (int j = 0; j < 8; ++j) {
+        const uint64_t l = lo + static_cast<uint64_t>(j);
+        const uint64_t h = hi + (l < lo);
+        b[j] = _mm_shuffle_epi8(_mm_set_epi64x(static_cast<long long>(h),
+                                               static_cast<long long>(l)),
+                                bswap);
+      }
+    }
+    lo += 8;
+    hi += lo < 8;
+
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) b[j] = _mm_xor_si128(b[j], rk[0]);
+    AESCPP_UNROLL
+    for (unsigned int r = 1; r < Nr; ++r) {
+      AESCPP_UNROLL
+      for (int j = 0; j < 8; ++j) b[j] = _mm_aesenc_si128(b[j], rk[r]);
+    }
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) {
+      b[j] = _mm_aesenclast_si128(b[j], rk[Nr]);
+      const __m128i p =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + j * 16));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + j * 16),
+                       _mm_xor_si128(b[j], p));
+    }
+  }
+
+  for (; i < len; i += 16) {
+    __m128i b = _mm_shuffle_epi8(
+        _mm_set_epi64x(static_cast<long long>(hi), static_cast<long long>(lo)),
+        bswap);
+    ++lo;
+    hi += lo == 0;
+    b = _mm_xor_si128(b, rk[0]);
+    AESCPP_UNROLL
+    for (unsigned int r = 1; r < Nr; ++r) b = _mm_aesenc_si128(b, rk[r]);
+    b = _mm_aesenclast_si128(b, rk[Nr]);
+    if (len - i >= 16) {
+      const __m128i p =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                       _mm_xor_si128(b, p));
+    } else {
+      unsigned char ks[16];
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(ks), b);
+      for (size_t j = 0; j < len - i; ++j) out[i + j] = in[i + j] ^ ks[j];
+      secure_zero(ks, sizeof(ks));
+    }
+  }
+
+  store_be64(counter, hi);
+  store_be64(counter + 8, lo);
+}
+
+// XTS over whole blocks, eight per iteration with interleaved round chains.
+// The tweak stays in a register and is multiplied by x with a 64-bit lane
+// shift plus a masked XOR of the two carries: bit 63 into bit 64 and bit 127
+// back in as 0x87. Each block's tweak is folded into the last round key, so
+// the output whitening costs no extra instruction.
+AESCPP_TARGET("sse2")
+static inline __m128i xts_double_sse(__m128i t) {
+  const __m128i carries = _mm_srai_epi32(_mm_shuffle_epi32(t, 0x5f), 31);
+  return _mm_xor_si128(_mm_slli_epi64(t, 1),
+                       _mm_and_si128(carries, _mm_set_epi32(0, 1, 0, 0x87)));
+}
+
+template <bool Decrypt>
+AESCPP_TARGET("aes,sse2")
+static inline __m128i xts_round(__m128i b, __m128i k) {
+  return Decrypt ? _mm_aesdec_si128(b, k) : _mm_aesenc_si128(b, k);
+}
+
+template <bool Decrypt>
+AESCPP_TARGET("aes,sse2")
+static inline __m128i xts_last_round(__m128i b, __m128i k) {
+  return Decrypt ? _mm_aesdeclast_si128(b, k) : _mm_aesenclast_si128(b, k);
+}
+
+// `roundKeys` is the equivalent inverse cipher schedule when decrypting.
+template <unsigned int Nr, bool Decrypt>
+AESCPP_TARGET("aes,sse2")
+static void XtsCryptAESNI(const unsigned char in[], unsigned char out[],
+                          size_t blocks, const unsigned char *roundKeys,
+                          unsigned char tweak[16]) {
+  __m128i rk[Nr + 1];
+  AESCPP_UNROLL
+  for (unsigned int r = 0; r <= Nr; ++r) {
+    rk[r] =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(roundKeys + r * 16));
+  }
+  __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tweak));
+
+  size_t i = 0;
+  for (; i + 8 <= blocks; i += 8) {
+    __m128i b[8];
+    __m128i last[8];
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) {
+      const __m128i p =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + (i + j) * 16));
+      b[j] = _mm_xor_si128(p, _mm_xor_si128(t, rk[0]));
+      last[j] = _mm_xor_si128(t, rk[Nr]);
+      t = xts_double_sse(t);
+    }
+    AESCPP_UNROLL
+    for (unsigned int r = 1; r < Nr; ++r) {
+      AESCPP_UNROLL
+      for (int j = 0; j < 8; ++j) b[j] = xts_round<Decrypt>(b[j], rk[r]);
+    }
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) {
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + (i + j) * 16),
+                       xts_last_round<Decrypt>(b[j], last[j]));
+    }
+  }
+
+  for (; i < blocks; ++i) {
+    __m128i b = _mm_xor_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 16)),
+        _mm_xor_si128(t, rk[0]));
+    AESCPP_UNROLL
+    for (unsigned int r = 1; r < Nr; ++r) b = xts_round<Decrypt>(b, rk[r]);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 16),
+                     xts_last_round<Decrypt>(b, _mm_xor_si128(t, rk[Nr])));
+    t = xts_double_sse(t);
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(tweak), t);
+}
+
+// CCM over whole blocks. CBC-MAC is one serial chain, so each iteration runs
+// a MAC block and, interleaved with it round by round, the CTR keystream for
+// the next block; the keystream is produced in the MAC's latency. Keeping it
+// one block ahead is what lets decryption MAC a block's plaintext in the same
+// iteration that recovers it. `counter` ends past the last block consumed.
+template <unsigned int Nr, bool Decrypt>
+AESCPP_TARGET("aes,ssse3")
+static void CcmCryptAESNI(const unsigned char in[], unsigned char out[],
+                          size_t blocks, const unsigned char *roundKeys,
+                          unsigned char counter[16], unsigned char mac[16]) {
+  if (blocks == 0) return;
+  __m128i rk[Nr + 1];
+  AESCPP_UNROLL
+  for (unsigned int r = 0; r <= Nr; ++r) {
+    rk[r] =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(roundKeys + r * 16));
+  }
+  const __m128i bswap =
+      _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  uint64_t hi = load_be64(counter);
+  uint64_t lo = load_be64(counter + 8);
+
+  __m128i ks = _mm_xor_si128(
+      _mm_shuffle_epi8(_mm_set_epi64x(static_cast<long long>(hi),
+                                      static_cast<long long>(lo)),
+                       bswap),
+      rk[0]);
+  AESCPP_UNROLL
+  for (unsigned int r = 1; r < Nr; ++r) ks = _mm_aesenc_si128(ks, rk[r]);
+  ks = _mm_aesenclast_si128(ks, rk[Nr]);
+
+  __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(mac));
+  for (size_t i = 0; i < blocks; ++i) {
+    ++lo;
+    hi += lo == 0;
+    const __m128i x =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i * 16));
+    const __m128i o = _mm_xor_si128(x, ks);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 16), o);
+    __m128i m = _mm_xor_si128(y, _mm_xor_si128(Decrypt ? o : x, rk[0]));
+    __m128i k = _mm_xor_si128(
+        _mm_shuffle_epi8(_mm_set_epi64x(static_cast<long long>(hi),
+                                        static_cast<long long>(lo)),
+                         bswap),
+        rk[0]);
+    AESCPP_UNROLL
+    for (unsigned int r = 1; r < Nr; ++r) {
+      m = _mm_aesenc_si128(m, rk[r]);
+      k = _mm_aesenc_si128(k, rk[r]);
+    }
+    y = _mm_aesenclast_si128(m, rk[Nr]);
+    ks = _mm_aesenclast_si128(k, rk[Nr]);
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(mac), y);
+  store_be64(counter, hi);
+  store_be64(counter + 8, lo);
+}
+#endif
+
+#if defined(AESCPP_X86_KERNELS) || defined(GF_MUL_VERIFY)
+// GHASH operands are kept byte-reflected so that GCM's bit order lines up with
+// the PCLMULQDQ lanes, following Intel's "Carry-Less Multiplication Instruction
+// and its Usage for Computing the GCM Mode".
+AESCPP_TARGET("pclmul,ssse3")
+static inline __m128i ghash_bswap(__m128i x) {
+  return _mm_shuffle_epi8(
+      x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+// XOR of the two 64-bit halves in the low lane, the Karatsuba middle operand.
+AESCPP_TARGET("pclmul,ssse3")
+static inline __m128i ghash_karatsuba_key(__m128i h) {
+  return _mm_xor_si128(h, _mm_shuffle_epi32(h, 0x4e));
+}
+
+// Accumulate the unreduced product x * h into <hi:mid:lo> with three
+// PCLMULQDQ. `hk` is ghash_karatsuba_key(h).
+AESCPP_TARGET("pclmul,ssse3")
+static inline void ghash_mul_acc(__m128i x, __m128i h, __m128i hk,
+                                 __m128i &lo, __m128i &mid, __m128i &hi) {
+  lo = _mm_xor_si128(lo, _mm_clmulepi64_si128(x, h, 0x00));
+  hi = _mm_xor_si128(hi, _mm_clmulepi64_si128(x, h, 0x11));
+  mid = _mm_xor_si128(mid,
+                      _mm_clmulepi64_si128(ghash_karatsuba_key(x), hk, 0x00));
+}
+
+// Recombine the Karatsuba sums and reduce the 256-bit product modulo
+// x^128 + x^7 + x^2 + x + 1, including the one-bit shift that the reflected
+// representation needs.
+AESCPP_TARGET("pclmul,ssse3")
+static inline __m128i ghash_reduce(__m128i lo, __m128i mid, __m128i hi) {
+  mid = _mm_xor_si128(mid, _mm_xor_si128(lo, hi));
+  lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+  hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+  __m128i t7 = _mm_srli_epi32(lo, 31);
+  __m128i t8 = _mm_srli_epi32(hi, 31);
+  lo = _mm_slli_epi32(lo, 1);
+  hi = _mm_slli_epi32(hi, 1);
+  __m128i t9 = _mm_srli_si128(t7, 12);
+  t8 = _mm_slli_si128(t8, 4);
+  t7 = _mm_slli_si128(t7, 4);
+  lo = _mm_or_si128(lo, t7);
+  hi = _mm_or_si128(_mm_or_si128(hi, t8), t9);
+
+  t7 = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31),
+                                   _mm_slli_epi32(lo, 30)),
+                     _mm_slli_epi32(lo, 25));
+  t8 = _mm_srli_si128(t7, 4);
+  lo = _mm_xor_si128(lo, _mm_slli_si128(t7, 12));
+  __m128i t2 = _mm_xor_si128(
+      _mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)),
+      _mm_xor_si128(_mm_srli_epi32(lo, 7), t8));
+  return _mm_xor_si128(hi, _mm_xor_si128(lo, t2));
+}
+
+AESCPP_TARGET("pclmul,ssse3")
+static inline __m128i ghash_mul(__m128i x, __m128i h) {
+  __m128i lo = _mm_setzero_si128();
+  __m128i mid = _mm_setzero_si128();
+  __m128i hi = _mm_setzero_si128();
+  ghash_mul_acc(x, h, ghash_karatsuba_key(h), lo, mid, hi);
+  return ghash_reduce(lo, mid, hi);
+}
+
+// Fill H^1..H^8 and their Karatsuba halves for aggregated GHASH.
+AESCPP_TARGET("pclmul,ssse3")
+static void GhashPowersPCLMUL(const unsigned char H[16],
+                              unsigned char powers[8][16],
+                              unsigned char karatsuba[8][16]) {
+  const __m128i h =
+      ghash_bswap(_mm_loadu_si128(reinterpret_cast<const __m128i *>(H)));
+  __m128i p = h;
+  for (int k = 0; k < 8; ++k) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(powers[k]), p);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(karatsuba[k]),
+                     ghash_karatsuba_key(p));
+    p = ghash_mul(p, h);
+  }
+}
+
+// GHASH over `len` bytes. Eight blocks are folded per iteration as
+// Y = (Y ^ X0) * H^8 ^ X1 * H^7 ^ ... ^ X7 * H with a single reduction.
+AESCPP_TARGET("pclmul,ssse3")
+static void GhashBlocksPCLMUL(const unsigned char powers[8][16],
+                              const unsigned char karatsuba[8][16],
+                              const unsigned char *X, size_t len,
+                              unsigned char tag[16]) {
+  __m128i hp[8], hk[8];
+  for (int k = 0; k < 8; ++k) {
+    hp[k] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(powers[k]));
+    hk[k] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(karatsuba[k]));
+  }
+  __m128i y = ghash_bswap(_mm_loadu_si128(reinterpret_cast<__m128i *>(tag)));
+
+  size_t i = 0;
+  for (; i + 8 * 16 <= len; i += 8 * 16) {
+    __m128i lo = _mm_setzero_si128();
+    __m128i mid = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    for (int j = 0; j < 8; ++j) {
+      __m128i x = ghash_bswap(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(X + i + j * 16)));
+      if (j == 0) x = _mm_xor_si128(x, y);
+      ghash_mul_acc(x, hp[7 - j], hk[7 - j], lo, mid, hi);
+    }
+    y = ghash_reduce(lo, mid, hi);
+  }
+
+  for (; i < len; i += 16) {
+    __m128i x;
+    if (len - i >= 16) {
+      x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(X + i));
+    } else {
+      unsigned char block[16] = {0};
+      memcpy(block, X + i, len - i);
+      x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block));
+      secure_zero(block, sizeof(block));
+    }
+    y = ghash_mul(_mm_xor_si128(y, ghash_bswap(x)), hp[0]);
+  }
+
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(tag), ghash_bswap(y));
+}
+// Single GF(2^128) product in GCM bit order, Z = X * Y.
+AESCPP_TARGET("pclmul,ssse3")
+static void GfMultiplyPCLMUL(const unsigned char *X, const unsigned char *Y,
+                             unsigned char *Z) {
+  const __m128i x =
+      ghash_bswap(_mm_loadu_si128(reinterpret_cast<const __m128i *>(X)));
+  const __m128i y =
+      ghash_bswap(_mm_loadu_si128(reinterpret_cast<const __m128i *>(Y)));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(Z),
+                   ghash_bswap(ghash_mul(x, y)));
+}
+#endif
+
+#if defined(AESCPP_X86_KERNELS)
+// Stitched GCM over the whole 128-byte batches of `len`. Each iteration runs
+// eight interleaved `aesenc` chains on consecutive counters and, between the
+// AES rounds, the eight Karatsuba multiplies of an aggregated GHASH step, so
+// the AES and PCLMULQDQ units work in parallel and the batch is reduced once.
+// Decryption hashes the ciphertext of the current batch; encryption hashes
+// the ciphertext produced by the previous iteration and finishes with the
+// last batch. Counters use GCM's 32-bit increment. Returns the number of
+// bytes processed; `counter` and `tag` are updated accordingly.
+template <unsigned int Nr>
+AESCPP_TARGET("aes,pclmul,ssse3")
+static size_t GcmCryptAESNI(const unsigned char in[], unsigned char out[],
+                            size_t len, const unsigned char *roundKeys,
+                            const unsigned char powers[8][16],
+                            const unsigned char karatsuba[8][16],
+                            unsigned char counter[16], unsigned char tag[16],
+                            bool decrypt) {
+  const size_t bytes = len / (8 * 16) * (8 * 16);
+  if (bytes == 0) return 0;
+
+  __m128i rk[Nr + 1];
+  AESCPP_UNROLL
+  for (unsigned int r = 0; r <= Nr; ++r) {
+    rk[r] =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(roundKeys + r * 16));
+  }
+  __m128i hp[8], hk[8];
+  AESCPP_UNROLL
+  for (int k = 0; k < 8; ++k) {
+    hp[k] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(powers[k]));
+    hk[k] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(karatsuba[k]));
+  }
+  const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+  __m128i ctr =
+      ghash_bswap(_mm_loadu_si128(reinterpret_cast<const __m128i *>(counter)));
+  __m128i y = ghash_bswap(_mm_loadu_si128(reinterpret_cast<__m128i *>(tag)));
+
+  for (size_t i = 0; i < bytes; i += 8 * 16) {
+    const bool hash = decrypt || i > 0;
+    __m128i x[8];
+    if (hash) {
+      const unsigned char *c = decrypt ? in + i : out + i - 8 * 16;
+      AESCPP_UNROLL
+      for (int j = 0; j < 8; ++j) {
+        x[j] = ghash_bswap(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(c + j * 16)));
+      }
+      x[0] = _mm_xor_si128(x[0], y);
+    } else {
+      AESCPP_UNROLL
+      for (int j = 0; j < 8; ++j) x[j] = _mm_setzero_si128();
+    }
+
+    __m128i b[8];
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) {
+      b[j] = _mm_xor_si128(ghash_bswap(ctr), rk[0]);
+      ctr = _mm_add_epi32(ctr, one);
+    }
+    __m128i lo = _mm_setzero_si128();
+    __m128i mid = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    AESCPP_UNROLL
+    for (unsigned int r = 1; r <= 8; ++r) {
+      AESCPP_UNROLL
+      for (int j = 0; j < 8; ++j) b[j] = _mm_aesenc_si128(b[j], rk[r]);
+      ghash_mul_acc(x[r - 1], hp[8 - r], hk[8 - r], lo, mid, hi);
+    }
+    AESCPP_UNROLL
+    for (unsigned int r = 9; r < Nr; ++r) {
+      AESCPP_UNROLL
+      for (int j = 0; j < 8; ++j) b[j] = _mm_aesenc_si128(b[j], rk[r]);
+    }
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) {
+      b[j] = _mm_aesenclast_si128(b[j], rk[Nr]);
+      const __m128i p =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + j * 16));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + j * 16),
+                       _mm_xor_si128(b[j], p));
+    }
+    if (hash) y = ghash_reduce(lo, mid, hi);
+  }
+
+  if (!decrypt) {
+    __m128i lo = _mm_setzero_si128();
+    __m128i mid = _mm_setzero_si128();
+    __m128i hi = _mm_setzero_si128();
+    const unsigned char *c = out + bytes - 8 * 16;
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) {
+      __m128i x = ghash_bswap(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(c + j * 16)));
+      if (j == 0) x = _mm_xor_si128(x, y);
+      ghash_mul_acc(x, hp[7 - j], hk[7 - j], lo, mid, hi);
+    }
+    y = ghash_reduce(lo, mid, hi);
+  }
+
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(tag), ghash_bswap(y));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(counter), ghash_bswap(ctr));
+  return bytes;
+}
+#endif
+
+#if defined(AESCPP_ARM_KERNELS)
+// ARMv8 Crypto Extensions. AESE/AESD add the round key before SubBytes and
+// ShiftRows rather than after MixColumns, so rounds are shifted by one
+// against AES-NI: AESE+AESMC with keys 0..Nr-2, AESE with key Nr-1 and a
+// final XOR. Decryption uses the same equivalent inverse schedule as AES-NI.
+template <unsigned int Nr>
+AESCPP_TARGET(AESCPP_ARM_ISA)
+static void EncryptBlockARMv8(const unsigned char in[], unsigned char out[],
+                              const unsigned char *roundKeys) {
+  uint8x16_t b = vld1q_u8(in);
+  AESCPP_UNROLL
+  for (unsigned int r = 0; r < Nr - 1; ++r) {
+    b = vaesmcq_u8(vaeseq_u8(b, vld1q_u8(roundKeys + r * 16)));
+  }
+  b = vaeseq_u8(b, vld1q_u8(roundKeys + (Nr - 1) * 16));
+  vst1q_u8(out, veorq_u8(b, vld1q_u8(roundKeys + Nr * 16)));
+}
+
+template <unsigned int Nr>
+AESCPP_TARGET(AESCPP_ARM_ISA)
+static void DecryptBlockARMv8(const unsigned char in[], unsigned char out[],
+                              const unsigned char *decKeys) {
+  uint8x16_t b = vld1q_u8(in);
+  AESCPP_UNROLL
+  for (unsigned int r = 0; r < Nr - 1; ++r) {
+    b = vaesimcq_u8(vaesdq_u8(b, vld1q_u8(decKeys + r * 16)));
+  }
+  b = vaesdq_u8(b, vld1q_u8(decKeys + (Nr - 1) * 16));
+  vst1q_u8(out, veorq_u8(b, vld1q_u8(decKeys + Nr * 16)));
+}
+
+// Encrypt `blocks` independent blocks, eight per iteration with interleaved
+// AESE/AESMC chains.
+template <unsigned int Nr>
+AESCPP_TARGET(AESCPP_ARM_ISA)
+static void EncryptBlocksARMv8(const unsigned char in[], unsigned char out[],
+                               size_t blocks, const unsigned char *roundKeys) {
+  uint8x16_t rk[Nr + 1];
+  AESCPP_UNROLL
+  for (unsigned int r = 0; r <= Nr; ++r) rk[r] = vld1q_u8(roundKeys + r * 16);
+  size_t i = 0;
+  for (; i + 8 <= blocks; i += 8) {
+    uint8x16_t b[8];
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) b[j] = vld1q_u8(in + (i + j) * 16);
+    AESCPP_UNROLL
+    for (unsigned int r = 0; r < Nr - 1; ++r) {
+      AESCPP_UNROLL
+      for (int j = 0; j < 8; ++j) b[j] = vaesmcq_u8(vaeseq_u8(b[j], rk[r]));
+    }
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) {
+      vst1q_u8(out + (i + j) * 16,
+               veorq_u8(vaeseq_u8(b[j], rk[Nr - 1]), rk[Nr]));
+    }
+  }
+  for (; i < blocks; ++i) {
+    uint8x16_t b = vld1q_u8(in + i * 16);
+    AESCPP_UNROLL
+    for (unsigned int r = 0; r < Nr - 1; ++r) {
+      b = vaesmcq_u8(vaeseq_u8(b, rk[r]));
+    }
+    vst1q_u8(out + i * 16, veorq_u8(vaeseq_u8(b, rk[Nr - 1]), rk[Nr]));
+  }
+}
+
+template <unsigned int Nr>
+AESCPP_TARGET(AESCPP_ARM_ISA)
+static void DecryptBlocksARMv8(const unsigned char in[], unsigned char out[],
+                               size_t blocks, const unsigned char *decKeys) {
+  uint8x16_t rk[Nr + 1];
+  AESCPP_UNROLL
+  for (unsigned int r = 0; r <= Nr; ++r) rk[r] = vld1q_u8(decKeys + r * 16);
+  size_t i = 0;
+  for (; i + 8 <= blocks; i += 8) {
+    uint8x16_t b[8];
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) b[j] = vld1q_u8(in + (i + j) * 16);
+    AESCPP_UNROLL
+    for (unsigned int r = 0; r < Nr - 1; ++r) {
+      AESCPP_UNROLL
+      for (int j = 0; j < 8; ++j) b[j] = vaesimcq_u8(vaesdq_u8(b[j], rk[r]));
+    }
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) {
+      vst1q_u8(out + (i + j) * 16,
+               veorq_u8(vaesdq_u8(b[j], rk[Nr - 1]), rk[Nr]));
+    }
+  }
+  for (; i < blocks; ++i) {
+    uint8x16_t b = vld1q_u8(in + i * 16);
+    AESCPP_UNROLL
+    for (unsigned int r = 0; r < Nr - 1; ++r) {
+      b = vaesimcq_u8(vaesdq_u8(b, rk[r]));
+    }
+    vst1q_u8(out + i * 16, veorq_u8(vaesdq_u8(b, rk[Nr - 1]), rk[Nr]));
+  }
+}
+
+// FIPS-197 key expansion with SubWord done by AESE on a zero key: with the
+// word replicated into all four columns ShiftRows has no effect, so every
+// lane holds SubWord(temp). Constant time like the AES-NI version.
+template <unsigned int Nk, unsigned int Nr>
+AESCPP_TARGET(AESCPP_ARM_ISA)
+static void KeyExpansionARMv8(const unsigned char key[], unsigned char w[]) {
+  std::memcpy(w, key, 4 * Nk);
+  AESCPP_UNROLL
+  for (unsigned int i = Nk; i < 4 * (Nr + 1); ++i) {
+    uint32_t temp;
+    std::memcpy(&temp, w + 4 * (i - 1), 4);
+    if (i % Nk == 0 || (Nk > 6 && i % Nk == 4)) {
+      const uint8x16_t t = vaeseq_u8(vreinterpretq_u8_u32(vdupq_n_u32(temp)),
+                                     vdupq_n_u8(0));
+      temp = vgetq_lane_u32(vreinterpretq_u32_u8(t), 0);
+      if (i % Nk == 0) {
+        temp = ((temp >> 8) | (temp << 24)) ^ RCON_TABLE[i / Nk - 1];
+      }
+    }
+    uint32_t prev;
+    std::memcpy(&prev, w + 4 * (i - Nk), 4);
+    temp ^= prev;
+    std::memcpy(w + 4 * i, &temp, 4);
+  }
+}
+
+template <unsigned int Nr>
+AESCPP_TARGET(AESCPP_ARM_ISA)
+static void InvKeyExpansionARMv8(const unsigned char w[], unsigned char dw[]) {
+  std::memcpy(dw, w + Nr * 16, 16);
+  AESCPP_UNROLL
+  for (unsigned int round = 1; round < Nr; ++round) {
+    vst1q_u8(dw + round * 16, vaesimcq_u8(vld1q_u8(w + (Nr - round) * 16)));
+  }
+  std::memcpy(dw + Nr * 16, w, 16);
+}
+
+// Counter block for the 128-bit big-endian value <hi:lo>.
+AESCPP_TARGET(AESCPP_ARM_ISA)
+static inline uint8x16_t ctr_block_neon(uint64_t hi, uint64_t lo) {
+  return vrev64q_u8(
+      vreinterpretq_u8_u64(vcombine_u64(vcreate_u64(hi), vcreate_u64(lo))));
+}
+
+// CTR keystream XOR over `len` bytes, eight counter blocks per iteration; see
+// CtrXorAESNI.
+template <unsigned int Nr>
+AESCPP_TARGET(AESCPP_ARM_ISA)
+static void CtrXorARMv8(const unsigned char in[], unsigned char out[],
+                        size_t len, const unsigned char *roundKeys,
+                        unsigned char counter[16]) {
+  uint8x16_t rk[Nr + 1];
+  AESCPP_UNROLL
+  for (unsigned int r = 0; r <= Nr; ++r) rk[r] = vld1q_u8(roundKeys + r * 16);
+  uint64_t hi = load_be64(counter);
+  uint64_t lo = load_be64(counter + 8);
+
+  size_t i = 0;
+  for (; i + 8 * 16 <= len; i += 8 * 16) {
+    uint8x16_t b[8];
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) {
+      const uint64_t l = lo + static_cast<uint64_t>(j);
+      b[j] = ctr_block_neon(hi + (l < lo), l);
+    }
+    lo += 8;
+    hi += lo < 8;
+
+    AESCPP_UNROLL
+    for (unsigned int r = 0; r < Nr - 1; ++r) {
+      AESCPP_UNROLL
+      for (int j = 0; j < 8; ++j) b[j] = vaesmcq_u8(vaeseq_u8(b[j], rk[r]));
+    }
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) {
+      b[j] = veorq_u8(vaeseq_u8(b[j], rk[Nr - 1]), rk[Nr]);
+      vst1q_u8(out + i + j * 16, veorq_u8(b[j], vld1q_u8(in + i + j * 16)));
+    }
+  }
+
+  for (; i < len; i += 16) {
+    uint8x16_t b = ctr_block_neon(hi, lo);
+    ++lo;
+    hi += lo == 0;
+    AESCPP_UNROLL
+    for (unsigned int r = 0; r < Nr - 1; ++r) {
+      b = vaesmcq_u8(vaeseq_u8(b, rk[r]));
+    }
+    b = veorq_u8(vaeseq_u8(b, rk[Nr - 1]), rk[Nr]);
+    if (len - i >= 16) {
+      vst1q_u8(out + i, veorq_u8(b, vld1q_u8(in + i)));
+    } else {
+      unsigned char ks[16];
+      vst1q_u8(ks, b);
+      for (size_t j = 0; j < len - i; ++j) out[i + j] = in[i + j] ^ ks[j];
+      secure_zero(ks, sizeof(ks));
+    }
+  }
+
+  store_be64(counter, hi);
+  store_be64(counter + 8, lo);
+}
+
+// GHASH with PMULL in the byte-reflected layout of the PCLMUL backend, so
+// the power tables are shared. The 256-bit product is reduced with the same
+// scalar ghash_fold as the portable path.
+AESCPP_TARGET(AESCPP_ARM_ISA)
+static inline uint8x16_t ghash_bswap_neon(uint8x16_t x) {
+  x = vrev64q_u8(x);
+  return vextq_u8(x, x, 8);
+}
+
+AESCPP_TARGET(AESCPP_ARM_ISA)
+static inline uint8x16_t ghash_pmull_lo(uint8x16_t a, uint8x16_t b) {
+  return vreinterpretq_u8_p128(vmull_p64(
+      static_cast<poly64_t>(vgetq_lane_u64(vreinterpretq_u64_u8(a), 0)),
+      static_cast<poly64_t>(vgetq_lane_u64(vreinterpretq_u64_u8(b), 0))));
+}
+
+AESCPP_TARGET(AESCPP_ARM_ISA)
+static inline uint8x16_t ghash_pmull_hi(uint8x16_t a, uint8x16_t b) {
+  return vreinterpretq_u8_p128(
+      vmull_high_p64(vreinterpretq_p64_u8(a), vreinterpretq_p64_u8(b)));
+}
+
+// Accumulate the unreduced product x * h into <hi:mid:lo> with three PMULLs.
+// `hk` holds the XOR of the halves of h in its low lane.
+AESCPP_TARGET(AESCPP_ARM_ISA)
+static inline void ghash_mul_acc_neon(uint8x16_t x, uint8x16_t h, uint8x16_t hk,
+                                      uint8x16_t &lo, uint8x16_t &mid,
+                                      uint8x16_t &hi) {
+  lo = veorq_u8(lo, ghash_pmull_lo(x, h));
+  hi = veorq_u8(hi, ghash_pmull_hi(x, h));
+  mid = veorq_u8(mid, ghash_pmull_lo(veorq_u8(x, vextq_u8(x, x, 8)), hk));
+}
+
+AESCPP_TARGET(AESCPP_ARM_ISA)
+static inline uint8x16_t ghash_reduce_neon(uint8x16_t lo, uint8x16_t mid,
+                                           uint8x16_t hi) {
+  const uint64x2_t l = vreinterpretq_u64_u8(lo);
+  const uint64x2_t h = vreinterpretq_u64_u8(hi);
+  const uint64x2_t m = vreinterpretq_u64_u8(veorq_u8(mid, veorq_u8(lo, hi)));
+  uint64_t y0, y1;
+  ghash_fold(vgetq_lane_u64(l, 0), vgetq_lane_u64(l, 1) ^ vgetq_lane_u64(m, 0),
+             vgetq_lane_u64(h, 0) ^ vgetq_lane_u64(m, 1), vgetq_lane_u64(h, 1),
+             y0, y1);
+  return vreinterpretq_u8_u64(vcombine_u64(vcreate_u64(y0), vcreate_u64(y1)));
+}
+
+// GHASH over `len` bytes, eight blocks per reduction; see GhashBlocksPCLMUL.
+AESCPP_TARGET(AESCPP_ARM_ISA)
+static void GhashBlocksARMv8(const unsigned char powers[8][16],
+                             const unsigned char karatsuba[8][16],
+                             const unsigned char *X, size_t len,
+                             unsigned char tag[16]) {
+  uint8x16_t hp[8], hk[8];
+  for (int k = 0; k < 8; ++k) {
+    hp[k] = vld1q_u8(powers[k]);
+    hk[k] = vld1q_u8(karatsuba[k]);
+  }
+  uint8x16_t y = ghash_bswap_neon(vld1q_u8(tag));
+
+  size_t i = 0;
+  for (; i + 8 * 16 <= len; i += 8 * 16) {
+    uint8x16_t lo = vdupq_n_u8(0);
+    uint8x16_t mid = vdupq_n_u8(0);
+    uint8x16_t hi = vdupq_n_u8(0);
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) {
+      uint8x16_t x = ghash_bswap_neon(vld1q_u8(X + i + j * 16));
+      if (j == 0) x = veorq_u8(x, y);
+      ghash_mul_acc_neon(x, hp[7 - j], hk[7 - j], lo, mid, hi);
+    }
+    y = ghash_reduce_neon(lo, mid, hi);
+  }
+
+  for (; i < len; i += 16) {
+    uint8x16_t x;
+    if (len - i >= 16) {
+      x = vld1q_u8(X + i);
+    } else {
+      unsigned char block[16] = {0};
+      memcpy(block, X + i, len - i);
+      x = vld1q_u8(block);
+      secure_zero(block, sizeof(block));
+    }
+    uint8x16_t lo = vdupq_n_u8(0);
+    uint8x16_t mid = vdupq_n_u8(0);
+    uint8x16_t hi = vdupq_n_u8(0);
+    ghash_mul_acc_neon(veorq_u8(y, ghash_bswap_neon(x)), hp[0], hk[0], lo, mid,
+                       hi);
+    y = ghash_reduce_neon(lo, mid, hi);
+  }
+
+  vst1q_u8(tag, ghash_bswap_neon(y));
+}
+
+// Single GF(2^128) product in GCM bit order, Z = X * Y.
+AESCPP_TARGET(AESCPP_ARM_ISA)
+static void GfMultiplyARMv8(const unsigned char *X, const unsigned char *Y,
+                            unsigned char *Z) {
+  const uint8x16_t x = ghash_bswap_neon(vld1q_u8(X));
+  const uint8x16_t h = ghash_bswap_neon(vld1q_u8(Y));
+  uint8x16_t lo = vdupq_n_u8(0);
+  uint8x16_t mid = vdupq_n_u8(0);
+  uint8x16_t hi = vdupq_n_u8(0);
+  ghash_mul_acc_neon(x, h, veorq_u8(h, vextq_u8(h, h, 8)), lo, mid, hi);
+  vst1q_u8(Z, ghash_bswap_neon(ghash_reduce_neon(lo, mid, hi)));
+}
+
+// Stitched GCM over the whole 128-byte batches of `len`; see GcmCryptAESNI.
+template <unsigned int Nr>
+AESCPP_TARGET(AESCPP_ARM_ISA)
+static size_t GcmCryptARMv8(const unsigned char in[], unsigned char out[],
+                            size_t len, const unsigned char *roundKeys,
+                            const unsigned char powers[8][16],
+                            const unsigned char karatsuba[8][16],
+                            unsigned char counter[16], unsigned char tag[16],
+                            bool decrypt) {
+  const size_t bytes = len / (8 * 16) * (8 * 16);
+  if (bytes == 0) return 0;
+
+  uint8x16_t rk[Nr + 1];
+  AESCPP_UNROLL
+  for (unsigned int r = 0; r <= Nr; ++r) rk[r] = vld1q_u8(roundKeys + r * 16);
+  uint8x16_t hp[8], hk[8];
+  for (int k = 0; k < 8; ++k) {
+    hp[k] = vld1q_u8(powers[k]);
+    hk[k] = vld1q_u8(karatsuba[k]);
+  }
+  const uint32x4_t one = vsetq_lane_u32(1, vdupq_n_u32(0), 0);
+  uint32x4_t ctr = vreinterpretq_u32_u8(ghash_bswap_neon(vld1q_u8(counter)));
+  uint8x16_t y = ghash_bswap_neon(vld1q_u8(tag));
+
+  for (size_t i = 0; i < bytes; i += 8 * 16) {
+    const bool hash = decrypt || i > 0;
+    uint8x16_t x[8];
+    if (hash) {
+      const unsigned char *c = decrypt ? in + i : out + i - 8 * 16;
+      AESCPP_UNROLL
+      for (int j = 0; j < 8; ++j) {
+        x[j] = ghash_bswap_neon(vld1q_u8(c + j * 16));
+      }
+      x[0] = veorq_u8(x[0], y);
+    } else {
+      AESCPP_UNROLL
+      for (int j = 0; j < 8; ++j) x[j] = vdupq_n_u8(0);
+    }
+
+    uint8x16_t b[8];
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) {
+      b[j] = ghash_bswap_neon(vreinterpretq_u8_u32(ctr));
+      ctr = vaddq_u32(ctr, one);
+    }
+    uint8x16_t lo = vdupq_n_u8(0);
+    uint8x16_t mid = vdupq_n_u8(0);
+    uint8x16_t hi = vdupq_n_u8(0);
+    AESCPP_UNROLL
+    for (unsigned int r = 0; r < 8; ++r) {
+      AESCPP_UNROLL
+      for (int j = 0; j < 8; ++j) b[j] = vaesmcq_u8(vaeseq_u8(b[j], rk[r]));
+      ghash_mul_acc_neon(x[r], hp[7 - r], hk[7 - r], lo, mid, hi);
+    }
+    AESCPP_UNROLL
+    for (unsigned int r = 8; r < Nr - 1; ++r) {
+      AESCPP_UNROLL
+      for (int j = 0; j < 8; ++j) b[j] = vaesmcq_u8(vaeseq_u8(b[j], rk[r]));
+    }
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) {
+      b[j] = veorq_u8(vaeseq_u8(b[j], rk[Nr - 1]), rk[Nr]);
+      vst1q_u8(out + i + j * 16, veorq_u8(b[j], vld1q_u8(in + i + j * 16)));
+    }
+    if (hash) y = ghash_reduce_neon(lo, mid, hi);
+  }
+
+  if (!decrypt) {
+    uint8x16_t lo = vdupq_n_u8(0);
+    uint8x16_t mid = vdupq_n_u8(0);
+    uint8x16_t hi = vdupq_n_u8(0);
+    const unsigned char *c = out + bytes - 8 * 16;
+    AESCPP_UNROLL
+    for (int j = 0; j < 8; ++j) {
+      uint8x16_t x = ghash_bswap_neon(vld1q_u8(c + j * 16));
+      if (j == 0) x = veorq_u8(x, y);
+      ghash_mul_acc_neon(x, hp[7 - j], hk[7 - j], lo, mid, hi);
+    }
+    y = ghash_reduce_neon(lo, mid, hi);
+  }
+
+  vst1q_u8(tag, ghash_bswap_neon(y));
+  vst1q_u8(counter, ghash_bswap_neon(vreinterpretq_u8_u32(ctr)));
+  return bytes;
+}
+#endif
+
+namespace {
+const Kernels softwareKernels = {Backend::Software, {}, nullptr, nullptr,
+                                 nullptr};
+
+#if defined(AESCPP_X86_KERNELS) || defined(AESCPP_ARM_KERNELS)
+const CpuFeatures &cpu_features() {
+  static const CpuFeatures cpu = detect_cpu();
+  return cpu;
+}
+#endif
+
+#if defined(AESCPP_X86_KERNELS)
+bool aesni_supported() {
+  const CpuFeatures &cpu = cpu_features();
+  return cpu.aes && cpu.ssse3;
+}
+
+template <unsigned int Nk, unsigned int Nr>
+CipherKernels aesni_cipher_kernels(bool pclmul) {
+  CipherKernels c = {};
+  c.encryptBlock = EncryptBlockAESNI<Nr>;
+  c.decryptBlock = DecryptBlockAESNI<Nr>;
+  c.encryptBlocks = EncryptBlocksAESNI<Nr>;
+  c.decryptBlocks = DecryptBlocksAESNI<Nr>;
+  c.keyExpansion = KeyExpansionAESNI<Nk, Nr>;
+  c.invKeyExpansion = InvKeyExpansionAESNI<Nr>;
+  c.ctrXor = CtrXorAESNI<Nr>;
+  c.xtsEncrypt = XtsCryptAESNI<Nr, false>;
+  c.xtsDecrypt = XtsCryptAESNI<Nr, true>;
+  c.ccmEncrypt = CcmCryptAESNI<Nr, false>;
+  c.ccmDecrypt = CcmCryptAESNI<Nr, true>;
+  if (pclmul) c.gcmCrypt = GcmCryptAESNI<Nr>;
+  return c;
+}
+
+// AES-NI kernels, plus the PCLMULQDQ GHASH ones when the CPU has them.
+const Kernels &aesni_kernels() {
+  static const Kernels kernels = []() {
+    const bool pclmul = cpu_features().pclmul;
+    Kernels k = softwareKernels;
+    k.backend = Backend::AESNI;
+    k.cipher[0] = aesni_cipher_kernels<4, 10>(pclmul);
+    k.cipher[1] = aesni_cipher_kernels<6, 12>(pclmul);
+    k.cipher[2] = aesni_cipher_kernels<8, 14>(pclmul);
+    if (pclmul) {
+      k.gfMultiply = GfMultiplyPCLMUL;
+      k.ghashPowers = GhashPowersPCLMUL;
+      k.ghashBlocks = GhashBlocksPCLMUL;
+    }
+    return k;
+  }();
+  return kernels;
+}
+#else
+bool aesni_supported() { return false; }
+#endif
+
+#if defined(AESCPP_ARM_KERNELS)
+bool armv8_supported() { return cpu_features().aes; }
+
+template <unsigned int Nk, unsigned int Nr>
+CipherKernels armv8_cipher_kernels(bool pmull) {
+  CipherKernels c = {};
+  c.encryptBlock = EncryptBlockARMv8<Nr>;
+  c.decryptBlock = DecryptBlockARMv8<Nr>;
+  c.encryptBlocks = EncryptBlocksARMv8<Nr>;
+  c.decryptBlocks = DecryptBlocksARMv8<Nr>;
+  c.keyExpansion = KeyExpansionARMv8<Nk, Nr>;
+  c.invKeyExpansion = InvKeyExpansionARMv8<Nr>;
+  c.ctrXor = CtrXorARMv8<Nr>;
+  if (pmull) c.gcmCrypt = GcmCryptARMv8<Nr>;
+  return c;
+}
+
+// ARMv8 AES kernels, plus the PMULL GHASH ones when the CPU has them. The
+// GHASH powers come from the portable code; they are computed once per key.
+const Kernels &armv8_kernels() {
+  static const Kernels kernels = []() {
+    const bool pmull = cpu_features().pmull;
+    Kernels k = softwareKernels;
+    k.backend = Backend::ARMv8;
+    k.cipher[0] = armv8_cipher_kernels<4, 10>(pmull);
+    k.cipher[1] = armv8_cipher_kernels<6, 12>(pmull);
+    k.cipher[2] = armv8_cipher_kernels<8, 14>(pmull);
+    if (pmull) {
+      k.gfMultiply = GfMultiplyARMv8;
+      k.ghashBlocks = GhashBlocksARMv8;
+    }
+    return k;
+  }();
+  return kernels;
+}
+#else
+bool armv8_supported() { return false; }
+#endif
+
+const Kernels &kernels_for(Backend backend) {
+#if defined(AESCPP_X86_KERNELS)
+  if (backend == Backend::AESNI) return aesni_kernels();
+#endif
+#if defined(AESCPP_ARM_KERNELS)
+  if (backend == Backend::ARMv8) return armv8_kernels();
+#endif
+  (void)backend;
+  return softwareKernels;
+}
+
+Backend auto_backend() {
+  if (aesni_supported()) return Backend::AESNI;
+  if (armv8_supported()) return Backend::ARMv8;
+  return Backend::Software;
+}
+
+std::atomic<const Kernels *> activeKernels{nullptr};
+
+// First use: AESCPP_BACKEND=software forces the portable path, anything else
+// picks the fastest one the CPU supports.
+const Kernels &resolve_kernels() {
+  Backend backend = auto_backend();
+  const char *env = std::getenv("AESCPP_BACKEND");
+  if (env && std::strcmp(env, "software") == 0) backend = Backend::Software;
+  const Kernels *expected = nullptr;
+  activeKernels.compare_exchange_strong(expected, &kernels_for(backend),
+                                        std::memory_order_acq_rel);
+  return *activeKernels.load(std::memory_order_acquire);
+}
+
+const Kernels &kernels() {
+  const Kernels *k = activeKernels.load(std::memory_order_acquire);
+  return k ? *k : resolve_kernels();
+}
+}  // namespace
 
-  if (!tagMatch) {
-    secure_zero(out, inLen);
-    throw std::runtime_error("Authentication failed");
+void set_backend(Backend backend) {
+  if (backend == Backend::Auto) backend = auto_backend();
+  if (backend == Backend::AESNI && !aesni_supported()) {
+    throw std::invalid_argument("AES-NI is not available");
+  }
+  if (backend == Backend::ARMv8 && !armv8_supported()) {
+    throw std::invalid_argument("ARMv8 Crypto Extensions are not available");
   }
+  activeKernels.store(&kernels_for(backend), std::memory_order_release);
 }
 
-AESCPP_NODISCARD unsigned char *AES::DecryptGCM(
-    const unsigned char in[], size_t inLen, const unsigned char key[],
-    const unsigned char iv[], const unsigned char aad[], size_t aadLen,
-    const unsigned char tag[]) {
-  auto out = AESCPP_MAKE_UNIQUE(unsigned char, inLen);
-  DecryptGCM(in, inLen, key, iv, aad, aadLen, tag, out.get());
-  return out.release();
+Backend active_backend() { return kernels().backend; }
+
+void AES::CtrXor(const unsigned char in[], unsigned char out[], size_t len,
+                 const unsigned char *roundKeys, unsigned char counter[16]) {
+  const CipherKernels &k = kernels().rounds(Nr);
+  if (k.ctrXor) {
+    k.ctrXor(in, out, len, roundKeys, counter);
+    return;
+  }
+  // Build a batch of counter blocks so the bitsliced engine runs full width.
+  unsigned char keystream[batchBlocks * blockBytesLen];
+  for (size_t i = 0; i < len; i += batchBlocks * blockBytesLen) {
+    const size_t batchLen =
+        std::min<size_t>(batchBlocks * blockBytesLen, len - i);
+    const size_t blocks = (batchLen + blockBytesLen - 1) / blockBytesLen;
+    for (size_t b = 0; b < blocks; ++b) {
+      memcpy(keystream + b * blockBytesLen, counter, blockBytesLen);
+      ctr_add(counter, 1);
+    }
+    EncryptBlocks(keystream, keystream, blocks, roundKeys);
+    XorBlocks(in + i, keystream, out + i, batchLen);
+  }
+  secure_zero(keystream, sizeof(keystream));
 }
 
-void AES::CheckLength(size_t len) {
-  // ensure input length is a multiple of the block size
-  if (len % blockBytesLen != 0) {
-    throw std::length_error("Plaintext length must be divisible by " +
-                            std::to_string(blockBytesLen));
+void AES::XTSBlocks(const unsigned char in[], unsigned char out[],
+                    size_t blocks, const unsigned char *roundKeys,
+                    unsigned char tweak[16], bool decrypt) {
+  const CipherKernels &k = kernels().rounds(Nr);
+  if (!decrypt && k.xtsEncrypt) {
+    k.xtsEncrypt(in, out, blocks, roundKeys, tweak);
+    return;
   }
+  if (decrypt && k.xtsDecrypt) {
+    k.xtsDecrypt(in, out, blocks, roundKeys + 4 * Nb * (Nr + 1), tweak);
+    return;
+  }
+  // Whiten a batch with its tweaks, run it through the multi-block kernels
+  // and whiten it again.
+  unsigned char tweaks[batchBlocks * blockBytesLen];
+  unsigned char buf[batchBlocks * blockBytesLen];
+  for (size_t i = 0; i < blocks; i += batchBlocks) {
+    const size_t n = std::min<size_t>(batchBlocks, blocks - i);
+    for (size_t b = 0; b < n; ++b) {
+      memcpy(tweaks + b * blockBytesLen, tweak, blockBytesLen);
+      xts_double(tweak);
+    }
+    XorBlocks(in + i * blockBytesLen, tweaks, buf, n * blockBytesLen);
+    if (decrypt) {
+      DecryptBlocks(buf, buf, n, roundKeys);
+    } else {
+      EncryptBlocks(buf, buf, n, roundKeys);
+    }
+    XorBlocks(buf, tweaks, out + i * blockBytesLen, n * blockBytesLen);
+  }
+  secure_zero(tweaks, sizeof(tweaks));
+  secure_zero(buf, sizeof(buf));
 }
 
-#if ((defined(__AES__) && (defined(__x86_64__) || defined(_M_X64) || \
-                           defined(__i386) || defined(_M_IX86))) ||  \
-     (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))))
-static void EncryptBlockAESNI(const unsigned char in[], unsigned char out[],
-                              const unsigned char *roundKeys, unsigned int Nr) {
-  __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
-  m = _mm_xor_si128(
-      m, _mm_loadu_si128(reinterpret_cast<const __m128i *>(roundKeys)));
-  for (unsigned int i = 1; i < Nr; ++i) {
-    m = _mm_aesenc_si128(
-        m,
-        _mm_loadu_si128(reinterpret_cast<const __m128i *>(roundKeys + i * 16)));
+void AES::CBCMACBlocks(const unsigned char data[], size_t blocks,
+                       const unsigned char *roundKeys, unsigned char mac[16]) {
+  for (size_t i = 0; i < blocks; ++i) {
+    XorBlocks(mac, data + i * blockBytesLen, mac, blockBytesLen);
+    EncryptBlock(mac, mac, roundKeys);
   }
-  m = _mm_aesenclast_si128(
-      m,
-      _mm_loadu_si128(reinterpret_cast<const __m128i *>(roundKeys + Nr * 16)));
-  _mm_storeu_si128(reinterpret_cast<__m128i *>(out), m);
 }
 
-static void DecryptBlockAESNI(const unsigned char in[], unsigned char out[],
-                              const unsigned char *roundKeys, unsigned int Nr) {
-  __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
-  m = _mm_xor_si128(
-      m,
-      _mm_loadu_si128(reinterpret_cast<const __m128i *>(roundKeys + Nr * 16)));
-  for (unsigned int i = Nr - 1; i > 0; --i) {
-    __m128i rk =
-        _mm_loadu_si128(reinterpret_cast<const __m128i *>(roundKeys + i * 16));
-    m = _mm_aesdec_si128(m, _mm_aesimc_si128(rk));
+void AES::CCMBlocks(const unsigned char in[], unsigned char out[],
+                    size_t blocks, const unsigned char *roundKeys,
+                    unsigned char counter[16], unsigned char mac[16],
+                    bool decrypt) {
+  const CipherKernels &k = kernels().rounds(Nr);
+  if (!decrypt && k.ccmEncrypt) {
+    k.ccmEncrypt(in, out, blocks, roundKeys, counter, mac);
+    return;
   }
-  m = _mm_aesdeclast_si128(
-      m, _mm_loadu_si128(reinterpret_cast<const __m128i *>(roundKeys)));
-  _mm_storeu_si128(reinterpret_cast<__m128i *>(out), m);
+  if (decrypt && k.ccmDecrypt) {
+    k.ccmDecrypt(in, out, blocks, roundKeys, counter, mac);
+    return;
+  }
+  // The MAC covers the plaintext: hash it before encrypting over it, or
+  // after decrypting it into `out`.
+  if (!decrypt) CBCMACBlocks(in, blocks, roundKeys, mac);
+  CtrXor(in, out, blocks * blockBytesLen, roundKeys, counter);
+  if (decrypt) CBCMACBlocks(out, blocks, roundKeys, mac);
 }
-#endif
 
 void AES::EncryptBlock(const unsigned char in[], unsigned char out[],
                        const unsigned char *roundKeys) {
-#if ((defined(__AES__) && (defined(__x86_64__) || defined(_M_X64) || \
-                           defined(__i386) || defined(_M_IX86))) ||  \
-     (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))))
-  static bool useAESNI = has_aesni();
-  if (useAESNI) {
-    EncryptBlockAESNI(in, out, roundKeys, Nr);
+  const CipherKernels &k = kernels().rounds(Nr);
+  if (k.encryptBlock) {
+    k.encryptBlock(in, out, roundKeys);
     return;
   }
-#endif
-  unsigned char state[4][Nb];
-  unsigned int i, j, round;
+  unsigned char scratch[bitslicedKeysMaxLen];
+  const unsigned char *sk = BitslicedKeys(roundKeys, scratch);
+  uint64_t q[8];
+  bs_load(in, 1, q);
+  bs_encrypt(Nr, sk, q);
+  bs_store(q, 1, out);
+  secure_zero(q, sizeof(q));
+  if (sk == scratch) secure_zero(scratch, sizeof(scratch));
+}
 
-  for (i = 0; i < 4; i++) {
-    for (j = 0; j < Nb; j++) {
-      state[i][j] = in[i + 4 * j];
-    }
+void AES::EncryptBlocks(const unsigned char in[], unsigned char out[],
+                        size_t blocks, const unsigned char *roundKeys) {
+  const CipherKernels &k = kernels().rounds(Nr);
+  if (k.encryptBlocks) {
+    k.encryptBlocks(in, out, blocks, roundKeys);
+    return;
   }
-
-  AddRoundKey(state, roundKeys);
-
-  for (round = 1; round <= Nr - 1; round++) {
-    SubBytes(state);
-    ShiftRows(state);
-    MixColumns(state);
-    AddRoundKey(state, roundKeys + round * 4 * Nb);
+  // Four blocks per bitsliced pass.
+  unsigned char scratch[bitslicedKeysMaxLen];
+  const unsigned char *sk = BitslicedKeys(roundKeys, scratch);
+  uint64_t q[8];
+  for (size_t i = 0; i < blocks; i += 4) {
+    const size_t n = std::min<size_t>(4, blocks - i);
+    bs_load(in + i * blockBytesLen, n, q);
+    bs_encrypt(Nr, sk, q);
+    bs_store(q, n, out + i * blockBytesLen);
   }
+  secure_zero(q, sizeof(q));
+  if (sk == scratch) secure_zero(scratch, sizeof(scratch));
+}
 
-  SubBytes(state);
-  ShiftRows(state);
-  AddRoundKey(state, roundKeys + Nr * 4 * Nb);
-
-  for (i = 0; i < 4; i++) {
-    for (j = 0; j < Nb; j++) {
-      out[i + 4 * j] = state[i][j];
-    }
+void AES::DecryptBlocks(const unsigned char in[], unsigned char out[],
+                        size_t blocks, const unsigned char *roundKeys) {
+  const CipherKernels &k = kernels().rounds(Nr);
+  if (k.decryptBlocks) {
+    k.decryptBlocks(in, out, blocks, roundKeys + 4 * Nb * (Nr + 1));
+    return;
   }
-  secure_zero(state, sizeof(state));
+  // Four blocks per bitsliced pass.
+  unsigned char scratch[bitslicedKeysMaxLen];
+  const unsigned char *sk = BitslicedKeys(roundKeys, scratch);
+  uint64_t q[8];
+  for (size_t i = 0; i < blocks; i += 4) {
+    const size_t n = std::min<size_t>(4, blocks - i);
+    bs_load(in + i * blockBytesLen, n, q);
+    bs_decrypt(Nr, sk, q);
+    bs_store(q, n, out + i * blockBytesLen);
+  }
+  secure_zero(q, sizeof(q));
+  if (sk == scratch) secure_zero(scratch, sizeof(scratch));
 }
 
 void AES::GF_Multiply(const unsigned char *X, const unsigned char *Y,
                       unsigned char *Z) {
 #if defined(GF_MUL_VERIFY)
-  const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(X));
-  const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Y));
-
-  const __m128i swap =
-      _mm_set_epi8(0x0f, 0x0e, 0x0d, 0x0c, 0x0b, 0x0a, 0x09, 0x08, 0x07, 0x06,
-                   0x05, 0x04, 0x03, 0x02, 0x01, 0x00);
-  __m128i x = _mm_shuffle_epi8(a, swap);
-  __m128i y = _mm_shuffle_epi8(b, swap);
-
-  const __m128i z0 = _mm_clmulepi64_si128(x, y, 0x00);
-  const __m128i z1 = _mm_clmulepi64_si128(x, y, 0x10);
-  const __m128i z2 = _mm_clmulepi64_si128(x, y, 0x01);
-  const __m128i z3 = _mm_clmulepi64_si128(x, y, 0x11);
-
-  const __m128i t = _mm_xor_si128(z1, z2);
-  const __m128i t_lo = _mm_slli_si128(t, 8);
-  const __m128i t_hi = _mm_srli_si128(t, 8);
-
-  __m128i low = _mm_xor_si128(z0, t_lo);
-  __m128i high = _mm_xor_si128(z3, t_hi);
-
-  const __m128i R128 = _mm_set_epi32(0, 0, 0, 0x87);
-  __m128i tmp = _mm_clmulepi64_si128(high, R128, 0x00);
-  __m128i tmp2 = _mm_clmulepi64_si128(_mm_srli_si128(high, 8), R128, 0x00);
-  tmp = _mm_xor_si128(tmp, _mm_slli_si128(tmp2, 8));
-  low = _mm_xor_si128(low, tmp);
-  tmp2 = _mm_clmulepi64_si128(tmp, R128, 0x00);
-  low = _mm_xor_si128(low, _mm_slli_si128(tmp2, 8));
-
-  low = _mm_shuffle_epi8(low, swap);
-  _mm_storeu_si128(reinterpret_cast<__m128i *>(Z), low);
+  const __m128i x =
+      ghash_bswap(_mm_loadu_si128(reinterpret_cast<const __m128i *>(X)));
+  const __m128i y =
+      ghash_bswap(_mm_loadu_si128(reinterpret_cast<const __m128i *>(Y)));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(Z),
+                   ghash_bswap(ghash_mul(x, y)));
   return;
 #else
-#if (((defined(__PCLMUL__) && defined(__SSSE3__)) &&                \
-      (defined(__x86_64__) || defined(_M_X64) || defined(__i386) || \
-       defined(_M_IX86))) ||                                        \
-     (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))))
-  if (has_pclmul()) {
-    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(X));
-    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Y));
-
-    const __m128i swap =
-        _mm_set_epi8(0x0f, 0x0e, 0x0d, 0x0c, 0x0b, 0x0a, 0x09, 0x08, 0x07, 0x06,
-                     0x05, 0x04, 0x03, 0x02, 0x01, 0x00);
-    __m128i x = _mm_shuffle_epi8(a, swap);
-    __m128i y = _mm_shuffle_epi8(b, swap);
-
-    const __m128i z0 = _mm_clmulepi64_si128(x, y, 0x00);
-    const __m128i z1 = _mm_clmulepi64_si128(x, y, 0x10);
-    const __m128i z2 = _mm_clmulepi64_si128(x, y, 0x01);
-    const __m128i z3 = _mm_clmulepi64_si128(x, y, 0x11);
-
-    const __m128i t = _mm_xor_si128(z1, z2);
-    const __m128i t_lo = _mm_slli_si128(t, 8);
-    const __m128i t_hi = _mm_srli_si128(t, 8);
-
-    __m128i low = _mm_xor_si128(z0, t_lo);
-    __m128i high = _mm_xor_si128(z3, t_hi);
-
-    const __m128i R128 = _mm_set_epi32(0, 0, 0, 0x87);
-    __m128i tmp = _mm_clmulepi64_si128(high, R128, 0x00);
-    __m128i tmp2 = _mm_clmulepi64_si128(_mm_srli_si128(high, 8), R128, 0x00);
-    tmp = _mm_xor_si128(tmp, _mm_slli_si128(tmp2, 8));
-    low = _mm_xor_si128(low, tmp);
-    tmp2 = _mm_clmulepi64_si128(tmp, R128, 0x00);
-    low = _mm_xor_si128(low, _mm_slli_si128(tmp2, 8));
-
-    low = _mm_shuffle_epi8(low, swap);
-    _mm_storeu_si128(reinterpret_cast<__m128i *>(Z), low);
+  const Kernels &k = kernels();
+  if (k.gfMultiply) {
+    k.gfMultiply(X, Y, Z);
     return;
   }
+  ghash_mul_ct64(X, Y, Z);
 #endif
-  unsigned char V[16];
-  unsigned char X_copy[16];
-  memcpy(X_copy, X, 16);
-  memset(Z, 0, 16);
-  memcpy(V, Y, 16);
-
-  for (int i = 0; i < 128; i++) {
-    unsigned char bit = (X_copy[i / 8] >> (7 - (i % 8))) & 1;
-    unsigned char mask = static_cast<unsigned char>(-bit);
-    for (int j = 0; j < 16; j++) {
-      Z[j] ^= V[j] & mask;
-    }
-
-    // Shift V left
-    unsigned char carry = V[0] & 0x80;  // Preserve most significant bit
-
-    for (int j = 0; j < 15; j++) {
-      V[j] = (V[j] << 1) | (V[j + 1] >> 7);
-    }
-
-    V[15] <<= 1;
+}
 
-    unsigned char rmask =
-        static_cast<unsigned char>(-(static_cast<unsigned char>(carry >> 7)));
+void AES::GHASH(const unsigned char *H, const unsigned char *X, size_t len,
+                unsigned char *tag) {
+  if (len == 16) {
     for (int j = 0; j < 16; j++) {
-      V[j] ^= R[j] & rmask;
+      tag[j] ^= X[j];
     }
+    GF_Multiply(tag, H, tag);
+    return;
   }
-  secure_zero(X_copy, sizeof(X_copy));
-  secure_zero(V, sizeof(V));
-#endif
-}
 
-void AES::GHASH(const unsigned char *H, const unsigned char *X, size_t len,
-                unsigned char *tag) {
   unsigned char block[16] = {0};
   memcpy(block, X, len);
 
@@ -859,45 +4225,118 @@ void AES::GHASH(const unsigned char *H, const unsigned char *X, size_t len,
   secure_zero(block, sizeof(block));
 }
 
-void AES::DecryptBlock(const unsigned char in[], unsigned char out[],
-                       const unsigned char *roundKeys) {
-#if ((defined(__AES__) && (defined(__x86_64__) || defined(_M_X64) || \
-                           defined(__i386) || defined(_M_IX86))) ||  \
-     (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))))
-  static bool useAESNI = has_aesni();
-  if (useAESNI) {
-    DecryptBlockAESNI(in, out, roundKeys, Nr);
+void AES::GHASHInit(const unsigned char *roundKeys, GhashKey &hashKey) {
+  const unsigned char zeroBlock[16] = {0};
+  EncryptBlock(zeroBlock, hashKey.H, roundKeys);
+  const Kernels &k = kernels();
+  if (k.ghashPowers) {
+    k.ghashPowers(hashKey.H, hashKey.powers, hashKey.karatsuba);
+  } else {
+    ghash_powers_ct64(hashKey.H, hashKey.powers, hashKey.karatsuba);
+  }
+  ghash_reversed_ct64(hashKey.powers, hashKey.reversed);
+}
+
+void AES::GHASHBlocks(const GhashKey &hashKey, const unsigned char *X,
+                      size_t len, unsigned char tag[16]) {
+  const Kernels &k = kernels();
+  if (k.ghashBlocks) {
+    k.ghashBlocks(hashKey.powers, hashKey.karatsuba, X, len, tag);
     return;
   }
-#endif
-  unsigned char state[4][Nb];
-  unsigned int i, j, round;
+  ghash_blocks_ct64(hashKey.powers, hashKey.reversed, X, len, tag);
+}
 
-  for (i = 0; i < 4; i++) {
-    for (j = 0; j < Nb; j++) {
-      state[i][j] = in[i + 4 * j];
-    }
+void AES::GCMCrypt(const unsigned char in[], unsigned char out[], size_t len,
+                   const unsigned char *roundKeys, const GhashKey &hashKey,
+                   unsigned char counter[16], unsigned char tag[16],
+                   bool decrypt) {
+  size_t done = 0;
+  const CipherKernels &k = kernels().rounds(Nr);
+  if (k.gcmCrypt) {
+    done = k.gcmCrypt(in, out, len, roundKeys, hashKey.powers,
+                      hashKey.karatsuba, counter, tag, decrypt);
+  }
+  // Remaining data goes through CtrXor and GHASHBlocks in batches. The
+  // ciphertext is hashed before it can be overwritten in place.
+  const size_t chunk = batchBlocks * blockBytesLen;
+  for (size_t i = done; i < len; i += chunk) {
+    const size_t n = std::min(chunk, len - i);
+    if (decrypt) GHASHBlocks(hashKey, in + i, n, tag);
+    CtrXor(in + i, out + i, n, roundKeys, counter);
+    if (!decrypt) GHASHBlocks(hashKey, out + i, n, tag);
   }
+}
 
-  AddRoundKey(state, roundKeys + Nr * 4 * Nb);
+void AES::GCMCryptParallel(const unsigned char in[], unsigned char out[],
+                           size_t len, const unsigned char *roundKeys,
+                           const GhashKey &hashKey,
+                           const unsigned char counter[16],
+                           unsigned char tag[16], bool decrypt,
+                           const Parallelism &parallel) {
+  // Ranges are whole eight-block batches, except at the end of the buffer.
+  const uint64_t blocks =
+      (static_cast<uint64_t>(len) + blockBytesLen - 1) / blockBytesLen;
+  std::atomic<uint64_t> hashHi{0}, hashLo{0};
+  bool whole = false;
+  const size_t batch = batchBlocks * blockBytesLen;
+  RunParallel(len, batch, parallel, [&](size_t begin, size_t end) {
+    unsigned char start[blockBytesLen];
+    memcpy(start, counter, blockBytesLen);
+    if (end - begin == len) {  // not split
+      GCMCrypt(in, out, len, roundKeys, hashKey, start, tag, decrypt);
+      secure_zero(start, sizeof(start));
+      whole = true;
+      return;
+    }
+    ctr_add(start, begin / blockBytesLen);
+    unsigned char partial[16] = {0};
+    GCMCrypt(in + begin, out + begin, end - begin, roundKeys, hashKey, start,
+             partial, decrypt);
+    const uint64_t endBlock =
+        (static_cast<uint64_t>(end) + blockBytesLen - 1) / blockBytesLen;
+    GHASHShift(hashKey, blocks - endBlock, partial);
+    hashHi.fetch_xor(load_be64(partial), std::memory_order_relaxed);
+    hashLo.fetch_xor(load_be64(partial + 8), std::memory_order_relaxed);
+    secure_zero(start, sizeof(start));
+    secure_zero(partial, sizeof(partial));
+  });
+  if (whole) return;
+
+  GHASHShift(hashKey, blocks, tag);
+  store_be64(tag, load_be64(tag) ^ hashHi.load());
+  store_be64(tag + 8, load_be64(tag + 8) ^ hashLo.load());
+  hashHi.store(0);
+  hashLo.store(0);
+}
 
-  for (round = Nr - 1; round >= 1; round--) {
-    InvSubBytes(state);
-    InvShiftRows(state);
-    AddRoundKey(state, roundKeys + round * 4 * Nb);
-    InvMixColumns(state);
+void AES::GHASHShift(const GhashKey &hashKey, uint64_t n,
+                     unsigned char tag[16]) {
+  unsigned char power[16];
+  memcpy(power, hashKey.H, sizeof(power));
+  while (n != 0) {
+    if (n & 1) GF_Multiply(tag, power, tag);
+    n >>= 1;
+    if (n != 0) GF_Multiply(power, power, power);
   }
+  secure_zero(power, sizeof(power));
+}
 
-  InvSubBytes(state);
-  InvShiftRows(state);
-  AddRoundKey(state, roundKeys);
-
-  for (i = 0; i < 4; i++) {
-    for (j = 0; j < Nb; j++) {
-      out[i + 4 * j] = state[i][j];
-    }
+void AES::DecryptBlock(const unsigned char in[], unsigned char out[],
+                       const unsigned char *roundKeys) {
+  const CipherKernels &k = kernels().rounds(Nr);
+  if (k.decryptBlock) {
+    k.decryptBlock(in, out, roundKeys + 4 * Nb * (Nr + 1));
+    return;
   }
-  secure_zero(state, sizeof(state));
+  unsigned char scratch[bitslicedKeysMaxLen];
+  const unsigned char *sk = BitslicedKeys(roundKeys, scratch);
+  uint64_t q[8];
+  bs_load(in, 1, q);
+  bs_decrypt(Nr, sk, q);
+  bs_store(q, 1, out);
+  secure_zero(q, sizeof(q));
+  if (sk == scratch) secure_zero(scratch, sizeof(scratch));
 }
 
 void AES::SubBytes(unsigned char state[4][Nb]) {
@@ -985,6 +4424,11 @@ void AES::Rcon(unsigned char *a, unsigned int n) {
 }
 
 void AES::KeyExpansion(const unsigned char key[], unsigned char w[]) {
+  const CipherKernels &k = kernels().rounds(Nr);
+  if (k.keyExpansion) {
+    k.keyExpansion(key, w);
+    return;
+  }
   unsigned char temp[4];
   unsigned char rcon[4];
 
@@ -1020,6 +4464,34 @@ void AES::KeyExpansion(const unsigned char key[], unsigned char w[]) {
   secure_zero(rcon, sizeof(rcon));
 }
 
+void AES::InvKeyExpansion(const unsigned char w[], unsigned char dw[]) {
+  const CipherKernels &k = kernels().rounds(Nr);
+  if (k.invKeyExpansion) {
+    k.invKeyExpansion(w, dw);
+    return;
+  }
+  // Equivalent inverse cipher (FIPS-197 5.3.5): reverse the round order and
+  // apply InvMixColumns to every round key except the first and the last.
+  unsigned char state[4][Nb];
+  std::memcpy(dw, w + Nr * 4 * Nb, 4 * Nb);
+  for (unsigned int round = 1; round < Nr; ++round) {
+    const unsigned char *rk = w + (Nr - round) * 4 * Nb;
+    for (unsigned int i = 0; i < 4; i++) {
+      for (unsigned int j = 0; j < Nb; j++) {
+        state[i][j] = rk[i + 4 * j];
+      }
+    }
+    InvMixColumns(state);
+    for (unsigned int i = 0; i < 4; i++) {
+      for (unsigned int j = 0; j < Nb; j++) {
+        dw[round * 4 * Nb + i + 4 * j] = state[i][j];
+      }
+    }
+  }
+  std::memcpy(dw + Nr * 4 * Nb, w, 4 * Nb);
+  secure_zero(state, sizeof(state));
+}
+
 void AES::InvSubBytes(unsigned char state[4][Nb]) {
   unsigned int i, j;
   for (i = 0; i < 4; i++) {
@@ -1105,10 +4577,6 @@ void AES::printHexVector(std::vector<unsigned char> &&a) {
 }
 #endif
 
-std::vector<unsigned char> AES::ArrayToVector(unsigned char *a, size_t len) {
-  std::vector<unsigned char> v(a, a + len);
-  return v;
-}
 AESCPP_NODISCARD std::vector<unsigned char> AES::EncryptECB(
     const std::vector<unsigned char> &in,
     const std::vector<unsigned char> &key) {
@@ -1292,4 +4760,275 @@ AESCPP_NODISCARD std::vector<unsigned char> AES::DecryptGCM(
   return out;
 }
 
+AESCPP_NODISCARD std::vector<unsigned char> AES::EncryptECB(
+    const std::vector<unsigned char> &in, const AesKey &key) {
+  std::vector<unsigned char> out(in.size());
+  EncryptECB(in.data(), in.size(), key, out.data());
+  return out;
+}
+
+AESCPP_NODISCARD std::vector<unsigned char> AES::DecryptECB(
+    const std::vector<unsigned char> &in, const AesKey &key) {
+  std::vector<unsigned char> out(in.size());
+  DecryptECB(in.data(), in.size(), key, out.data());
+  return out;
+}
+
+AESCPP_NODISCARD std::vector<unsigned char> AES::EncryptBlocks(
+    const std::vector<unsigned char> &in, const AesKey &key) {
+  CheckLength(in.size());
+  std::vector<unsigned char> out(in.size());
+  EncryptBlocks(in.data(), in.size() / blockBytesLen, key, out.data());
+  return out;
+}
+
+AESCPP_NODISCARD std::vector<unsigned char> AES::DecryptBlocks(
+    const std::vector<unsigned char> &in, const AesKey &key) {
+  CheckLength(in.size());
+  std::vector<unsigned char> out(in.size());
+  DecryptBlocks(in.data(), in.size() / blockBytesLen, key, out.data());
+  return out;
+}
+
+AESCPP_NODISCARD std::vector<unsigned char> AES::EncryptCBC(
+    const std::vector<unsigned char> &in, const AesKey &key,
+    const std::vector<unsigned char> &iv) {
+  std::vector<unsigned char> out(in.size());
+  EncryptCBC(in.data(), in.size(), key, iv.data(), out.data());
+  return out;
+}
+
+AESCPP_NODISCARD std::vector<unsigned char> AES::DecryptCBC(
+    const std::vector<unsigned char> &in, const AesKey &key,
+    const std::vector<unsigned char> &iv) {
+  std::vector<unsigned char> out(in.size());
+  DecryptCBC(in.data(), in.size(), key, iv.data(), out.data());
+  return out;
+}
+
+AESCPP_NODISCARD std::vector<unsigned char> AES::EncryptCFB(
+    const std::vector<unsigned char> &in, const AesKey &key,
+    const std::vector<unsigned char> &iv) {
+  std::vector<unsigned char> out(in.size());
+  EncryptCFB(in.data(), in.size(), key, iv.data(), out.data());
+  return out;
+}
+
+AESCPP_NODISCARD std::vector<unsigned char> AES::DecryptCFB(
+    const std::vector<unsigned char> &in, const AesKey &key,
+    const std::vector<unsigned char> &iv) {
+  std::vector<unsigned char> out(in.size());
+  DecryptCFB(in.data(), in.size(), key, iv.data(), out.data());
+  return out;
+}
+
+AESCPP_NODISCARD std::vector<unsigned char> AES::EncryptCTR(
+    const std::vector<unsigned char> &in, const AesKey &key,
+    const std::vector<unsigned char> &iv) {
+  std::vector<unsigned char> out(in.size());
+  EncryptCTR(in.data(), in.size(), key, iv.data(), out.data());
+  return out;
+}
+
+AESCPP_NODISCARD std::vector<unsigned char> AES::DecryptCTR(
+    const std::vector<unsigned char> &in, const AesKey &key,
+    const std::vector<unsigned char> &iv) {
+  std::vector<unsigned char> out(in.size());
+  DecryptCTR(in.data(), in.size(), key, iv.data(), out.data());
+  return out;
+}
+
+AESCPP_NODISCARD std::vector<unsigned char> AES::EncryptGCM(
+    const std::vector<unsigned char> &in, const GcmKey &key,
+    const std::vector<unsigned char> &iv, const std::vector<unsigned char> &aad,
+    std::vector<unsigned char> &tag) {
+  if (iv.size() != 12) throw std::invalid_argument("IV size must be 12 bytes");
+  if (tag.size() > 16)
+    throw std::invalid_argument("Tag size must be at most 16 bytes");
+  if (tag.size() < 16) tag.resize(16);
+  std::vector<unsigned char> out(in.size());
+  EncryptGCM(in.data(), in.size(), key, iv.data(), aad.data(), aad.size(),
+             tag.data(), out.data());
+  return out;
+}
+
+AESCPP_NODISCARD std::vector<unsigned char> AES::DecryptGCM(
+    const std::vector<unsigned char> &in, const GcmKey &key,
+    const std::vector<unsigned char> &iv, const std::vector<unsigned char> &aad,
+    const std::vector<unsigned char> &tag) {
+  if (iv.size() != 12) throw std::invalid_argument("IV size must be 12 bytes");
+  if (tag.size() > 16)
+    throw std::invalid_argument("Tag size must be at most 16 bytes");
+  std::vector<unsigned char> tagCopy = tag;
+  if (tagCopy.size() < 16) tagCopy.resize(16);
+  std::vector<unsigned char> out(in.size());
+  DecryptGCM(in.data(), in.size(), key, iv.data(), aad.data(), aad.size(),
+             tagCopy.data(), out.data());
+  return out;
+}
+
+void AES::EncryptECB(ByteSpan in, ByteSpan key, MutableByteSpan out) {
+  check_span_args(in, ByteSpan(), 0, out);
+  EncryptECB(in.data(), in.size(), CheckedKey(key), out.data());
+}
+
+void AES::DecryptECB(ByteSpan in, ByteSpan key, MutableByteSpan out) {
+  check_span_args(in, ByteSpan(), 0, out);
+  DecryptECB(in.data(), in.size(), CheckedKey(key), out.data());
+}
+
+void AES::EncryptCBC(ByteSpan in, ByteSpan key, ByteSpan iv,
+                     MutableByteSpan out) {
+  check_span_args(in, iv, blockBytesLen, out);
+  EncryptCBC(in.data(), in.size(), CheckedKey(key), iv.data(), out.data());
+}
+
+void AES::DecryptCBC(ByteSpan in, ByteSpan key, ByteSpan iv,
+                     MutableByteSpan out) {
+  check_span_args(in, iv, blockBytesLen, out);
+  DecryptCBC(in.data(), in.size(), CheckedKey(key), iv.data(), out.data());
+}
+
+void AES::EncryptCFB(ByteSpan in, ByteSpan key, ByteSpan iv,
+                     MutableByteSpan out) {
+  check_span_args(in, iv, blockBytesLen, out);
+  EncryptCFB(in.data(), in.size(), CheckedKey(key), iv.data(), out.data());
+}
+
+void AES::DecryptCFB(ByteSpan in, ByteSpan key, ByteSpan iv,
+                     MutableByteSpan out) {
+  check_span_args(in, iv, blockBytesLen, out);
+  DecryptCFB(in.data(), in.size(), CheckedKey(key), iv.data(), out.data());
+}
+
+void AES::EncryptCTR(ByteSpan in, ByteSpan key, ByteSpan iv,
+                     MutableByteSpan out) {
+  check_span_args(in, iv, blockBytesLen, out);
+  EncryptCTR(in.data(), in.size(), CheckedKey(key), iv.data(), out.data());
+}
+
+void AES::DecryptCTR(ByteSpan in, ByteSpan key, ByteSpan iv,
+                     MutableByteSpan out) {
+  check_span_args(in, iv, blockBytesLen, out);
+  DecryptCTR(in.data(), in.size(), CheckedKey(key), iv.data(), out.data());
+}
+
+void AES::EncryptGCM(ByteSpan in, ByteSpan key, ByteSpan iv, ByteSpan aad,
+                     MutableByteSpan tag, MutableByteSpan out) {
+  check_span_args(in, iv, 12, out);
+  if (tag.size() != 16) throw std::invalid_argument("Tag size must be 16");
+  EncryptGCM(in.data(), in.size(), CheckedKey(key), iv.data(), aad.data(),
+             aad.size(), tag.data(), out.data());
+}
+
+void AES::DecryptGCM(ByteSpan in, ByteSpan key, ByteSpan iv, ByteSpan aad,
+                     ByteSpan tag, MutableByteSpan out) {
+  check_span_args(in, iv, 12, out);
+  if (tag.size() != 16) throw std::invalid_argument("Tag size must be 16");
+  DecryptGCM(in.data(), in.size(), CheckedKey(key), iv.data(), aad.data(),
+             aad.size(), tag.data(), out.data());
+}
+
+void AES::EncryptECB(ByteSpan in, const AesKey &key, MutableByteSpan out) {
+  check_span_args(in, ByteSpan(), 0, out);
+  EncryptECB(in.data(), in.size(), key, out.data());
+}
+
+void AES::DecryptECB(ByteSpan in, const AesKey &key, MutableByteSpan out) {
+  check_span_args(in, ByteSpan(), 0, out);
+  DecryptECB(in.data(), in.size(), key, out.data());
+}
+
+void AES::EncryptCBC(ByteSpan in, const AesKey &key, ByteSpan iv,
+                     MutableByteSpan out) {
+  check_span_args(in, iv, blockBytesLen, out);
+  EncryptCBC(in.data(), in.size(), key, iv.data(), out.data());
+}
+
+void AES::DecryptCBC(ByteSpan in, const AesKey &key, ByteSpan iv,
+                     MutableByteSpan out) {
+  check_span_args(in, iv, blockBytesLen, out);
+  DecryptCBC(in.data(), in.size(), key, iv.data(), out.data());
+}
+
+void AES::EncryptCFB(ByteSpan in, const AesKey &key, ByteSpan iv,
+                     MutableByteSpan out) {
+  check_span_args(in, iv, blockBytesLen, out);
+  EncryptCFB(in.data(), in.size(), key, iv.data(), out.data());
+}
+
+void AES::DecryptCFB(ByteSpan in, const AesKey &key, ByteSpan iv,
+                     MutableByteSpan out) {
+  check_span_args(in, iv, blockBytesLen, out);
+  DecryptCFB(in.data(), in.size(), key, iv.data(), out.data());
+}
+
+void AES::EncryptCTR(ByteSpan in, const AesKey &key, ByteSpan iv,
+                     MutableByteSpan out) {
+  check_span_args(in, iv, blockBytesLen, out);
+  EncryptCTR(in.data(), in.size(), key, iv.data(), out.data());
+}
+
+void AES::DecryptCTR(ByteSpan in, const AesKey &key, ByteSpan iv,
+                     MutableByteSpan out) {
+  check_span_args(in, iv, blockBytesLen, out);
+  DecryptCTR(in.data(), in.size(), key, iv.data(), out.data());
+}
+
+void AES::EncryptGCM(ByteSpan in, const GcmKey &key, ByteSpan iv,
+                     ByteSpan aad, MutableByteSpan tag, MutableByteSpan out) {
+  check_span_args(in, iv, 12, out);
+  if (tag.size() != 16) throw std::invalid_argument("Tag size must be 16");
+  EncryptGCM(in.data(), in.size(), key, iv.data(), aad.data(), aad.size(),
+             tag.data(), out.data());
+}
+
+void AES::DecryptGCM(ByteSpan in, const GcmKey &key, ByteSpan iv,
+                     ByteSpan aad, ByteSpan tag, MutableByteSpan out) {
+  check_span_args(in, iv, 12, out);
+  if (tag.size() != 16) throw std::invalid_argument("Tag size must be 16");
+  DecryptGCM(in.data(), in.size(), key, iv.data(), aad.data(), aad.size(),
+             tag.data(), out.data());
+}
+
+void AES::EncryptXTS(ByteSpan in, const XtsKey &key, uint64_t sector,
+                     MutableByteSpan out) {
+  check_span_args(in, ByteSpan(), 0, out);
+  EncryptXTS(in.data(), in.size(), key, sector, out.data());
+}
+
+void AES::DecryptXTS(ByteSpan in, const XtsKey &key, uint64_t sector,
+                     MutableByteSpan out) {
+  check_span_args(in, ByteSpan(), 0, out);
+  DecryptXTS(in.data(), in.size(), key, sector, out.data());
+}
+
+void AES::EncryptXTSSectors(ByteSpan in, const XtsKey &key, size_t sectorSize,
+                            uint64_t firstSector, MutableByteSpan out) {
+  check_span_args(in, ByteSpan(), 0, out);
+  EncryptXTSSectors(in.data(), in.size(), key, sectorSize, firstSector,
+                    out.data());
+}
+
+void AES::DecryptXTSSectors(ByteSpan in, const XtsKey &key, size_t sectorSize,
+                            uint64_t firstSector, MutableByteSpan out) {
+  check_span_args(in, ByteSpan(), 0, out);
+  DecryptXTSSectors(in.data(), in.size(), key, sectorSize, firstSector,
+                    out.data());
+}
+
+void AES::EncryptCCM(ByteSpan in, const AesKey &key, ByteSpan nonce,
+                     ByteSpan aad, MutableByteSpan tag, MutableByteSpan out) {
+  check_span_args(in, ByteSpan(), 0, out);
+  EncryptCCM(in.data(), in.size(), key, nonce.data(), nonce.size(),
+             aad.data(), aad.size(), tag.data(), tag.size(), out.data());
+}
+
+void AES::DecryptCCM(ByteSpan in, const AesKey &key, ByteSpan nonce,
+                     ByteSpan aad, ByteSpan tag, MutableByteSpan out) {
+  check_span_args(in, ByteSpan(), 0, out);
+  DecryptCCM(in.data(), in.size(), key, nonce.data(), nonce.size(),
+             aad.data(), aad.size(), tag.data(), tag.size(), out.data());
+}
+
 }  // namespace aes_cpp
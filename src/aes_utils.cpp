@@ -39,9 +39,19 @@
 // clang-format on
 #endif
 
+#if !defined(AESUTILS_HAVE_ARC4RANDOM) && !defined(AESUTILS_DISABLE_RANDOM_POOL)
+#define AESUTILS_HAVE_RANDOM_POOL 1
+#endif
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
 #include <aes_cpp/aes_utils.hpp>
 #include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <functional>
+#include <limits>
 #include <stdexcept>
 
 #ifdef AESUTILS_TRUST_STD_RANDOM_DEVICE
@@ -129,10 +139,81 @@ bool fill_os_random(void *data, size_t len) noexcept {
 
 namespace {
 
+std::atomic<unsigned> fork_count{0};
+
+#if !defined(_WIN32)
+void on_fork_child() { fork_count.fetch_add(1, std::memory_order_relaxed); }
+#endif
+
+// Bumped in the child after every fork(), so that a child never hands out
+// bytes its parent buffered or repeats its parent's DRBG output. Returns false
+// if the handler could not be installed, in which case buffered state must not
+// be reused.
+bool fork_generation(unsigned &generation) noexcept {
+#if !defined(_WIN32)
+  static const bool registered =
+      pthread_atfork(nullptr, nullptr, on_fork_child) == 0;
+  if (!registered) return false;
+#endif
+  generation = fork_count.load(std::memory_order_relaxed);
+  return true;
+}
+
+#if defined(AESUTILS_HAVE_RANDOM_POOL)
+// Per-thread buffer of OS randomness, so that IVs do not cost a system call
+// each. Every byte is handed out once and wiped as it is consumed; the rest is
+// wiped when the thread exits.
+struct RandomPool {
+  static constexpr std::size_t capacity = 4096;
+  uint8_t bytes[capacity];
+  std::size_t pos = capacity;  // first unused byte
+  unsigned generation = 0;     // fork_generation() at the last refill
+
+  ~RandomPool() { secure_zero(bytes, sizeof(bytes)); }
+};
+
+thread_local RandomPool random_pool;
+#endif
+
+// Random bytes for IVs: served from the per-thread pool when there is one,
+// otherwise straight from the OS. Large requests bypass the pool.
+bool fill_random(void *data, std::size_t len) noexcept {
+#if defined(AESUTILS_HAVE_RANDOM_POOL)
+  unsigned generation = 0;
+  if (len > RandomPool::capacity / 4 || !fork_generation(generation)) {
+    return detail::fill_os_random(data, len);
+  }
+  RandomPool &pool = random_pool;
+  if (pool.generation != generation) {
+    secure_zero(pool.bytes, sizeof(pool.bytes));
+    pool.pos = RandomPool::capacity;
+    pool.generation = generation;
+  }
+  uint8_t *p = static_cast<uint8_t *>(data);
+  while (len > 0) {
+    if (pool.pos == RandomPool::capacity) {
+      if (!detail::fill_os_random(pool.bytes, sizeof(pool.bytes))) {
+        return false;
+      }
+      pool.pos = 0;
+    }
+    const std::size_t n = std::min(len, RandomPool::capacity - pool.pos);
+    std::memcpy(p, pool.bytes + pool.pos, n);
+    secure_zero(pool.bytes + pool.pos, n);
+    pool.pos += n;
+    p += n;
+    len -= n;
+  }
+  return true;
+#else
+  return detail::fill_os_random(data, len);
+#endif
+}
+
 template <std::size_t N>
 std::array<uint8_t, N> generate_iv_impl() {
   std::array<uint8_t, N> iv{};
-  if (detail::fill_os_random(iv.data(), iv.size())) return iv;
+  if (fill_random(iv.data(), iv.size())) return iv;
 
 #if defined(AESUTILS_TRUST_STD_RANDOM_DEVICE)
   {
@@ -184,6 +265,41 @@ std::array<uint8_t, N> generate_iv_impl() {
       "No secure random source available on this platform");
 }
 
+template <std::size_t N>
+std::vector<std::array<uint8_t, N>> generate_ivs_impl(std::size_t count) {
+  static_assert(sizeof(std::array<uint8_t, N>) == N, "IVs must be contiguous");
+  if (count > std::numeric_limits<std::size_t>::max() / N) {
+    throw std::length_error("Too many IVs requested");
+  }
+  std::vector<std::array<uint8_t, N>> ivs(count);
+  if (count == 0 || fill_random(ivs.data(), count * N)) return ivs;
+  for (auto &iv : ivs) iv = generate_iv_impl<N>();
+  return ivs;
+}
+
+// Check the PKCS#7 padding of `len` bytes in constant time. `out_len` receives
+// the unpadded length, or `len` if the padding is invalid.
+bool padded_length(const uint8_t *data, std::size_t len,
+                   std::size_t &out_len) noexcept {
+  if (len == 0 || (len % BLOCK_SIZE) != 0) {
+    out_len = len;
+    return false;
+  }
+  uint8_t padding = data[len - 1];
+  uint8_t invalid = 0;
+  invalid |= static_cast<uint8_t>((padding - 1) >= BLOCK_SIZE);
+  invalid |= static_cast<uint8_t>(padding > len);
+  uint8_t diff = 0;
+  for (std::size_t i = 0; i < BLOCK_SIZE; ++i) {
+    uint8_t mask = static_cast<uint8_t>(0 - static_cast<uint8_t>(i < padding));
+    diff |= (data[len - 1 - i] ^ padding) & mask;
+  }
+  invalid |= diff;
+  size_t mask = -static_cast<size_t>(invalid == 0);
+  out_len = ((len - padding) & mask) | (len & ~mask);
+  return mask != 0;
+}
+
 }  // namespace
 
 bool constant_time_equal(const std::vector<uint8_t> &a,
@@ -206,6 +322,14 @@ std::array<uint8_t, 12> generate_iv_12() { return generate_iv_impl<12>(); }
 
 std::array<uint8_t, 16> generate_iv_16() { return generate_iv_impl<16>(); }
 
+std::vector<std::array<uint8_t, 12>> generate_iv_12(std::size_t count) {
+  return generate_ivs_impl<12>(count);
+}
+
+std::vector<std::array<uint8_t, 16>> generate_iv_16(std::size_t count) {
+  return generate_ivs_impl<16>(count);
+}
+
 std::vector<uint8_t> add_padding(const std::vector<uint8_t> &data) {
   std::vector<uint8_t> padded = data;
   std::size_t padding = BLOCK_SIZE - (data.size() % BLOCK_SIZE);
@@ -215,27 +339,9 @@ std::vector<uint8_t> add_padding(const std::vector<uint8_t> &data) {
 
 bool remove_padding(const std::vector<uint8_t> &data, std::vector<uint8_t> &out,
                     std::size_t &out_len) noexcept {
-  std::size_t len = data.size();
-  if (len == 0 || (len % BLOCK_SIZE) != 0) {
-    out = data;
-    out_len = len;
-    return false;
-  }
-  uint8_t padding = data.back();
-  uint8_t invalid = 0;
-  invalid |= static_cast<uint8_t>((padding - 1) >= BLOCK_SIZE);
-  invalid |= static_cast<uint8_t>(padding > len);
-  uint8_t diff = 0;
-  for (std::size_t i = 0; i < BLOCK_SIZE; ++i) {
-    uint8_t mask = static_cast<uint8_t>(0 - static_cast<uint8_t>(i < padding));
-    diff |= (data[len - 1 - i] ^ padding) & mask;
-  }
-  invalid |= diff;
-  size_t mask = -static_cast<size_t>(invalid == 0);
-  out_len = ((len - padding) & mask) | (len & ~mask);
-  out.resize(len);
-  std::copy(data.begin(), data.end(), out.begin());
-  return mask != 0;
+  const bool ok = padded_length(data.data(), data.size(), out_len);
+  out = data;
+  return ok;
 }
 
 std::vector<uint8_t> add_iv_to_ciphertext(
@@ -277,36 +383,55 @@ AESKeyLength key_length_from_key(const T &key) {
 template <class T>
 EncryptedData encrypt(const std::vector<uint8_t> &plain, const T &key,
                       AesMode mode, const MacFn &mac_fn) {
-  AES aes(key_length_from_key(key));
-  auto iv = generate_iv_16();
-  const std::vector<uint8_t> *src = &plain;
-  std::vector<uint8_t> padded;
-  if (mode == AesMode::CBC) {
-    padded = add_padding(plain);
-    src = &padded;
-  }
+  return encrypt(ByteSpan(plain), key, mode, mac_fn);
+}
 
-  std::vector<uint8_t> ciphertext(src->size());
+template <class T>
+EncryptedData encrypt(const std::string &plain_text, const T &key, AesMode mode,
+                      const MacFn &mac_fn) {
+  return encrypt(ByteSpan(plain_text), key, mode, mac_fn);
+}
+
+template <class T>
+EncryptedData encrypt(ByteSpan plain, const T &key, AesMode mode,
+                      const MacFn &mac_fn) {
+  const AESKeyLength key_length = key_length_from_key(key);
+  AES aes(key_length, 0);
+  auto iv = generate_iv_16();
+  std::vector<uint8_t> ciphertext;
   switch (mode) {
-    case AesMode::CBC:
-      aes.EncryptCBC(src->data(), src->size(), key.data(), iv.data(),
-                     ciphertext.data());
+    case AesMode::CBC: {
+      // Whole blocks are encrypted straight from `plain`; only the last,
+      // padded block is assembled in a local buffer.
+      const std::size_t full = plain.size() - plain.size() % BLOCK_SIZE;
+      const uint8_t padding =
+          static_cast<uint8_t>(BLOCK_SIZE - (plain.size() - full));
+      std::array<uint8_t, BLOCK_SIZE> last;
+      last.fill(padding);
+      std::copy(plain.data() + full, plain.data() + plain.size(), last.begin());
+      ciphertext.resize(full + BLOCK_SIZE);
+      const AesKey handle(key_length, key.data());
+      aes.EncryptCBC(plain.data(), full, handle, iv.data(), ciphertext.data());
+      aes.EncryptCBC(last.data(), BLOCK_SIZE, handle,
+                     full ? ciphertext.data() + full - BLOCK_SIZE : iv.data(),
+                     ciphertext.data() + full);
+      secure_zero(last.data(), last.size());
       break;
+    }
     case AesMode::CFB:
-      aes.EncryptCFB(src->data(), src->size(), key.data(), iv.data(),
+      ciphertext.resize(plain.size());
+      aes.EncryptCFB(plain.data(), plain.size(), key.data(), iv.data(),
                      ciphertext.data());
       break;
     case AesMode::CTR:
-      aes.EncryptCTR(src->data(), src->size(), key.data(), iv.data(),
+      ciphertext.resize(plain.size());
+      aes.EncryptCTR(plain.data(), plain.size(), key.data(), iv.data(),
                      ciphertext.data());
       break;
     default:
       throw std::invalid_argument(
           "Invalid AES mode; expected CBC, CFB, or CTR");
   }
-  if (mode == AesMode::CBC) {
-    secure_zero(padded.data(), padded.size());
-  }
   std::vector<uint8_t> tag;
   if (mac_fn) {
     auto mac_input = add_iv_to_ciphertext(ciphertext, iv);
@@ -317,15 +442,25 @@ EncryptedData encrypt(const std::vector<uint8_t> &plain, const T &key,
 }
 
 template <class T>
-EncryptedData encrypt(const std::string &plain_text, const T &key, AesMode mode,
-                      const MacFn &mac_fn) {
-  return encrypt(std::vector<uint8_t>(plain_text.begin(), plain_text.end()),
-                 key, mode, mac_fn);
+std::vector<uint8_t> decrypt(const EncryptedData &data, const T &key,
+                             AesMode mode, const MacFn &mac_fn) {
+  std::vector<uint8_t> plain(data.ciphertext.size());
+  plain.resize(decrypt_into(data, key, mode, MutableByteSpan(plain), mac_fn));
+  return plain;
 }
 
 template <class T>
-std::vector<uint8_t> decrypt(const EncryptedData &data, const T &key,
-                             AesMode mode, const MacFn &mac_fn) {
+std::string decrypt_to_string(const EncryptedData &data, const T &key,
+                              AesMode mode, const MacFn &mac_fn) {
+  std::string result(data.ciphertext.size(), '\0');
+  MutableByteSpan out(reinterpret_cast<uint8_t *>(&result[0]), result.size());
+  result.resize(decrypt_into(data, key, mode, out, mac_fn));
+  return result;
+}
+
+template <class T>
+std::size_t decrypt_into(const EncryptedData &data, const T &key, AesMode mode,
+                         MutableByteSpan out, const MacFn &mac_fn) {
   if (mac_fn) {
     auto mac_input = add_iv_to_ciphertext(data.ciphertext, data.iv);
     auto expected = mac_fn(mac_input);
@@ -333,22 +468,24 @@ std::vector<uint8_t> decrypt(const EncryptedData &data, const T &key,
       throw std::invalid_argument("MAC verification failed");
     }
   }
-  AES aes(key_length_from_key(key));
-  std::vector<uint8_t> plain(data.ciphertext.size());
+  const std::size_t len = data.ciphertext.size();
+  if (out.size() < len) throw std::length_error("Output buffer too small");
+  AES aes(key_length_from_key(key), 0);
+  uint8_t *plain = out.data();
   bool decrypt_error = false;
   try {
     switch (mode) {
       case AesMode::CBC:
-        aes.DecryptCBC(data.ciphertext.data(), data.ciphertext.size(),
-                       key.data(), data.iv.data(), plain.data());
+        aes.DecryptCBC(data.ciphertext.data(), len, key.data(),
+                       data.iv.data(), plain);
         break;
       case AesMode::CFB:
-        aes.DecryptCFB(data.ciphertext.data(), data.ciphertext.size(),
-                       key.data(), data.iv.data(), plain.data());
+        aes.DecryptCFB(data.ciphertext.data(), len, key.data(),
+                       data.iv.data(), plain);
         break;
       case AesMode::CTR:
-        aes.DecryptCTR(data.ciphertext.data(), data.ciphertext.size(),
-                       key.data(), data.iv.data(), plain.data());
+        aes.DecryptCTR(data.ciphertext.data(), len, key.data(),
+                       data.iv.data(), plain);
         break;
       default:
         throw std::invalid_argument(
@@ -357,38 +494,33 @@ std::vector<uint8_t> decrypt(const EncryptedData &data, const T &key,
   } catch (const std::length_error &) {
     decrypt_error = true;
   }
-  if (mode == AesMode::CBC) {
-    std::vector<uint8_t> result;
-    std::size_t out_len = 0;
-    bool ok = remove_padding(plain, result, out_len);
-    secure_zero(plain.data(), plain.size());
-    if (decrypt_error || !ok) {
-      secure_zero(result.data(), result.size());
-      throw std::runtime_error("Invalid ciphertext");
-    }
-    result.resize(out_len);
-    return result;
-  }
-  if (decrypt_error) {
-    secure_zero(plain.data(), plain.size());
+  std::size_t out_len = len;
+  bool ok = true;
+  if (mode == AesMode::CBC) ok = padded_length(plain, len, out_len);
+  if (decrypt_error || !ok) {
+    secure_zero(plain, len);
     throw std::runtime_error("Invalid ciphertext");
   }
-  return plain;
+  // Drop the padding bytes.
+  secure_zero(plain + out_len, len - out_len);
+  return out_len;
 }
 
 template <class T>
-std::string decrypt_to_string(const EncryptedData &data, const T &key,
-                              AesMode mode, const MacFn &mac_fn) {
-  std::vector<uint8_t> plain = decrypt(data, key, mode, mac_fn);
-  std::string result(plain.begin(), plain.end());
-  secure_zero(plain.data(), plain.size());
-  return result;
+GcmEncryptedData encrypt_gcm(const std::vector<uint8_t> &plain, const T &key,
+                             const std::vector<uint8_t> &aad) {
+  return encrypt_gcm(ByteSpan(plain), key, ByteSpan(aad));
 }
 
 template <class T>
-GcmEncryptedData encrypt_gcm(const std::vector<uint8_t> &plain, const T &key,
+GcmEncryptedData encrypt_gcm(const std::string &plain_text, const T &key,
                              const std::vector<uint8_t> &aad) {
-  AES aes(key_length_from_key(key));
+  return encrypt_gcm(ByteSpan(plain_text), key, ByteSpan(aad));
+}
+
+template <class T>
+GcmEncryptedData encrypt_gcm(ByteSpan plain, const T &key, ByteSpan aad) {
+  AES aes(key_length_from_key(key), 0);
   auto iv = generate_iv_12();
   std::array<uint8_t, 16> tag{};
   std::vector<uint8_t> ciphertext(plain.size());
@@ -398,33 +530,273 @@ GcmEncryptedData encrypt_gcm(const std::vector<uint8_t> &plain, const T &key,
   return {std::chrono::system_clock::now(), iv, std::move(ciphertext), tag};
 }
 
-template <class T>
-GcmEncryptedData encrypt_gcm(const std::string &plain_text, const T &key,
-                             const std::vector<uint8_t> &aad) {
-  return encrypt_gcm(std::vector<uint8_t>(plain_text.begin(), plain_text.end()),
-                     key, aad);
-}
-
 template <class T>
 std::vector<uint8_t> decrypt_gcm(const GcmEncryptedData &data, const T &key,
                                  const std::vector<uint8_t> &aad) {
-  AES aes(key_length_from_key(key));
   std::vector<uint8_t> plain(data.ciphertext.size());
-  aes.DecryptGCM(data.ciphertext.data(), data.ciphertext.size(), key.data(),
-                 data.iv.data(), aad.empty() ? nullptr : aad.data(), aad.size(),
-                 data.tag.data(), plain.data());
+  decrypt_gcm_into(data, key, MutableByteSpan(plain), ByteSpan(aad));
   return plain;
 }
 
 template <class T>
 std::string decrypt_gcm_to_string(const GcmEncryptedData &data, const T &key,
                                   const std::vector<uint8_t> &aad) {
-  std::vector<uint8_t> plain = decrypt_gcm(data, key, aad);
-  std::string result(plain.begin(), plain.end());
-  secure_zero(plain.data(), plain.size());
+  std::string result(data.ciphertext.size(), '\0');
+  MutableByteSpan out(reinterpret_cast<uint8_t *>(&result[0]), result.size());
+  decrypt_gcm_into(data, key, out, ByteSpan(aad));
+  return result;
+}
+
+template <class T>
+std::size_t decrypt_gcm_into(const GcmEncryptedData &data, const T &key,
+                             MutableByteSpan out, ByteSpan aad) {
+  const std::size_t len = data.ciphertext.size();
+  if (out.size() < len) throw std::length_error("Output buffer too small");
+  AES aes(key_length_from_key(key), 0);
+  aes.DecryptGCM(data.ciphertext.data(), len, key.data(), data.iv.data(),
+                 aad.empty() ? nullptr : aad.data(), aad.size(),
+                 data.tag.data(), out.data());
+  return len;
+}
+
+namespace {
+
+// Counter values a thread has reserved from one GcmNonceSequence. A few slots
+// let a thread alternate between sequences without dropping its blocks.
+struct NonceBlock {
+  uint64_t owner = 0;  // GcmNonceSequence::id, never reused
+  uint64_t next = 0;
+  uint64_t end = 0;
+};
+
+constexpr std::size_t nonce_block_slots = 4;
+thread_local NonceBlock nonce_blocks[nonce_block_slots];
+thread_local std::size_t nonce_block_victim = 0;
+std::atomic<uint64_t> next_nonce_sequence_id{1};
+
+}  // namespace
+
+GcmNonceSequence::GcmNonceSequence(const GcmKey &key, uint32_t fixed,
+                                   uint64_t limit, uint32_t block_size)
+    : key(key),
+      fixed(fixed),
+      limit(limit),
+      blockSize(block_size),
+      id(next_nonce_sequence_id.fetch_add(1, std::memory_order_relaxed)),
+      reserved(0) {
+  if (block_size == 0) throw std::invalid_argument("Block size must be > 0");
+  if (!fork_generation(forkGeneration)) {
+    throw std::runtime_error("Cannot detect fork() for nonce sequence");
+  }
+}
+
+std::array<uint8_t, 12> GcmNonceSequence::next() {
+  // A forked child inherits the thread-local blocks and the shared counter,
+  // so it would issue the same nonces as its parent under the same key.
+  unsigned generation = 0;
+  if (!fork_generation(generation) || generation != forkGeneration) {
+    throw std::logic_error("Nonce sequence used after fork()");
+  }
+  NonceBlock *slot = nullptr;
+  for (NonceBlock &block : nonce_blocks) {
+    if (block.owner != id) continue;
+    slot = &block;
+    if (block.next < block.end) break;
+  }
+
+  if (!slot || slot->next == slot->end) {
+    // Reserve the next block; never move the shared counter past the limit.
+    uint64_t begin = reserved.load(std::memory_order_relaxed);
+    uint64_t end = 0;
+    do {
+      if (begin >= limit) throw std::length_error("Nonce sequence exhausted");
+      end = begin + std::min<uint64_t>(blockSize, limit - begin);
+    } while (!reserved.compare_exchange_weak(begin, end,
+                                             std::memory_order_relaxed));
+    if (!slot) {
+      slot = &nonce_blocks[nonce_block_victim];
+      nonce_block_victim = (nonce_block_victim + 1) % nonce_block_slots;
+    }
+    slot->owner = id;
+    slot->next = begin;
+    slot->end = end;
+  }
+
+  const uint64_t counter = slot->next++;
+  std::array<uint8_t, 12> nonce;
+  for (int i = 0; i < 4; ++i) {
+    nonce[i] = static_cast<uint8_t>(fixed >> (24 - 8 * i));
+  }
+  for (int i = 0; i < 8; ++i) {
+    nonce[4 + i] = static_cast<uint8_t>(counter >> (56 - 8 * i));
+  }
+  return nonce;
+}
+
+GcmEncryptedData GcmNonceSequence::encrypt(ByteSpan plain, ByteSpan aad) {
+  GcmEncryptedData result;
+  result.iv = next();
+  result.ciphertext.resize(plain.size());
+  AES aes(key.aes_key().key_length(), 0);
+  aes.EncryptGCM(plain.data(), plain.size(), key, result.iv.data(),
+                 aad.empty() ? nullptr : aad.data(), aad.size(),
+                 result.tag.data(), result.ciphertext.data());
+  result.timestamp = std::chrono::system_clock::now();
   return result;
 }
 
+namespace {
+
+// Big-endian 128-bit V arithmetic, wrapping like the CTR kernels.
+void be128_increment(uint8_t v[16]) {
+  for (int i = 15; i >= 0 && ++v[i] == 0; --i) {
+  }
+}
+
+void be128_decrement(uint8_t v[16]) {
+  for (int i = 15; i >= 0 && v[i]-- == 0; --i) {
+  }
+}
+
+}  // namespace
+
+constexpr std::size_t CtrDrbg::seed_length;
+constexpr std::size_t CtrDrbg::max_request_bytes;
+constexpr uint64_t CtrDrbg::default_reseed_interval;
+
+CtrDrbg::CtrDrbg(ByteSpan personalization, uint64_t reseed_interval)
+    : cipher(AESKeyLength::AES_256, 0) {
+  uint8_t entropy[seed_length];
+  if (!detail::fill_os_random(entropy, sizeof(entropy))) {
+    throw std::runtime_error("Failed to read OS entropy");
+  }
+  try {
+    Instantiate(ByteSpan(entropy, sizeof(entropy)), personalization,
+                reseed_interval);
+  } catch (...) {
+    secure_zero(entropy, sizeof(entropy));
+    throw;
+  }
+  secure_zero(entropy, sizeof(entropy));
+}
+
+CtrDrbg::CtrDrbg(ByteSpan entropy, ByteSpan personalization,
+                 uint64_t reseed_interval)
+    : cipher(AESKeyLength::AES_256, 0) {
+  Instantiate(entropy, personalization, reseed_interval);
+}
+
+CtrDrbg::~CtrDrbg() { secure_zero(v, sizeof(v)); }
+
+void CtrDrbg::Instantiate(ByteSpan entropy, ByteSpan personalization,
+                          uint64_t reseed_interval) {
+  if (reseed_interval == 0 || reseed_interval > (1ull << 48)) {
+    throw std::invalid_argument("Reseed interval must be 1 to 2^48");
+  }
+  reseedInterval = reseed_interval;
+  const uint8_t zeroKey[32] = {0};
+  schedule = cipher.ExpandSchedule(zeroKey);
+  std::memset(v, 0, sizeof(v));
+  Seed(entropy, personalization);
+}
+
+void CtrDrbg::generate(MutableByteSpan out, ByteSpan additional) {
+  if (additional.size() > seed_length) {
+    throw std::invalid_argument("Additional input too long");
+  }
+  unsigned generation = 0;
+  if (!fork_generation(generation) || generation != forkGeneration) {
+    // A forked child must not repeat its parent's output.
+    reseed();
+  }
+  uint8_t *p = out.data();
+  std::size_t left = out.size();
+  while (left > 0) {
+    if (reseedCounter > reseedInterval) {
+      reseed(additional);
+      additional = ByteSpan();
+    }
+    const std::size_t n = std::min(left, max_request_bytes);
+    Request(p, n, additional);
+    additional = ByteSpan();
+    p += n;
+    left -= n;
+  }
+}
+
+void CtrDrbg::reseed(ByteSpan additional) {
+  uint8_t entropy[seed_length];
+  if (!detail::fill_os_random(entropy, sizeof(entropy))) {
+    throw std::runtime_error("Failed to read OS entropy");
+  }
+  try {
+    Seed(ByteSpan(entropy, sizeof(entropy)), additional);
+  } catch (...) {
+    secure_zero(entropy, sizeof(entropy));
+    throw;
+  }
+  secure_zero(entropy, sizeof(entropy));
+}
+
+void CtrDrbg::reseed(ByteSpan entropy, ByteSpan additional) {
+  Seed(entropy, additional);
+}
+
+void CtrDrbg::Seed(ByteSpan entropy, ByteSpan additional) {
+  if (entropy.size() != seed_length) {
+    throw std::invalid_argument("Entropy input must be 48 bytes");
+  }
+  if (additional.size() > seed_length) {
+    throw std::invalid_argument("Additional input too long");
+  }
+  uint8_t seed[seed_length] = {0};
+  std::copy(additional.data(), additional.data() + additional.size(), seed);
+  for (std::size_t i = 0; i < seed_length; ++i) seed[i] ^= entropy.data()[i];
+  Update(seed);
+  secure_zero(seed, sizeof(seed));
+  reseedCounter = 1;
+  fork_generation(forkGeneration);
+}
+
+void CtrDrbg::Update(const uint8_t provided[seed_length]) {
+  // temp = E(K, V+1) || E(K, V+2) || E(K, V+3), XORed with `provided`.
+  uint8_t temp[seed_length];
+  uint8_t counter[16];
+  std::memcpy(counter, v, sizeof(counter));
+  be128_increment(counter);
+  cipher.CtrXor(provided, temp, seed_length, schedule->data(), counter);
+  schedule = cipher.ExpandSchedule(temp);
+  std::memcpy(v, temp + 32, sizeof(v));
+  secure_zero(temp, sizeof(temp));
+  secure_zero(counter, sizeof(counter));
+}
+
+void CtrDrbg::Request(uint8_t *out, std::size_t len, ByteSpan additional) {
+  uint8_t extra[seed_length] = {0};
+  if (!additional.empty()) {
+    std::copy(additional.data(), additional.data() + additional.size(),
+              extra);
+    Update(extra);
+  }
+  // The output is the CTR keystream from V+1; V ends on the last block used.
+  uint8_t counter[16];
+  std::memcpy(counter, v, sizeof(counter));
+  be128_increment(counter);
+  std::memset(out, 0, len);
+  cipher.CtrXor(out, out, len, schedule->data(), counter);
+  std::memcpy(v, counter, sizeof(v));
+  be128_decrement(v);
+  Update(extra);
+  ++reseedCounter;
+  secure_zero(extra, sizeof(extra));
+  secure_zero(counter, sizeof(counter));
+}
+
+void random_bytes(MutableByteSpan out) {
+  thread_local CtrDrbg drbg;
+  drbg.generate(out);
+}
+
 template AESKeyLength key_length_from_key<std::vector<uint8_t>>(
     const std::vector<uint8_t> &);
 template AESKeyLength key_length_from_key<std::array<uint8_t, 16>>(
@@ -537,6 +909,50 @@ template std::string decrypt_gcm_to_string<std::array<uint8_t, 32>>(
     const GcmEncryptedData &, const std::array<uint8_t, 32> &,
     const std::vector<uint8_t> &);
 
+template EncryptedData encrypt<std::vector<uint8_t>>(
+    ByteSpan, const std::vector<uint8_t> &, AesMode, const MacFn &);
+template EncryptedData encrypt<std::array<uint8_t, 16>>(
+    ByteSpan, const std::array<uint8_t, 16> &, AesMode, const MacFn &);
+template EncryptedData encrypt<std::array<uint8_t, 24>>(
+    ByteSpan, const std::array<uint8_t, 24> &, AesMode, const MacFn &);
+template EncryptedData encrypt<std::array<uint8_t, 32>>(
+    ByteSpan, const std::array<uint8_t, 32> &, AesMode, const MacFn &);
+
+template std::size_t decrypt_into<std::vector<uint8_t>>(
+    const EncryptedData &, const std::vector<uint8_t> &, AesMode,
+    MutableByteSpan, const MacFn &);
+template std::size_t decrypt_into<std::array<uint8_t, 16>>(
+    const EncryptedData &, const std::array<uint8_t, 16> &, AesMode,
+    MutableByteSpan, const MacFn &);
+template std::size_t decrypt_into<std::array<uint8_t, 24>>(
+    const EncryptedData &, const std::array<uint8_t, 24> &, AesMode,
+    MutableByteSpan, const MacFn &);
+template std::size_t decrypt_into<std::array<uint8_t, 32>>(
+    const EncryptedData &, const std::array<uint8_t, 32> &, AesMode,
+    MutableByteSpan, const MacFn &);
+
+template GcmEncryptedData encrypt_gcm<std::vector<uint8_t>>(
+    ByteSpan, const std::vector<uint8_t> &, ByteSpan);
+template GcmEncryptedData encrypt_gcm<std::array<uint8_t, 16>>(
+    ByteSpan, const std::array<uint8_t, 16> &, ByteSpan);
+template GcmEncryptedData encrypt_gcm<std::array<uint8_t, 24>>(
+    ByteSpan, const std::array<uint8_t, 24> &, ByteSpan);
+template GcmEncryptedData encrypt_gcm<std::array<uint8_t, 32>>(
+    ByteSpan, const std::array<uint8_t, 32> &, ByteSpan);
+
+template std::size_t decrypt_gcm_into<std::vector<uint8_t>>(
+    const GcmEncryptedData &, const std::vector<uint8_t> &, MutableByteSpan,
+    ByteSpan);
+template std::size_t decrypt_gcm_into<std::array<uint8_t, 16>>(
+    const GcmEncryptedData &, const std::array<uint8_t, 16> &, MutableByteSpan,
+    ByteSpan);
+template std::size_t decrypt_gcm_into<std::array<uint8_t, 24>>(
+    const GcmEncryptedData &, const std::array<uint8_t, 24> &, MutableByteSpan,
+    ByteSpan);
+template std::size_t decrypt_gcm_into<std::array<uint8_t, 32>>(
+    const GcmEncryptedData &, const std::array<uint8_t, 32> &, MutableByteSpan,
+    ByteSpan);
+
 }  // namespace utils
 
 }  // namespace aes_cpp
@@ -8,12 +8,18 @@
 #include <chrono>
 #include <future>
 #include <iostream>
+#include <random>
 #include <string>
 #include <thread>
 #include <vector>
 
 #include "gtest/gtest.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 #if defined(__GNUC__) || defined(__clang__)
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
@@ -27,6 +33,7 @@ const unsigned int BLOCK_BYTES_LENGTH = 16 * sizeof(unsigned char);
 namespace aes_cpp {
 bool constant_time_eq(const unsigned char *a, const unsigned char *b,
                       size_t len);
+uint64_t snapshot_registry_lock_count();
 }
 
 TEST(Internal, ConstantTimeEq) {
@@ -70,6 +77,246 @@ TEST(Internal, ConcurrentKeyPreparationDoesNotAffectEncryption) {
   ASSERT_FALSE(memcmp(expected, out.data(), sizeof(expected)));
 }
 
+TEST(Internal, KeyCacheCountsHitsAndMisses) {
+  // Every shard holds at least two entries, so two keys never evict.
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128, 16);
+  unsigned char key1[16] = {1};
+  unsigned char key2[16] = {2};
+
+  auto first = aes.prepare_round_keys(key1);
+  aes.prepare_round_keys(key2);
+  auto again = aes.prepare_round_keys(key1);
+
+  EXPECT_EQ(first.get(), again.get());
+  auto stats = aes.cache_stats();
+  EXPECT_EQ(stats.hits, 1u);
+  EXPECT_EQ(stats.misses, 2u);
+  EXPECT_EQ(stats.evictions, 0u);
+  EXPECT_EQ(stats.size, 2u);
+  EXPECT_EQ(stats.capacity, 16u);
+
+  aes.clear_cache();
+  EXPECT_EQ(aes.cache_stats().size, 0u);
+}
+
+TEST(Internal, KeyCacheEvictsWhenFull) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128, 1);
+  unsigned char key1[16] = {1};
+  unsigned char key2[16] = {2};
+
+  auto held = aes.prepare_round_keys(key1);
+  std::vector<unsigned char> snapshot(*held);
+  aes.prepare_round_keys(key2);
+
+  auto stats = aes.cache_stats();
+  EXPECT_EQ(stats.evictions, 1u);
+  EXPECT_EQ(stats.size, 1u);
+  // A schedule still referenced by a caller survives eviction unchanged.
+  EXPECT_EQ(*held, snapshot);
+  EXPECT_NE(aes.prepare_round_keys(key1).get(), held.get());
+}
+
+TEST(Internal, KeyCacheDisabled) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128, 0);
+  unsigned char key[16] = {1};
+  unsigned char plain[16] = {0};
+  std::vector<unsigned char> in(plain, plain + 16);
+  std::vector<unsigned char> k(key, key + 16);
+
+  auto c1 = aes.EncryptECB(in, k);
+  auto c2 = aes.EncryptECB(in, k);
+  EXPECT_EQ(c1, c2);
+  auto stats = aes.cache_stats();
+  EXPECT_EQ(stats.hits, 0u);
+  EXPECT_EQ(stats.misses, 2u);
+  EXPECT_EQ(stats.size, 0u);
+  // Nothing keeps the schedule once the caller drops it.
+  std::weak_ptr<const std::vector<unsigned char>> schedule =
+      aes.prepare_round_keys(key);
+  EXPECT_TRUE(schedule.expired());
+}
+
+TEST(Internal, KeyCacheManyKeysManyThreads) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128, 8);
+  const size_t keyCount = 32;
+  std::vector<std::vector<unsigned char>> keys(keyCount);
+  std::vector<std::vector<unsigned char>> expected(keyCount);
+  std::vector<unsigned char> plain(64, 0x5c);
+  {
+    aes_cpp::AES reference(aes_cpp::AESKeyLength::AES_128, 0);
+    for (size_t i = 0; i < keyCount; ++i) {
+      keys[i].assign(16, static_cast<unsigned char>(i));
+      expected[i] = reference.EncryptECB(plain, keys[i]);
+    }
+  }
+
+  std::atomic<bool> mismatch{false};
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t]() {
+      for (size_t n = 0; n < 200; ++n) {
+        size_t i = (n * 7 + t * 13) % keyCount;
+        if (aes.EncryptECB(plain, keys[i]) != expected[i]) mismatch = true;
+      }
+    });
+  }
+  for (auto &th : threads) th.join();
+
+  EXPECT_FALSE(mismatch.load());
+  auto stats = aes.cache_stats();
+  // Snapshot hits of the worker threads may not all have been published.
+  EXPECT_LE(stats.hits + stats.misses, 800u);
+  EXPECT_GE(stats.misses, keyCount);
+  EXPECT_LE(stats.size, 8u);
+}
+
+TEST(Internal, KeyCacheSnapshotServesRepeatedLookups) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
+  unsigned char key[16] = {7};
+
+  const auto first = aes.prepare_round_keys(key);
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(aes.prepare_round_keys(key).get(), first.get());
+  }
+  auto stats = aes.cache_stats();
+  EXPECT_EQ(stats.misses, 1u);
+  EXPECT_EQ(stats.hits, 1000u);
+  // Handles given out by the snapshot count references among themselves.
+  EXPECT_EQ(first.use_count(), 2);
+}
+
+TEST(Internal, KeyCacheKeepsHitsOfSnapshotsTakenOver) {
+  aes_cpp::AES first(aes_cpp::AESKeyLength::AES_128);
+  aes_cpp::AES second(aes_cpp::AESKeyLength::AES_128);
+  unsigned char key[16] = {8};
+  for (int i = 0; i <= 10; ++i) first.prepare_round_keys(key);
+  // Another object in this thread takes over every snapshot slot.
+  for (unsigned char k = 1; k <= 4; ++k) {
+    unsigned char other[16] = {k, 0xaa};
+    second.prepare_round_keys(other);
+  }
+  auto stats = first.cache_stats();
+  EXPECT_EQ(stats.misses, 1u);
+  EXPECT_EQ(stats.hits, 10u);
+}
+
+TEST(Internal, KeyCacheDestroyWithoutSnapshotsSkipsRegistry) {
+  const std::vector<unsigned char> key(16, 6);
+  unsigned char plain[16] = {0}, out[16];
+  // Register this thread's snapshot table before counting.
+  aes_cpp::AES user(aes_cpp::AESKeyLength::AES_128);
+  user.EncryptECB(plain, sizeof(plain), key.data(), out);
+
+  const uint64_t locks = aes_cpp::snapshot_registry_lock_count();
+  { aes_cpp::AES unused(aes_cpp::AESKeyLength::AES_128); }
+  {
+    aes_cpp::AES cleared(aes_cpp::AESKeyLength::AES_128);
+    cleared.clear_cache();
+  }
+  { aes_cpp::AES uncached(aes_cpp::AESKeyLength::AES_128, 0); }
+  {
+    aes_cpp::AES uncached(aes_cpp::AESKeyLength::AES_128, 0);
+    uncached.EncryptECB(plain, sizeof(plain), key.data(), out);
+  }
+  const aes_cpp::AesKey handle(aes_cpp::AESKeyLength::AES_128, key);
+  const aes_cpp::GcmKey gcmKey(aes_cpp::AESKeyLength::AES_128, key);
+  EXPECT_EQ(aes_cpp::snapshot_registry_lock_count(), locks);
+
+  // An object that did take a snapshot still releases it.
+  {
+    aes_cpp::AES used(aes_cpp::AESKeyLength::AES_128);
+    used.EncryptECB(plain, sizeof(plain), key.data(), out);
+  }
+  EXPECT_GT(aes_cpp::snapshot_registry_lock_count(), locks);
+}
+
+TEST(Internal, KeyCacheClearReleasesOtherThreadsSnapshots) {
+  std::unique_ptr<aes_cpp::AES> aes(
+      new aes_cpp::AES(aes_cpp::AESKeyLength::AES_128, 4));
+  unsigned char key[16] = {5};
+  // The schedule owned by the cache, not a thread's handle to it.
+  auto cached = [&aes]() {
+    std::weak_ptr<std::vector<unsigned char>> schedule;
+    for (size_t i = 0; i < aes->cacheShardCount; ++i) {
+      for (size_t j = 0; j < aes->cacheShards[i].capacity; ++j) {
+        const auto &entry = aes->cacheShards[i].entries[j];
+        if (entry.roundKeys) schedule = entry.roundKeys;
+      }
+    }
+    return schedule;
+  };
+  // Leaves a snapshot in a thread that stays alive but idle until released.
+  auto useInThread = [&aes, &key](std::promise<void> &release) {
+    std::promise<void> used;
+    std::thread worker([&]() {
+      aes->prepare_round_keys(key);
+      used.set_value();
+      release.get_future().wait();
+    });
+    used.get_future().wait();
+    return worker;
+  };
+
+  std::promise<void> release1;
+  std::thread worker1 = useInThread(release1);
+  std::weak_ptr<std::vector<unsigned char>> schedule = cached();
+  ASSERT_FALSE(schedule.expired());
+  aes->clear_cache();
+  EXPECT_TRUE(schedule.expired());
+  release1.set_value();
+  worker1.join();
+
+  std::promise<void> release2;
+  std::thread worker2 = useInThread(release2);
+  schedule = cached();
+  ASSERT_FALSE(schedule.expired());
+  aes.reset();
+  EXPECT_TRUE(schedule.expired());
+  release2.set_value();
+  worker2.join();
+}
+
+TEST(Internal, KeyCacheSnapshotInvalidatedByEvictionAndClear) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128, 1);
+  unsigned char key1[16] = {1};
+  unsigned char key2[16] = {2};
+
+  auto held = aes.prepare_round_keys(key1);
+  aes.prepare_round_keys(key2);
+  // key1 was evicted; its snapshot must not be served from the fast path.
+  auto after = aes.prepare_round_keys(key1);
+  EXPECT_NE(after.get(), held.get());
+  EXPECT_EQ(*after, *held);
+  EXPECT_EQ(aes.cache_stats().misses, 3u);
+
+  aes.clear_cache();
+  auto cleared = aes.prepare_round_keys(key1);
+  EXPECT_NE(cleared.get(), after.get());
+  EXPECT_EQ(aes.cache_stats().misses, 4u);
+}
+
+TEST(Internal, KeyCacheSnapshotSharedKeyManyThreads) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_256);
+  std::vector<unsigned char> key(32, 0x3c);
+  std::vector<unsigned char> iv(16, 0x01);
+  std::vector<unsigned char> plain(100, 0xa7);
+  const auto expected = aes.EncryptCTR(plain, key, iv);
+
+  std::atomic<bool> mismatch{false};
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < 8; ++t) {
+    threads.emplace_back([&]() {
+      for (int n = 0; n < 500; ++n) {
+        if (aes.EncryptCTR(plain, key, iv) != expected) mismatch = true;
+      }
+    });
+  }
+  for (auto &th : threads) th.join();
+
+  EXPECT_FALSE(mismatch.load());
+  EXPECT_EQ(aes.cache_stats().misses, 1u);
+}
+
 TEST(KeyLengths, KeyLength128) {
   aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
   unsigned char plain[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
@@ -115,6 +362,180 @@ TEST(KeyLengths, KeyLength256) {
   delete[] out;
 }
 
+TEST(KeyLengths, KeyExpansionMatchesFips197AppendixA) {
+  const unsigned char key128[] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae,
+                                  0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88,
+                                  0x09, 0xcf, 0x4f, 0x3c};
+  const unsigned char key192[] = {0x8e, 0x73, 0xb0, 0xf7, 0xda, 0x0e,
+                                  0x64, 0x52, 0xc8, 0x10, 0xf3, 0x2b,
+                                  0x80, 0x90, 0x79, 0xe5, 0x62, 0xf8,
+                                  0xea, 0xd2, 0x52, 0x2c, 0x6b, 0x7b};
+  const unsigned char key256[] = {
+      0x60, 0x3d, 0xeb, 0x10, 0x15, 0xca, 0x71, 0xbe, 0x2b, 0x73, 0xae,
+      0xf0, 0x85, 0x7d, 0x77, 0x81, 0x1f, 0x35, 0x2c, 0x07, 0x3b, 0x61,
+      0x08, 0xd7, 0x2d, 0x98, 0x10, 0xa3, 0x09, 0x14, 0xdf, 0xf4};
+  // Last round key of each expansion.
+  const unsigned char last[3][16] = {
+      {0xd0, 0x14, 0xf9, 0xa8, 0xc9, 0xee, 0x25, 0x89, 0xe1, 0x3f, 0x0c, 0xc8,
+       0xb6, 0x63, 0x0c, 0xa6},
+      {0xe9, 0x8b, 0xa0, 0x6f, 0x44, 0x8c, 0x77, 0x3c, 0x8e, 0xcc, 0x72, 0x04,
+       0x01, 0x00, 0x22, 0x02},
+      {0xfe, 0x48, 0x90, 0xd1, 0xe6, 0x18, 0x8d, 0x0b, 0x04, 0x6d, 0xf3, 0x44,
+       0x70, 0x6c, 0x63, 0x1e}};
+  const unsigned char *keys[] = {key128, key192, key256};
+  const aes_cpp::AESKeyLength lengths[] = {aes_cpp::AESKeyLength::AES_128,
+                                           aes_cpp::AESKeyLength::AES_192,
+                                           aes_cpp::AESKeyLength::AES_256};
+
+  for (int k = 0; k < 3; ++k) {
+    aes_cpp::AES aes(lengths[k]);
+    std::vector<unsigned char> w(16 * (aes.Nr + 1));
+    aes.KeyExpansion(keys[k], w.data());
+    EXPECT_FALSE(memcmp(w.data(), keys[k], 4 * aes.Nk));
+    EXPECT_FALSE(memcmp(w.data() + 16 * aes.Nr, last[k], 16));
+  }
+}
+
+TEST(KeyLengths, InverseScheduleDecryptsFips197Vectors) {
+  const unsigned char plain[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55,
+                                 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb,
+                                 0xcc, 0xdd, 0xee, 0xff};
+  const unsigned char cipher[3][16] = {
+      {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80,
+       0x70, 0xb4, 0xc5, 0x5a},
+      {0xdd, 0xa9, 0x7c, 0xa4, 0x86, 0x4c, 0xdf, 0xe0, 0x6e, 0xaf, 0x70, 0xa0,
+       0xec, 0x0d, 0x71, 0x91},
+      {0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf, 0xea, 0xfc, 0x49, 0x90,
+       0x4b, 0x49, 0x60, 0x89}};
+  const aes_cpp::AESKeyLength lengths[] = {aes_cpp::AESKeyLength::AES_128,
+                                           aes_cpp::AESKeyLength::AES_192,
+                                           aes_cpp::AESKeyLength::AES_256};
+  unsigned char key[32];
+  for (unsigned char i = 0; i < sizeof(key); ++i) key[i] = i;
+
+  for (int k = 0; k < 3; ++k) {
+    aes_cpp::AES aes(lengths[k]);
+    auto roundKeys = aes.prepare_round_keys(key);
+    const size_t scheduleLen = 16 * (aes.Nr + 1);
+    ASSERT_EQ(2 * scheduleLen + 64 * (aes.Nr + 1) + 1, roundKeys->size());
+    // The inverse schedule starts with the last round key and ends with the
+    // cipher key.
+    EXPECT_FALSE(memcmp(roundKeys->data() + scheduleLen,
+                        roundKeys->data() + scheduleLen - 16, 16));
+    EXPECT_FALSE(memcmp(roundKeys->data() + 2 * scheduleLen - 16, key, 16));
+
+    unsigned char *out = aes.DecryptECB(cipher[k], BLOCK_BYTES_LENGTH, key);
+    EXPECT_FALSE(memcmp(plain, out, BLOCK_BYTES_LENGTH));
+    delete[] out;
+  }
+}
+
+// Software plus whichever hardware backends this build and CPU support.
+static std::vector<aes_cpp::Backend> AvailableBackends() {
+  std::vector<aes_cpp::Backend> backends = {aes_cpp::Backend::Software};
+  const aes_cpp::Backend hardware[] = {aes_cpp::Backend::AESNI,
+                                       aes_cpp::Backend::ARMv8};
+  const aes_cpp::Backend initial = aes_cpp::active_backend();
+  for (aes_cpp::Backend backend : hardware) {
+    try {
+      aes_cpp::set_backend(backend);
+      backends.push_back(backend);
+    } catch (const std::invalid_argument &) {
+    }
+  }
+  aes_cpp::set_backend(initial);
+  return backends;
+}
+
+// Run every mode under each available backend, switching between key
+// expansion and use, and compare with the default backend.
+TEST(Backend, AllBackendsAgree) {
+  const aes_cpp::Backend initial = aes_cpp::active_backend();
+  const std::vector<aes_cpp::Backend> backends = AvailableBackends();
+
+  std::vector<unsigned char> key(32);
+  for (size_t i = 0; i < key.size(); ++i) {
+    key[i] = static_cast<unsigned char>(i);
+  }
+  std::vector<unsigned char> plain(16 * 21);
+  for (size_t i = 0; i < plain.size(); ++i) {
+    plain[i] = static_cast<unsigned char>(i * 13);
+  }
+  std::vector<unsigned char> iv(16, 0x42), gcmIv(12, 0x24), aad(7, 0x99);
+  std::vector<unsigned char> odd(plain.begin(), plain.end() - 3);
+
+  const aes_cpp::AESKeyLength lengths[] = {aes_cpp::AESKeyLength::AES_128,
+                                           aes_cpp::AESKeyLength::AES_192,
+                                           aes_cpp::AESKeyLength::AES_256};
+  for (aes_cpp::AESKeyLength length : lengths) {
+    const std::vector<unsigned char> k(
+        key.begin(), key.begin() + 16 + 8 * static_cast<int>(length));
+    aes_cpp::set_backend(aes_cpp::Backend::Auto);
+    aes_cpp::AES reference(length, 0);
+    std::vector<unsigned char> refTag;
+    const auto ecb = reference.EncryptECB(plain, k);
+    const auto cbc = reference.EncryptCBC(plain, k, iv);
+    const auto cfb = reference.EncryptCFB(odd, k, iv);
+    const auto ctr = reference.EncryptCTR(odd, k, iv);
+    const auto gcm = reference.EncryptGCM(odd, k, gcmIv, aad, refTag);
+
+    for (aes_cpp::Backend expandWith : backends) {
+      aes_cpp::set_backend(expandWith);
+      aes_cpp::AesKey handle(length, k);
+      aes_cpp::GcmKey gcmHandle(length, k);
+      for (aes_cpp::Backend runWith : backends) {
+        aes_cpp::set_backend(runWith);
+        EXPECT_EQ(aes_cpp::active_backend(), runWith);
+        aes_cpp::AES aes(length);
+        EXPECT_EQ(aes.EncryptECB(plain, handle), ecb);
+        EXPECT_EQ(aes.DecryptECB(ecb, handle), plain);
+        EXPECT_EQ(aes.EncryptCBC(plain, handle, iv), cbc);
+        EXPECT_EQ(aes.DecryptCBC(cbc, handle, iv), plain);
+        EXPECT_EQ(aes.EncryptCFB(odd, handle, iv), cfb);
+        EXPECT_EQ(aes.DecryptCFB(cfb, handle, iv), odd);
+        EXPECT_EQ(aes.EncryptCTR(odd, handle, iv), ctr);
+        std::vector<unsigned char> tag;
+        EXPECT_EQ(aes.EncryptGCM(odd, gcmHandle, gcmIv, aad, tag), gcm);
+        EXPECT_EQ(tag, refTag);
+        EXPECT_EQ(aes.DecryptGCM(gcm, gcmHandle, gcmIv, aad, refTag), odd);
+        EXPECT_EQ(aes.EncryptGCM(odd, k, gcmIv, aad, tag), gcm);
+        EXPECT_EQ(tag, refTag);
+      }
+    }
+  }
+  aes_cpp::set_backend(initial);
+}
+
+// A schedule expanded under a hardware backend gets its bitsliced keys once,
+// on first use by the software engine, rather than on every block.
+TEST(Backend, BitslicedKeysBuiltOncePerSchedule) {
+  const aes_cpp::Backend initial = aes_cpp::active_backend();
+  const std::vector<aes_cpp::Backend> backends = AvailableBackends();
+  if (backends.size() < 2) GTEST_SKIP() << "no hardware backend";
+  aes_cpp::set_backend(backends[1]);
+  const aes_cpp::AesKey key(aes_cpp::AESKeyLength::AES_128,
+                            std::vector<unsigned char>(16, 0x2b));
+  const std::vector<unsigned char> plain(64, 0x6c), iv(16, 0x01);
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
+  const auto expected = aes.EncryptCBC(plain, key, iv);
+  const std::vector<unsigned char> &schedule = *key.schedule;
+  EXPECT_EQ(schedule.back(), aes_cpp::AES::bitslicedAbsent);
+
+  aes_cpp::set_backend(aes_cpp::Backend::Software);
+  EXPECT_EQ(aes.EncryptCBC(plain, key, iv), expected);
+  EXPECT_EQ(schedule.back(), aes_cpp::AES::bitslicedReady);
+  unsigned char scratch[aes_cpp::AES::bitslicedKeysMaxLen];
+  EXPECT_EQ(aes.BitslicedKeys(schedule.data(), scratch),
+            schedule.data() + 8 * aes_cpp::AES::Nb * (aes.Nr + 1));
+  EXPECT_EQ(aes.DecryptCBC(expected, key, iv), plain);
+  aes_cpp::set_backend(initial);
+}
+
+TEST(Backend, AutoNeverReported) {
+  aes_cpp::set_backend(aes_cpp::Backend::Auto);
+  EXPECT_NE(aes_cpp::active_backend(), aes_cpp::Backend::Auto);
+}
+
 TEST(ECB, EncryptDecryptOneBlock) {
   aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_256);
   unsigned char plain[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
@@ -224,6 +645,40 @@ TEST(ECB, TwoBlocksEncrypt) {
   delete[] out;
 }
 
+TEST(ECB, MultiBlockMatchesSingleBlock) {
+  // Seven blocks: one full group of four plus a partial group on the
+  // bitsliced software path.
+  const aes_cpp::AESKeyLength lengths[] = {aes_cpp::AESKeyLength::AES_128,
+                                           aes_cpp::AESKeyLength::AES_192,
+                                           aes_cpp::AESKeyLength::AES_256};
+  for (aes_cpp::AESKeyLength length : lengths) {
+    aes_cpp::AES aes(length);
+    unsigned char key[32];
+    for (size_t i = 0; i < sizeof(key); ++i) {
+      key[i] = static_cast<unsigned char>(i * 29 + 3);
+    }
+    unsigned char plain[7 * BLOCK_BYTES_LENGTH];
+    for (size_t i = 0; i < sizeof(plain); ++i) {
+      plain[i] = static_cast<unsigned char>(i * 11);
+    }
+    auto roundKeys = aes.prepare_round_keys(key);
+    unsigned char right[sizeof(plain)];
+    for (size_t i = 0; i < sizeof(plain); i += BLOCK_BYTES_LENGTH) {
+      aes.EncryptBlock(plain + i, right + i, roundKeys->data());
+    }
+
+    unsigned char out[sizeof(plain)];
+    aes.EncryptECB(plain, sizeof(plain), key, out);
+    EXPECT_FALSE(memcmp(right, out, sizeof(right)));
+    for (size_t i = 0; i < sizeof(plain); i += BLOCK_BYTES_LENGTH) {
+      aes.DecryptBlock(out + i, out + i, roundKeys->data());
+    }
+    EXPECT_FALSE(memcmp(plain, out, sizeof(plain)));
+    aes.DecryptECB(right, sizeof(right), key, out);
+    EXPECT_FALSE(memcmp(plain, out, sizeof(plain)));
+  }
+}
+
 TEST(ECB, OneBlockDecrypt) {
   aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
   unsigned char encrypted[] = {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
@@ -418,6 +873,24 @@ TEST(CBC, InPlaceDecrypt) {
   delete[] buf;
 }
 
+TEST(CBC, InPlaceDecryptMultipleBatches) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
+  std::vector<unsigned char> key = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05,
+                                    0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b,
+                                    0x0c, 0x0d, 0x0e, 0x0f};
+  std::vector<unsigned char> iv(BLOCK_BYTES_LENGTH, 0x5a);
+  std::vector<unsigned char> plain(19 * BLOCK_BYTES_LENGTH);
+  for (size_t i = 0; i < plain.size(); ++i) {
+    plain[i] = static_cast<unsigned char>(i * 31);
+  }
+
+  std::vector<unsigned char> buf = aes.EncryptCBC(plain, key, iv);
+  std::vector<unsigned char> copy = aes.DecryptCBC(buf, key, iv);
+  aes.DecryptCBC(buf.data(), buf.size(), key.data(), iv.data(), buf.data());
+  ASSERT_EQ(plain, copy);
+  ASSERT_EQ(plain, buf);
+}
+
 TEST(CFB, EncryptDecrypt) {
   aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_256);
   unsigned char plain[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
@@ -556,6 +1029,22 @@ TEST(CFB, InPlaceDecrypt) {
   delete[] buf;
 }
 
+TEST(CFB, InPlaceDecryptMultipleBatchesPartialTail) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_192);
+  std::vector<unsigned char> key(24, 0x3c);
+  std::vector<unsigned char> iv(BLOCK_BYTES_LENGTH, 0xa5);
+  std::vector<unsigned char> plain(17 * BLOCK_BYTES_LENGTH + 9);
+  for (size_t i = 0; i < plain.size(); ++i) {
+    plain[i] = static_cast<unsigned char>(i * 13);
+  }
+
+  std::vector<unsigned char> buf = aes.EncryptCFB(plain, key, iv);
+  std::vector<unsigned char> copy = aes.DecryptCFB(buf, key, iv);
+  aes.DecryptCFB(buf.data(), buf.size(), key.data(), iv.data(), buf.data());
+  ASSERT_EQ(plain, copy);
+  ASSERT_EQ(plain, buf);
+}
+
 TEST(LongData, EncryptDecryptOneKb) {
   aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_256);
   unsigned int kbSize = 1024 * sizeof(unsigned char);
@@ -606,6 +1095,252 @@ TEST(CTR, CounterOverflowThrows) {
                std::length_error);
 }
 
+TEST(CTR, Sp800_38aVector) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
+  unsigned char key[] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+                         0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+  unsigned char iv[] = {0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7,
+                        0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff};
+  unsigned char plain[] = {
+      0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11,
+      0x73, 0x93, 0x17, 0x2a, 0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c,
+      0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51, 0x30, 0xc8, 0x1c, 0x46,
+      0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+      0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b,
+      0xe6, 0x6c, 0x37, 0x10};
+  unsigned char right[] = {
+      0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64,
+      0x99, 0x0d, 0xb6, 0xce, 0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff,
+      0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff, 0x5a, 0xe4, 0xdf, 0x3e,
+      0xdb, 0xd5, 0xd3, 0x5e, 0x5b, 0x4f, 0x09, 0x02, 0x0d, 0xb0, 0x3e, 0xab,
+      0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03, 0xd1, 0x79, 0x21, 0x70, 0xa0,
+      0xf3, 0x00, 0x9c, 0xee};
+
+  unsigned char *out = aes.EncryptCTR(plain, sizeof(plain), key, iv);
+  ASSERT_FALSE(memcmp(right, out, sizeof(right)));
+  delete[] out;
+}
+
+TEST(CTR, MultiBlockCounterCarryMatchesBlockwise) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_192);
+  std::vector<unsigned char> key(24);
+  for (size_t i = 0; i < key.size(); ++i) {
+    key[i] = static_cast<unsigned char>(0xa0 + i);
+  }
+  // The low 64 bits of the counter carry into the high half inside the first
+  // eight-block batch.
+  std::vector<unsigned char> iv = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05,
+                                   0x06, 0x07, 0xff, 0xff, 0xff, 0xff,
+                                   0xff, 0xff, 0xff, 0xfc};
+  const size_t len = 3 * 8 * BLOCK_BYTES_LENGTH + 5;
+  std::vector<unsigned char> plain(len);
+  for (size_t i = 0; i < len; ++i) {
+    plain[i] = static_cast<unsigned char>(i * 7);
+  }
+
+  // Reference keystream: ECB over explicit counter blocks.
+  const size_t blocks = (len + BLOCK_BYTES_LENGTH - 1) / BLOCK_BYTES_LENGTH;
+  std::vector<unsigned char> counters(blocks * BLOCK_BYTES_LENGTH);
+  std::vector<unsigned char> counter = iv;
+  for (size_t b = 0; b < blocks; ++b) {
+    std::copy(counter.begin(), counter.end(),
+              counters.begin() + b * BLOCK_BYTES_LENGTH);
+    for (int j = BLOCK_BYTES_LENGTH - 1; j >= 0; --j) {
+      if (++counter[j] != 0) break;
+    }
+  }
+  std::vector<unsigned char> keystream = aes.EncryptECB(counters, key);
+  std::vector<unsigned char> right(len);
+  for (size_t i = 0; i < len; ++i) right[i] = plain[i] ^ keystream[i];
+
+  std::vector<unsigned char> out = aes.EncryptCTR(plain, key, iv);
+  ASSERT_EQ(right, out);
+  std::vector<unsigned char> innew = aes.DecryptCTR(out, key, iv);
+  ASSERT_EQ(plain, innew);
+}
+
+TEST(CTR, CounterOverflowKeepsPrecedingBlocks) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
+  unsigned char key[16] = {0};
+  unsigned char iv[16];
+  std::fill_n(iv, sizeof(iv), 0xFF);
+  iv[15] = 0xFE;
+  unsigned char plain[3 * 16] = {0};
+  unsigned char out[3 * 16];
+  std::fill_n(out, sizeof(out), 0xAA);
+  EXPECT_NO_THROW(aes.EncryptCTR(plain, 16, key, iv, out));
+  EXPECT_THROW(aes.EncryptCTR(plain, sizeof(plain), key, iv, out),
+               std::length_error);
+  unsigned char *first = aes.EncryptECB(iv, 16, key);
+  EXPECT_FALSE(memcmp(first, out, 16));
+  EXPECT_EQ(0xAA, out[32]);
+  delete[] first;
+}
+
+// Ranges of 48 bytes or more get a thread each, so the buffer is split at odd
+// block offsets, across the carry out of the low 64 counter bits, both with
+// ad hoc threads and on a pool.
+TEST(CTR, ParallelMatchesSequential) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_256);
+  std::vector<unsigned char> key(32);
+  for (size_t i = 0; i < key.size(); ++i) {
+    key[i] = static_cast<unsigned char>(3 * i + 1);
+  }
+  const aes_cpp::AesKey handle(aes_cpp::AESKeyLength::AES_256, key);
+  std::vector<unsigned char> iv(16, 0xff);
+  iv[0] = 0x12;
+  iv[15] = 0xf5;
+  aes_cpp::ThreadPool pool(3);
+  EXPECT_EQ(pool.size(), 3u);
+
+  for (size_t len : {0, 1, 47, 48, 100, 16 * 37 + 9, 16 * 300}) {
+    std::vector<unsigned char> plain(len);
+    for (size_t i = 0; i < len; ++i) {
+      plain[i] = static_cast<unsigned char>(i * 5 + 3);
+    }
+    const std::vector<unsigned char> expected =
+        aes.EncryptCTR(plain, handle, iv);
+
+    aes_cpp::Parallelism threads(5);
+    threads.minBytesPerThread = 48;
+    aes_cpp::Parallelism onPool(pool);
+    onPool.minBytesPerThread = 48;
+    for (const aes_cpp::Parallelism &parallel : {threads, onPool}) {
+      std::vector<unsigned char> out(len), back(len);
+      aes.EncryptCTR(plain.data(), len, handle, iv.data(), out.data(),
+                     parallel);
+      EXPECT_EQ(out, expected);
+      aes.DecryptCTR(out.data(), len, handle, iv.data(), back.data(),
+                     parallel);
+      EXPECT_EQ(back, plain);
+    }
+  }
+}
+
+TEST(CTR, ParallelCounterOverflowKeepsPrecedingBlocks) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
+  const std::vector<unsigned char> key(16, 0x5a);
+  const aes_cpp::AesKey handle(aes_cpp::AESKeyLength::AES_128, key);
+  unsigned char iv[16];
+  std::fill_n(iv, sizeof(iv), 0xFF);
+  iv[15] = 0xF0;
+  std::vector<unsigned char> plain(32 * 16, 0x11), expected(plain.size());
+  std::vector<unsigned char> out(plain.size(), 0xAA);
+  expected = out;
+  EXPECT_THROW(aes.EncryptCTR(plain.data(), plain.size(), handle, iv,
+                              expected.data()),
+               std::length_error);
+  aes_cpp::Parallelism parallel(4);
+  parallel.minBytesPerThread = 16;
+  EXPECT_THROW(aes.EncryptCTR(plain.data(), plain.size(), handle, iv,
+                              out.data(), parallel),
+               std::length_error);
+  EXPECT_EQ(out, expected);
+  EXPECT_EQ(0xAA, out[16 * 16]);
+}
+
+// Ranges start on page-sized tiles; the last one may be short, and for CFB end
+// in a partial block. In-place calls must still see the original ciphertext
+// block in front of each range.
+TEST(ParallelModes, EcbCbcCfbMatchSequential) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_192);
+  std::vector<unsigned char> key(24);
+  for (size_t i = 0; i < key.size(); ++i) {
+    key[i] = static_cast<unsigned char>(7 * i + 2);
+  }
+  const aes_cpp::AesKey handle(aes_cpp::AESKeyLength::AES_192, key);
+  const std::vector<unsigned char> iv(16, 0x77);
+  aes_cpp::ThreadPool pool(3);
+
+  for (size_t len : {16 * 3, 4096 * 2, 4096 * 5 + 16 * 7}) {
+    std::vector<unsigned char> plain(len);
+    for (size_t i = 0; i < len; ++i) {
+      plain[i] = static_cast<unsigned char>(i * 3 + (i >> 8));
+    }
+    const std::vector<unsigned char> odd(plain.begin(), plain.end() - 5);
+    const std::vector<unsigned char> ecb = aes.EncryptECB(plain, handle);
+    const std::vector<unsigned char> cbc = aes.EncryptCBC(plain, handle, iv);
+    const std::vector<unsigned char> cfb = aes.EncryptCFB(odd, handle, iv);
+
+    aes_cpp::Parallelism threads(4);
+    threads.minBytesPerThread = 1;
+    aes_cpp::Parallelism onPool(pool);
+    onPool.minBytesPerThread = 4096;
+    for (const aes_cpp::Parallelism &parallel : {threads, onPool}) {
+      std::vector<unsigned char> buf = plain;
+      aes.EncryptECB(buf.data(), len, handle, buf.data(), parallel);
+      EXPECT_EQ(buf, ecb);
+      aes.DecryptECB(buf.data(), len, handle, buf.data(), parallel);
+      EXPECT_EQ(buf, plain);
+
+      buf = cbc;
+      aes.DecryptCBC(buf.data(), len, handle, iv.data(), buf.data(), parallel);
+      EXPECT_EQ(buf, plain);
+      std::vector<unsigned char> out(len);
+      aes.DecryptCBC(cbc.data(), len, handle, iv.data(), out.data(),
+                     parallel);
+      EXPECT_EQ(out, plain);
+
+      buf = cfb;
+      aes.DecryptCFB(buf.data(), buf.size(), handle, iv.data(), buf.data(),
+                     parallel);
+      EXPECT_EQ(buf, odd);
+    }
+  }
+
+  std::vector<unsigned char> out(20);
+  EXPECT_THROW(aes.DecryptCBC(out.data(), out.size(), handle, iv.data(),
+                              out.data(), aes_cpp::Parallelism(2)),
+               std::length_error);
+}
+
+// Ranges that themselves run parallel work on the same pool complete: waiting
+// callers run queued ranges instead of blocking the workers.
+TEST(ThreadPool, NestedRunsComplete) {
+  aes_cpp::ThreadPool pool(2);
+  std::atomic<int> calls{0};
+  aes_cpp::Parallelism outer(pool);
+  outer.minBytesPerThread = 1;
+  aes_cpp::AES::RunParallel(8, 1, outer, [&](size_t, size_t) {
+    aes_cpp::AES::RunParallel(8, 1, outer, [&](size_t begin, size_t end) {
+      calls += static_cast<int>(end - begin);
+    });
+  });
+  EXPECT_EQ(calls.load(), 3 * 8);
+}
+
+// A throwing range must not unwind the caller while other ranges still run.
+TEST(ThreadPool, RunRethrowsAfterAllTasksFinish) {
+  aes_cpp::ThreadPool pool(2);
+  std::atomic<int> finished{0};
+  size_t failing = 0;
+  auto task = [&](size_t i) {
+    if (i != 0) std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ++finished;
+    if (i == failing) throw std::runtime_error("task");
+  };
+  for (size_t i : {0u, 2u}) {
+    failing = i;
+    finished = 0;
+    EXPECT_THROW(pool.Run(4, task), std::runtime_error);
+    EXPECT_EQ(finished.load(), 4);
+  }
+  // The pool is still usable afterwards.
+  failing = 4;
+  finished = 0;
+  pool.Run(4, task);
+  EXPECT_EQ(finished.load(), 4);
+
+  aes_cpp::Parallelism threads(3);
+  threads.minBytesPerThread = 1;
+  failing = 1;
+  finished = 0;
+  EXPECT_THROW(aes_cpp::AES::RunParallel(
+                   3, 1, threads, [&](size_t begin, size_t) { task(begin); }),
+               std::runtime_error);
+  EXPECT_EQ(finished.load(), 3);
+}
+
 TEST(GCM, EncryptDecryptZeroPlaintext) {
   aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
   unsigned char key[16] = {0};
@@ -656,6 +1391,442 @@ TEST(GCM, DecryptInPlace) {
   ASSERT_FALSE(memcmp(buffer, plain, sizeof(plain)));
 }
 
+TEST(GCM, NistTestCase2) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
+  unsigned char key[16] = {0};
+  unsigned char iv[12] = {0};
+  unsigned char plain[16] = {0};
+  unsigned char right[] = {0x03, 0x88, 0xda, 0xce, 0x60, 0xb6, 0xa3, 0x92,
+                           0xf3, 0x28, 0xc2, 0xb9, 0x71, 0xb2, 0xfe, 0x78};
+  unsigned char rightTag[] = {0xab, 0x6e, 0x47, 0xd4, 0x2c, 0xec, 0x13, 0xbd,
+                              0xf5, 0x3a, 0x67, 0xb2, 0x12, 0x57, 0xbd, 0xdf};
+  unsigned char tag[16];
+
+  unsigned char *out =
+      aes.EncryptGCM(plain, sizeof(plain), key, iv, nullptr, 0, tag);
+  EXPECT_FALSE(memcmp(right, out, sizeof(right)));
+  EXPECT_FALSE(memcmp(rightTag, tag, sizeof(rightTag)));
+  delete[] out;
+}
+
+TEST(GCM, NistTestCase4) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
+  unsigned char key[] = {0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c,
+                         0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08};
+  unsigned char iv[] = {0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce,
+                        0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88};
+  unsigned char aad[] = {0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe,
+                         0xef, 0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad,
+                         0xbe, 0xef, 0xab, 0xad, 0xda, 0xd2};
+  unsigned char plain[] = {
+      0xd9, 0x31, 0x32, 0x25, 0xf8, 0x84, 0x06, 0xe5, 0xa5, 0x59, 0x09, 0xc5,
+      0xaf, 0xf5, 0x26, 0x9a, 0x86, 0xa7, 0xa9, 0x53, 0x15, 0x34, 0xf7, 0xda,
+      0x2e, 0x4c, 0x30, 0x3d, 0x8a, 0x31, 0x8a, 0x72, 0x1c, 0x3c, 0x0c, 0x95,
+      0x95, 0x68, 0x09, 0x53, 0x2f, 0xcf, 0x0e, 0x24, 0x49, 0xa6, 0xb5, 0x25,
+      0xb1, 0x6a, 0xed, 0xf5, 0xaa, 0x0d, 0xe6, 0x57, 0xba, 0x63, 0x7b, 0x39};
+  unsigned char right[] = {
+      0x42, 0x83, 0x1e, 0xc2, 0x21, 0x77, 0x74, 0x24, 0x4b, 0x72, 0x21, 0xb7,
+      0x84, 0xd0, 0xd4, 0x9c, 0xe3, 0xaa, 0x21, 0x2f, 0x2c, 0x02, 0xa4, 0xe0,
+      0x35, 0xc1, 0x7e, 0x23, 0x29, 0xac, 0xa1, 0x2e, 0x21, 0xd5, 0x14, 0xb2,
+      0x54, 0x66, 0x93, 0x1c, 0x7d, 0x8f, 0x6a, 0x5a, 0xac, 0x84, 0xaa, 0x05,
+      0x1b, 0xa3, 0x0b, 0x39, 0x6a, 0x0a, 0xac, 0x97, 0x3d, 0x58, 0xe0, 0x91};
+  unsigned char rightTag[] = {0x5b, 0xc9, 0x4f, 0xbc, 0x32, 0x21, 0xa5, 0xdb,
+                              0x94, 0xfa, 0xe9, 0x5a, 0xe7, 0x12, 0x1a, 0x47};
+  unsigned char tag[16];
+  unsigned char out[sizeof(plain)];
+
+  aes.EncryptGCM(plain, sizeof(plain), key, iv, aad, sizeof(aad), tag, out);
+  EXPECT_FALSE(memcmp(right, out, sizeof(right)));
+  EXPECT_FALSE(memcmp(rightTag, tag, sizeof(rightTag)));
+  aes.DecryptGCM(out, sizeof(out), key, iv, aad, sizeof(aad), rightTag, out);
+  EXPECT_FALSE(memcmp(plain, out, sizeof(plain)));
+}
+
+// SP 800-38D Algorithm 1, one bit at a time.
+static void ReferenceGfMultiply(const unsigned char *X, const unsigned char *Y,
+                                unsigned char *Z) {
+  unsigned char V[16], acc[16] = {0};
+  memcpy(V, Y, 16);
+  for (int i = 0; i < 128; ++i) {
+    if ((X[i / 8] >> (7 - i % 8)) & 1) {
+      for (int j = 0; j < 16; ++j) acc[j] ^= V[j];
+    }
+    const bool carry = V[15] & 1;
+    for (int j = 15; j > 0; --j) {
+      V[j] = static_cast<unsigned char>((V[j] >> 1) | (V[j - 1] << 7));
+    }
+    V[0] >>= 1;
+    if (carry) V[0] ^= 0xe1;
+  }
+  memcpy(Z, acc, 16);
+}
+
+TEST(GCM, GfMultiplyMatchesBitwiseReference) {
+  const aes_cpp::Backend initial = aes_cpp::active_backend();
+  const std::vector<aes_cpp::Backend> backends = AvailableBackends();
+  std::mt19937 rng(1234);
+  for (aes_cpp::Backend backend : backends) {
+    aes_cpp::set_backend(backend);
+    aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
+    for (int n = 0; n < 200; ++n) {
+      unsigned char X[16], Y[16], expected[16], actual[16];
+      for (int i = 0; i < 16; ++i) {
+        X[i] = n == 0 ? 0xff : static_cast<unsigned char>(rng());
+        Y[i] = n == 1 ? 0xff : static_cast<unsigned char>(rng());
+      }
+      ReferenceGfMultiply(X, Y, expected);
+      aes.GF_Multiply(X, Y, actual);
+      EXPECT_FALSE(memcmp(expected, actual, 16));
+      aes.GF_Multiply(X, Y, X);
+      EXPECT_FALSE(memcmp(expected, X, 16));
+    }
+  }
+  aes_cpp::set_backend(initial);
+}
+
+TEST(GCM, MultipleBatchesMatchBlockwiseReference) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_256);
+  std::vector<unsigned char> key(32);
+  for (size_t i = 0; i < key.size(); ++i) {
+    key[i] = static_cast<unsigned char>(0x40 + 3 * i);
+  }
+  unsigned char iv[12] = {0x0f, 0x0e, 0x0d, 0x0c, 0x0b, 0x0a,
+                          0x09, 0x08, 0x07, 0x06, 0x05, 0x04};
+  std::vector<unsigned char> aad(9 * BLOCK_BYTES_LENGTH + 3);
+  for (size_t i = 0; i < aad.size(); ++i) {
+    aad[i] = static_cast<unsigned char>(i * 13);
+  }
+  const size_t len = 3 * 8 * BLOCK_BYTES_LENGTH + 7;
+  std::vector<unsigned char> plain(len);
+  for (size_t i = 0; i < len; ++i) {
+    plain[i] = static_cast<unsigned char>(i * 5 + 1);
+  }
+
+  // Reference: one counter block and one GHASH multiply at a time.
+  auto roundKeys = aes.prepare_round_keys(key.data());
+  unsigned char H[16] = {0};
+  aes.EncryptBlock(H, H, roundKeys->data());
+  unsigned char counter[16] = {0};
+  memcpy(counter, iv, sizeof(iv));
+  counter[15] = 2;
+  std::vector<unsigned char> right(len);
+  unsigned char rightTag[16] = {0};
+  for (size_t i = 0; i < aad.size(); i += 16) {
+    aes.GHASH(H, aad.data() + i, std::min<size_t>(16, aad.size() - i),
+              rightTag);
+  }
+  for (size_t i = 0; i < len; i += 16) {
+    unsigned char ks[16];
+    aes.EncryptBlock(counter, ks, roundKeys->data());
+    ++counter[15];
+    const size_t n = std::min<size_t>(16, len - i);
+    for (size_t j = 0; j < n; ++j) right[i + j] = plain[i + j] ^ ks[j];
+    aes.GHASH(H, right.data() + i, n, rightTag);
+  }
+  unsigned char lenBlock[16] = {0};
+  lenBlock[6] = static_cast<unsigned char>((aad.size() * 8) >> 8);
+  lenBlock[7] = static_cast<unsigned char>(aad.size() * 8);
+  lenBlock[14] = static_cast<unsigned char>((len * 8) >> 8);
+  lenBlock[15] = static_cast<unsigned char>(len * 8);
+  aes.GHASH(H, lenBlock, 16, rightTag);
+  counter[15] = 1;
+  unsigned char S[16];
+  aes.EncryptBlock(counter, S, roundKeys->data());
+  for (int i = 0; i < 16; ++i) rightTag[i] ^= S[i];
+
+  unsigned char tag[16];
+  std::vector<unsigned char> buffer = plain;
+  aes.EncryptGCM(buffer.data(), len, key.data(), iv, aad.data(), aad.size(),
+                 tag, buffer.data());
+  EXPECT_EQ(right, buffer);
+  EXPECT_FALSE(memcmp(rightTag, tag, sizeof(tag)));
+  aes.DecryptGCM(buffer.data(), len, key.data(), iv, aad.data(), aad.size(),
+                 tag, buffer.data());
+  EXPECT_EQ(plain, buffer);
+}
+
+// Split points fall inside and between eight-block batches, and the last
+// range may end in a partial block; tags must match the sequential call under
+// every backend. A tampered tag still zeroizes the whole output.
+TEST(GCM, ParallelMatchesSequential) {
+  const aes_cpp::Backend initial = aes_cpp::active_backend();
+  const std::vector<aes_cpp::Backend> backends = AvailableBackends();
+  std::vector<unsigned char> key(16);
+  for (size_t i = 0; i < key.size(); ++i) {
+    key[i] = static_cast<unsigned char>(0x21 * i);
+  }
+  const std::vector<unsigned char> iv(12, 0x6b), aad(21, 0x3c);
+  aes_cpp::ThreadPool pool(2);
+
+  for (aes_cpp::Backend backend : backends) {
+    aes_cpp::set_backend(backend);
+    aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
+    const aes_cpp::GcmKey handle(aes_cpp::AESKeyLength::AES_128, key);
+    for (size_t len : {0, 5, 128, 129, 16 * 40 + 3, 16 * 8 * 9}) {
+      std::vector<unsigned char> plain(len);
+      for (size_t i = 0; i < len; ++i) {
+        plain[i] = static_cast<unsigned char>(i * 11 + 7);
+      }
+      std::vector<unsigned char> expectedTag;
+      const std::vector<unsigned char> expected =
+          aes.EncryptGCM(plain, handle, iv, aad, expectedTag);
+
+      aes_cpp::Parallelism threads(4);
+      threads.minBytesPerThread = 1;
+      aes_cpp::Parallelism onPool(pool);
+      onPool.minBytesPerThread = 128;
+      for (const aes_cpp::Parallelism &parallel : {threads, onPool}) {
+        std::vector<unsigned char> out(len), back(len), tag(16);
+        aes.EncryptGCM(plain.data(), len, handle, iv.data(), aad.data(),
+                       aad.size(), tag.data(), out.data(), parallel);
+        EXPECT_EQ(out, expected);
+        EXPECT_EQ(tag, expectedTag);
+        aes.DecryptGCM(out.data(), len, handle, iv.data(), aad.data(),
+                       aad.size(), tag.data(), back.data(), parallel);
+        EXPECT_EQ(back, plain);
+
+        tag[0] ^= 1;
+        EXPECT_THROW(aes.DecryptGCM(out.data(), len, handle, iv.data(),
+                                    aad.data(), aad.size(), tag.data(),
+                                    back.data(), parallel),
+                     std::runtime_error);
+        EXPECT_EQ(back, std::vector<unsigned char>(len, 0));
+      }
+    }
+  }
+  aes_cpp::set_backend(initial);
+}
+
+// AAD and payload are fed in random pieces, so partial blocks of keystream
+// and GHASH input are carried across calls at every offset.
+TEST(GCM, StreamingMatchesOneShot) {
+  const aes_cpp::Backend initial = aes_cpp::active_backend();
+  std::vector<unsigned char> key(32);
+  for (size_t i = 0; i < key.size(); ++i) {
+    key[i] = static_cast<unsigned char>(0x90 ^ i);
+  }
+  const std::vector<unsigned char> iv(12, 0x5e);
+  std::mt19937 rng(42);
+
+  for (aes_cpp::Backend backend : AvailableBackends()) {
+    aes_cpp::set_backend(backend);
+    aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_256);
+    const aes_cpp::GcmKey handle(aes_cpp::AESKeyLength::AES_256, key);
+    aes_cpp::GcmEncryptor enc(handle, iv.data());
+    aes_cpp::GcmDecryptor dec(handle, iv.data());
+    for (size_t len : {0, 1, 15, 16, 17, 127, 128, 129, 1000}) {
+      std::vector<unsigned char> plain(len), aad(len % 37);
+      for (size_t i = 0; i < len; ++i) {
+        plain[i] = static_cast<unsigned char>(rng());
+      }
+      for (size_t i = 0; i < aad.size(); ++i) {
+        aad[i] = static_cast<unsigned char>(rng());
+      }
+      std::vector<unsigned char> expectedTag;
+      const std::vector<unsigned char> expected =
+          aes.EncryptGCM(plain, handle, iv, aad, expectedTag);
+
+      // Random piece sizes, including empty ones.
+      auto pieces = [&rng](size_t total) {
+        std::vector<size_t> sizes;
+        for (size_t done = 0; done < total;) {
+          const size_t n = std::min<size_t>(rng() % 40, total - done);
+          sizes.push_back(n);
+          done += n;
+        }
+        return sizes;
+      };
+
+      enc.init(iv.data());
+      size_t pos = 0;
+      for (size_t n : pieces(aad.size())) {
+        enc.aad(aad.data() + pos, n);
+        pos += n;
+      }
+      std::vector<unsigned char> buf = plain;
+      pos = 0;
+      for (size_t n : pieces(len)) {
+        enc.update(buf.data() + pos, n, buf.data() + pos);
+        pos += n;
+      }
+      std::vector<unsigned char> tag(16);
+      enc.finish(tag.data());
+      EXPECT_EQ(buf, expected);
+      EXPECT_EQ(tag, expectedTag);
+
+      dec.init(iv.data());
+      dec.aad(aad.data(), aad.size());
+      pos = 0;
+      for (size_t n : pieces(len)) {
+        dec.update(buf.data() + pos, n, buf.data() + pos);
+        pos += n;
+      }
+      EXPECT_NO_THROW(dec.finish(tag.data()));
+      EXPECT_EQ(buf, plain);
+
+      tag[15] ^= 0x80;
+      dec.init(iv.data());
+      dec.aad(aad.data(), aad.size());
+      dec.update(expected.data(), len, buf.data());
+      EXPECT_THROW(dec.finish(tag.data()), std::runtime_error);
+    }
+  }
+  aes_cpp::set_backend(initial);
+}
+
+TEST(GCM, StreamingEnforcesCallOrder) {
+  const aes_cpp::GcmKey key(aes_cpp::AESKeyLength::AES_128,
+                            std::vector<unsigned char>(16, 1));
+  const unsigned char iv[12] = {0};
+  unsigned char data[4] = {0}, tag[16];
+  EXPECT_THROW(aes_cpp::GcmEncryptor(key, nullptr), std::invalid_argument);
+  aes_cpp::GcmEncryptor enc(key, iv);
+  enc.update(data, sizeof(data), data);
+  EXPECT_THROW(enc.aad(data, sizeof(data)), std::logic_error);
+  enc.finish(tag);
+  EXPECT_THROW(enc.update(data, sizeof(data), data), std::logic_error);
+  EXPECT_THROW(enc.finish(tag), std::logic_error);
+  enc.init(iv);
+  EXPECT_NO_THROW(enc.aad(data, sizeof(data)));
+}
+
+TEST(Streaming, CtrCbcCfbMatchOneShot) {
+  const aes_cpp::Backend initial = aes_cpp::active_backend();
+  std::vector<unsigned char> key(24);
+  for (size_t i = 0; i < key.size(); ++i) {
+    key[i] = static_cast<unsigned char>(0x31 * i + 7);
+  }
+  const std::vector<unsigned char> iv(16, 0xa7);
+  std::mt19937 rng(19);
+
+  // Random piece sizes, including empty ones.
+  auto pieces = [&rng](size_t total) {
+    std::vector<size_t> sizes;
+    for (size_t done = 0; done < total;) {
+      const size_t n = std::min<size_t>(rng() % 70, total - done);
+      sizes.push_back(n);
+      done += n;
+    }
+    return sizes;
+  };
+
+  for (aes_cpp::Backend backend : AvailableBackends()) {
+    aes_cpp::set_backend(backend);
+    aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_192);
+    const aes_cpp::AesKey handle(aes_cpp::AESKeyLength::AES_192, key);
+    aes_cpp::CtrEncryptor ctrEnc(handle, iv.data());
+    aes_cpp::CtrDecryptor ctrDec(handle, iv.data());
+    aes_cpp::CbcEncryptor cbcEnc(handle, iv.data());
+    aes_cpp::CbcDecryptor cbcDec(handle, iv.data());
+    aes_cpp::CfbEncryptor cfbEnc(handle, iv.data());
+    aes_cpp::CfbDecryptor cfbDec(handle, iv.data());
+    for (size_t len : {0, 1, 15, 16, 17, 127, 128, 129, 1000}) {
+      std::vector<unsigned char> plain(len);
+      for (size_t i = 0; i < len; ++i) {
+        plain[i] = static_cast<unsigned char>(rng());
+      }
+      std::vector<unsigned char> out(len + 16);
+      size_t pos = 0;
+
+      // CTR and CFB write exactly what they are given, so run them in place.
+      std::vector<unsigned char> buf = plain;
+      ctrEnc.init(iv.data());
+      for (size_t n : pieces(len)) {
+        ctrEnc.update(buf.data() + pos, n, buf.data() + pos);
+        pos += n;
+      }
+      EXPECT_EQ(buf, aes.EncryptCTR(plain, handle, iv));
+      ctrDec.init(iv.data());
+      pos = 0;
+      for (size_t n : pieces(len)) {
+        ctrDec.update(buf.data() + pos, n, buf.data() + pos);
+        pos += n;
+      }
+      EXPECT_EQ(buf, plain);
+
+      cfbEnc.init(iv.data());
+      pos = 0;
+      for (size_t n : pieces(len)) {
+        cfbEnc.update(buf.data() + pos, n, buf.data() + pos);
+        pos += n;
+      }
+      EXPECT_EQ(buf, aes.EncryptCFB(plain, handle, iv));
+      cfbDec.init(iv.data());
+      pos = 0;
+      for (size_t n : pieces(len)) {
+        cfbDec.update(buf.data() + pos, n, buf.data() + pos);
+        pos += n;
+      }
+      EXPECT_EQ(buf, plain);
+
+      // CBC output trails the input by the buffered partial block.
+      if (len % 16 != 0) continue;
+      cbcEnc.init(iv.data());
+      size_t written = 0;
+      pos = 0;
+      for (size_t n : pieces(len)) {
+        written += cbcEnc.update(plain.data() + pos, n, out.data() + written);
+        pos += n;
+      }
+      cbcEnc.finish();
+      ASSERT_EQ(written, len);
+      const std::vector<unsigned char> cipher(out.begin(), out.begin() + len);
+      EXPECT_EQ(cipher, aes.EncryptCBC(plain, handle, iv));
+      cbcDec.init(iv.data());
+      written = 0;
+      pos = 0;
+      for (size_t n : pieces(len)) {
+        written += cbcDec.update(cipher.data() + pos, n, out.data() + written);
+        pos += n;
+      }
+      cbcDec.finish();
+      ASSERT_EQ(written, len);
+      EXPECT_TRUE(std::equal(plain.begin(), plain.end(), out.begin()));
+    }
+  }
+  aes_cpp::set_backend(initial);
+}
+
+TEST(Streaming, CbcRequiresWholeBlocks) {
+  const aes_cpp::AesKey key(aes_cpp::AESKeyLength::AES_128,
+                            std::vector<unsigned char>(16, 2));
+  const unsigned char iv[16] = {0};
+  unsigned char data[40] = {0}, out[48];
+  EXPECT_THROW(aes_cpp::CbcEncryptor(key, nullptr), std::invalid_argument);
+  aes_cpp::CbcEncryptor enc(key, iv);
+  EXPECT_EQ(enc.update(data, 10, out), 0u);
+  EXPECT_EQ(enc.update(data, 30, out), 32u);
+  EXPECT_THROW(enc.finish(), std::length_error);
+  EXPECT_EQ(enc.update(data, 8, out), 16u);
+  enc.finish();
+  EXPECT_THROW(enc.update(data, 16, out), std::logic_error);
+  std::string finished_msg;
+  try {
+    enc.finish();
+    FAIL() << "Expected logic_error";
+  } catch (const std::logic_error &e) {
+    finished_msg = e.what();
+  }
+  EXPECT_EQ(finished_msg, "CBC message already finished");
+  enc.init(iv);
+  EXPECT_EQ(enc.update(data, 16, data), 16u);
+}
+
+TEST(Streaming, CtrCounterOverflow) {
+  const aes_cpp::AesKey key(aes_cpp::AESKeyLength::AES_128,
+                            std::vector<unsigned char>(16, 3));
+  unsigned char iv[16];
+  memset(iv, 0xff, sizeof(iv));
+  iv[15] = 0xfe;
+  unsigned char data[40] = {0};
+  aes_cpp::CtrEncryptor enc(key, iv);
+  // Two blocks remain: the one at iv and the one at 2^128 - 1.
+  EXPECT_THROW(enc.update(data, 33, data), std::length_error);
+  enc.update(data, 20, data);
+  enc.update(data, 12, data);
+  EXPECT_THROW(enc.update(data, 1, data), std::length_error);
+}
+
 TEST(GCM, InputTooLong) {
   aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
   unsigned char in[16] = {0};
@@ -710,6 +1881,485 @@ TEST(GCM, AadPlusInputTooLong) {
                std::length_error);
 }
 
+TEST(ExpandedKey, MatchesRawKeyAllModes) {
+  const aes_cpp::AESKeyLength lengths[] = {aes_cpp::AESKeyLength::AES_128,
+                                           aes_cpp::AESKeyLength::AES_192,
+                                           aes_cpp::AESKeyLength::AES_256};
+  const size_t keySizes[] = {16, 24, 32};
+  std::vector<unsigned char> plain(16 * 19);
+  for (size_t i = 0; i < plain.size(); ++i) {
+    plain[i] = static_cast<unsigned char>(i * 7 + 3);
+  }
+  std::vector<unsigned char> iv(16, 0xa5);
+  std::vector<unsigned char> gcmIv(12, 0x5a);
+  std::vector<unsigned char> aad = {1, 2, 3, 4, 5};
+
+  for (size_t k = 0; k < 3; ++k) {
+    std::vector<unsigned char> rawKey(keySizes[k]);
+    for (size_t i = 0; i < rawKey.size(); ++i) {
+      rawKey[i] = static_cast<unsigned char>(0x40 + i);
+    }
+    aes_cpp::AES aes(lengths[k]);
+    aes_cpp::AesKey key(lengths[k], rawKey);
+    aes_cpp::GcmKey gcmKey(lengths[k], rawKey);
+    EXPECT_EQ(key.key_length(), lengths[k]);
+
+    auto c = aes.EncryptECB(plain, key);
+    EXPECT_EQ(c, aes.EncryptECB(plain, rawKey));
+    EXPECT_EQ(aes.DecryptECB(c, key), plain);
+
+    c = aes.EncryptCBC(plain, key, iv);
+    EXPECT_EQ(c, aes.EncryptCBC(plain, rawKey, iv));
+    EXPECT_EQ(aes.DecryptCBC(c, key, iv), plain);
+
+    // CFB and CTR also cover a partial final block.
+    std::vector<unsigned char> odd(plain.begin(), plain.end() - 5);
+    c = aes.EncryptCFB(odd, key, iv);
+    EXPECT_EQ(c, aes.EncryptCFB(odd, rawKey, iv));
+    EXPECT_EQ(aes.DecryptCFB(c, key, iv), odd);
+
+    c = aes.EncryptCTR(odd, key, iv);
+    EXPECT_EQ(c, aes.EncryptCTR(odd, rawKey, iv));
+    EXPECT_EQ(aes.DecryptCTR(c, key, iv), odd);
+
+    std::vector<unsigned char> tag, rawTag;
+    c = aes.EncryptGCM(odd, gcmKey, gcmIv, aad, tag);
+    EXPECT_EQ(c, aes.EncryptGCM(odd, rawKey, gcmIv, aad, rawTag));
+    EXPECT_EQ(tag, rawTag);
+    EXPECT_EQ(aes.DecryptGCM(c, gcmKey, gcmIv, aad, tag), odd);
+  }
+}
+
+TEST(ExpandedKey, CopiesShareSchedule) {
+  std::vector<unsigned char> rawKey(16, 0x11);
+  aes_cpp::AesKey key(aes_cpp::AESKeyLength::AES_128, rawKey);
+  aes_cpp::AesKey copy = key;
+  EXPECT_EQ(key.schedule.get(), copy.schedule.get());
+}
+
+TEST(ExpandedKey, KeyLengthMismatchThrows) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_256);
+  std::vector<unsigned char> rawKey(16, 0x22);
+  aes_cpp::AesKey key(aes_cpp::AESKeyLength::AES_128, rawKey);
+  aes_cpp::GcmKey gcmKey(aes_cpp::AESKeyLength::AES_128, rawKey);
+  std::vector<unsigned char> in(16), iv(16), gcmIv(12), tag;
+
+  EXPECT_THROW(aes.EncryptCBC(in, key, iv), std::invalid_argument);
+  EXPECT_THROW(aes.EncryptCTR(in, key, iv), std::invalid_argument);
+  EXPECT_THROW(aes.EncryptGCM(in, gcmKey, gcmIv, {}, tag),
+               std::invalid_argument);
+}
+
+TEST(ExpandedKey, InvalidRawKeyThrows) {
+  std::vector<unsigned char> shortKey(15);
+  EXPECT_THROW(aes_cpp::AesKey(aes_cpp::AESKeyLength::AES_128, shortKey),
+               std::invalid_argument);
+  EXPECT_THROW(aes_cpp::GcmKey(aes_cpp::AESKeyLength::AES_256, shortKey),
+               std::invalid_argument);
+  const unsigned char *nullKey = nullptr;
+  EXPECT_THROW(aes_cpp::AesKey(aes_cpp::AESKeyLength::AES_128, nullKey),
+               std::invalid_argument);
+}
+
+TEST(ExpandedKey, BlocksMatchFips197AndEcb) {
+  // FIPS-197 Appendix C.1
+  const std::vector<unsigned char> rawKey = {
+      0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+      0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+  const std::vector<unsigned char> plain = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55,
+                                            0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb,
+                                            0xcc, 0xdd, 0xee, 0xff};
+  const std::vector<unsigned char> expected = {
+      0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+      0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a};
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
+  aes_cpp::AesKey key(aes_cpp::AESKeyLength::AES_128, rawKey);
+  EXPECT_EQ(aes.EncryptBlocks(plain, key), expected);
+  EXPECT_EQ(aes.DecryptBlocks(expected, key), plain);
+
+  // Eight-block batches plus a tail, in place.
+  std::vector<unsigned char> data(16 * 13);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<unsigned char>(i * 7);
+  }
+  const std::vector<unsigned char> ecb = aes.EncryptECB(data, key);
+  std::vector<unsigned char> buf = data;
+  aes.EncryptBlocks(buf.data(), 13, key, buf.data());
+  EXPECT_EQ(buf, ecb);
+  aes.DecryptBlocks(buf.data(), 13, key, buf.data());
+  EXPECT_EQ(buf, data);
+
+  aes.EncryptBlocks(nullptr, 0, key, nullptr);
+  std::vector<unsigned char> partial(17);
+  EXPECT_THROW(aes.EncryptBlocks(partial, key), std::length_error);
+  aes_cpp::AES aes256(aes_cpp::AESKeyLength::AES_256);
+  EXPECT_THROW(aes256.EncryptBlocks(plain, key), std::invalid_argument);
+}
+
+TEST(ExpandedKey, GcmDecryptInvalidTagZeroesOutput) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
+  unsigned char rawKey[16] = {0};
+  aes_cpp::GcmKey key(aes_cpp::AESKeyLength::AES_128, rawKey);
+  unsigned char plain[20] = {1, 2, 3};
+  unsigned char iv[12] = {0};
+  unsigned char tag[16];
+  unsigned char cipher[sizeof(plain)];
+  unsigned char out[sizeof(plain)];
+
+  aes.EncryptGCM(plain, sizeof(plain), key, iv, nullptr, 0, tag, cipher);
+  tag[0] ^= 1;
+  memset(out, 0xff, sizeof(out));
+  EXPECT_THROW(aes.DecryptGCM(cipher, sizeof(cipher), key, iv, nullptr, 0,
+                              tag, out),
+               std::runtime_error);
+  for (unsigned char b : out) EXPECT_EQ(b, 0);
+}
+
+TEST(Span, MatchesVectorOverloads) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
+  std::vector<unsigned char> key(16), iv(16), plain(64);
+  for (size_t i = 0; i < plain.size(); ++i) {
+    plain[i] = static_cast<unsigned char>(i * 7);
+  }
+  for (size_t i = 0; i < key.size(); ++i) {
+    key[i] = static_cast<unsigned char>(i);
+    iv[i] = static_cast<unsigned char>(0xf0 ^ i);
+  }
+  const aes_cpp::AesKey handle(aes_cpp::AESKeyLength::AES_128, key);
+  std::array<unsigned char, 16> ivArray;
+  std::copy(iv.begin(), iv.end(), ivArray.begin());
+
+  std::vector<unsigned char> out(plain.size());
+  aes.EncryptCBC(plain, key, ivArray, out);
+  EXPECT_EQ(out, aes.EncryptCBC(plain, key, iv));
+  aes.DecryptCBC(out, handle, iv, out);  // in place
+  EXPECT_EQ(out, plain);
+  aes.EncryptCFB(plain, handle, iv, out);
+  EXPECT_EQ(out, aes.EncryptCFB(plain, key, iv));
+  aes.EncryptCTR(aes_cpp::ByteSpan(plain.data(), 33), key, iv, out);
+  std::vector<unsigned char> head(plain.begin(), plain.begin() + 33);
+  EXPECT_TRUE(std::equal(out.begin(), out.begin() + 33,
+                         aes.EncryptCTR(head, key, iv).begin()));
+
+  const std::string text = "text passed without a copy";
+  std::vector<unsigned char> expected(text.begin(), text.end());
+  aes.EncryptCTR(text, handle, iv, out);
+  expected = aes.EncryptCTR(expected, handle, iv);
+  EXPECT_TRUE(std::equal(expected.begin(), expected.end(), out.begin()));
+#if __cplusplus >= 201703L
+  aes.EncryptCTR(std::string_view(text), handle, iv, out);
+  EXPECT_TRUE(std::equal(expected.begin(), expected.end(), out.begin()));
+#endif
+
+  const aes_cpp::GcmKey gcmKey(aes_cpp::AESKeyLength::AES_128, key);
+  const std::vector<unsigned char> gcmIv(iv.begin(), iv.begin() + 12);
+  unsigned char tag[16];
+  std::vector<unsigned char> vectorTag;
+  const std::vector<unsigned char> aad(text.begin(), text.end());
+  aes.EncryptGCM(plain, key, gcmIv, text, tag, out);
+  EXPECT_EQ(out, aes.EncryptGCM(plain, gcmKey, gcmIv, aad, vectorTag));
+  EXPECT_TRUE(std::equal(vectorTag.begin(), vectorTag.end(), tag));
+  aes.DecryptGCM(out, gcmKey, gcmIv, text, tag, out);
+  EXPECT_EQ(out, plain);
+}
+
+TEST(Span, RejectsWrongSizes) {
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
+  std::vector<unsigned char> key(16), iv(16), in(32), out(32), tag(16);
+  std::vector<unsigned char> shortOut(31), shortKey(24), shortIv(12);
+  EXPECT_THROW(aes.EncryptCBC(in, shortKey, iv, out), std::invalid_argument);
+  EXPECT_THROW(aes.EncryptCBC(in, key, shortIv, out), std::invalid_argument);
+  EXPECT_THROW(aes.EncryptCBC(in, key, iv, shortOut), std::length_error);
+  EXPECT_THROW(aes.EncryptCTR(in, key, iv, shortOut), std::length_error);
+  EXPECT_THROW(aes.EncryptGCM(in, key, iv, {}, tag, out),
+               std::invalid_argument);
+  EXPECT_THROW(aes.EncryptGCM(in, key, shortIv, {}, shortIv, out),
+               std::invalid_argument);
+  EXPECT_NO_THROW(aes.EncryptCFB({}, key, iv, {}));
+}
+
+static std::vector<unsigned char> HexBytes(const std::string &hex) {
+  std::vector<unsigned char> bytes;
+  for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+    bytes.push_back(
+        static_cast<unsigned char>(std::stoul(hex.substr(i, 2), nullptr, 16)));
+  }
+  return bytes;
+}
+
+TEST(XTS, MatchesIeee1619Vectors) {
+  struct Vector {
+    aes_cpp::AESKeyLength keyLength;
+    const char *key;
+    uint64_t sector;
+    const char *plain;
+    const char *cipher;
+  };
+  // Vectors 2 and 15, and the first two blocks of vector 10.
+  const Vector vectors[] = {
+      {aes_cpp::AESKeyLength::AES_128,
+       "11111111111111111111111111111111"
+       "22222222222222222222222222222222",
+       0x3333333333,
+       "44444444444444444444444444444444"
+       "44444444444444444444444444444444",
+       "c454185e6a16936e39334038acef838b"
+       "fb186fff7480adc4289382ecd6d394f0"},
+      {aes_cpp::AESKeyLength::AES_128,
+       "fffefdfcfbfaf9f8f7f6f5f4f3f2f1f0"
+       "bfbebdbcbbbab9b8b7b6b5b4b3b2b1b0",
+       0x123456789a, "000102030405060708090a0b0c0d0e0f10",
+       "6c1625db4671522d3d7599601de7ca09ed"},
+      {aes_cpp::AESKeyLength::AES_256,
+       "2718281828459045235360287471352662497757247093699959574966967627"
+       "3141592653589793238462643383279502884197169399375105820974944592",
+       0xff,
+       "000102030405060708090a0b0c0d0e0f"
+       "101112131415161718191a1b1c1d1e1f",
+       "1c3b3a102f770386e4836c99e370cf9b"
+       "ea00803f5e482357a4ae12d414a3e63b"},
+  };
+  for (const Vector &v : vectors) {
+    aes_cpp::AES aes(v.keyLength);
+    const aes_cpp::XtsKey key(v.keyLength, HexBytes(v.key));
+    const std::vector<unsigned char> plain = HexBytes(v.plain);
+    std::vector<unsigned char> out(plain.size());
+    aes.EncryptXTS(plain, key, v.sector, out);
+    EXPECT_EQ(out, HexBytes(v.cipher));
+    aes.DecryptXTS(out.data(), out.size(), key, v.sector, out.data());
+    EXPECT_EQ(out, plain);
+  }
+}
+
+TEST(XTS, AllBackendsAgree) {
+  const aes_cpp::Backend initial = aes_cpp::active_backend();
+  std::vector<unsigned char> raw(64);
+  for (size_t i = 0; i < raw.size(); ++i) raw[i] = static_cast<uint8_t>(i * 7);
+  std::vector<unsigned char> plain(4096 + 13);
+  for (size_t i = 0; i < plain.size(); ++i) {
+    plain[i] = static_cast<uint8_t>(i * 31 + 5);
+  }
+  const size_t lengths[] = {16, 17, 31, 128, 129, 143, 512, 4096, 4096 + 13};
+  const aes_cpp::AESKeyLength keyLengths[] = {aes_cpp::AESKeyLength::AES_128,
+                                              aes_cpp::AESKeyLength::AES_256};
+  for (aes_cpp::AESKeyLength keyLength : keyLengths) {
+    aes_cpp::AES aes(keyLength);
+    const aes_cpp::XtsKey key(
+        keyLength, keyLength == aes_cpp::AESKeyLength::AES_128
+                       ? std::vector<unsigned char>(raw.begin(),
+                                                    raw.begin() + 32)
+                       : raw);
+    for (size_t len : lengths) {
+      aes_cpp::set_backend(aes_cpp::Backend::Software);
+      std::vector<unsigned char> expected(len);
+      aes.EncryptXTS(plain.data(), len, key, len, expected.data());
+      for (aes_cpp::Backend backend : AvailableBackends()) {
+        aes_cpp::set_backend(backend);
+        std::vector<unsigned char> buf(plain.begin(), plain.begin() + len);
+        aes.EncryptXTS(buf.data(), len, key, len, buf.data());
+        EXPECT_EQ(buf, expected) << "length " << len;
+        aes.DecryptXTS(buf.data(), len, key, len, buf.data());
+        EXPECT_TRUE(std::equal(buf.begin(), buf.end(), plain.begin()));
+      }
+    }
+  }
+  aes_cpp::set_backend(initial);
+}
+
+TEST(XTS, SectorsMatchPerSectorCalls) {
+  std::vector<unsigned char> raw(32);
+  for (size_t i = 0; i < raw.size(); ++i) raw[i] = static_cast<uint8_t>(i);
+  const aes_cpp::XtsKey key(aes_cpp::AESKeyLength::AES_128, raw);
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
+  aes_cpp::Parallelism parallel(4);
+  parallel.minBytesPerThread = 1;
+  const size_t sectorSizes[] = {16, 520, 4096};
+  for (size_t sectorSize : sectorSizes) {
+    const size_t count = 70;  // more than one batch of tweaks
+    const uint64_t first = (1ull << 32) - 3;
+    std::vector<unsigned char> plain(sectorSize * count);
+    for (size_t i = 0; i < plain.size(); ++i) {
+      plain[i] = static_cast<uint8_t>(i * 13);
+    }
+    std::vector<unsigned char> expected(plain.size());
+    for (size_t i = 0; i < count; ++i) {
+      aes.EncryptXTS(plain.data() + i * sectorSize, sectorSize, key, first + i,
+                     expected.data() + i * sectorSize);
+    }
+    std::vector<unsigned char> out(plain.size());
+    aes.EncryptXTSSectors(plain, key, sectorSize, first, out);
+    EXPECT_EQ(out, expected);
+    std::vector<unsigned char> threaded = plain;
+    aes.EncryptXTSSectors(threaded.data(), threaded.size(), key, sectorSize,
+                          first, threaded.data(), parallel);
+    EXPECT_EQ(threaded, expected);
+    aes.DecryptXTSSectors(threaded.data(), threaded.size(), key, sectorSize,
+                          first, threaded.data(), parallel);
+    EXPECT_EQ(threaded, plain);
+    aes.DecryptXTSSectors(out, key, sectorSize, first, out);
+    EXPECT_EQ(out, plain);
+  }
+}
+
+TEST(XTS, RejectsBadArguments) {
+  std::vector<unsigned char> raw(32);
+  for (size_t i = 0; i < raw.size(); ++i) raw[i] = static_cast<uint8_t>(i);
+  using aes_cpp::AESKeyLength;
+  EXPECT_THROW(aes_cpp::XtsKey(AESKeyLength::AES_192, raw.data()),
+               std::invalid_argument);
+  EXPECT_THROW(aes_cpp::XtsKey(AESKeyLength::AES_256, raw),
+               std::invalid_argument);
+  EXPECT_THROW(aes_cpp::XtsKey(AESKeyLength::AES_128,
+                               std::vector<unsigned char>(32, 1)),
+               std::invalid_argument);
+  const unsigned char *nullKey = nullptr;
+  EXPECT_THROW(aes_cpp::XtsKey(AESKeyLength::AES_128, nullKey),
+               std::invalid_argument);
+
+  const aes_cpp::XtsKey key(AESKeyLength::AES_128, raw);
+  aes_cpp::AES aes(AESKeyLength::AES_128);
+  std::vector<unsigned char> buf(1024);
+  EXPECT_THROW(aes.EncryptXTS(buf.data(), 15, key, 0, buf.data()),
+               std::length_error);
+  EXPECT_THROW(aes.EncryptXTS(nullptr, (size_t(1) << 24) + 16, key, 0,
+                              nullptr),
+               std::length_error);
+  EXPECT_THROW(aes.EncryptXTSSectors(buf.data(), 1000, key, 512, 0,
+                                     buf.data()),
+               std::length_error);
+  EXPECT_THROW(aes.EncryptXTSSectors(buf.data(), 1024, key, 512, UINT64_MAX,
+                                     buf.data()),
+               std::length_error);
+  EXPECT_NO_THROW(aes.EncryptXTSSectors(buf.data(), 512, key, 512, UINT64_MAX,
+                                        buf.data()));
+  EXPECT_THROW(aes.EncryptXTS(aes_cpp::ByteSpan(buf.data(), 32), key, 0,
+                              aes_cpp::MutableByteSpan(buf.data(), 31)),
+               std::length_error);
+  aes_cpp::AES aes256(AESKeyLength::AES_256);
+  EXPECT_THROW(aes256.EncryptXTS(buf.data(), 32, key, 0, buf.data()),
+               std::invalid_argument);
+}
+
+TEST(CCM, MatchesPublishedVectors) {
+  struct Vector {
+    const char *key;
+    const char *nonce;
+    const char *aad;
+    const char *plain;
+    const char *cipher;
+    const char *tag;
+  };
+  // SP 800-38C examples 1 to 3 and RFC 3610 packet vector #1.
+  const Vector vectors[] = {
+      {"404142434445464748494a4b4c4d4e4f", "10111213141516",
+       "0001020304050607", "20212223", "7162015b", "4dac255d"},
+      {"404142434445464748494a4b4c4d4e4f", "1011121314151617",
+       "000102030405060708090a0b0c0d0e0f", "202122232425262728292a2b2c2d2e2f",
+       "d2a1f0e051ea5f62081a7792073d593d", "1fc64fbfaccd"},
+      {"404142434445464748494a4b4c4d4e4f", "101112131415161718191a1b",
+       "000102030405060708090a0b0c0d0e0f10111213",
+       "202122232425262728292a2b2c2d2e2f3031323334353637",
+       "e3b201a9f5b71a7a9b1ceaeccd97e70b6176aad9a4428aa5", "484392fbc1b09951"},
+      {"c0c1c2c3c4c5c6c7c8c9cacbcccdcecf", "00000003020100a0a1a2a3a4a5",
+       "0001020304050607",
+       "08090a0b0c0d0e0f101112131415161718191a1b1c1d1e",
+       "588c979a61c663d2f066d0c2c0f989806d5f6b61dac384", "17e8d12cfdf926e0"},
+  };
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
+  for (const Vector &v : vectors) {
+    const aes_cpp::AesKey key(aes_cpp::AESKeyLength::AES_128, HexBytes(v.key));
+    const std::vector<unsigned char> plain = HexBytes(v.plain);
+    const std::vector<unsigned char> expectedTag = HexBytes(v.tag);
+    std::vector<unsigned char> out(plain.size()), tag(expectedTag.size());
+    aes.EncryptCCM(plain, key, HexBytes(v.nonce), HexBytes(v.aad), tag, out);
+    EXPECT_EQ(out, HexBytes(v.cipher));
+    EXPECT_EQ(tag, expectedTag);
+    aes.DecryptCCM(out, key, HexBytes(v.nonce), HexBytes(v.aad), tag, out);
+    EXPECT_EQ(out, plain);
+  }
+}
+
+TEST(CCM, AllBackendsAgreeAndDetectTampering) {
+  const aes_cpp::Backend initial = aes_cpp::active_backend();
+  const aes_cpp::AesKey key(aes_cpp::AESKeyLength::AES_256,
+                            std::vector<unsigned char>(32, 0x5c));
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_256);
+  const std::vector<unsigned char> nonce = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+  std::vector<unsigned char> aad(0xff00 + 3);  // six-byte length encoding
+  for (size_t i = 0; i < aad.size(); ++i) aad[i] = static_cast<uint8_t>(i);
+  const size_t lengths[] = {0, 1, 16, 31, 129, 1000};
+  const size_t aadLengths[] = {0, 14, 100, aad.size()};
+  for (size_t len : lengths) {
+    for (size_t aadLen : aadLengths) {
+      std::vector<unsigned char> plain(len);
+      for (size_t i = 0; i < len; ++i) plain[i] = static_cast<uint8_t>(i * 3);
+      aes_cpp::set_backend(aes_cpp::Backend::Software);
+      std::vector<unsigned char> expected(len), expectedTag(14);
+      aes.EncryptCCM(plain.data(), len, key, nonce.data(), nonce.size(),
+                     aad.data(), aadLen, expectedTag.data(), 14,
+                     expected.data());
+      for (aes_cpp::Backend backend : AvailableBackends()) {
+        aes_cpp::set_backend(backend);
+        std::vector<unsigned char> buf = plain, tag(14);
+        aes.EncryptCCM(buf.data(), len, key, nonce.data(), nonce.size(),
+                       aad.data(), aadLen, tag.data(), 14, buf.data());
+        EXPECT_EQ(buf, expected);
+        EXPECT_EQ(tag, expectedTag);
+        aes.DecryptCCM(buf.data(), len, key, nonce.data(), nonce.size(),
+                       aad.data(), aadLen, tag.data(), 14, buf.data());
+        EXPECT_EQ(buf, plain);
+
+        std::vector<unsigned char> out(len, 0xaa);
+        tag[13] ^= 1;
+        EXPECT_THROW(
+            aes.DecryptCCM(expected.data(), len, key, nonce.data(),
+                           nonce.size(), aad.data(), aadLen, tag.data(), 14,
+                           out.data()),
+            std::runtime_error);
+        EXPECT_EQ(out, std::vector<unsigned char>(len, 0));
+      }
+    }
+  }
+  aes_cpp::set_backend(initial);
+}
+
+TEST(CCM, RejectsBadArguments) {
+  const aes_cpp::AesKey key(aes_cpp::AESKeyLength::AES_128,
+                            std::vector<unsigned char>(16, 1));
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_128);
+  std::vector<unsigned char> buf(64), tag(16), nonce(13);
+  EXPECT_THROW(aes.EncryptCCM(buf.data(), 64, key, nonce.data(), 6, nullptr, 0,
+                              tag.data(), 16, buf.data()),
+               std::invalid_argument);
+  EXPECT_THROW(aes.EncryptCCM(buf.data(), 64, key, nonce.data(), 14, nullptr,
+                              0, tag.data(), 16, buf.data()),
+               std::invalid_argument);
+  const size_t badTags[] = {0, 2, 5, 18};
+  for (size_t tagLen : badTags) {
+    EXPECT_THROW(aes.EncryptCCM(buf.data(), 64, key, nonce.data(), 13,
+                                nullptr, 0, tag.data(), tagLen, buf.data()),
+                 std::invalid_argument);
+  }
+  EXPECT_THROW(aes.EncryptCCM(buf.data(), 64, key, nullptr, 13, nullptr, 0,
+                              tag.data(), 16, buf.data()),
+               std::invalid_argument);
+  EXPECT_THROW(aes.EncryptCCM(buf.data(), 64, key, nonce.data(), 13, nullptr,
+                              4, tag.data(), 16, buf.data()),
+               std::invalid_argument);
+  // A 13-byte nonce leaves two bytes for the message length.
+  EXPECT_THROW(aes.EncryptCCM(nullptr, 65536, key, nonce.data(), 13, nullptr,
+                              0, tag.data(), 16, nullptr),
+               std::length_error);
+  EXPECT_THROW(aes.EncryptCCM(buf, key, nonce, {},
+                              aes_cpp::MutableByteSpan(tag.data(), 8),
+                              aes_cpp::MutableByteSpan(buf.data(), 63)),
+               std::length_error);
+  aes_cpp::AES aes256(aes_cpp::AESKeyLength::AES_256);
+  EXPECT_THROW(aes256.EncryptCCM(buf.data(), 64, key, nonce.data(), 13,
+                                 nullptr, 0, tag.data(), 16, buf.data()),
+               std::invalid_argument);
+}
+
 TEST(Utils, EncryptDecryptStringCBC) {
   std::string text = "hello world";
   std::array<uint8_t, 16> key = {0};
@@ -848,6 +2498,303 @@ TEST(Utils, DecryptStringGcmAadMismatch) {
   EXPECT_THROW(aes_cpp::utils::decrypt_gcm(enc, key, aad), std::runtime_error);
 }
 
+TEST(Utils, SpanInputsAndCallerBuffers) {
+  std::array<uint8_t, 32> key = {1};
+  for (size_t len : {0, 1, 15, 16, 17, 48}) {
+    std::vector<uint8_t> plain(len);
+    for (size_t i = 0; i < len; ++i) plain[i] = static_cast<uint8_t>(i + 3);
+    for (aes_cpp::utils::AesMode mode :
+         {aes_cpp::utils::AesMode::CBC, aes_cpp::utils::AesMode::CFB,
+          aes_cpp::utils::AesMode::CTR}) {
+      auto enc = aes_cpp::utils::encrypt(
+          aes_cpp::ByteSpan(plain.data(), plain.size()), key, mode);
+      std::vector<uint8_t> out(enc.ciphertext.size(), 0xee);
+      const size_t n = aes_cpp::utils::decrypt_into(enc, key, mode, out);
+      ASSERT_EQ(n, len);
+      EXPECT_TRUE(std::equal(plain.begin(), plain.end(), out.begin()));
+      for (size_t i = n; i < out.size(); ++i) EXPECT_EQ(out[i], 0);
+      EXPECT_EQ(aes_cpp::utils::decrypt(enc, key, mode), plain);
+      if (!enc.ciphertext.empty()) {
+        std::vector<uint8_t> small(enc.ciphertext.size() - 1);
+        EXPECT_THROW(aes_cpp::utils::decrypt_into(enc, key, mode, small),
+                     std::length_error);
+      }
+    }
+  }
+
+  // CBC pads the last block without copying the whole plaintext.
+  const std::vector<uint8_t> plain(20, 0x41);
+  auto enc = aes_cpp::utils::encrypt(plain, key, aes_cpp::utils::AesMode::CBC);
+  ASSERT_EQ(enc.ciphertext.size(), 32u);
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_256);
+  std::vector<uint8_t> raw(32);
+  aes.DecryptCBC(enc.ciphertext, key, enc.iv, raw);
+  EXPECT_EQ(std::vector<uint8_t>(raw.begin() + 20, raw.end()),
+            std::vector<uint8_t>(12, 12));
+
+  const std::string text = "gcm over a span";
+  const std::array<uint8_t, 3> aad = {7, 8, 9};
+  auto gcm = aes_cpp::utils::encrypt_gcm(aes_cpp::ByteSpan(text), key, aad);
+  std::array<uint8_t, 32> buf;
+  ASSERT_EQ(aes_cpp::utils::decrypt_gcm_into(gcm, key, buf, aad), text.size());
+  EXPECT_EQ(std::string(buf.begin(), buf.begin() + text.size()), text);
+  EXPECT_THROW(aes_cpp::utils::decrypt_gcm_into(gcm, key, buf),
+               std::runtime_error);
+}
+
+TEST(Utils, GenerateIvBatchesAreDistinct) {
+  // Enough IVs to run through several refills of the per-thread pool.
+  const auto ivs = aes_cpp::utils::generate_iv_12(1000);
+  ASSERT_EQ(ivs.size(), 1000u);
+  std::vector<std::array<uint8_t, 16>> all = aes_cpp::utils::generate_iv_16(0);
+  EXPECT_TRUE(all.empty());
+  for (int i = 0; i < 600; ++i) all.push_back(aes_cpp::utils::generate_iv_16());
+  const auto batch = aes_cpp::utils::generate_iv_16(600);
+  all.insert(all.end(), batch.begin(), batch.end());
+  std::sort(all.begin(), all.end());
+  EXPECT_EQ(std::adjacent_find(all.begin(), all.end()), all.end());
+  std::vector<std::array<uint8_t, 12>> sorted = ivs;
+  std::sort(sorted.begin(), sorted.end());
+  EXPECT_EQ(std::adjacent_find(sorted.begin(), sorted.end()), sorted.end());
+  EXPECT_THROW(aes_cpp::utils::generate_iv_16(SIZE_MAX / 8),
+               std::length_error);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+TEST(Utils, GenerateIvReseedsAfterFork) {
+  // Leave buffered bytes in the pool, then check that a child does not
+  // hand out the same IV as its parent.
+  (void)aes_cpp::utils::generate_iv_12();
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  const pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    const auto iv = aes_cpp::utils::generate_iv_12();
+    const ssize_t written = write(fds[1], iv.data(), iv.size());
+    _exit(written == static_cast<ssize_t>(iv.size()) ? 0 : 1);
+  }
+  const auto parent = aes_cpp::utils::generate_iv_12();
+  std::array<uint8_t, 12> child{};
+  ASSERT_EQ(read(fds[0], child.data(), child.size()),
+            static_cast<ssize_t>(child.size()));
+  int status = 0;
+  waitpid(pid, &status, 0);
+  close(fds[0]);
+  close(fds[1]);
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  EXPECT_NE(parent, child);
+}
+
+TEST(Utils, GcmNonceSequenceRefusesUseAfterFork) {
+  const aes_cpp::GcmKey key(aes_cpp::AESKeyLength::AES_128,
+                            std::vector<unsigned char>(16, 4));
+  aes_cpp::utils::GcmNonceSequence seq(key, 1);
+  (void)seq.next();  // the child inherits this thread's reserved block
+  const pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    bool refused = false;
+    try {
+      (void)seq.next();
+    } catch (const std::logic_error &) {
+      refused = true;
+    }
+    _exit(refused ? 0 : 1);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  EXPECT_EQ(seq.next()[11], 1);
+}
+
+TEST(Utils, CtrDrbgReseedsAfterFork) {
+  aes_cpp::utils::CtrDrbg drbg(std::vector<uint8_t>(48, 3), {}, 1000);
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  const pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    std::array<uint8_t, 16> out{};
+    drbg.generate(out);
+    const ssize_t written = write(fds[1], out.data(), out.size());
+    _exit(written == static_cast<ssize_t>(out.size()) ? 0 : 1);
+  }
+  std::array<uint8_t, 16> parent{};
+  std::array<uint8_t, 16> child{};
+  drbg.generate(parent);
+  ASSERT_EQ(read(fds[0], child.data(), child.size()),
+            static_cast<ssize_t>(child.size()));
+  int status = 0;
+  waitpid(pid, &status, 0);
+  close(fds[0]);
+  close(fds[1]);
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  EXPECT_NE(parent, child);
+}
+#endif
+
+TEST(Utils, GcmNonceSequenceUniqueAcrossThreads) {
+  const aes_cpp::GcmKey key(aes_cpp::AESKeyLength::AES_128,
+                            std::vector<unsigned char>(16, 4));
+  aes_cpp::utils::GcmNonceSequence seq(key, 0x01020304u, UINT64_MAX, 16);
+  std::vector<std::vector<std::array<uint8_t, 12>>> perThread(4);
+  std::vector<std::thread> threads;
+  for (auto &out : perThread) {
+    threads.emplace_back([&seq, &out]() {
+      for (int i = 0; i < 1000; ++i) out.push_back(seq.next());
+    });
+  }
+  for (auto &t : threads) t.join();
+
+  std::vector<std::array<uint8_t, 12>> all;
+  for (const auto &out : perThread) {
+    all.insert(all.end(), out.begin(), out.end());
+  }
+  for (const auto &nonce : all) {
+    EXPECT_EQ(nonce[0], 1);
+    EXPECT_EQ(nonce[3], 4);
+  }
+  std::sort(all.begin(), all.end());
+  EXPECT_EQ(std::adjacent_find(all.begin(), all.end()), all.end());
+}
+
+TEST(Utils, GcmNonceSequenceLimitAndEncrypt) {
+  const std::vector<unsigned char> raw(32, 9);
+  const aes_cpp::GcmKey key(aes_cpp::AESKeyLength::AES_256, raw);
+  aes_cpp::utils::GcmNonceSequence other(key, 7, 100, 4);
+  aes_cpp::utils::GcmNonceSequence seq(key, 7, 5, 4);
+  (void)other.next();  // interleaving sequences keeps both blocks
+  for (uint8_t i = 0; i < 3; ++i) EXPECT_EQ(seq.next()[11], i);
+  EXPECT_EQ(other.next()[11], 1);
+
+  const std::string text = "sealed with a counter nonce";
+  auto enc = seq.encrypt(text, raw);
+  EXPECT_EQ(enc.iv[11], 3);
+  aes_cpp::AES aes(aes_cpp::AESKeyLength::AES_256);
+  std::vector<unsigned char> plain(enc.ciphertext.size());
+  aes.DecryptGCM(enc.ciphertext, key, enc.iv, raw, enc.tag, plain);
+  EXPECT_EQ(std::string(plain.begin(), plain.end()), text);
+
+  EXPECT_EQ(seq.next()[11], 4);
+  EXPECT_THROW(seq.next(), std::length_error);
+  EXPECT_THROW(aes_cpp::utils::GcmNonceSequence(key, 0, 10, 0),
+               std::invalid_argument);
+}
+
+TEST(Utils, CtrDrbgMatchesReferenceVectors) {
+  // AES-256 CTR_DRBG without derivation function (SP 800-90A, 10.2.1).
+  std::vector<uint8_t> entropy(48), reseed(48), additional(48);
+  std::vector<uint8_t> personalization(20);
+  for (uint8_t i = 0; i < 48; ++i) {
+    entropy[i] = i;
+    reseed[i] = 0x80 + i;
+    additional[i] = 0xa0 + i;
+  }
+  for (uint8_t i = 0; i < 20; ++i) personalization[i] = 0x40 + i;
+
+  aes_cpp::utils::CtrDrbg drbg(entropy, personalization, 100);
+  std::vector<uint8_t> first(64), second(100), third(40);
+  drbg.generate(first);
+  drbg.generate(second, aes_cpp::ByteSpan(additional.data(), 30));
+  drbg.reseed(reseed, additional);
+  drbg.generate(third);
+
+  const std::vector<uint8_t> head = {0xba, 0x0a, 0x07, 0xe2, 0x70, 0xe9,
+                                     0x05, 0x05, 0xcd, 0xe5, 0x8d, 0x54,
+                                     0x10, 0xa1, 0x13, 0x6e};
+  const std::vector<uint8_t> tail = {0xed, 0x68, 0x48, 0xce, 0x71, 0x6b,
+                                     0x49, 0xfc, 0x02, 0x3b, 0x45, 0x49,
+                                     0x67, 0xba, 0x8f, 0xac};
+  const std::vector<uint8_t> reseeded = {0x84, 0x85, 0x61, 0x77, 0x79, 0x07,
+                                         0x95, 0x2b, 0xb6, 0x95, 0x28, 0x1b,
+                                         0x24, 0x4c, 0xf2, 0xd4};
+  EXPECT_EQ(std::vector<uint8_t>(first.begin(), first.begin() + 16), head);
+  EXPECT_EQ(std::vector<uint8_t>(second.end() - 16, second.end()), tail);
+  EXPECT_EQ(std::vector<uint8_t>(third.end() - 16, third.end()), reseeded);
+}
+
+TEST(Utils, CtrDrbgMatchesNistCavpVectors) {
+  // NIST CAVP drbgtestvectors, CTR_DRBG.rsp, [AES-256 no df], COUNT = 0,
+  // with empty personalization and additional input. Each case generates
+  // twice and checks the second output.
+  struct Vector {
+    const char *entropy;
+    const char *entropyReseed;  // null in the no_reseed set
+    const char *returned;
+  };
+  const Vector vectors[] = {
+      // drbgvectors_no_reseed
+      {"df5d73faa468649edda33b5cca79b0b05600419ccb7a879ddfec9db32ee494e5"
+       "531b51de16a30f769262474c73bec010",
+       nullptr,
+       "d1c07cd95af8a7f11012c84ce48bb8cb87189e99d40fccb1771c619bdf82ab22"
+       "80b1dc2f2581f39164f7ac0c510494b3a43c41b7db17514c87b107ae793e01c5"},
+      // drbgvectors_pr_false
+      {"e4bc23c5089a19d86f4119cb3fa08c0a4991e0a1def17e101e4c14d9c323460a"
+       "7c2fb58e0b086c6c57b55f56cae25bad",
+       "fd85a836bba85019881e8c6bad23c9061adc75477659acaea8e4a01dfe07a183"
+       "2dad1c136f59d70f8653a5dc118663d6",
+       "b2cb8905c05e5950ca31895096be29ea3d5a3b82b269495554eb80fe07de43e1"
+       "93b9e7c3ece73b80e062b1c1f68202fbb1c52a040ea2478864295282234aaada"},
+  };
+  for (const Vector &v : vectors) {
+    aes_cpp::utils::CtrDrbg drbg(HexBytes(v.entropy), {}, 100);
+    if (v.entropyReseed) drbg.reseed(HexBytes(v.entropyReseed), {});
+    std::vector<uint8_t> out(64);
+    drbg.generate(out);
+    drbg.generate(out);
+    EXPECT_EQ(out, HexBytes(v.returned)) << v.entropy;
+  }
+}
+
+TEST(Utils, CtrDrbgSplitsLongRequests) {
+  const std::vector<uint8_t> entropy(48, 0x5a);
+  const std::size_t limit = aes_cpp::utils::CtrDrbg::max_request_bytes;
+  aes_cpp::utils::CtrDrbg whole(entropy, {}, 100);
+  aes_cpp::utils::CtrDrbg parts(entropy, {}, 100);
+  std::vector<uint8_t> a(limit + 100), b(limit + 100);
+  whole.generate(a);
+  parts.generate(aes_cpp::MutableByteSpan(b.data(), limit));
+  parts.generate(aes_cpp::MutableByteSpan(b.data() + limit, 100));
+  EXPECT_EQ(a, b);
+
+  // Due reseeds draw fresh OS entropy, so the streams diverge.
+  aes_cpp::utils::CtrDrbg eager(entropy, {}, 1);
+  aes_cpp::utils::CtrDrbg lazy(entropy, {}, 2);
+  std::vector<uint8_t> c(32), d(32);
+  eager.generate(c);
+  lazy.generate(d);
+  EXPECT_EQ(c, d);
+  eager.generate(c);
+  lazy.generate(d);
+  EXPECT_NE(c, d);
+}
+
+TEST(Utils, CtrDrbgRejectsBadArguments) {
+  const std::vector<uint8_t> entropy(48, 1);
+  const std::vector<uint8_t> tooLong(49, 2);
+  using aes_cpp::utils::CtrDrbg;
+  EXPECT_THROW(CtrDrbg(std::vector<uint8_t>(47), {}, 10),
+               std::invalid_argument);
+  EXPECT_THROW(CtrDrbg(entropy, tooLong, 10), std::invalid_argument);
+  EXPECT_THROW(CtrDrbg(entropy, {}, 0), std::invalid_argument);
+  EXPECT_THROW(CtrDrbg(entropy, {}, (1ull << 48) + 1), std::invalid_argument);
+  EXPECT_THROW(CtrDrbg drbg(tooLong), std::invalid_argument);
+
+  CtrDrbg drbg(entropy, {}, 10);
+  std::vector<uint8_t> out(16);
+  EXPECT_THROW(drbg.generate(out, tooLong), std::invalid_argument);
+  EXPECT_THROW(drbg.reseed(entropy, tooLong), std::invalid_argument);
+  EXPECT_THROW(drbg.reseed(tooLong, {}), std::invalid_argument);
+  drbg.generate(aes_cpp::MutableByteSpan());
+
+  std::vector<uint8_t> x(64), y(64);
+  aes_cpp::utils::random_bytes(x);
+  aes_cpp::utils::random_bytes(y);
+  EXPECT_NE(x, y);
+}
+
 int main(int argc, char *argv[]) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();